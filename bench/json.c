@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <time.h>
+
+#include <cbase.h>
+
+#include "config.h"
+#include "value.h"
+#include "json.h"
+
+/*
+ * Loads a JSON file (or, with no argument, a generated document of roughly
+ * SYNTHETIC_SIZE bytes) into a context Value, eagerly and then lazily, and
+ * reports throughput.  Every
+ * Value carries its own decimal storage, so the loaded tree is several times
+ * the size of the document; keep that in mind when choosing inputs.
+ */
+
+#ifndef SYNTHETIC_SIZE
+#define SYNTHETIC_SIZE (256 * 1024 * 1024)
+#endif
+
+static
+bool generate_document(String *s, Status *status) {
+    char buf[256];
+    size_t i = 0;
+
+    if (!string_init(s, "{\"records\": [", status)) {
+        return false;
+    }
+
+    while (s->byte_len < SYNTHETIC_SIZE) {
+        int len = snprintf(buf, sizeof(buf),
+            "%s{\"id\": %zu, \"name\": \"person %zu\", "
+            "\"balance\": %zu.%02zu, \"active\": %s, "
+            "\"tags\": [\"alpha\", \"beta\", \"a somewhat longer tag\"], "
+            "\"note\": null}",
+            i ? ", " : "", i, i, i * 37, i % 100, (i % 3) ? "true" : "false"
+        );
+
+        if (!string_append_cstr_len(s, buf, (size_t)len, status)) {
+            return false;
+        }
+
+        i++;
+    }
+
+    return string_append_cstr(s, "]}", status);
+}
+
+static
+double elapsed(struct timespec *start, struct timespec *end) {
+    return (double)(end->tv_sec - start->tv_sec) +
+           ((double)(end->tv_nsec - start->tv_nsec) / 1000000000.0);
+}
+
+static
+bool load(Value *context, const char *path, String *document,
+                                            bool lazy,
+                                            DecimalContext *ctx,
+                                            Status *status) {
+    if (path && lazy) {
+        return json_load_lazy_path(context, path, ctx, status);
+    }
+
+    if (path) {
+        return json_load_path(context, path, ctx, status);
+    }
+
+    if (lazy) {
+        return json_load_lazy_data(context, document->data,
+                                            document->byte_len,
+                                            ctx,
+                                            status);
+    }
+
+    return json_load_data(context, document->data, document->byte_len,
+                                                   ctx,
+                                                   status);
+}
+
+static
+bool report(const char *path, String *document, size_t byte_len,
+                                                bool lazy,
+                                                DecimalContext *ctx) {
+    Value context;
+    Status status;
+    struct timespec start;
+    struct timespec end;
+    double seconds = 0.0;
+
+    status_init(&status);
+
+    context.type = VALUE_NONE;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (!load(&context, path, document, lazy, ctx, &status)) {
+        fprintf(stderr, "Error loading JSON: %s\n", status.message);
+        return false;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    seconds = elapsed(&start, &end);
+
+    printf("%s: loaded %zu bytes in %.3fs (%.1f MB/s)\n",
+        lazy ? "Lazy" : "Eager",
+        byte_len,
+        seconds,
+        ((double)byte_len / (1024.0 * 1024.0)) / seconds
+    );
+
+    value_free(&context);
+
+    return true;
+}
+
+int main(int argc, char **argv) {
+    String document;
+    Status status;
+    DecimalContext ctx;
+    const char *path = NULL;
+    size_t byte_len = 0;
+    bool ok = false;
+
+    status_init(&status);
+    decimal_context_set_max(&ctx);
+
+    if (argc > 1) {
+        FILE *fobj = fopen(argv[1], "rb");
+
+        if (!fobj) {
+            fprintf(stderr, "Error opening %s\n", argv[1]);
+            return EXIT_FAILURE;
+        }
+
+        fseek(fobj, 0, SEEK_END);
+        byte_len = (size_t)ftell(fobj);
+        fclose(fobj);
+
+        path = argv[1];
+    }
+    else {
+        if (!generate_document(&document, &status)) {
+            fprintf(stderr, "Error generating document: %s\n",
+                status.message
+            );
+            return EXIT_FAILURE;
+        }
+
+        byte_len = document.byte_len;
+    }
+
+    ok = report(path, &document, byte_len, false, &ctx) &&
+         report(path, &document, byte_len, true, &ctx);
+
+    if (!path) {
+        string_free(&document);
+    }
+
+    if (!ok) {
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/* vi: set et ts=4 sw=4: */
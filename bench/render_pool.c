@@ -0,0 +1,235 @@
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <cbase.h>
+
+#include "config.h"
+#include "lang.h"
+#include "value.h"
+#include "json.h"
+#include "function.h"
+#include "expression.h"
+#include "expression_evaluator.h"
+#include "template.h"
+#include "render_pool.h"
+#include "builtins.h"
+
+/*
+ * Renders JOB_COUNT jobs, spread over CONTEXT_COUNT generated contexts,
+ * through render pools of 1, 2, 4, ... threads up to the given maximum
+ * (MAX_THREADS by default), and reports throughput and speedup over one
+ * thread.
+ */
+
+#ifndef JOB_COUNT
+#define JOB_COUNT 200000
+#endif
+
+#ifndef CONTEXT_COUNT
+#define CONTEXT_COUNT 64
+#endif
+
+#ifndef MAX_THREADS
+#define MAX_THREADS 64
+#endif
+
+#define TEMPLATE_SOURCE                                                     \
+    "<h1>{{ upper(title) }}</h1>\n<ul>\n"                                   \
+    "{{ for item in items }}"                                               \
+        "<li class=\"{{ if loop.index % 2 == 0 }}even{{ else }}odd"         \
+        "{{ endif }}\">{{ item.name }}: {{ item.price * item.quantity }}"   \
+        "</li>\n"                                                           \
+    "{{ endfor }}</ul>\n"
+
+static
+bool generate_context(Value *context, size_t n, DecimalContext *ctx,
+                                                Status *status) {
+    String document;
+    char buf[256];
+    bool ok = false;
+
+    if (!string_init(&document, "", status)) {
+        return false;
+    }
+
+    snprintf(buf, sizeof(buf), "{\"title\": \"order %zu\", \"items\": [", n);
+
+    if (!string_append_cstr(&document, buf, status)) {
+        string_free(&document);
+        return false;
+    }
+
+    for (size_t i = 0; i < 20 + (n % 20); i++) {
+        int len = snprintf(buf, sizeof(buf),
+            "%s{\"name\": \"item %zu\", \"price\": %zu.%02zu, "
+            "\"quantity\": %zu}",
+            i ? ", " : "", i, i * 3, (i * n) % 100, (i % 7) + 1
+        );
+
+        if (!string_append_cstr_len(&document, buf, (size_t)len, status)) {
+            string_free(&document);
+            return false;
+        }
+    }
+
+    ok = (
+        string_append_cstr(&document, "]}", status) &&
+        json_load_data(context, document.data, document.byte_len,
+                                               ctx,
+                                               status)
+    );
+
+    string_free(&document);
+
+    return ok;
+}
+
+static
+double elapsed(struct timespec *start, struct timespec *end) {
+    return (double)(end->tv_sec - start->tv_sec) +
+           ((double)(end->tv_nsec - start->tv_nsec) / 1000000000.0);
+}
+
+static
+bool report(RenderJob *jobs, size_t threads, double *baseline) {
+    RenderPool pool;
+    Status status;
+    struct timespec start;
+    struct timespec end;
+    double seconds = 0.0;
+
+    status_init(&status);
+
+    if (!render_pool_init(&pool, threads, &status)) {
+        fprintf(stderr, "Error starting pool: %s\n", status.message);
+        return false;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (!render_pool_render(&pool, jobs, JOB_COUNT, &status)) {
+        fprintf(stderr, "Error rendering: %s\n", status.message);
+        render_pool_free(&pool);
+        return false;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    render_pool_free(&pool);
+
+    for (size_t i = 0; i < JOB_COUNT; i++) {
+        if (!jobs[i].ok) {
+            fprintf(stderr, "Error rendering job %zu: %s\n",
+                i,
+                jobs[i].status.message
+            );
+            return false;
+        }
+    }
+
+    seconds = elapsed(&start, &end);
+
+    if (threads == 1) {
+        *baseline = seconds;
+    }
+
+    printf("%2zu threads: %d renders in %.3fs (%.0f/s, %.2fx)\n",
+        threads,
+        JOB_COUNT,
+        seconds,
+        (double)JOB_COUNT / seconds,
+        *baseline / seconds
+    );
+
+    return true;
+}
+
+int main(int argc, char **argv) {
+    FunctionRegistry functions;
+    DecimalContext ctx;
+    Template t;
+    String source;
+    Status status;
+    Value *contexts = NULL;
+    RenderJob *jobs = NULL;
+    String *outputs = NULL;
+    size_t max_threads = MAX_THREADS;
+    double baseline = 0.0;
+    bool ok = true;
+
+    status_init(&status);
+    decimal_context_set_max(&ctx);
+
+    if (argc > 1) {
+        max_threads = strtoul(argv[1], NULL, 10);
+    }
+
+    contexts = calloc(CONTEXT_COUNT, sizeof(Value));
+    jobs = calloc(JOB_COUNT, sizeof(RenderJob));
+    outputs = calloc(JOB_COUNT, sizeof(String));
+
+    if ((!contexts) || (!jobs) || (!outputs)) {
+        fprintf(stderr, "Error allocating jobs\n");
+        return EXIT_FAILURE;
+    }
+
+    if ((!function_registry_init(&functions, &status)) ||
+            (!builtins_register(&functions, &status)) ||
+            (!template_init(&t, &functions, &status)) ||
+            (!string_init(&source, TEMPLATE_SOURCE, &status)) ||
+            (!template_parse_data(&t, &source, &status))) {
+        fprintf(stderr, "Error compiling template: %s\n", status.message);
+        return EXIT_FAILURE;
+    }
+
+    string_free(&source);
+
+    for (size_t i = 0; i < CONTEXT_COUNT; i++) {
+        contexts[i].type = VALUE_NONE;
+
+        if (!generate_context(&contexts[i], i, &ctx, &status)) {
+            fprintf(stderr, "Error generating context: %s\n",
+                status.message
+            );
+            return EXIT_FAILURE;
+        }
+    }
+
+    for (size_t i = 0; i < JOB_COUNT; i++) {
+        if (!string_init(&outputs[i], "", &status)) {
+            fprintf(stderr, "Error allocating output: %s\n", status.message);
+            return EXIT_FAILURE;
+        }
+
+        jobs[i].template = &t;
+        jobs[i].context = &contexts[i % CONTEXT_COUNT];
+        jobs[i].output = &outputs[i];
+    }
+
+    for (size_t threads = 1; ok && (threads <= max_threads); threads *= 2) {
+        ok = report(jobs, threads, &baseline);
+    }
+
+    for (size_t i = 0; i < JOB_COUNT; i++) {
+        string_free(&outputs[i]);
+    }
+
+    for (size_t i = 0; i < CONTEXT_COUNT; i++) {
+        value_free(&contexts[i]);
+    }
+
+    template_free(&t);
+    function_registry_free(&functions);
+    free(outputs);
+    free(jobs);
+    free(contexts);
+
+    if (!ok) {
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/* vi: set et ts=4 sw=4: */
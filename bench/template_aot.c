@@ -0,0 +1,247 @@
+#include <stdio.h>
+#include <time.h>
+
+#include <cbase.h>
+
+#include "config.h"
+#include "lang.h"
+#include "value.h"
+#include "json.h"
+#include "function.h"
+#include "expression.h"
+#include "expression_evaluator.h"
+#include "template.h"
+#include "template_aot.h"
+#include "builtins.h"
+
+/*
+ * Renders bench/template_aot.txt (or the given template) RENDER_COUNT times,
+ * over CONTEXT_COUNT generated contexts, through the interpreter and through
+ * the same template compiled ahead of time to C (see template_aot.h), on one
+ * thread, and reports throughput and speedup over the interpreter.
+ */
+
+#ifndef RENDER_COUNT
+#define RENDER_COUNT 200000
+#endif
+
+#ifndef CONTEXT_COUNT
+#define CONTEXT_COUNT 64
+#endif
+
+#ifndef TEMPLATE_PATH
+#define TEMPLATE_PATH "bench/template_aot.txt"
+#endif
+
+/* Generated from TEMPLATE_PATH at build time */
+TEMPLATE_AOT_DECLARE(bench_page);
+
+static
+bool generate_context(Value *context, size_t n, DecimalContext *ctx,
+                                                Status *status) {
+    String document;
+    char buf[256];
+    bool ok = false;
+
+    if (!string_init(&document, "", status)) {
+        return false;
+    }
+
+    snprintf(buf, sizeof(buf), "{\"title\": \"order %zu\", \"items\": [", n);
+
+    if (!string_append_cstr(&document, buf, status)) {
+        string_free(&document);
+        return false;
+    }
+
+    for (size_t i = 0; i < 20 + (n % 20); i++) {
+        int len = snprintf(buf, sizeof(buf),
+            "%s{\"name\": \"item %zu\", \"price\": %zu.%02zu, "
+            "\"quantity\": %zu}",
+            i ? ", " : "", i, i * 3, (i * n) % 100, (i % 7) + 1
+        );
+
+        if (!string_append_cstr_len(&document, buf, (size_t)len, status)) {
+            string_free(&document);
+            return false;
+        }
+    }
+
+    ok = (
+        string_append_cstr(&document, "]}", status) &&
+        json_load_data(context, document.data, document.byte_len,
+                                               ctx,
+                                               status)
+    );
+
+    string_free(&document);
+
+    return ok;
+}
+
+static
+double elapsed(struct timespec *start, struct timespec *end) {
+    return (double)(end->tv_sec - start->tv_sec) +
+           ((double)(end->tv_nsec - start->tv_nsec) / 1000000000.0);
+}
+
+static
+bool render(Template *t, ExpressionEvaluator *evaluator, Value *contexts,
+                                                         String *output,
+                                                         size_t *bytes,
+                                                         Status *status) {
+    *bytes = 0;
+
+    for (size_t i = 0; i < RENDER_COUNT; i++) {
+        bool rendered = false;
+
+        string_clear(output);
+
+        if (t) {
+            rendered = template_render_with_evaluator(
+                t,
+                evaluator,
+                &contexts[i % CONTEXT_COUNT],
+                output,
+                status
+            );
+        }
+        else {
+            rendered = bench_page_render(evaluator,
+                                         &contexts[i % CONTEXT_COUNT],
+                                         output,
+                                         status);
+        }
+
+        if (!rendered) {
+            return false;
+        }
+
+        *bytes += output->byte_len;
+    }
+
+    return true;
+}
+
+static
+bool report(const char *name, Template *t, ExpressionEvaluator *evaluator,
+                                           Value *contexts,
+                                           String *output,
+                                           double *baseline) {
+    Status status;
+    struct timespec start;
+    struct timespec end;
+    size_t bytes = 0;
+    double seconds = 0.0;
+
+    status_init(&status);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (!render(t, evaluator, contexts, output, &bytes, &status)) {
+        fprintf(stderr, "Error rendering (%s): %s\n", name, status.message);
+        return false;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    seconds = elapsed(&start, &end);
+
+    if (t) {
+        *baseline = seconds;
+    }
+
+    printf("%-11s %d renders (%zu bytes) in %.3fs (%.0f/s, %.2fx)\n",
+        name,
+        RENDER_COUNT,
+        bytes,
+        seconds,
+        (double)RENDER_COUNT / seconds,
+        *baseline / seconds
+    );
+
+    return true;
+}
+
+int main(int argc, char **argv) {
+    FunctionRegistry functions;
+    ExpressionEvaluator evaluator;
+    DecimalContext ctx;
+    Template t;
+    String interpreted;
+    String compiled;
+    Status status;
+    Value *contexts = NULL;
+    const char *path = TEMPLATE_PATH;
+    double baseline = 0.0;
+    bool ok = false;
+
+    status_init(&status);
+    decimal_context_set_max(&ctx);
+
+    if (argc > 1) {
+        path = argv[1];
+    }
+
+    contexts = calloc(CONTEXT_COUNT, sizeof(Value));
+
+    if (!contexts) {
+        fprintf(stderr, "Error allocating contexts\n");
+        return EXIT_FAILURE;
+    }
+
+    if ((!function_registry_init(&functions, &status)) ||
+            (!builtins_register(&functions, &status)) ||
+            (!expression_evaluator_init(&evaluator, &status)) ||
+            (!string_init(&interpreted, "", &status)) ||
+            (!string_init(&compiled, "", &status)) ||
+            (!template_init(&t, &functions, &status)) ||
+            (!template_parse_path(&t, path, &status)) ||
+            (!bench_page_init(&functions, &status))) {
+        fprintf(stderr, "Error compiling template: %s\n", status.message);
+        return EXIT_FAILURE;
+    }
+
+    for (size_t i = 0; i < CONTEXT_COUNT; i++) {
+        contexts[i].type = VALUE_NONE;
+
+        if (!generate_context(&contexts[i], i, &ctx, &status)) {
+            fprintf(stderr, "Error generating context: %s\n",
+                status.message
+            );
+            return EXIT_FAILURE;
+        }
+    }
+
+    ok = (
+        report("interpreted", &t, &evaluator, contexts, &interpreted,
+                                                        &baseline) &&
+        report("compiled", NULL, &evaluator, contexts, &compiled,
+                                                       &baseline)
+    );
+
+    if (ok && (strcmp(interpreted.data, compiled.data) != 0)) {
+        fprintf(stderr, "Compiled output differs from interpreted output\n");
+        ok = false;
+    }
+
+    for (size_t i = 0; i < CONTEXT_COUNT; i++) {
+        value_free(&contexts[i]);
+    }
+
+    bench_page_free();
+    template_free(&t);
+    string_free(&compiled);
+    string_free(&interpreted);
+    expression_evaluator_free(&evaluator);
+    function_registry_free(&functions);
+    free(contexts);
+
+    if (!ok) {
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/* vi: set et ts=4 sw=4: */
@@ -0,0 +1,279 @@
+#include <cbase.h>
+#include <stdio.h>
+
+#include "config.h"
+#include "utils.h"
+#include "number.h"
+#include "value.h"
+#include "function.h"
+#include "escape.h"
+#include "builtins.h"
+
+#define invalid_utf8(status) status_failure( \
+    status,                                  \
+    "builtins",                              \
+    BUILTINS_INVALID_UTF8,                   \
+    "Invalid UTF-8"                          \
+)
+
+#define range_too_long(status) status_failure( \
+    status,                                    \
+    "builtins",                                \
+    BUILTINS_RANGE_TOO_LONG,                   \
+    "Range too long"                           \
+)
+
+static bool change_case(Value *result, Value *string, bool upper,
+                                                      Status *status) {
+    const char *data = value_string_data(string);
+    size_t len = string->as.string.len;
+    size_t byte_len = string->as.string.byte_len;
+    size_t out_len = 0;
+    char *buf = NULL;
+    bool ok = false;
+
+    if (utf8_is_ascii(data, byte_len)) {
+        buf = malloc(byte_len + 1);
+
+        if (!buf) {
+            return alloc_failure(status);
+        }
+
+        if (upper) {
+            ascii_to_upper(buf, data, byte_len);
+        }
+        else {
+            ascii_to_lower(buf, data, byte_len);
+        }
+
+        ok = value_init_string_full(result, buf, len, byte_len, status);
+
+        free(buf);
+
+        return ok;
+    }
+
+    /* Mapped runes may encode to more bytes, but never more than 4 */
+    buf = malloc((len * 4) + 1);
+
+    if (!buf) {
+        return alloc_failure(status);
+    }
+
+    for (size_t i = 0; i < byte_len;) {
+        utf8proc_int32_t r = 0;
+        utf8proc_ssize_t width = utf8proc_iterate(
+            (const utf8proc_uint8_t *)(data + i),
+            byte_len - i,
+            &r
+        );
+
+        if (width <= 0) {
+            free(buf);
+            return invalid_utf8(status);
+        }
+
+        r = upper ? utf8proc_toupper(r) : utf8proc_tolower(r);
+        out_len += utf8proc_encode_char(
+            r,
+            (utf8proc_uint8_t *)(buf + out_len)
+        );
+        i += width;
+    }
+
+    ok = value_init_string_full(result, buf, len, out_len, status);
+
+    free(buf);
+
+    return ok;
+}
+
+static bool bytes_contain(const char *haystack, size_t haystack_len,
+                                                const char *needle,
+                                                size_t needle_len) {
+    if (needle_len == 0) {
+        return true;
+    }
+
+    while (haystack_len >= needle_len) {
+        const char *first = memchr(haystack, needle[0],
+                                             haystack_len - needle_len + 1);
+
+        if (!first) {
+            return false;
+        }
+
+        if (memcmp(first, needle, needle_len) == 0) {
+            return true;
+        }
+
+        haystack_len -= (first - haystack) + 1;
+        haystack = first + 1;
+    }
+
+    return false;
+}
+
+static bool builtin_upper(Value *result, Value *arguments,
+                                         DecimalContext *ctx,
+                                         Status *status) {
+    (void)ctx;
+
+    return change_case(result, &arguments[0], true, status);
+}
+
+static bool builtin_lower(Value *result, Value *arguments,
+                                         DecimalContext *ctx,
+                                         Status *status) {
+    (void)ctx;
+
+    return change_case(result, &arguments[0], false, status);
+}
+
+static bool builtin_length(Value *result, Value *arguments,
+                                          DecimalContext *ctx,
+                                          Status *status) {
+    char buf[32];
+    size_t length = 0;
+
+    if (!value_length(&arguments[0], &length, status)) {
+        return false;
+    }
+
+    snprintf(buf, sizeof(buf), "%zu", length);
+
+    return value_init_number(result, buf, ctx, status);
+}
+
+static bool builtin_contains(Value *result, Value *arguments,
+                                            DecimalContext *ctx,
+                                            Status *status) {
+    Value *haystack = &arguments[0];
+    Value *needle = &arguments[1];
+
+    (void)ctx;
+
+    value_init_boolean(result, bytes_contain(
+        value_string_data(haystack),
+        haystack->as.string.byte_len,
+        value_string_data(needle),
+        needle->as.string.byte_len
+    ));
+
+    return status_ok(status);
+}
+
+static bool builtin_escape(Value *result, Value *arguments,
+                                          DecimalContext *ctx,
+                                          Status *status) {
+    Value *string = &arguments[0];
+    String escaped;
+    bool ok = false;
+
+    (void)ctx;
+
+    if (!string_init(&escaped, "", status)) {
+        return false;
+    }
+
+    ok = (
+        escape_html(&escaped, value_string_data(string),
+                              string->as.string.byte_len,
+                              status) &&
+        value_init_string_full(result, escaped.data, escaped.len,
+                                                     escaped.byte_len,
+                                                     status)
+    );
+
+    string_free(&escaped);
+
+    return ok;
+}
+
+static bool builtin_safe(Value *result, Value *arguments,
+                                        DecimalContext *ctx,
+                                        Status *status) {
+    (void)ctx;
+
+    return value_copy(result, &arguments[0], status);
+}
+
+static bool builtin_format(Value *result, Value *arguments,
+                                          DecimalContext *ctx,
+                                          Status *status) {
+    char buf[NUMBER_BUF_SIZE];
+    NumberFormat format;
+    size_t len = 0;
+    SSlice spec;
+
+    spec.data = value_string_data(&arguments[1]);
+    spec.len = arguments[1].as.string.len;
+    spec.byte_len = arguments[1].as.string.byte_len;
+
+    return (
+        number_format_parse(&spec, &format, status) &&
+        number_format(&arguments[0].as.number, &format, ctx, buf, &len,
+                                                                  status) &&
+        value_init_string_full(result, buf, len, len, status)
+    );
+}
+
+static bool builtin_range(Value *result, Value *arguments,
+                                         DecimalContext *ctx,
+                                         Status *status) {
+    mpd_ssize_t start = 0;
+    mpd_ssize_t stop = 0;
+
+    (void)ctx;
+
+    if ((!value_to_integer(&arguments[0], &start, status)) ||
+        (!value_to_integer(&arguments[1], &stop, status))) {
+        return false;
+    }
+
+    /* The length has to fit too */
+    if ((start < 0) && (stop > MPD_SSIZE_MAX + start)) {
+        return range_too_long(status);
+    }
+
+    value_init_range(result, start, stop);
+
+    return status_ok(status);
+}
+
+bool builtins_is_escaped(FunctionEntry *entry) {
+    return (
+        (entry->callback == builtin_escape) ||
+        (entry->callback == builtin_safe)
+    );
+}
+
+bool builtins_register(FunctionRegistry *registry, Status *status) {
+    return (
+        function_registry_add_pure(registry, "upper", 1, "s", builtin_upper,
+                                                              status) &&
+        function_registry_add_pure(registry, "lower", 1, "s", builtin_lower,
+                                                              status) &&
+        function_registry_add_pure(registry, "length", 1, "*",
+                                                          builtin_length,
+                                                          status) &&
+        function_registry_add_pure(registry, "contains", 2, "ss",
+                                                            builtin_contains,
+                                                            status) &&
+        function_registry_add_pure(registry, "escape", 1, "s",
+                                                          builtin_escape,
+                                                          status) &&
+        function_registry_add_pure(registry, "safe", 1, "s", builtin_safe,
+                                                             status) &&
+        function_registry_add_pure(registry, "format", 2, "ns",
+                                                          builtin_format,
+                                                          status) &&
+        function_registry_add_pure(registry, "range", 2, "nn",
+                                                         builtin_range,
+                                                         status) &&
+        function_registry_set_memoized(registry, "safe", false, status) &&
+        function_registry_set_memoized(registry, "range", false, status)
+    );
+}
+
+/* vi: set et ts=4 sw=4: */
@@ -0,0 +1,40 @@
+#ifndef BUILTINS_H__
+#define BUILTINS_H__
+
+enum {
+    BUILTINS_INVALID_UTF8 = 1,
+    BUILTINS_RANGE_TOO_LONG,
+};
+
+/*
+ * SST's built-in functions, all registered as pure (though `safe` and
+ * `range`, which cost less than a memo lookup, aren't memoized):
+ *
+ *   upper(s), lower(s): case-mapped copies of `s`
+ *   length(x):          runes in a string, elements in an array or entries
+ *                       in a table
+ *   contains(s, sub):   whether `sub` occurs in `s`
+ *   escape(s):          `s` with HTML special characters escaped
+ *   safe(s):            `s`, marked as not to be autoescaped (see
+ *                       template.h)
+ *   format(n, spec):    `n` formatted per `spec`, e.g. ",.2f" (see
+ *                       number.h)
+ *   range(start, stop): the integers from `start` up to `stop`, as an array
+ *                       whose elements are computed as they're read (see
+ *                       value.h)
+ *
+ * Case mapping checks for all-ASCII strings a word at a time and maps those
+ * a word at a time too, falling back to utf8proc's per-rune mappings
+ * otherwise.
+ *
+ * builtins_is_escaped says whether `entry` is the `escape` or `safe`
+ * builtin, whose results autoescaping leaves alone.  It compares callbacks
+ * rather than names, so other functions called `safe` are still escaped.
+ */
+
+bool builtins_register(FunctionRegistry *registry, Status *status);
+bool builtins_is_escaped(FunctionEntry *entry);
+
+#endif
+
+/* vi: set et ts=4 sw=4: */
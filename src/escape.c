@@ -0,0 +1,129 @@
+#include <cbase.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "config.h"
+#include "escape.h"
+
+#define ONES  ((uint64_t)0x0101010101010101ULL)
+#define HIGHS ((uint64_t)0x8080808080808080ULL)
+
+static inline bool html_special(char c) {
+    switch (c) {
+        case '&':
+        case '<':
+        case '>':
+        case '"':
+        case '\'':
+            return true;
+        default:
+            return false;
+    }
+}
+
+/*
+ * Sets the top bit of every byte in `word` that equals `c`.
+ */
+static inline uint64_t word_match(uint64_t word, char c) {
+    uint64_t x = word ^ (ONES * (unsigned char)c);
+
+    return (x - ONES) & ~x & HIGHS;
+}
+
+/*
+ * Returns the number of leading bytes of `data` that don't need escaping.
+ */
+static size_t html_clean_prefix(const char *data, size_t byte_len) {
+    size_t i = 0;
+
+#ifdef __SSE2__
+    const __m128i amp = _mm_set1_epi8('&');
+    const __m128i lt = _mm_set1_epi8('<');
+    const __m128i gt = _mm_set1_epi8('>');
+    const __m128i quot = _mm_set1_epi8('"');
+    const __m128i apos = _mm_set1_epi8('\'');
+
+    for (; (i + 16) <= byte_len; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(data + i));
+        __m128i hits = _mm_or_si128(
+            _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(chunk, amp),
+                             _mm_cmpeq_epi8(chunk, lt)),
+                _mm_or_si128(_mm_cmpeq_epi8(chunk, gt),
+                             _mm_cmpeq_epi8(chunk, quot))
+            ),
+            _mm_cmpeq_epi8(chunk, apos)
+        );
+        int mask = _mm_movemask_epi8(hits);
+
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+#endif
+
+    for (; (i + sizeof(uint64_t)) <= byte_len; i += sizeof(uint64_t)) {
+        uint64_t word;
+
+        memcpy(&word, data + i, sizeof(word));
+
+        if (word_match(word, '&') | word_match(word, '<') |
+            word_match(word, '>') | word_match(word, '"') |
+            word_match(word, '\'')) {
+            break;
+        }
+    }
+
+    for (; i < byte_len; i++) {
+        if (html_special(data[i])) {
+            break;
+        }
+    }
+
+    return i;
+}
+
+static const char* html_entity(char c) {
+    switch (c) {
+        case '&':
+            return "&amp;";
+        case '<':
+            return "&lt;";
+        case '>':
+            return "&gt;";
+        case '"':
+            return "&quot;";
+        default:
+            return "&#39;";
+    }
+}
+
+bool escape_html(String *s, const char *data, size_t byte_len,
+                                              Status *status) {
+    while (byte_len > 0) {
+        size_t clean = html_clean_prefix(data, byte_len);
+
+        if (clean > 0) {
+            if (!string_append_cstr_len(s, data, clean, status)) {
+                return false;
+            }
+        }
+
+        if (clean == byte_len) {
+            break;
+        }
+
+        if (!string_append_cstr(s, html_entity(data[clean]), status)) {
+            return false;
+        }
+
+        data += clean + 1;
+        byte_len -= clean + 1;
+    }
+
+    return status_ok(status);
+}
+
+/* vi: set et ts=4 sw=4: */
@@ -0,0 +1,14 @@
+#ifndef ESCAPE_H__
+#define ESCAPE_H__
+
+/*
+ * Appends `data` to `s`, replacing &, <, >, " and ' with HTML entities.
+ * Runs without any of those are found 16 bytes at a time (8 without SSE2)
+ * and appended in one go.
+ */
+bool escape_html(String *s, const char *data, size_t byte_len,
+                                              Status *status);
+
+#endif
+
+/* vi: set et ts=4 sw=4: */
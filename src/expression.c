@@ -0,0 +1,394 @@
+#include <cbase.h>
+
+#include "config.h"
+#include "lang.h"
+#include "tokenizer.h"
+#include "lexer.h"
+#include "value.h"
+#include "function.h"
+#include "expression.h"
+
+#define EXPRESSION_INIT_ALLOC 16
+
+#define unknown_function(status) status_failure( \
+    status,                                      \
+    "expression",                                \
+    EXPRESSION_UNKNOWN_FUNCTION,                 \
+    "Unknown function"                           \
+)
+
+#define wrong_number_of_arguments(status) status_failure( \
+    status,                                               \
+    "expression",                                         \
+    EXPRESSION_WRONG_NUMBER_OF_ARGUMENTS,                 \
+    "Wrong number of function arguments"                  \
+)
+
+#define invalid_expression(status) status_failure( \
+    status,                                        \
+    "expression",                                  \
+    EXPRESSION_INVALID_EXPRESSION,                 \
+    "Invalid expression"                           \
+)
+
+typedef struct {
+    Expression *expression;
+    Array *locals;
+    size_t depth;
+} ExpressionCompiler;
+
+static bool compiler_emit(ExpressionCompiler *compiler,
+                          InstructionType type,
+                          Instruction **instruction,
+                          Status *status) {
+    Instruction *new_instruction = NULL;
+
+    if (!array_append(&compiler->expression->instructions,
+                      (void **)&new_instruction,
+                      status)) {
+        return false;
+    }
+
+    new_instruction->type = type;
+    *instruction = new_instruction;
+
+    return status_ok(status);
+}
+
+/*
+ * Accounts for an instruction popping `pops` values and pushing one.
+ */
+static bool compiler_adjust_depth(ExpressionCompiler *compiler,
+                                  size_t pops,
+                                  Status *status) {
+    if (compiler->depth < pops) {
+        return invalid_expression(status);
+    }
+
+    compiler->depth = compiler->depth - pops + 1;
+
+    if (compiler->depth > compiler->expression->stack_size) {
+        compiler->expression->stack_size = compiler->depth;
+    }
+
+    return status_ok(status);
+}
+
+static bool compiler_add_constant(ExpressionCompiler *compiler,
+                                  Value *value,
+                                  size_t *index,
+                                  Status *status) {
+    PArray *constants = &compiler->expression->constants;
+    Value *constant = malloc(sizeof(Value));
+
+    if (!constant) {
+        value_free(value);
+        return alloc_failure(status);
+    }
+
+    value_move(constant, value);
+
+    if (!parray_append(constants, constant, status)) {
+        value_free(constant);
+        free(constant);
+        return false;
+    }
+
+    *index = constants->len - 1;
+
+    return status_ok(status);
+}
+
+static bool compiler_emit_name(ExpressionCompiler *compiler,
+                               InstructionType type,
+                               const char *data,
+                               size_t byte_len,
+                               Status *status) {
+    Instruction *instruction = NULL;
+    Value name;
+
+    if (!value_init_string_len(&name, data, byte_len, status)) {
+        return false;
+    }
+
+    if (!compiler_emit(compiler, type, &instruction, status)) {
+        value_free(&name);
+        return false;
+    }
+
+    return compiler_add_constant(compiler, &name, &instruction->as.constant,
+                                                  status);
+}
+
+/*
+ * Finds the innermost local that `path` starts with, whole segments only.
+ */
+static bool compiler_find_local(ExpressionCompiler *compiler, SSlice *path,
+                                                              size_t *local,
+                                                              size_t *len) {
+    if (!compiler->locals) {
+        return false;
+    }
+
+    for (size_t i = compiler->locals->len; i > 0; i--) {
+        SSlice *candidate = array_index_fast(compiler->locals, i - 1);
+
+        if ((candidate->byte_len <= path->byte_len) &&
+            (memcmp(candidate->data, path->data, candidate->byte_len) == 0) &&
+            ((candidate->byte_len == path->byte_len) ||
+             (path->data[candidate->byte_len] == '.'))) {
+            *local = i - 1;
+            *len = candidate->byte_len;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Emits a LOCAL for the local a dotted path starts with, or a LOOKUP for its
+ * first segment, and a MEMBER for each segment after that.
+ */
+static bool compiler_emit_path(ExpressionCompiler *compiler, SSlice *path,
+                                                             Status *status) {
+    const char *start = path->data;
+    const char *end = path->data + path->byte_len;
+    InstructionType type = INSTRUCTION_LOOKUP;
+    Instruction *instruction = NULL;
+    size_t local = 0;
+    size_t len = 0;
+
+    if (compiler_find_local(compiler, path, &local, &len)) {
+        if ((!compiler_emit(compiler, INSTRUCTION_LOCAL, &instruction,
+                                                         status)) ||
+                (!compiler_adjust_depth(compiler, 0, status))) {
+            return false;
+        }
+
+        instruction->as.local = local;
+
+        if (len == path->byte_len) {
+            return status_ok(status);
+        }
+
+        type = INSTRUCTION_MEMBER;
+        start += len + 1;
+    }
+
+    while (true) {
+        const char *dot = memchr(start, '.', end - start);
+        const char *segment_end = dot ? dot : end;
+
+        if (segment_end == start) {
+            return invalid_expression(status);
+        }
+
+        if (!compiler_emit_name(compiler, type, start, segment_end - start,
+                                                      status)) {
+            return false;
+        }
+
+        if (type == INSTRUCTION_LOOKUP) {
+            if (!compiler_adjust_depth(compiler, 0, status)) {
+                return false;
+            }
+        }
+
+        if (!dot) {
+            break;
+        }
+
+        type = INSTRUCTION_MEMBER;
+        start = dot + 1;
+    }
+
+    return status_ok(status);
+}
+
+static bool compiler_compile_token(ExpressionCompiler *compiler,
+                                   CodeToken *code_token,
+                                   FunctionRegistry *functions,
+                                   DecimalContext *ctx,
+                                   Status *status) {
+    Instruction *instruction = NULL;
+    FunctionEntry *function = NULL;
+    Value constant;
+
+    switch (code_token->type) {
+        case CODE_TOKEN_NUMBER:
+            if (!value_init_number_from_sslice(&constant,
+                                               &code_token->as.number,
+                                               ctx,
+                                               status)) {
+                return false;
+            }
+
+            if (!compiler_emit(compiler, INSTRUCTION_PUSH, &instruction,
+                                                           status)) {
+                value_free(&constant);
+                return false;
+            }
+
+            return (
+                compiler_add_constant(compiler, &constant,
+                                                &instruction->as.constant,
+                                                status) &&
+                compiler_adjust_depth(compiler, 0, status)
+            );
+        case CODE_TOKEN_STRING:
+            if (!value_init_string_from_sslice(&constant,
+                                               &code_token->as.string,
+                                               status)) {
+                return false;
+            }
+
+            if (!compiler_emit(compiler, INSTRUCTION_PUSH, &instruction,
+                                                           status)) {
+                value_free(&constant);
+                return false;
+            }
+
+            return (
+                compiler_add_constant(compiler, &constant,
+                                                &instruction->as.constant,
+                                                status) &&
+                compiler_adjust_depth(compiler, 0, status)
+            );
+        case CODE_TOKEN_LOOKUP:
+            return compiler_emit_path(compiler, &code_token->as.lookup,
+                                                status);
+        case CODE_TOKEN_INDEX_START:
+            if (code_token->arity != 1) {
+                return invalid_expression(status);
+            }
+
+            return (
+                compiler_emit_path(compiler, &code_token->as.index, status) &&
+                compiler_emit(compiler, INSTRUCTION_INDEX, &instruction,
+                                                           status) &&
+                compiler_adjust_depth(compiler, 2, status)
+            );
+        case CODE_TOKEN_ARRAY_START:
+            if (!compiler_emit(compiler, INSTRUCTION_ARRAY, &instruction,
+                                                            status)) {
+                return false;
+            }
+
+            instruction->as.count = code_token->arity;
+
+            return compiler_adjust_depth(compiler, code_token->arity, status);
+        case CODE_TOKEN_FUNCTION_START:
+            if (!functions) {
+                return unknown_function(status);
+            }
+
+            if (!function_registry_lookup(functions, &code_token->as.function,
+                                                     &function,
+                                                     status)) {
+                if (status_match(status, "base", ERROR_NOT_FOUND)) {
+                    return unknown_function(status);
+                }
+
+                return false;
+            }
+
+            if (function->signature.arity != code_token->arity) {
+                return wrong_number_of_arguments(status);
+            }
+
+            if (!compiler_emit(compiler, INSTRUCTION_CALL, &instruction,
+                                                           status)) {
+                return false;
+            }
+
+            instruction->as.function = function;
+
+            return compiler_adjust_depth(compiler, code_token->arity, status);
+        case CODE_TOKEN_OPERATOR:
+            if (!compiler_emit(compiler, INSTRUCTION_OPERATOR, &instruction,
+                                                               status)) {
+                return false;
+            }
+
+            instruction->as.op = code_token->as.op;
+
+            return compiler_adjust_depth(
+                compiler,
+                OperatorInfo[code_token->as.op].arity,
+                status
+            );
+        default:
+            return invalid_expression(status);
+    }
+}
+
+bool expression_init(Expression *expression, Status *status) {
+    if (!array_init_alloc(&expression->instructions, sizeof(Instruction),
+                                                     EXPRESSION_INIT_ALLOC,
+                                                     status)) {
+        return false;
+    }
+
+    if (!parray_init_alloc(&expression->constants, EXPRESSION_INIT_ALLOC,
+                                                   status)) {
+        array_free(&expression->instructions);
+        return false;
+    }
+
+    expression->stack_size = 0;
+
+    return status_ok(status);
+}
+
+bool expression_compile(Expression *expression, PArray *rpn,
+                                                Array *locals,
+                                                FunctionRegistry *functions,
+                                                DecimalContext *ctx,
+                                                Status *status) {
+    ExpressionCompiler compiler;
+
+    expression_clear(expression);
+
+    compiler.expression = expression;
+    compiler.locals = locals;
+    compiler.depth = 0;
+
+    for (size_t i = 0; i < rpn->len; i++) {
+        if (!compiler_compile_token(&compiler, parray_index_fast(rpn, i),
+                                               functions,
+                                               ctx,
+                                               status)) {
+            expression_clear(expression);
+            return false;
+        }
+    }
+
+    if (compiler.depth != 1) {
+        expression_clear(expression);
+        return invalid_expression(status);
+    }
+
+    return status_ok(status);
+}
+
+void expression_clear(Expression *expression) {
+    for (size_t i = 0; i < expression->constants.len; i++) {
+        Value *constant = parray_index_fast(&expression->constants, i);
+
+        value_free(constant);
+        free(constant);
+    }
+
+    array_clear(&expression->instructions);
+    parray_clear(&expression->constants);
+    expression->stack_size = 0;
+}
+
+void expression_free(Expression *expression) {
+    expression_clear(expression);
+    array_free(&expression->instructions);
+    parray_free(&expression->constants);
+}
+
+/* vi: set et ts=4 sw=4: */
@@ -0,0 +1,75 @@
+#ifndef EXPRESSION_H__
+#define EXPRESSION_H__
+
+enum {
+    EXPRESSION_UNKNOWN_FUNCTION = 1,
+    EXPRESSION_WRONG_NUMBER_OF_ARGUMENTS,
+    EXPRESSION_INVALID_EXPRESSION,
+};
+
+/*
+ * Expressions are compiled from the expression parser's RPN output into
+ * instructions for a small stack machine (see expression_evaluator.h).
+ * Literals become constants, dotted lookups are split into a LOOKUP and a
+ * MEMBER per segment, and function names are resolved to their registry
+ * entries, so nothing is looked up by name at render time except context
+ * keys.
+ *
+ * `locals` (an Array of SSlice, or NULL) lists the names in scope that
+ * aren't context keys, loop variables say.  A path starting with one of them
+ * (which may themselves be dotted, like `loop.index`) compiles to a LOCAL of
+ * its index, the innermost (last) one winning, and the evaluator reads it
+ * from its frame (see expression_evaluator.h).
+ *
+ *   PUSH:     push constant `constant`
+ *   LOOKUP:   push the context's value named by constant `constant`
+ *   LOCAL:    push local `local`
+ *   MEMBER:   replace the table on top with its member named by `constant`
+ *   INDEX:    pop a container, then replace the index (or key) below it with
+ *             the element it refers to
+ *   ARRAY:    replace the top `count` values with an array of them
+ *   CALL:     replace the top `function->signature.arity` values with the
+ *             result of calling `function` with them
+ *   OPERATOR: apply `op` to the top one or two values
+ */
+
+typedef enum {
+    INSTRUCTION_PUSH,
+    INSTRUCTION_LOOKUP,
+    INSTRUCTION_LOCAL,
+    INSTRUCTION_MEMBER,
+    INSTRUCTION_INDEX,
+    INSTRUCTION_ARRAY,
+    INSTRUCTION_CALL,
+    INSTRUCTION_OPERATOR,
+} InstructionType;
+
+typedef struct {
+    InstructionType type;
+    union {
+        size_t constant;
+        size_t local;
+        size_t count;
+        Operator op;
+        FunctionEntry *function;
+    } as;
+} Instruction;
+
+typedef struct {
+    Array instructions;
+    PArray constants;
+    size_t stack_size;
+} Expression;
+
+bool expression_init(Expression *expression, Status *status);
+bool expression_compile(Expression *expression, PArray *rpn,
+                                                Array *locals,
+                                                FunctionRegistry *functions,
+                                                DecimalContext *ctx,
+                                                Status *status);
+void expression_clear(Expression *expression);
+void expression_free(Expression *expression);
+
+#endif
+
+/* vi: set et ts=4 sw=4: */
@@ -1,34 +1,735 @@
 #include <cbase.h>
+#include <stdio.h>
 
 #include "config.h"
 #include "lang.h"
-#include "parser.h"
 #include "value.h"
+#include "function.h"
+#include "expression.h"
+#include "expression_evaluator.h"
 
-bool expression_evaluator_init(ExpressionEvaluator *expression_evaluator) {
-    list_init(&expression_evaluator->value_cache, sizeof(Value));
+#define EXPRESSION_EVALUATOR_INIT_ALLOC 16
+
+#define invalid_operator(status) status_failure( \
+    status,                                      \
+    "expression evaluator",                      \
+    EXPRESSION_EVALUATOR_INVALID_OPERATOR,       \
+    "Invalid operator"                           \
+)
+
+static inline
+Value* evaluator_slot(ExpressionEvaluator *expression_evaluator,
+                      size_t index) {
+    return array_index_fast(&expression_evaluator->stack, index);
+}
+
+/*
+ * Makes sure the stack has `size` slots.  Slots not in use are always
+ * VALUE_NONE, which is what makes it safe to move them around here.
+ */
+static bool evaluator_reserve(ExpressionEvaluator *expression_evaluator,
+                              size_t size,
+                              Status *status) {
+    Array *stack = &expression_evaluator->stack;
+
+    if (!array_ensure_capacity(stack, size, status)) {
+        return false;
+    }
+
+    while (stack->len < size) {
+        Value *slot = NULL;
+
+        if (!array_append(stack, (void **)&slot, status)) {
+            return false;
+        }
+
+        slot->type = VALUE_NONE;
+    }
+
+    return status_ok(status);
+}
+
+static void evaluator_unwind(ExpressionEvaluator *expression_evaluator,
+                             size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        value_free(evaluator_slot(expression_evaluator, i));
+    }
+}
+
+/*
+ * Replaces `slot` with `value`.
+ */
+static inline
+void evaluator_replace(Value *slot, Value *value) {
+    value_free(slot);
+    value_move(slot, value);
+}
+
+bool expression_evaluator_lookup(Value *context, Value *name, Value *result,
+                                                              Status *status) {
+    SSlice key;
+
+    key.data = value_string_data(name);
+    key.len = name->as.string.len;
+    key.byte_len = name->as.string.byte_len;
+
+    return value_lookup(context, &key, result, status);
+}
+
+static inline
+Value* evaluator_local(ExpressionEvaluator *expression_evaluator,
+                       size_t local) {
+    return *(Value **)array_index_fast(&expression_evaluator->locals, local);
 }
 
-bool expression_evaluator_init_alloc(ExpressionEvaluator *expression_evaluator,
-                                     size_t len) {
-    return list_init_alloc(
-        &expression_evaluator->value_cache,
-        sizeof(Value),
-        len
-    );
+bool expression_evaluator_member(Value *slot, Value *name, Status *status) {
+    Value member;
+    SSlice key;
+
+    key.data = value_string_data(name);
+    key.len = name->as.string.len;
+    key.byte_len = name->as.string.byte_len;
+
+    member.type = VALUE_NONE;
+
+    if (!value_lookup(slot, &key, &member, status)) {
+        value_free(&member);
+        return false;
+    }
+
+    evaluator_replace(slot, &member);
+
+    return status_ok(status);
+}
+
+/*
+ * Replaces `index` with the element of `container` it refers to.
+ */
+static bool evaluator_index(Value *container, Value *index, Status *status) {
+    Value element;
+    size_t i = 0;
+
+    element.type = VALUE_NONE;
+
+    if (index->type == VALUE_STRING) {
+        SSlice key;
+
+        key.data = value_string_data(index);
+        key.len = index->as.string.len;
+        key.byte_len = index->as.string.byte_len;
+
+        if (!value_lookup(container, &key, &element, status)) {
+            value_free(&element);
+            return false;
+        }
+    }
+    else {
+        if (!value_to_index(index, &i, status)) {
+            return false;
+        }
+
+        if (!value_index(container, i, &element, status)) {
+            value_free(&element);
+            return false;
+        }
+    }
+
+    evaluator_replace(index, &element);
+
+    return status_ok(status);
+}
+
+bool expression_evaluator_index(Value *operands, Status *status) {
+    bool ok = evaluator_index(&operands[1], &operands[0], status);
+
+    value_free(&operands[1]);
+
+    return ok;
+}
+
+Value* expression_evaluator_local(ExpressionEvaluator *expression_evaluator,
+                                  size_t local) {
+    return evaluator_local(expression_evaluator, local);
+}
+
+bool expression_evaluator_array(Value *elements, size_t count,
+                                                Status *status) {
+    Value array;
+
+    if (!value_init_array(&array, status)) {
+        return false;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        Value *element = NULL;
+
+        if (!value_array_append(&array, &element, status)) {
+            value_free(&array);
+            return false;
+        }
+
+        value_move(element, &elements[i]);
+    }
+
+    evaluator_replace(&elements[0], &array);
+
+    return status_ok(status);
+}
+
+static inline
+size_t memo_number_hash(Decimal *number, size_t seed) {
+    uint8_t flags = number->flags & (MPD_NEG | MPD_SPECIAL);
+
+    seed = hash64(&flags, sizeof(flags), seed);
+    seed = hash64(&number->exp, sizeof(number->exp), seed);
+
+    return hash64(number->data, sizeof(mpd_uint_t) * (size_t)number->len,
+                                seed);
+}
+
+/*
+ * Hashes a call to `function` with `arguments` by the entry's address and
+ * each argument's type and value.  Numbers are hashed (and compared) by
+ * their exact representation, since a function may format 1.5 and 1.50
+ * differently.  Calls with arguments that aren't booleans, numbers or
+ * strings aren't memoized.
+ */
+static bool evaluator_memo_hash(FunctionEntry *function, Value *arguments,
+                                                         size_t *hash) {
+    size_t seed = hash64(&function, sizeof(function), 0);
+
+    for (unsigned int i = 0; i < function->signature.arity; i++) {
+        Value *argument = &arguments[i];
+
+        seed = hash64(&argument->type, sizeof(argument->type), seed);
+
+        switch (argument->type) {
+            case VALUE_BOOLEAN:
+                seed = hash64(&argument->as.boolean,
+                              sizeof(argument->as.boolean),
+                              seed);
+                break;
+            case VALUE_NUMBER:
+                seed = memo_number_hash(&argument->as.number, seed);
+                break;
+            case VALUE_STRING:
+                seed = hash64(value_string_data(argument),
+                              argument->as.string.byte_len,
+                              seed);
+                break;
+            default:
+                return false;
+        }
+    }
+
+    *hash = seed;
+
+    return true;
+}
+
+static bool memo_argument_equal(Value *value, Value *other) {
+    if (value->type != other->type) {
+        return false;
+    }
+
+    switch (value->type) {
+        case VALUE_BOOLEAN:
+            return value->as.boolean == other->as.boolean;
+        case VALUE_NUMBER:
+            return (
+                ((value->as.number.flags & (MPD_NEG | MPD_SPECIAL)) ==
+                 (other->as.number.flags & (MPD_NEG | MPD_SPECIAL))) &&
+                (value->as.number.exp == other->as.number.exp) &&
+                (value->as.number.len == other->as.number.len) &&
+                (memcmp(value->as.number.data,
+                        other->as.number.data,
+                        sizeof(mpd_uint_t) * (size_t)value->as.number.len)
+                    == 0)
+            );
+        case VALUE_STRING:
+            return (
+                (value->as.string.byte_len == other->as.string.byte_len) &&
+                (memcmp(value_string_data(value),
+                        value_string_data(other),
+                        value->as.string.byte_len) == 0)
+            );
+        default:
+            return false;
+    }
+}
+
+static bool evaluator_memo_match(ExpressionMemoEntry *entry,
+                                 FunctionEntry *function,
+                                 Value *arguments,
+                                 size_t hash) {
+    if ((entry->function != function) || (entry->hash != hash)) {
+        return false;
+    }
+
+    for (unsigned int i = 0; i < function->signature.arity; i++) {
+        if (!memo_argument_equal(&entry->values[i], &arguments[i])) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void memo_entry_clear(ExpressionMemoEntry *entry) {
+    for (size_t i = 0; i < entry->capacity; i++) {
+        value_free(&entry->values[i]);
+    }
+
+    entry->function = NULL;
+}
+
+/*
+ * Stores `result` in `entry`, replacing whatever call it held.  Its values
+ * are only reallocated when they're too few for this call.
+ */
+static bool evaluator_memo_store(ExpressionMemoEntry *entry,
+                                 FunctionEntry *function,
+                                 Value *arguments,
+                                 size_t hash,
+                                 Value *result,
+                                 Status *status) {
+    unsigned int arity = function->signature.arity;
+
+    memo_entry_clear(entry);
+
+    if (entry->capacity < (arity + 1)) {
+        Value *values = realloc(entry->values, sizeof(Value) * (arity + 1));
+
+        if (!values) {
+            return alloc_failure(status);
+        }
+
+        for (size_t i = entry->capacity; i < (arity + 1); i++) {
+            values[i].type = VALUE_NONE;
+        }
+
+        entry->values = values;
+        entry->capacity = arity + 1;
+    }
+
+    for (unsigned int i = 0; i < arity; i++) {
+        if (!value_copy(&entry->values[i], &arguments[i], status)) {
+            memo_entry_clear(entry);
+            return false;
+        }
+    }
+
+    if (!value_copy(&entry->values[arity], result, status)) {
+        memo_entry_clear(entry);
+        return false;
+    }
+
+    entry->function = function;
+    entry->hash = hash;
+
+    return status_ok(status);
+}
+
+bool expression_evaluator_call(ExpressionEvaluator *expression_evaluator,
+                               FunctionEntry *function,
+                               Value *arguments,
+                               Status *status) {
+    unsigned int arity = function->signature.arity;
+    ExpressionMemoEntry *entry = NULL;
+    bool memoizable = false;
+    size_t hash = 0;
+    Value result;
+
+    if (!function_check_arguments(function, arguments, status)) {
+        return false;
+    }
+
+    result.type = VALUE_NONE;
+
+    if (function->pure && function->memoized) {
+        memoizable = evaluator_memo_hash(function, arguments, &hash);
+    }
+
+    if (memoizable && (!expression_evaluator->memo)) {
+        expression_evaluator->memo = calloc(
+            EXPRESSION_EVALUATOR_MEMO_SIZE,
+            sizeof(ExpressionMemoEntry)
+        );
+
+        if (!expression_evaluator->memo) {
+            return alloc_failure(status);
+        }
+    }
+
+    if (memoizable) {
+        entry = &expression_evaluator->memo[
+            hash & (EXPRESSION_EVALUATOR_MEMO_SIZE - 1)
+        ];
+    }
+
+    if (entry && evaluator_memo_match(entry, function, arguments, hash)) {
+        expression_evaluator->memo_hits++;
+
+        if (!value_copy(&result, &entry->values[arity], status)) {
+            value_free(&result);
+            return false;
+        }
+    }
+    else {
+        if (!function->callback(&result, arguments,
+                                         &expression_evaluator->ctx,
+                                         status)) {
+            value_free(&result);
+            return false;
+        }
+
+        if (entry) {
+            expression_evaluator->memo_misses++;
+
+            if (!evaluator_memo_store(entry, function, arguments, hash,
+                                                                  &result,
+                                                                  status)) {
+                value_free(&result);
+                return false;
+            }
+        }
+    }
+
+    for (unsigned int i = 1; i < arity; i++) {
+        value_free(&arguments[i]);
+    }
+
+    evaluator_replace(&arguments[0], &result);
+
+    return status_ok(status);
+}
+
+static bool evaluator_compare(Operator op, Value *op1, Value *op2,
+                                           Value *result,
+                                           Status *status) {
+    int cmp_res = 0;
+
+    if (!value_compare(op1, op2, &cmp_res, status)) {
+        return false;
+    }
+
+    value_set_type(result, VALUE_BOOLEAN);
+
+    switch (op) {
+        case OP_BOOL_LESS_THAN:
+            result->as.boolean = cmp_res < 0;
+            break;
+        case OP_BOOL_LESS_THAN_OR_EQUAL:
+            result->as.boolean = cmp_res <= 0;
+            break;
+        case OP_BOOL_GREATER_THAN:
+            result->as.boolean = cmp_res > 0;
+            break;
+        default:
+            result->as.boolean = cmp_res >= 0;
+            break;
+    }
+
+    return status_ok(status);
+}
+
+bool expression_evaluator_operator(
+    ExpressionEvaluator *expression_evaluator,
+    Operator op,
+    Value *operands,
+    Status *status) {
+    DecimalContext *ctx = &expression_evaluator->ctx;
+    Value *op1 = &operands[0];
+    Value *op2 = &operands[1];
+    Value result;
+    bool ok = false;
+
+    result.type = VALUE_NONE;
+
+    switch (op) {
+        case OP_BOOL_OR:
+            ok = value_or(&result, op1, op2, status);
+            break;
+        case OP_BOOL_AND:
+            ok = value_and(&result, op1, op2, status);
+            break;
+        case OP_BOOL_NOT:
+            ok = value_not(&result, op1, status);
+            break;
+        case OP_BOOL_LESS_THAN:
+        case OP_BOOL_LESS_THAN_OR_EQUAL:
+        case OP_BOOL_GREATER_THAN:
+        case OP_BOOL_GREATER_THAN_OR_EQUAL:
+            ok = evaluator_compare(op, op1, op2, &result, status);
+            break;
+        case OP_BOOL_NOT_EQUAL:
+            ok = value_equal(&result, op1, op2, status);
+
+            if (ok) {
+                result.as.boolean = !result.as.boolean;
+            }
+
+            break;
+        case OP_BOOL_EQUAL:
+            ok = value_equal(&result, op1, op2, status);
+            break;
+        case OP_MATH_ADD:
+            ok = value_add(&result, op1, op2, ctx, status);
+            break;
+        case OP_MATH_SUBTRACT:
+            ok = value_sub(&result, op1, op2, ctx, status);
+            break;
+        case OP_MATH_MULTIPLY:
+            ok = value_mul(&result, op1, op2, ctx, status);
+            break;
+        case OP_MATH_DIVIDE:
+            ok = value_div(&result, op1, op2, ctx, status);
+            break;
+        case OP_MATH_REMAINDER:
+            ok = value_rem(&result, op1, op2, ctx, status);
+            break;
+        case OP_MATH_POSITIVE:
+            if (op1->type != VALUE_NUMBER) {
+                return invalid_operator(status);
+            }
+
+            return status_ok(status);
+        case OP_MATH_NEGATIVE:
+            ok = value_negate(&result, op1, ctx, status);
+            break;
+        case OP_MATH_EXPONENT:
+            ok = value_pow(&result, op1, op2, ctx, status);
+            break;
+        default:
+            return invalid_operator(status);
+    }
+
+    if (!ok) {
+        value_free(&result);
+        return false;
+    }
+
+    if (OperatorInfo[op].arity == 2) {
+        value_free(op2);
+    }
+
+    evaluator_replace(op1, &result);
+
+    return status_ok(status);
+}
+
+bool expression_evaluator_init(ExpressionEvaluator *expression_evaluator,
+                               Status *status) {
+    if (!array_init_alloc(&expression_evaluator->stack,
+                          sizeof(Value),
+                          EXPRESSION_EVALUATOR_INIT_ALLOC,
+                          status)) {
+        return false;
+    }
+
+    if (!array_init_alloc(&expression_evaluator->locals,
+                          sizeof(Value *),
+                          EXPRESSION_EVALUATOR_INIT_ALLOC,
+                          status)) {
+        array_free(&expression_evaluator->stack);
+        return false;
+    }
+
+    expression_evaluator->memo = NULL;
+
+    decimal_context_set_max(&expression_evaluator->ctx);
+
+    expression_evaluator->memo_hits = 0;
+    expression_evaluator->memo_misses = 0;
+
+    return status_ok(status);
+}
+
+bool expression_evaluator_set_local(
+    ExpressionEvaluator *expression_evaluator,
+    size_t local,
+    Value *value,
+    Status *status) {
+    Array *locals = &expression_evaluator->locals;
+
+    while (locals->len <= local) {
+        Value **slot = NULL;
+
+        if (!array_append(locals, (void **)&slot, status)) {
+            return false;
+        }
+
+        *slot = NULL;
+    }
+
+    *(Value **)array_index_fast(locals, local) = value;
+
+    return status_ok(status);
+}
+
+bool expression_evaluator_share_locals(
+    ExpressionEvaluator *expression_evaluator,
+    ExpressionEvaluator *source,
+    size_t count,
+    Status *status) {
+    for (size_t i = 0; (i < count) && (i < source->locals.len); i++) {
+        Value *value = *(Value **)array_index_fast(&source->locals, i);
+
+        if (!expression_evaluator_set_local(expression_evaluator, i, value,
+                                                                     status)) {
+            return false;
+        }
+    }
+
+    return status_ok(status);
 }
 
 bool expression_evaluator_evaluate(ExpressionEvaluator *expression_evaluator,
-                                   Array *nodes,
-                                   Value *context) {
+                                   Expression *expression,
+                                   Value *context,
+                                   Value *result,
+                                   Status *status) {
+    size_t top = 0;
+
+    if (!evaluator_reserve(expression_evaluator, expression->stack_size,
+                                                 status)) {
+        return false;
+    }
+
+    for (size_t i = 0; i < expression->instructions.len; i++) {
+        Instruction *instruction = array_index_fast(
+            &expression->instructions,
+            i
+        );
+        Value *constant = NULL;
+        size_t pops = 0;
+        bool ok = false;
+
+        switch (instruction->type) {
+            case INSTRUCTION_PUSH:
+                constant = parray_index_fast(
+                    &expression->constants,
+                    instruction->as.constant
+                );
+                ok = value_copy(
+                    evaluator_slot(expression_evaluator, top),
+                    constant,
+                    status
+                );
+                top++;
+                break;
+            case INSTRUCTION_LOOKUP:
+                constant = parray_index_fast(
+                    &expression->constants,
+                    instruction->as.constant
+                );
+                ok = expression_evaluator_lookup(
+                    context,
+                    constant,
+                    evaluator_slot(expression_evaluator, top),
+                    status
+                );
+                top++;
+                break;
+            case INSTRUCTION_LOCAL:
+                ok = value_copy(
+                    evaluator_slot(expression_evaluator, top),
+                    evaluator_local(expression_evaluator,
+                                    instruction->as.local),
+                    status
+                );
+                top++;
+                break;
+            case INSTRUCTION_MEMBER:
+                constant = parray_index_fast(
+                    &expression->constants,
+                    instruction->as.constant
+                );
+                ok = expression_evaluator_member(
+                    evaluator_slot(expression_evaluator, top - 1),
+                    constant,
+                    status
+                );
+                break;
+            case INSTRUCTION_INDEX:
+                ok = expression_evaluator_index(
+                    evaluator_slot(expression_evaluator, top - 2),
+                    status
+                );
+                top--;
+                break;
+            case INSTRUCTION_ARRAY:
+                pops = instruction->as.count;
+                ok = expression_evaluator_array(
+                    evaluator_slot(expression_evaluator, top - pops),
+                    pops,
+                    status
+                );
+                top = top - pops + 1;
+                break;
+            case INSTRUCTION_CALL:
+                pops = instruction->as.function->signature.arity;
+                ok = expression_evaluator_call(
+                    expression_evaluator,
+                    instruction->as.function,
+                    evaluator_slot(expression_evaluator, top - pops),
+                    status
+                );
+                top = top - pops + 1;
+                break;
+            case INSTRUCTION_OPERATOR:
+                pops = OperatorInfo[instruction->as.op].arity;
+                ok = expression_evaluator_operator(
+                    expression_evaluator,
+                    instruction->as.op,
+                    evaluator_slot(expression_evaluator, top - pops),
+                    status
+                );
+                top = top - pops + 1;
+                break;
+        }
+
+        if (!ok) {
+            evaluator_unwind(expression_evaluator, expression->stack_size);
+            return false;
+        }
+    }
+
+    evaluator_replace(result, evaluator_slot(expression_evaluator, 0));
+
+    return status_ok(status);
+}
+
+void expression_evaluator_reset_memo(
+    ExpressionEvaluator *expression_evaluator) {
+    if (expression_evaluator->memo) {
+        for (size_t i = 0; i < EXPRESSION_EVALUATOR_MEMO_SIZE; i++) {
+            memo_entry_clear(&expression_evaluator->memo[i]);
+        }
+    }
+
+    expression_evaluator->memo_hits = 0;
+    expression_evaluator->memo_misses = 0;
 }
 
 void expression_evaluator_clear(ExpressionEvaluator *expression_evaluator) {
-    list_clear(&expression_evaluator->value_cache);
+    array_clear(&expression_evaluator->locals);
+    expression_evaluator_reset_memo(expression_evaluator);
 }
 
 void expression_evaluator_free(ExpressionEvaluator *expression_evaluator) {
-    list_free(&expression_evaluator->value_cache);
+    expression_evaluator_reset_memo(expression_evaluator);
+
+    if (expression_evaluator->memo) {
+        for (size_t i = 0; i < EXPRESSION_EVALUATOR_MEMO_SIZE; i++) {
+            free(expression_evaluator->memo[i].values);
+        }
+
+        free(expression_evaluator->memo);
+    }
+
+    array_free(&expression_evaluator->stack);
+    array_free(&expression_evaluator->locals);
 }
 
 /* vi: set et ts=4 sw=4: */
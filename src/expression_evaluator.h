@@ -2,23 +2,114 @@
 #define EXPRESSION_EVALUATOR_H__
 
 enum {
+    EXPRESSION_EVALUATOR_INVALID_OPERATOR = 1,
 };
 
+/*
+ * An ExpressionEvaluator runs compiled expressions against a context.  It
+ * holds the value stack and decimal context, so each thread rendering needs
+ * its own, but it can be reused across expressions and renders.
+ *
+ * Locals (loop variables, say) are resolved to frame slots when expressions
+ * are compiled (see expression.h), and expression_evaluator_set_local points
+ * a slot at its current Value.  The Value is referred to, not copied, so it
+ * must stay put while expressions using the slot are evaluated.
+ * expression_evaluator_share_locals points another evaluator's first `count`
+ * slots at the same Values, so a worker thread can evaluate a loop body in
+ * its parent's scope; the Values are only read.  Nothing is ever written to
+ * the context, so one context can be shared by any number of renders at
+ * once.
+ *
+ * Results of pure functions (see function.h) are memoized by function and
+ * argument values until expression_evaluator_reset_memo, which rendering
+ * calls at the start of each render.  The memo is a table of
+ * EXPRESSION_EVALUATOR_MEMO_SIZE slots, indexed by a hash of the function
+ * and its arguments, each holding the last call that hashed there, so it
+ * never grows past that however many calls a render makes.  Slots keep
+ * their allocations across resets.  `memo_hits` and `memo_misses` count
+ * pure calls answered from the memo and made for real since the last reset.
+ *
+ * The step for each instruction is public too, so code generated ahead of
+ * time (see template_aot.h) can call them directly on a stack of its own.
+ * Each works on the stack slots the instruction pops, leaving its result in
+ * the first and freeing the rest:
+ *
+ *   PUSH:     value_copy(slot, constant)
+ *   LOOKUP:   expression_evaluator_lookup(context, name, slot)
+ *   LOCAL:    value_copy(slot, expression_evaluator_local(evaluator, local))
+ *   MEMBER:   expression_evaluator_member(slot, name)
+ *   INDEX:    expression_evaluator_index(slots), the container on top
+ *   ARRAY:    expression_evaluator_array(slots, count)
+ *   CALL:     expression_evaluator_call(evaluator, function, slots)
+ *   OPERATOR: expression_evaluator_operator(evaluator, op, slots)
+ */
+
+#define EXPRESSION_EVALUATOR_MEMO_SIZE 256
+
+/*
+ * A memo slot: a call to `function` (NULL if the slot's empty), its hash,
+ * and in `values` its arguments followed by its result.  `values` has room
+ * for `capacity` of them.
+ */
 typedef struct {
-    List value_cache;
-    Value result;
+    FunctionEntry *function;
+    size_t hash;
+    Value *values;
+    size_t capacity;
+} ExpressionMemoEntry;
+
+typedef struct {
+    Array stack;
+    Array locals;
+    DecimalContext ctx;
+    ExpressionMemoEntry *memo;
+    size_t memo_hits;
+    size_t memo_misses;
 } ExpressionEvaluator;
 
-bool expression_evaluator_init(ExpressionEvaluator *expression_evaluator);
-bool expression_evaluator_init_alloc(ExpressionEvaluator *expression_evaluator
-                                     size_t len);
+bool expression_evaluator_init(ExpressionEvaluator *expression_evaluator,
+                               Status *status);
+bool expression_evaluator_set_local(
+    ExpressionEvaluator *expression_evaluator,
+    size_t local,
+    Value *value,
+    Status *status
+);
+bool expression_evaluator_share_locals(
+    ExpressionEvaluator *expression_evaluator,
+    ExpressionEvaluator *source,
+    size_t count,
+    Status *status
+);
+bool expression_evaluator_lookup(Value *context, Value *name, Value *result,
+                                                              Status *status);
+Value* expression_evaluator_local(ExpressionEvaluator *expression_evaluator,
+                                  size_t local);
+bool expression_evaluator_member(Value *slot, Value *name, Status *status);
+bool expression_evaluator_index(Value *operands, Status *status);
+bool expression_evaluator_array(Value *elements, size_t count,
+                                                Status *status);
+bool expression_evaluator_call(ExpressionEvaluator *expression_evaluator,
+                               FunctionEntry *function,
+                               Value *arguments,
+                               Status *status);
+bool expression_evaluator_operator(
+    ExpressionEvaluator *expression_evaluator,
+    Operator op,
+    Value *operands,
+    Status *status
+);
 bool expression_evaluator_evaluate(ExpressionEvaluator *expression_evaluator,
-                                   Array *nodes,
-                                   Value *context);
+                                   Expression *expression,
+                                   Value *context,
+                                   Value *result,
+                                   Status *status);
+void expression_evaluator_reset_memo(
+    ExpressionEvaluator *expression_evaluator
+);
 void expression_evaluator_clear(ExpressionEvaluator *expression_evaluator);
 void expression_evaluator_free(ExpressionEvaluator *expression_evaluator);
 
 #endif
 
 /* vi: set et ts=4 sw=4: */
-
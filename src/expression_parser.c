@@ -58,13 +58,93 @@
     "Extraneous parentheses"                           \
 )
 
+static inline
+bool code_token_is_group_start(CodeToken *code_token) {
+    return (
+        (code_token->type == CODE_TOKEN_FUNCTION_START) ||
+        (code_token->type == CODE_TOKEN_INDEX_START) ||
+        (code_token->type == CODE_TOKEN_ARRAY_START)
+    );
+}
+
+/*
+ * Counts the first argument (or element) of the innermost function call,
+ * index or array literal when something shows up inside it.  Later ones are
+ * counted at each comma.
+ */
+static void note_group_member(PArray *operators) {
+    for (size_t i = operators->len; i > 0; i--) {
+        CodeToken *op = parray_index_fast(operators, i - 1);
+
+        if (code_token_is_group_start(op)) {
+            if (op->arity == 0) {
+                op->arity = 1;
+            }
+
+            break;
+        }
+    }
+}
+
+/*
+ * Moves operators to the output until the innermost open group or
+ * parenthesis, which is left on the stack.  Returns false (without setting
+ * status) if that isn't a `type` token.
+ */
+static bool pop_operators_until(PArray *operators, PArray *output,
+                                                   CodeTokenType type,
+                                                   bool *found,
+                                                   Status *status) {
+    *found = false;
+
+    while (operators->len > 0) {
+        CodeToken *op = parray_index_fast(operators, operators->len - 1);
+
+        if (code_token_is_group_start(op) ||
+            ((op->type == CODE_TOKEN_OPERATOR) && (op->as.op == OP_OPAREN))) {
+            *found = op->type == type;
+            break;
+        }
+
+        if (!parray_append(output, op, status)) {
+            return false;
+        }
+
+        parray_truncate_fast(operators, operators->len - 1);
+    }
+
+    return status_ok(status);
+}
+
+/*
+ * Closes the innermost group, moving its start token to the output.
+ */
+static bool close_group(PArray *operators, PArray *output, CodeTokenType type,
+                                                           bool *found,
+                                                           Status *status) {
+    CodeToken *op = NULL;
+
+    if (!pop_operators_until(operators, output, type, found, status)) {
+        return false;
+    }
+
+    if (!*found) {
+        return status_ok(status);
+    }
+
+    op = parray_index_fast(operators, operators->len - 1);
+    parray_truncate_fast(operators, operators->len - 1);
+
+    return parray_append(output, op, status);
+}
+
 bool expression_parser_convert_to_rpn(ExpressionParser *expression_parser,
                                       Status *status) {
     /*
-     * This just runs shunting yard.  We need function arity information to go
-     * any further (fold an expression, generate instructions like LOAD, EVAL,
-     * whatever).  Folding and type checking has to happen during compilation,
-     * where functions must be available.
+     * This runs shunting yard, leaving function calls, indexes and array
+     * literals in the output after their arguments with their arity filled
+     * in.  Resolving functions, folding and type checking happen during
+     * compilation, where functions are available.
      */
 
     Array *code_tokens = &expression_parser->code_tokens;
@@ -83,222 +163,137 @@ bool expression_parser_convert_to_rpn(ExpressionParser *expression_parser,
 
     for (size_t i = 0; i < code_tokens->len; i++) {
         CodeToken *code_token = array_index_fast(code_tokens, i);
+        bool found = false;
 
-        if ((code_token->type == CODE_TOKEN_NUMBER) ||
-            (code_token->type == CODE_TOKEN_STRING)) {
-            if (!parray_append(output, code_token, status)) {
-                return false;
-            }
-        }
-        else if ((code_token->type == CODE_TOKEN_LOOKUP) ||
-                 (code_token->type == CODE_TOKEN_FUNCTION_START) ||
-                 (code_token->type == CODE_TOKEN_INDEX_START) ||
-                 (code_token->type == CODE_TOKEN_ARRAY_START)) {
-            if (!parray_append(operators, code_token, status)) {
-                return false;
-            }
-        }
-        else if (code_token->type == CODE_TOKEN_FUNCTION_ARGUMENT_END) {
-            bool found_function_start = false;
-
-            while (operators->len > 0) {
-                CodeToken *op = parray_index_fast(
-                    operators,
-                    operators->len - 1
-                );
-
-                if (op->type == CODE_TOKEN_FUNCTION_START) {
-                    found_function_start = true;
-                    break;
-                }
+        switch (code_token->type) {
+            case CODE_TOKEN_NUMBER:
+            case CODE_TOKEN_STRING:
+            case CODE_TOKEN_LOOKUP:
+                note_group_member(operators);
 
-                if (!parray_append(output, op, status)) {
+                if (!parray_append(output, code_token, status)) {
                     return false;
                 }
 
-                parray_truncate_fast(operators, operators->len - 1);
-            }
-
-            if (!found_function_start) {
-                return unexpected_comma(status);
-            }
-        }
-        else if (code_token->type == CODE_TOKEN_ARRAY_ELEMENT_END) {
-            bool found_array_start = false;
-
-            while (operators->len > 0) {
-                CodeToken *op = parray_index_fast(
-                    operators,
-                    operators->len - 1
-                );
-
-                if (op->type == CODE_TOKEN_ARRAY_START) {
-                    found_array_start = true;
-                    break;
-                }
+                break;
+            case CODE_TOKEN_FUNCTION_START:
+            case CODE_TOKEN_INDEX_START:
+            case CODE_TOKEN_ARRAY_START:
+                note_group_member(operators);
+                code_token->arity = 0;
 
-                if (!parray_append(output, op, status)) {
+                if (!parray_append(operators, code_token, status)) {
                     return false;
                 }
 
-                parray_truncate_fast(operators, operators->len - 1);
-            }
-
-            if (!found_array_start) {
-                return unexpected_comma(status);
-            }
-        }
-        else if ((code_token->type == CODE_TOKEN_OPERATOR) &&
-                 (code_token->as.op == OP_OPAREN)) {
-            if (!parray_append(operators, code_token, status)) {
-                return false;
-            }
-        }
-        else if ((code_token->type == CODE_TOKEN_OPERATOR) &&
-                 (code_token->as.op == OP_CPAREN)) {
-            bool found_open_parenthesis = false;
-
-            while (operators->len > 0) {
-                CodeToken *op = parray_index_fast(
-                    operators,
-                    operators->len - 1
-                );
-
-                if ((op->type == CODE_TOKEN_OPERATOR) &&
-                    (op->as.op == OP_OPAREN)) {
-                    found_open_parenthesis = true;
-                    parray_truncate_fast(operators, operators->len - 1);
-                    break;
-                }
-
-                if (!parray_append(output, op, status)) {
+                break;
+            case CODE_TOKEN_FUNCTION_ARGUMENT_END:
+            case CODE_TOKEN_ARRAY_ELEMENT_END:
+                if (!pop_operators_until(
+                        operators,
+                        output,
+                        code_token->type == CODE_TOKEN_ARRAY_ELEMENT_END ?
+                            CODE_TOKEN_ARRAY_START :
+                            CODE_TOKEN_FUNCTION_START,
+                        &found,
+                        status)) {
                     return false;
                 }
 
-                parray_truncate_fast(operators, operators->len - 1);
-            }
-
-            if (!found_open_parenthesis) {
-                return unmatched_parenthesis(status);
-            }
-        }
-        else if (code_token->type == CODE_TOKEN_FUNCTION_END) {
-            bool found_function_start = false;
+                if (!found) {
+                    return unexpected_comma(status);
+                }
 
-            while (operators->len > 0) {
-                CodeToken *op = parray_index_fast(
+                ((CodeToken *)parray_index_fast(
                     operators,
                     operators->len - 1
-                );
-
-                if (op->type == CODE_TOKEN_FUNCTION_START) {
-                    found_function_start = true;
-                    break;
-                }
-
-                if (!parray_append(output, op, status)) {
+                ))->arity++;
+
+                break;
+            case CODE_TOKEN_FUNCTION_END:
+                if (!close_group(operators, output,
+                                            CODE_TOKEN_FUNCTION_START,
+                                            &found,
+                                            status)) {
                     return false;
                 }
 
-                parray_truncate_fast(operators, operators->len - 1);
-            }
-
-            if (!found_function_start) {
-                return unmatched_function_end(status);
-            }
-        }
-        else if (code_token->type == CODE_TOKEN_ARRAY_END) {
-            bool found_array_start = false;
-
-            while (operators->len > 0) {
-                CodeToken *op = parray_index_fast(
-                    operators,
-                    operators->len - 1
-                );
-
-                if (op->type == CODE_TOKEN_ARRAY_START) {
-                    found_array_start = true;
-                    break;
+                if (!found) {
+                    return unmatched_function_end(status);
                 }
 
-                if (!parray_append(output, op, status)) {
+                break;
+            case CODE_TOKEN_ARRAY_END:
+                if (!close_group(operators, output, CODE_TOKEN_ARRAY_START,
+                                                    &found,
+                                                    status)) {
                     return false;
                 }
 
-                parray_truncate_fast(operators, operators->len - 1);
-            }
-
-            if (!found_array_start) {
-                return unmatched_array_end(status);
-            }
-        }
-        else if (code_token->type == CODE_TOKEN_INDEX_END) {
-            bool found_index_start = false;
-
-            while (operators->len > 0) {
-                CodeToken *op = parray_index_fast(
-                    operators,
-                    operators->len - 1
-                );
-
-                if (op->type == CODE_TOKEN_INDEX_START) {
-                    found_index_start = true;
-                    break;
+                if (!found) {
+                    return unmatched_array_end(status);
                 }
 
-                if (!parray_append(output, op, status)) {
+                break;
+            case CODE_TOKEN_INDEX_END:
+                if (!close_group(operators, output, CODE_TOKEN_INDEX_START,
+                                                    &found,
+                                                    status)) {
                     return false;
                 }
 
-                parray_truncate_fast(operators, operators->len - 1);
-            }
-
-            if (!found_index_start) {
-                return unmatched_index_end(status);
-            }
-        }
-        else {
-            while (operators->len > 0) {
-                CodeToken *op = parray_index_fast(
-                    operators,
-                    operators->len - 1
-                );
+                if (!found) {
+                    return unmatched_index_end(status);
+                }
 
-                if (op->type == CODE_TOKEN_LOOKUP) {
-                    if (!parray_append(output, op, status)) {
+                break;
+            case CODE_TOKEN_OPERATOR:
+                if (code_token->as.op == OP_CPAREN) {
+                    if (!pop_operators_until(operators, output,
+                                                        CODE_TOKEN_OPERATOR,
+                                                        &found,
+                                                        status)) {
                         return false;
                     }
 
-                    parray_truncate_fast(operators, operators->len - 1);
-
-                    break;
-                }
+                    if (!found) {
+                        return unmatched_parenthesis(status);
+                    }
 
-                if ((op->type == CODE_TOKEN_FUNCTION_START) ||
-                    (op->type == CODE_TOKEN_INDEX_START) ||
-                    (op->type == CODE_TOKEN_ARRAY_START)) {
+                    parray_truncate_fast(operators, operators->len - 1);
 
                     break;
                 }
 
-                if (code_token->type != CODE_TOKEN_OPERATOR) {
-                    return expected_operator(status);
-                }
-
-                if (op->type != CODE_TOKEN_OPERATOR) {
-                    return expected_operator(status);
-                }
+                note_group_member(operators);
+
+                /*
+                 * Prefix operators (and open parentheses) have no left
+                 * operand, so they can't cause anything to be output.
+                 */
+                while ((OperatorInfo[code_token->as.op].arity == 2) &&
+                       (operators->len > 0)) {
+                    CodeToken *op = parray_index_fast(
+                        operators,
+                        operators->len - 1
+                    );
+                    OperatorInformation *op1nfo = NULL;
+                    OperatorInformation *op2nfo = NULL;
+
+                    if ((op->type != CODE_TOKEN_OPERATOR) ||
+                        (op->as.op == OP_OPAREN)) {
+                        break;
+                    }
 
-                OperatorInformation *op1nfo = &OperatorInfo[code_token->as.op];
-                OperatorInformation *op2nfo = &OperatorInfo[op->as.op];
-                OperatorAssociativity op1_assoc = op1nfo->assoc;
-                unsigned char op1_prec = op1nfo->prec;
-                unsigned char op2_prec = op2nfo->prec;
+                    op1nfo = &OperatorInfo[code_token->as.op];
+                    op2nfo = &OperatorInfo[op->as.op];
 
-                if (((op1_assoc == OP_ASSOC_LEFT) &&
-                     (op1_prec <= op2_prec)) ||
-                    ((op1_assoc == OP_ASSOC_RIGHT) &&
-                     (op1_prec < op2_prec))) {
+                    if (!(((op1nfo->assoc == OP_ASSOC_LEFT) &&
+                           (op1nfo->prec <= op2nfo->prec)) ||
+                          ((op1nfo->assoc == OP_ASSOC_RIGHT) &&
+                           (op1nfo->prec < op2nfo->prec)))) {
+                        break;
+                    }
 
                     if (!parray_append(output, op, status)) {
                         return false;
@@ -306,23 +301,14 @@ bool expression_parser_convert_to_rpn(ExpressionParser *expression_parser,
 
                     parray_truncate_fast(operators, operators->len - 1);
                 }
-                else {
-                    break;
-                }
 
-                if (operators->len >= 1) {
-                    op = parray_index_fast(operators, operators->len - 1);
-                    if ((op->type == CODE_TOKEN_FUNCTION_START) ||
-                        (op->type == CODE_TOKEN_INDEX_START) ||
-                        (op->type == CODE_TOKEN_ARRAY_START)) {
-                        break;
-                    }
+                if (!parray_append(operators, code_token, status)) {
+                    return false;
                 }
-            }
 
-            if (!parray_append(operators, code_token, status)) {
-                return false;
-            }
+                break;
+            default:
+                return expected_operator(status);
         }
     }
 
@@ -334,6 +320,17 @@ bool expression_parser_convert_to_rpn(ExpressionParser *expression_parser,
             return extraneous_parentheses(status);
         }
 
+        switch (op->type) {
+            case CODE_TOKEN_FUNCTION_START:
+                return unmatched_function_end(status);
+            case CODE_TOKEN_INDEX_START:
+                return unmatched_index_end(status);
+            case CODE_TOKEN_ARRAY_START:
+                return unmatched_array_end(status);
+            default:
+                break;
+        }
+
         if (!parray_append(output, op, status)) {
             return false;
         }
@@ -0,0 +1,553 @@
+#include <cbase.h>
+
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "config.h"
+
+#include "value.h"
+#include "json.h"
+#include "fragment_cache.h"
+
+#define invalid_key(status) status_failure( \
+    status,                                 \
+    "fragment_cache",                       \
+    FRAGMENT_CACHE_INVALID_KEY,             \
+    "Invalid fragment cache key"            \
+)
+
+static size_t entry_key_to_hash(const void *key, size_t seed) {
+    SSlice *ss = (SSlice *)key;
+
+    return hash64(ss->data, ss->byte_len, seed);
+}
+
+static void* entry_to_key(const void *obj) {
+    return (void *)(&((FragmentCacheEntry *)obj)->key);
+}
+
+static bool entry_key_equal(const void *key1, const void *key2) {
+    SSlice *ss1 = (SSlice *)key1;
+    SSlice *ss2 = (SSlice *)key2;
+
+    return (
+        (ss1->byte_len == ss2->byte_len) &&
+        (memcmp(ss1->data, ss2->data, ss1->byte_len) == 0)
+    );
+}
+
+static uint64_t cache_now(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return ((uint64_t)now.tv_sec * 1000) + ((uint64_t)now.tv_nsec / 1000000);
+}
+
+static inline
+size_t entry_size(FragmentCacheEntry *entry) {
+    return entry->key.byte_len + entry->output.byte_len;
+}
+
+static void entry_free(FragmentCacheEntry *entry) {
+    free((char *)entry->key.data);
+    string_free(&entry->output);
+    free(entry);
+}
+
+static void cache_unlink(FragmentCache *cache, FragmentCacheEntry *entry) {
+    if (entry->prev) {
+        entry->prev->next = entry->next;
+    }
+    else {
+        cache->newest = entry->next;
+    }
+
+    if (entry->next) {
+        entry->next->prev = entry->prev;
+    }
+    else {
+        cache->oldest = entry->prev;
+    }
+
+    entry->prev = NULL;
+    entry->next = NULL;
+}
+
+static void cache_link(FragmentCache *cache, FragmentCacheEntry *entry) {
+    entry->prev = NULL;
+    entry->next = cache->newest;
+
+    if (cache->newest) {
+        cache->newest->prev = entry;
+    }
+    else {
+        cache->oldest = entry;
+    }
+
+    cache->newest = entry;
+}
+
+/*
+ * Drops `entry` from the cache, which must be locked.
+ */
+static void cache_remove(FragmentCache *cache, FragmentCacheEntry *entry) {
+    Status status;
+
+    status_init(&status);
+
+    cache_unlink(cache, entry);
+    table_remove(&cache->entries, &entry->key, &status);
+    cache->bytes -= entry_size(entry);
+    entry_free(entry);
+}
+
+static inline
+bool cache_is_full(FragmentCache *cache, size_t size) {
+    return (
+        ((cache->max_entries > 0) &&
+         (cache->entries.len >= cache->max_entries)) ||
+        ((cache->max_bytes > 0) &&
+         (cache->bytes + size > cache->max_bytes))
+    );
+}
+
+static void cache_key_slice(String *key, SSlice *slice) {
+    slice->data = key->data;
+    slice->len = key->len;
+    slice->byte_len = key->byte_len;
+}
+
+static bool fragment_cache_key_value(String *key, Value *value,
+                                                  Status *status);
+
+/*
+ * Lazy tables are materialized to iterate over them, so `value` must be a
+ * copy the caller owns, and values are copied out of their entries before
+ * they're written.
+ */
+static bool fragment_cache_key_table(String *key, Value *value,
+                                                  Status *status) {
+    ValueTableIterator entries;
+    ValueTableEntry *entry = NULL;
+    size_t length = 0;
+    char buf[32];
+
+    if ((!value_length(value, &length, status)) ||
+            (!value_table_iterator_init(&entries, value, status))) {
+        return false;
+    }
+
+    snprintf(buf, sizeof(buf), "t%zu:", length);
+
+    if (!string_append_cstr(key, buf, status)) {
+        return false;
+    }
+
+    while (value_table_iterator_next(&entries, &entry)) {
+        Value element;
+        bool ok = false;
+
+        element.type = VALUE_NONE;
+
+        ok = (
+            fragment_cache_key_value(key, &entry->key, status) &&
+            value_copy(&element, &entry->value, status) &&
+            fragment_cache_key_value(key, &element, status)
+        );
+
+        value_free(&element);
+
+        if (!ok) {
+            return false;
+        }
+    }
+
+    return status_ok(status);
+}
+
+static bool fragment_cache_key_value(String *key, Value *value,
+                                                  Status *status) {
+    const char *data = NULL;
+    char buf[32];
+    size_t length = 0;
+
+    switch (value->type) {
+        case VALUE_NONE:
+            return string_append_cstr(key, "z,", status);
+        case VALUE_BOOLEAN:
+            return string_append_cstr(key, value->as.boolean ? "b1," : "b0,",
+                                           status);
+        case VALUE_NUMBER:
+            return (
+                string_append_cstr(key, "n", status) &&
+                value_to_string(value, key, status) &&
+                string_append_cstr(key, ",", status)
+            );
+        case VALUE_STRING:
+            snprintf(buf, sizeof(buf), "s%zu:", value->as.string.byte_len);
+
+            return (
+                string_append_cstr(key, buf, status) &&
+                value_to_string(value, key, status)
+            );
+        case VALUE_JSON:
+            json_value_source(value, &data, &length);
+            snprintf(buf, sizeof(buf), "j%zu:", length);
+
+            return (
+                string_append_cstr(key, buf, status) &&
+                string_append_cstr_len(key, data, length, status)
+            );
+        case VALUE_PROVIDER:
+            return invalid_key(status);
+        default:
+            break;
+    }
+
+    if (value_is_table(value)) {
+        return fragment_cache_key_table(key, value, status);
+    }
+
+    if (!value_is_array(value)) {
+        return invalid_key(status);
+    }
+
+    if (!value_length(value, &length, status)) {
+        return false;
+    }
+
+    snprintf(buf, sizeof(buf), "a%zu:", length);
+
+    if (!string_append_cstr(key, buf, status)) {
+        return false;
+    }
+
+    for (size_t i = 0; i < length; i++) {
+        Value element;
+        bool ok = false;
+
+        element.type = VALUE_NONE;
+
+        ok = (
+            value_index(value, i, &element, status) &&
+            fragment_cache_key_value(key, &element, status)
+        );
+
+        value_free(&element);
+
+        if (!ok) {
+            return false;
+        }
+    }
+
+    return status_ok(status);
+}
+
+bool fragment_cache_init(FragmentCache *cache, size_t max_entries,
+                                               size_t max_bytes,
+                                               Status *status) {
+    if (!table_init(&cache->entries, entry_key_to_hash,
+                                     entry_to_key,
+                                     entry_key_equal,
+                                     0,
+                                     status)) {
+        return false;
+    }
+
+    if (pthread_mutex_init(&cache->lock, NULL) != 0) {
+        table_free(&cache->entries);
+        return alloc_failure(status);
+    }
+
+    cache->newest = NULL;
+    cache->oldest = NULL;
+    cache->max_entries = max_entries;
+    cache->max_bytes = max_bytes;
+    cache->ttl = 0;
+    cache->bytes = 0;
+    cache->hits = 0;
+    cache->misses = 0;
+    cache->evictions = 0;
+    cache->expirations = 0;
+
+    return status_ok(status);
+}
+
+void fragment_cache_set_ttl(FragmentCache *cache, size_t ttl) {
+    pthread_mutex_lock(&cache->lock);
+    cache->ttl = ttl;
+    pthread_mutex_unlock(&cache->lock);
+}
+
+/*
+ * Builds the key for rendering block `block` of template `template_id` with
+ * key value `value` into `key`, replacing what was there.
+ */
+bool fragment_cache_key(String *key, size_t template_id, size_t block,
+                                                         Value *value,
+                                                         Status *status) {
+    char buf[48];
+
+    string_clear(key);
+
+    snprintf(buf, sizeof(buf), "%zu|%zu|", template_id, block);
+
+    return (
+        string_append_cstr(key, buf, status) &&
+        fragment_cache_key_value(key, value, status)
+    );
+}
+
+/*
+ * Appends the value at `path` (dotted, like `site.title`) in `context` to
+ * `key`, or a marker if there isn't one.
+ */
+static bool fragment_cache_key_path(String *key, const char *path,
+                                                 Value *context,
+                                                 Status *status) {
+    const char *start = path;
+    Value values[2];
+    Value *value = context;
+    size_t current = 0;
+    bool ok = true;
+
+    values[0].type = VALUE_NONE;
+    values[1].type = VALUE_NONE;
+
+    while (ok && start) {
+        const char *dot = strchr(start, '.');
+        SSlice name;
+
+        name.data = start;
+        name.byte_len = dot ? (size_t)(dot - start) : strlen(start);
+        name.len = name.byte_len;
+        start = dot ? dot + 1 : NULL;
+
+        ok = value_lookup(value, &name, &values[current], status);
+
+        if ((!ok) && (status_match(status, "value", VALUE_KEY_NOT_FOUND) ||
+                      status_match(status, "value", VALUE_INVALID_TYPE))) {
+            value_free(&values[0]);
+            value_free(&values[1]);
+            return string_append_cstr(key, "-,", status);
+        }
+
+        value = &values[current];
+        current = 1 - current;
+        value_free(&values[current]);
+    }
+
+    ok = ok && fragment_cache_key_value(key, value, status);
+
+    value_free(&values[0]);
+    value_free(&values[1]);
+
+    return ok;
+}
+
+/*
+ * Builds the key for rendering template `template_id`, which reads `paths`,
+ * with `context` into `key`, replacing what was there.  The values are
+ * written out into `key` first, then replaced with their hash.
+ */
+bool fragment_cache_render_key(String *key, size_t template_id,
+                                            PArray *paths,
+                                            Value *context,
+                                            Status *status) {
+    char buf[64];
+    size_t hashes[2];
+
+    string_clear(key);
+
+    for (size_t i = 0; i < paths->len; i++) {
+        if (!fragment_cache_key_path(key, parray_index_fast(paths, i),
+                                          context,
+                                          status)) {
+            return false;
+        }
+    }
+
+    hashes[0] = hash64(key->data, key->byte_len, 0);
+    hashes[1] = hash64(key->data, key->byte_len, hashes[0]);
+
+    snprintf(buf, sizeof(buf), "%zu|r|%016llx%016llx",
+             template_id,
+             (unsigned long long)hashes[0],
+             (unsigned long long)hashes[1]);
+
+    string_clear(key);
+
+    return string_append_cstr(key, buf, status);
+}
+
+/*
+ * Appends the output stored for `key`, if there is any, to `output`, setting
+ * `found` accordingly.  It's copied with the cache locked, since another
+ * thread may evict it as soon as it's unlocked.
+ */
+bool fragment_cache_get(FragmentCache *cache, String *key, String *output,
+                                                           bool *found,
+                                                           Status *status) {
+    FragmentCacheEntry *entry = NULL;
+    SSlice slice;
+    bool ok = true;
+
+    cache_key_slice(key, &slice);
+
+    pthread_mutex_lock(&cache->lock);
+
+    *found = table_lookup(&cache->entries, &slice, (void **)&entry, status);
+
+    if ((!*found) && (!status_match(status, "base", ERROR_NOT_FOUND))) {
+        ok = false;
+    }
+    else if (*found && (entry->expires > 0) &&
+                       (entry->expires <= cache_now())) {
+        cache_remove(cache, entry);
+        cache->expirations++;
+        *found = false;
+    }
+
+    if (*found) {
+        cache->hits++;
+        cache_unlink(cache, entry);
+        cache_link(cache, entry);
+        ok = string_append_cstr_full(output, entry->output.data,
+                                             entry->output.len,
+                                             entry->output.byte_len,
+                                             status);
+    }
+    else if (ok) {
+        cache->misses++;
+    }
+
+    pthread_mutex_unlock(&cache->lock);
+
+    if (!ok) {
+        return false;
+    }
+
+    return status_ok(status);
+}
+
+/*
+ * Stores `byte_len` bytes (`len` runes) of output at `data` under `key`,
+ * replacing whatever was stored there.  The entry is built before locking
+ * the cache.
+ */
+bool fragment_cache_put(FragmentCache *cache, String *key, const char *data,
+                                                           size_t len,
+                                                           size_t byte_len,
+                                                           Status *status) {
+    FragmentCacheEntry *entry = NULL;
+    FragmentCacheEntry *existing = NULL;
+    char *key_data = NULL;
+    size_t size = key->byte_len + byte_len;
+    bool ok = true;
+
+    if ((cache->max_bytes > 0) && (size > cache->max_bytes)) {
+        return status_ok(status);
+    }
+
+    entry = malloc(sizeof(FragmentCacheEntry));
+
+    if (!entry) {
+        return alloc_failure(status);
+    }
+
+    key_data = malloc(key->byte_len);
+
+    if (!key_data) {
+        free(entry);
+        return alloc_failure(status);
+    }
+
+    memcpy(key_data, key->data, key->byte_len);
+
+    entry->key.data = key_data;
+    entry->key.len = key->len;
+    entry->key.byte_len = key->byte_len;
+    entry->expires = 0;
+    entry->prev = NULL;
+    entry->next = NULL;
+
+    if (!string_init(&entry->output, "", status)) {
+        free(key_data);
+        free(entry);
+        return false;
+    }
+
+    if (!string_append_cstr_full(&entry->output, data, len, byte_len,
+                                                            status)) {
+        entry_free(entry);
+        return false;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+
+    if (cache->ttl > 0) {
+        entry->expires = cache_now() + cache->ttl;
+    }
+
+    if (table_lookup(&cache->entries, &entry->key, (void **)&existing,
+                                                   status)) {
+        cache_remove(cache, existing);
+    }
+
+    while (cache->oldest && cache_is_full(cache, size)) {
+        cache_remove(cache, cache->oldest);
+        cache->evictions++;
+    }
+
+    ok = table_insert(&cache->entries, entry, status);
+
+    if (ok) {
+        cache_link(cache, entry);
+        cache->bytes += size;
+    }
+
+    pthread_mutex_unlock(&cache->lock);
+
+    if (!ok) {
+        entry_free(entry);
+        return false;
+    }
+
+    return status_ok(status);
+}
+
+void fragment_cache_stats(FragmentCache *cache, FragmentCacheStats *stats) {
+    pthread_mutex_lock(&cache->lock);
+    stats->entries = cache->entries.len;
+    stats->bytes = cache->bytes;
+    stats->hits = cache->hits;
+    stats->misses = cache->misses;
+    stats->evictions = cache->evictions;
+    stats->expirations = cache->expirations;
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void fragment_cache_clear(FragmentCache *cache) {
+    pthread_mutex_lock(&cache->lock);
+
+    while (cache->oldest) {
+        cache_remove(cache, cache->oldest);
+    }
+
+    cache->hits = 0;
+    cache->misses = 0;
+    cache->evictions = 0;
+    cache->expirations = 0;
+
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void fragment_cache_free(FragmentCache *cache) {
+    fragment_cache_clear(cache);
+    table_free(&cache->entries);
+    pthread_mutex_destroy(&cache->lock);
+}
+
+/* vi: set et ts=4 sw=4: */
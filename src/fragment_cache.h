@@ -0,0 +1,108 @@
+#ifndef FRAGMENT_CACHE_H__
+#define FRAGMENT_CACHE_H__
+
+enum {
+    FRAGMENT_CACHE_INVALID_KEY = 1,
+};
+
+/*
+ * A fragment cache holds rendered output, so that rendering the same thing
+ * again copies the bytes saved the first time instead.  It backs
+ * `{{ cache key }} ... {{ endcache }}` blocks (see
+ * template_set_fragment_cache) and whole renders (see
+ * template_set_render_cache).
+ *
+ * Block entries are keyed by the template (its `id`, see template.h), the
+ * block (its CACHE node's index) and the key's value, which must be null,
+ * a boolean, a number, a string, or an array or table of those; anything
+ * else fails with FRAGMENT_CACHE_INVALID_KEY.  Numbers are keyed by their
+ * exact representation, as in the evaluator's memo, and tables by their
+ * entries in iteration order.  Everything the body outputs should be
+ * determined by the key: a cached block is never re-rendered because some
+ * other value it reads changed.
+ *
+ * Whole renders are keyed by the template and a fingerprint of the context:
+ * a 128-bit hash of the values at the context paths the template reads
+ * (`reads`, see template.h), encoded like block keys, with missing paths
+ * marked as such.  Lazy JSON values are hashed as their source text, so
+ * they're never materialized for it.  A path whose value is a provider
+ * can't be fingerprinted, since its entries aren't known until they're
+ * looked up, so fragment_cache_render_key fails with
+ * FRAGMENT_CACHE_INVALID_KEY and the template is rendered uncached.
+ *
+ * The cache is bounded by `max_entries` and `max_bytes` (keys and output
+ * together), either of which may be 0 for no limit.  Storing an entry evicts
+ * the least recently used ones until it fits; output that couldn't fit in
+ * an empty cache isn't stored at all.  Every operation takes the cache's
+ * lock, so it may be shared by any number of templates and threads at once.
+ * A block's body is rendered without the lock held, so two threads missing
+ * the same key at once both render it, and the last to finish stores it.
+ *
+ * With fragment_cache_set_ttl, entries expire `ttl` milliseconds after
+ * they're stored; an expired entry is dropped (and counted as a miss) when
+ * it's next looked up, or evicted as usual before then.
+ *
+ * fragment_cache_stats reads the counters, which cover lookups since the
+ * cache was initialized or cleared: the hit rate is `hits` over `hits` plus
+ * `misses`.  `evictions` counts entries dropped to make room.
+ */
+
+typedef struct FragmentCacheEntry {
+    SSlice key;
+    String output;
+    uint64_t expires;
+    struct FragmentCacheEntry *prev;
+    struct FragmentCacheEntry *next;
+} FragmentCacheEntry;
+
+struct FragmentCache {
+    pthread_mutex_t lock;
+    Table entries;
+    FragmentCacheEntry *newest;
+    FragmentCacheEntry *oldest;
+    size_t max_entries;
+    size_t max_bytes;
+    size_t ttl;
+    size_t bytes;
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+    size_t expirations;
+};
+
+typedef struct FragmentCache FragmentCache;
+
+typedef struct {
+    size_t entries;
+    size_t bytes;
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+    size_t expirations;
+} FragmentCacheStats;
+
+bool fragment_cache_init(FragmentCache *cache, size_t max_entries,
+                                               size_t max_bytes,
+                                               Status *status);
+void fragment_cache_set_ttl(FragmentCache *cache, size_t ttl);
+bool fragment_cache_key(String *key, size_t template_id, size_t block,
+                                                         Value *value,
+                                                         Status *status);
+bool fragment_cache_render_key(String *key, size_t template_id,
+                                            PArray *paths,
+                                            Value *context,
+                                            Status *status);
+bool fragment_cache_get(FragmentCache *cache, String *key, String *output,
+                                                           bool *found,
+                                                           Status *status);
+bool fragment_cache_put(FragmentCache *cache, String *key, const char *data,
+                                                           size_t len,
+                                                           size_t byte_len,
+                                                           Status *status);
+void fragment_cache_stats(FragmentCache *cache, FragmentCacheStats *stats);
+void fragment_cache_clear(FragmentCache *cache);
+void fragment_cache_free(FragmentCache *cache);
+
+#endif
+
+/* vi: set et ts=4 sw=4: */
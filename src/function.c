@@ -0,0 +1,234 @@
+#include <cbase.h>
+
+#include "config.h"
+#include "utils.h"
+#include "value.h"
+#include "function.h"
+
+#define invalid_argument_types(status) status_failure( \
+    status,                                            \
+    "function",                                        \
+    FUNCTION_INVALID_ARGUMENT_TYPES,                   \
+    "Invalid function argument types"                  \
+)
+
+#define already_registered(status) status_failure( \
+    status,                                        \
+    "function",                                    \
+    FUNCTION_ALREADY_REGISTERED,                   \
+    "Function already registered"                  \
+)
+
+#define wrong_argument_type(status) status_failure( \
+    status,                                         \
+    "function",                                     \
+    FUNCTION_WRONG_ARGUMENT_TYPE,                   \
+    "Wrong function argument type"                  \
+)
+
+static size_t key_to_hash(const void *key, size_t seed) {
+    SSlice *ss = (SSlice *)key;
+
+    return hash64(ss->data, ss->byte_len, seed);
+}
+
+static void* entry_to_key(const void *obj) {
+    return (void *)(&((FunctionEntry *)obj)->name);
+}
+
+static bool key_equal(const void *key1, const void *key2) {
+    SSlice *ss1 = (SSlice *)key1;
+    SSlice *ss2 = (SSlice *)key2;
+
+    return (
+        (ss1->byte_len == ss2->byte_len) &&
+        (memcmp(ss1->data, ss2->data, ss1->byte_len) == 0)
+    );
+}
+
+static bool argument_types_valid(unsigned int arity,
+                                 const char *argument_types) {
+    if (strlen(argument_types) != arity) {
+        return false;
+    }
+
+    for (unsigned int i = 0; i < arity; i++) {
+        switch (argument_types[i]) {
+            case 'b':
+            case 'n':
+            case 's':
+            case 'a':
+            case 't':
+            case '*':
+                break;
+            default:
+                return false;
+        }
+    }
+
+    return true;
+}
+
+bool function_registry_init(FunctionRegistry *registry, Status *status) {
+    return table_init(&registry->functions, key_to_hash,
+                                            entry_to_key,
+                                            key_equal,
+                                            0,
+                                            status);
+}
+
+static bool registry_add(FunctionRegistry *registry,
+                         const char *name,
+                         unsigned int arity,
+                         const char *argument_types,
+                         FunctionCallback *callback,
+                         bool pure,
+                         Status *status) {
+    FunctionEntry *entry = NULL;
+    SSlice key;
+
+    if (!argument_types_valid(arity, argument_types)) {
+        return invalid_argument_types(status);
+    }
+
+    key.data = name;
+    key.len = strlen(name);
+    key.byte_len = key.len;
+
+    if (table_lookup(&registry->functions, &key, (void **)&entry, status)) {
+        return already_registered(status);
+    }
+
+    if (!status_match(status, "base", ERROR_NOT_FOUND)) {
+        return false;
+    }
+
+    entry = malloc(sizeof(FunctionEntry));
+
+    if (!entry) {
+        return alloc_failure(status);
+    }
+
+    entry->name.data = strdup(name);
+
+    if (!entry->name.data) {
+        free(entry);
+        return alloc_failure(status);
+    }
+
+    entry->name.len = utf8_rune_count(name, key.byte_len);
+    entry->name.byte_len = key.byte_len;
+    entry->signature.arity = arity;
+    entry->signature.argument_types = argument_types;
+    entry->callback = callback;
+    entry->pure = pure;
+    entry->memoized = pure;
+
+    if (!table_insert(&registry->functions, entry, status)) {
+        free((char *)entry->name.data);
+        free(entry);
+        return false;
+    }
+
+    return status_ok(status);
+}
+
+bool function_registry_add(FunctionRegistry *registry,
+                           const char *name,
+                           unsigned int arity,
+                           const char *argument_types,
+                           FunctionCallback *callback,
+                           Status *status) {
+    return registry_add(registry, name, arity, argument_types, callback,
+                                                               false,
+                                                               status);
+}
+
+bool function_registry_add_pure(FunctionRegistry *registry,
+                                const char *name,
+                                unsigned int arity,
+                                const char *argument_types,
+                                FunctionCallback *callback,
+                                Status *status) {
+    return registry_add(registry, name, arity, argument_types, callback,
+                                                               true,
+                                                               status);
+}
+
+bool function_registry_set_memoized(FunctionRegistry *registry,
+                                    const char *name,
+                                    bool memoized,
+                                    Status *status) {
+    FunctionEntry *entry = NULL;
+    SSlice key;
+
+    key.data = name;
+    key.len = strlen(name);
+    key.byte_len = key.len;
+
+    if (!table_lookup(&registry->functions, &key, (void **)&entry, status)) {
+        return false;
+    }
+
+    entry->memoized = memoized;
+
+    return status_ok(status);
+}
+
+bool function_registry_lookup(FunctionRegistry *registry,
+                              SSlice *name,
+                              FunctionEntry **entry,
+                              Status *status) {
+    return table_lookup(&registry->functions, name, (void **)entry, status);
+}
+
+void function_registry_free(FunctionRegistry *registry) {
+    TableIterator iter;
+    FunctionEntry *entry = NULL;
+
+    table_iterator_init(&iter, &registry->functions);
+
+    while (table_iterator_next(&iter, (void **)&entry)) {
+        free((char *)entry->name.data);
+        free(entry);
+    }
+
+    table_free(&registry->functions);
+}
+
+bool function_check_arguments(FunctionEntry *entry, Value *arguments,
+                                                    Status *status) {
+    for (unsigned int i = 0; i < entry->signature.arity; i++) {
+        Value *argument = &arguments[i];
+        bool valid = false;
+
+        switch (entry->signature.argument_types[i]) {
+            case 'b':
+                valid = argument->type == VALUE_BOOLEAN;
+                break;
+            case 'n':
+                valid = argument->type == VALUE_NUMBER;
+                break;
+            case 's':
+                valid = argument->type == VALUE_STRING;
+                break;
+            case 'a':
+                valid = value_is_array(argument);
+                break;
+            case 't':
+                valid = value_is_table(argument);
+                break;
+            default:
+                valid = true;
+                break;
+        }
+
+        if (!valid) {
+            return wrong_argument_type(status);
+        }
+    }
+
+    return status_ok(status);
+}
+
+/* vi: set et ts=4 sw=4: */
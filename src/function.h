@@ -0,0 +1,86 @@
+#ifndef FUNCTION_H__
+#define FUNCTION_H__
+
+enum {
+    FUNCTION_INVALID_ARGUMENT_TYPES = 1,
+    FUNCTION_ALREADY_REGISTERED,
+    FUNCTION_WRONG_ARGUMENT_TYPE,
+};
+
+/*
+ * Functions callable from templates are registered by the host (along with
+ * SST's builtins) in a FunctionRegistry.  Each has a fixed arity and a
+ * signature string with one character per argument:
+ *
+ *   'b': boolean
+ *   'n': number
+ *   's': string
+ *   'a': array (including lazy arrays)
+ *   't': table (including lazy tables and providers)
+ *   '*': anything
+ *
+ * The name is copied, but the signature string isn't (it's normally a
+ * literal).
+ *
+ * Templates resolve function names when they're compiled, checking arity
+ * then, so a call at render time is an argument type check and a call
+ * through the entry's function pointer.  Compiled templates point into the
+ * registry, so it must outlive them and mustn't change while they're in use.
+ *
+ * A callback receives its arguments as a contiguous array of `arity` Values
+ * (which it must not free) and stores its result in `result`, which starts
+ * out as VALUE_NONE.
+ *
+ * Functions added with function_registry_add_pure promise that their result
+ * depends only on their arguments, so the evaluator may answer repeated
+ * calls with the same (boolean, number or string) arguments from its memo
+ * instead of calling them again.  Pure functions cheaper than a memo lookup
+ * can opt out of that with function_registry_set_memoized, and still count
+ * as pure otherwise (for parallel loops, say).
+ */
+
+typedef bool (FunctionCallback)(Value *result, Value *arguments,
+                                               DecimalContext *ctx,
+                                               Status *status);
+
+typedef struct {
+    SSlice name;
+    Function signature;
+    FunctionCallback *callback;
+    bool pure;
+    bool memoized;
+} FunctionEntry;
+
+typedef struct {
+    Table functions;
+} FunctionRegistry;
+
+bool function_registry_init(FunctionRegistry *registry, Status *status);
+bool function_registry_add(FunctionRegistry *registry,
+                           const char *name,
+                           unsigned int arity,
+                           const char *argument_types,
+                           FunctionCallback *callback,
+                           Status *status);
+bool function_registry_add_pure(FunctionRegistry *registry,
+                                const char *name,
+                                unsigned int arity,
+                                const char *argument_types,
+                                FunctionCallback *callback,
+                                Status *status);
+bool function_registry_set_memoized(FunctionRegistry *registry,
+                                    const char *name,
+                                    bool memoized,
+                                    Status *status);
+bool function_registry_lookup(FunctionRegistry *registry,
+                              SSlice *name,
+                              FunctionEntry **entry,
+                              Status *status);
+void function_registry_free(FunctionRegistry *registry);
+
+bool function_check_arguments(FunctionEntry *entry, Value *arguments,
+                                                    Status *status);
+
+#endif
+
+/* vi: set et ts=4 sw=4: */
@@ -0,0 +1,1845 @@
+#include <cbase.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__SSE2__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "config.h"
+#include "refcount.h"
+#include "utils.h"
+#include "value.h"
+#include "json.h"
+
+#define JSON_INIT_CONTAINER_ALLOC 32
+#define JSON_INIT_INDEX_ALLOC 64
+#define JSON_NUMBER_BUF_SIZE 128
+
+#define unexpected_eof(status) status_failure( \
+    status,                                    \
+    "json",                                    \
+    JSON_UNEXPECTED_EOF,                       \
+    "Unexpected EOF"                           \
+)
+
+#define invalid_syntax(status) status_failure( \
+    status,                                    \
+    "json",                                    \
+    JSON_INVALID_SYNTAX,                       \
+    "Invalid syntax"                           \
+)
+
+#define invalid_number(status) status_failure( \
+    status,                                    \
+    "json",                                    \
+    JSON_INVALID_NUMBER,                       \
+    "Invalid number"                           \
+)
+
+#define invalid_string(status) status_failure( \
+    status,                                    \
+    "json",                                    \
+    JSON_INVALID_STRING,                       \
+    "Invalid string"                           \
+)
+
+#define invalid_escape(status) status_failure( \
+    status,                                    \
+    "json",                                    \
+    JSON_INVALID_ESCAPE,                       \
+    "Invalid escape sequence"                  \
+)
+
+#define trailing_data(status) status_failure( \
+    status,                                   \
+    "json",                                   \
+    JSON_TRAILING_DATA,                       \
+    "Trailing data after JSON value"          \
+)
+
+#define opening_file_failed(status) status_failure( \
+    status,                                         \
+    "json",                                         \
+    JSON_OPENING_FILE_FAILED,                       \
+    "Opening file failed"                           \
+)
+
+#define reading_file_failed(status) status_failure( \
+    status,                                         \
+    "json",                                         \
+    JSON_READING_FILE_FAILED,                       \
+    "Reading file failed"                           \
+)
+
+#define mismatched_brackets(status) status_failure( \
+    status,                                         \
+    "json",                                         \
+    JSON_MISMATCHED_BRACKETS,                       \
+    "Mismatched brackets"                           \
+)
+
+static inline
+bool json_is_digit(char c) {
+    return (c >= '0') && (c <= '9');
+}
+
+static inline
+void json_skip_whitespace(JSONParser *parser) {
+    while (parser->cursor < parser->end) {
+        switch (*parser->cursor) {
+            case ' ':
+            case '\t':
+            case '\n':
+            case '\r':
+                parser->cursor++;
+                break;
+            default:
+                return;
+        }
+    }
+}
+
+/*
+ * Returns the first byte in [cursor, end) that ends a run of plain string
+ * data: a quote, a backslash or a control character.  Returns `end` if there
+ * isn't one.  Strings are almost entirely plain data, so this checks 32 (AVX2)
+ * or 16 (SSE2) bytes at a time.
+ */
+static inline
+const char* json_find_string_special(const char *cursor, const char *end) {
+#if defined(__AVX2__)
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i control = _mm256_set1_epi8(0x1F);
+
+    while ((end - cursor) >= 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)cursor);
+        __m256i specials = _mm256_or_si256(
+            _mm256_or_si256(
+                _mm256_cmpeq_epi8(chunk, quote),
+                _mm256_cmpeq_epi8(chunk, backslash)
+            ),
+            _mm256_cmpeq_epi8(_mm256_max_epu8(chunk, control), control)
+        );
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(specials);
+
+        if (mask) {
+            return cursor + __builtin_ctz(mask);
+        }
+
+        cursor += 32;
+    }
+#endif
+
+#if defined(__SSE2__)
+    const __m128i quote16 = _mm_set1_epi8('"');
+    const __m128i backslash16 = _mm_set1_epi8('\\');
+    const __m128i control16 = _mm_set1_epi8(0x1F);
+
+    while ((end - cursor) >= 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)cursor);
+        __m128i specials = _mm_or_si128(
+            _mm_or_si128(
+                _mm_cmpeq_epi8(chunk, quote16),
+                _mm_cmpeq_epi8(chunk, backslash16)
+            ),
+            _mm_cmpeq_epi8(_mm_max_epu8(chunk, control16), control16)
+        );
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(specials);
+
+        if (mask) {
+            return cursor + __builtin_ctz(mask);
+        }
+
+        cursor += 16;
+    }
+#endif
+
+    while (cursor < end) {
+        unsigned char c = (unsigned char)*cursor;
+
+        if ((c == '"') || (c == '\\') || (c < 0x20)) {
+            return cursor;
+        }
+
+        cursor++;
+    }
+
+    return end;
+}
+
+static
+bool json_read_hex4(const char *cursor, const char *end,
+                                        uint32_t *code_point) {
+    uint32_t cp = 0;
+
+    if ((end - cursor) < 4) {
+        return false;
+    }
+
+    for (size_t i = 0; i < 4; i++) {
+        char c = cursor[i];
+
+        cp <<= 4;
+
+        if (json_is_digit(c)) {
+            cp |= (uint32_t)(c - '0');
+        }
+        else if ((c >= 'a') && (c <= 'f')) {
+            cp |= (uint32_t)(c - 'a' + 10);
+        }
+        else if ((c >= 'A') && (c <= 'F')) {
+            cp |= (uint32_t)(c - 'A' + 10);
+        }
+        else {
+            return false;
+        }
+    }
+
+    *code_point = cp;
+
+    return true;
+}
+
+static
+size_t json_encode_utf8(uint32_t cp, char *buf) {
+    if (cp < 0x80) {
+        buf[0] = (char)cp;
+        return 1;
+    }
+
+    if (cp < 0x800) {
+        buf[0] = (char)(0xC0 | (cp >> 6));
+        buf[1] = (char)(0x80 | (cp & 0x3F));
+        return 2;
+    }
+
+    if (cp < 0x10000) {
+        buf[0] = (char)(0xE0 | (cp >> 12));
+        buf[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        buf[2] = (char)(0x80 | (cp & 0x3F));
+        return 3;
+    }
+
+    buf[0] = (char)(0xF0 | (cp >> 18));
+    buf[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+    buf[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+    buf[3] = (char)(0x80 | (cp & 0x3F));
+
+    return 4;
+}
+
+/*
+ * Parses the string starting at the cursor (which must be on the opening
+ * quote).  Strings without escapes are returned as a slice of the input;
+ * otherwise they're decoded into the parser's scratch buffer, which is only
+ * valid until the next string is parsed.
+ */
+static
+bool json_parse_string(JSONParser *parser, SSlice *string, Status *status) {
+    const char *start = parser->cursor + 1;
+    const char *end = parser->end;
+    const char *cursor = json_find_string_special(start, end);
+
+    if (cursor == end) {
+        return unexpected_eof(status);
+    }
+
+    if (*cursor == '"') {
+        string->data = start;
+        string->byte_len = (size_t)(cursor - start);
+        string->len = utf8_rune_count(start, string->byte_len);
+        parser->cursor = cursor + 1;
+
+        return status_ok(status);
+    }
+
+    string_clear(&parser->scratch);
+
+    if (!string_append_cstr_len(&parser->scratch, start,
+                                                  (size_t)(cursor - start),
+                                                  status)) {
+        return false;
+    }
+
+    while (*cursor != '"') {
+        char escaped[4];
+        size_t escaped_len = 1;
+        const char *run = NULL;
+        uint32_t cp = 0;
+        uint32_t low = 0;
+
+        if (((unsigned char)*cursor) < 0x20) {
+            return invalid_string(status);
+        }
+
+        cursor++;
+
+        if (cursor >= end) {
+            return unexpected_eof(status);
+        }
+
+        switch (*cursor) {
+            case '"':
+            case '\\':
+            case '/':
+                escaped[0] = *cursor;
+                break;
+            case 'b':
+                escaped[0] = '\b';
+                break;
+            case 'f':
+                escaped[0] = '\f';
+                break;
+            case 'n':
+                escaped[0] = '\n';
+                break;
+            case 'r':
+                escaped[0] = '\r';
+                break;
+            case 't':
+                escaped[0] = '\t';
+                break;
+            case 'u':
+                if (!json_read_hex4(cursor + 1, end, &cp)) {
+                    return invalid_escape(status);
+                }
+
+                cursor += 4;
+
+                if ((cp >= 0xD800) && (cp <= 0xDBFF)) {
+                    if (((end - cursor) < 7) ||
+                            (cursor[1] != '\\') ||
+                            (cursor[2] != 'u') ||
+                            (!json_read_hex4(cursor + 3, end, &low)) ||
+                            (low < 0xDC00) ||
+                            (low > 0xDFFF)) {
+                        return invalid_escape(status);
+                    }
+
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                    cursor += 6;
+                }
+                else if ((cp >= 0xDC00) && (cp <= 0xDFFF)) {
+                    return invalid_escape(status);
+                }
+
+                escaped_len = json_encode_utf8(cp, escaped);
+                break;
+            default:
+                return invalid_escape(status);
+        }
+
+        cursor++;
+
+        if (!string_append_cstr_len(&parser->scratch, escaped, escaped_len,
+                                                               status)) {
+            return false;
+        }
+
+        run = cursor;
+        cursor = json_find_string_special(cursor, end);
+
+        if (cursor == end) {
+            return unexpected_eof(status);
+        }
+
+        if (!string_append_cstr_len(&parser->scratch, run,
+                                                      (size_t)(cursor - run),
+                                                      status)) {
+            return false;
+        }
+    }
+
+    string->data = parser->scratch.data;
+    string->byte_len = parser->scratch.byte_len;
+    string->len = utf8_rune_count(string->data, string->byte_len);
+    parser->cursor = cursor + 1;
+
+    return status_ok(status);
+}
+
+/*
+ * Validates the number at the cursor against the JSON grammar, then hands its
+ * text directly to the decimal library; it never passes through a double.
+ * Only the cursor, end and ctx of `parser` are used.
+ */
+static
+bool json_parse_number(JSONParser *parser, Value *value, Status *status) {
+    const char *start = parser->cursor;
+    const char *cursor = start;
+    const char *end = parser->end;
+    char buf[JSON_NUMBER_BUF_SIZE];
+    char *num = buf;
+    size_t len = 0;
+
+    if ((cursor < end) && (*cursor == '-')) {
+        cursor++;
+    }
+
+    if (cursor >= end) {
+        return invalid_number(status);
+    }
+
+    if (*cursor == '0') {
+        cursor++;
+
+        if ((cursor < end) && json_is_digit(*cursor)) {
+            return invalid_number(status);
+        }
+    }
+    else if (json_is_digit(*cursor)) {
+        while ((cursor < end) && json_is_digit(*cursor)) {
+            cursor++;
+        }
+    }
+    else {
+        return invalid_number(status);
+    }
+
+    if ((cursor < end) && (*cursor == '.')) {
+        cursor++;
+
+        if ((cursor >= end) || (!json_is_digit(*cursor))) {
+            return invalid_number(status);
+        }
+
+        while ((cursor < end) && json_is_digit(*cursor)) {
+            cursor++;
+        }
+    }
+
+    if ((cursor < end) && ((*cursor == 'e') || (*cursor == 'E'))) {
+        cursor++;
+
+        if ((cursor < end) && ((*cursor == '+') || (*cursor == '-'))) {
+            cursor++;
+        }
+
+        if ((cursor >= end) || (!json_is_digit(*cursor))) {
+            return invalid_number(status);
+        }
+
+        while ((cursor < end) && json_is_digit(*cursor)) {
+            cursor++;
+        }
+    }
+
+    len = (size_t)(cursor - start);
+
+    if (len >= sizeof(buf)) {
+        num = malloc(len + 1);
+
+        if (!num) {
+            return alloc_failure(status);
+        }
+    }
+
+    memcpy(num, start, len);
+    num[len] = '\0';
+
+    if (!value_init_number(value, num, parser->ctx, status)) {
+        if (num != buf) {
+            free(num);
+        }
+
+        value->type = VALUE_NONE;
+        return false;
+    }
+
+    if (num != buf) {
+        free(num);
+    }
+
+    parser->cursor = cursor;
+
+    return status_ok(status);
+}
+
+static
+bool json_init_string(JSONParser *parser, Value *value, SSlice *string,
+                                                        Status *status) {
+    Value *interned = NULL;
+
+    if (string->byte_len <= VALUE_INLINE_STRING_MAX) {
+        return value_init_string_from_sslice(value, string, status);
+    }
+
+    value->type = VALUE_NONE;
+
+    if (value_lookup(&parser->interner, string, value, status)) {
+        return status_ok(status);
+    }
+
+    if (!status_match(status, "value", VALUE_KEY_NOT_FOUND)) {
+        return false;
+    }
+
+    if (!value_init_string_from_sslice(value, string, status)) {
+        return false;
+    }
+
+    if (!value_table_insert_key(&parser->interner, value, &interned,
+                                                          status)) {
+        return false;
+    }
+
+    return value_copy(interned, value, status);
+}
+
+static
+bool json_parse_literal(JSONParser *parser, const char *literal,
+                                            size_t len,
+                                            Status *status) {
+    if ((((size_t)(parser->end - parser->cursor)) < len) ||
+            (memcmp(parser->cursor, literal, len) != 0)) {
+        return invalid_syntax(status);
+    }
+
+    parser->cursor += len;
+
+    return status_ok(status);
+}
+
+static
+bool json_parse_value(JSONParser *parser, Value *value, Status *status) {
+    SSlice string;
+
+    json_skip_whitespace(parser);
+
+    if (parser->cursor >= parser->end) {
+        return unexpected_eof(status);
+    }
+
+    switch (*parser->cursor) {
+        case '{':
+            parser->cursor++;
+
+            if (!value_init_ordered_table(value, status)) {
+                return false;
+            }
+
+            return parray_append(&parser->containers, value, status);
+        case '[':
+            parser->cursor++;
+
+            if (!value_init_array(value, status)) {
+                return false;
+            }
+
+            return parray_append(&parser->containers, value, status);
+        case '"':
+            if (!json_parse_string(parser, &string, status)) {
+                return false;
+            }
+
+            return json_init_string(parser, value, &string, status);
+        case 't':
+            if (!json_parse_literal(parser, "true", 4, status)) {
+                return false;
+            }
+
+            value_init_boolean(value, true);
+
+            return status_ok(status);
+        case 'f':
+            if (!json_parse_literal(parser, "false", 5, status)) {
+                return false;
+            }
+
+            value_init_boolean(value, false);
+
+            return status_ok(status);
+        case 'n':
+            if (!json_parse_literal(parser, "null", 4, status)) {
+                return false;
+            }
+
+            value->type = VALUE_NONE;
+
+            return status_ok(status);
+        default:
+            if ((*parser->cursor == '-') || json_is_digit(*parser->cursor)) {
+                return json_parse_number(parser, value, status);
+            }
+
+            return invalid_syntax(status);
+    }
+}
+
+/*
+ * Makes room for the next member of `container`: appends an element to an
+ * array, or parses a key and inserts it into a table.
+ */
+static
+bool json_next_member(JSONParser *parser, Value *container, Value **slot,
+                                                            Status *status) {
+    SSlice key;
+
+    if (container->type == VALUE_ARRAY) {
+        return value_array_append(container, slot, status);
+    }
+
+    json_skip_whitespace(parser);
+
+    if (parser->cursor >= parser->end) {
+        return unexpected_eof(status);
+    }
+
+    if (*parser->cursor != '"') {
+        return invalid_syntax(status);
+    }
+
+    if (!json_parse_string(parser, &key, status)) {
+        return false;
+    }
+
+    json_skip_whitespace(parser);
+
+    if (parser->cursor >= parser->end) {
+        return unexpected_eof(status);
+    }
+
+    if (*parser->cursor != ':') {
+        return invalid_syntax(status);
+    }
+
+    parser->cursor++;
+
+    if (key.byte_len > VALUE_INLINE_STRING_MAX) {
+        Value key_value;
+
+        if (!json_init_string(parser, &key_value, &key, status)) {
+            return false;
+        }
+
+        if (!value_table_insert_key(container, &key_value, slot, status)) {
+            value_free(&key_value);
+            return false;
+        }
+
+        value_free(&key_value);
+    }
+    else if (!value_table_insert(container, &key, slot, status)) {
+        return false;
+    }
+
+    /* Duplicate keys: the last one wins. */
+    value_free(*slot);
+
+    return status_ok(status);
+}
+
+/*
+ * Called after `value` has been parsed (or opened, if it's a container).
+ * Consumes separators and closing brackets and returns the next slot to parse
+ * into, or NULL once the document is complete.
+ */
+static
+bool json_advance(JSONParser *parser, Value *value, Value **slot,
+                                                    Status *status) {
+    PArray *containers = &parser->containers;
+
+    if ((containers->len > 0) &&
+            (parray_index_fast(containers, containers->len - 1) == value)) {
+        char close = value->type == VALUE_TABLE ? '}' : ']';
+
+        json_skip_whitespace(parser);
+
+        if ((parser->cursor >= parser->end) || (*parser->cursor != close)) {
+            return json_next_member(parser, value, slot, status);
+        }
+
+        parser->cursor++;
+        parray_truncate_fast(containers, containers->len - 1);
+    }
+
+    while (containers->len > 0) {
+        Value *container = parray_index_fast(
+            containers,
+            containers->len - 1
+        );
+        char close = container->type == VALUE_TABLE ? '}' : ']';
+
+        json_skip_whitespace(parser);
+
+        if (parser->cursor >= parser->end) {
+            return unexpected_eof(status);
+        }
+
+        if (*parser->cursor == ',') {
+            parser->cursor++;
+            return json_next_member(parser, container, slot, status);
+        }
+
+        if (*parser->cursor != close) {
+            return invalid_syntax(status);
+        }
+
+        parser->cursor++;
+        parray_truncate_fast(containers, containers->len - 1);
+    }
+
+    json_skip_whitespace(parser);
+
+    if (parser->cursor != parser->end) {
+        return trailing_data(status);
+    }
+
+    *slot = NULL;
+
+    return status_ok(status);
+}
+
+bool json_parser_init(JSONParser *parser, DecimalContext *ctx,
+                                          Status *status) {
+    parser->cursor = NULL;
+    parser->end = NULL;
+    parser->ctx = ctx;
+
+    if (!parray_init_alloc(&parser->containers, JSON_INIT_CONTAINER_ALLOC,
+                                                status)) {
+        return false;
+    }
+
+    if (!string_init(&parser->scratch, "", status)) {
+        parray_free(&parser->containers);
+        return false;
+    }
+
+    if (!value_init_table(&parser->interner, status)) {
+        string_free(&parser->scratch);
+        parray_free(&parser->containers);
+        return false;
+    }
+
+    return status_ok(status);
+}
+
+bool json_parser_load(JSONParser *parser, Value *value, const char *data,
+                                                        size_t len,
+                                                        Status *status) {
+    Value *slot = value;
+
+    parser->cursor = data;
+    parser->end = data + len;
+    parray_clear(&parser->containers);
+
+    value->type = VALUE_NONE;
+
+    while (slot) {
+        if ((!json_parse_value(parser, slot, status)) ||
+                (!json_advance(parser, slot, &slot, status))) {
+            parray_clear(&parser->containers);
+            value_free(value);
+            return false;
+        }
+    }
+
+    return status_ok(status);
+}
+
+void json_parser_clear(JSONParser *parser) {
+    parser->cursor = NULL;
+    parser->end = NULL;
+    parray_clear(&parser->containers);
+    string_clear(&parser->scratch);
+    value_clear(&parser->interner);
+}
+
+void json_parser_free(JSONParser *parser) {
+    parser->cursor = NULL;
+    parser->end = NULL;
+    parray_free(&parser->containers);
+    string_free(&parser->scratch);
+    value_free(&parser->interner);
+}
+
+bool json_load_data(Value *value, const char *data, size_t len,
+                                                    DecimalContext *ctx,
+                                                    Status *status) {
+    JSONParser parser;
+
+    if (!json_parser_init(&parser, ctx, status)) {
+        return false;
+    }
+
+    if (!json_parser_load(&parser, value, data, len, status)) {
+        json_parser_free(&parser);
+        return false;
+    }
+
+    json_parser_free(&parser);
+
+    return status_ok(status);
+}
+
+static
+bool json_map_path(const char *path, void **data, size_t *len,
+                                                  Status *status) {
+    struct stat st;
+    void *mapping = NULL;
+    int fd = open(path, O_RDONLY);
+
+    if (fd == -1) {
+        return opening_file_failed(status);
+    }
+
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return reading_file_failed(status);
+    }
+
+    if (st.st_size == 0) {
+        close(fd);
+        return unexpected_eof(status);
+    }
+
+    mapping = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    close(fd);
+
+    if (mapping == MAP_FAILED) {
+        return reading_file_failed(status);
+    }
+
+    *data = mapping;
+    *len = (size_t)st.st_size;
+
+    return status_ok(status);
+}
+
+bool json_load_path(Value *value, const char *path, DecimalContext *ctx,
+                                                    Status *status) {
+    void *data = NULL;
+    size_t len = 0;
+
+    if (!json_map_path(path, &data, &len, status)) {
+        return false;
+    }
+
+    madvise(data, len, MADV_SEQUENTIAL);
+
+    if (!json_load_data(value, data, len, ctx, status)) {
+        munmap(data, len);
+        return false;
+    }
+
+    munmap(data, len);
+
+    return status_ok(status);
+}
+
+/*
+ * Returns the first byte in [cursor, end) the index pass cares about: a
+ * bracket, a comma (they give container lengths) or a quote.  Returns `end` if
+ * there isn't one.
+ */
+static inline
+const char* json_find_structural(const char *cursor, const char *end) {
+#if defined(__AVX2__)
+    const __m256i open_brace = _mm256_set1_epi8('{');
+    const __m256i close_brace = _mm256_set1_epi8('}');
+    const __m256i open_bracket = _mm256_set1_epi8('[');
+    const __m256i close_bracket = _mm256_set1_epi8(']');
+    const __m256i comma = _mm256_set1_epi8(',');
+    const __m256i quote = _mm256_set1_epi8('"');
+
+    while ((end - cursor) >= 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)cursor);
+        __m256i structurals = _mm256_or_si256(
+            _mm256_or_si256(
+                _mm256_or_si256(
+                    _mm256_cmpeq_epi8(chunk, open_brace),
+                    _mm256_cmpeq_epi8(chunk, close_brace)
+                ),
+                _mm256_or_si256(
+                    _mm256_cmpeq_epi8(chunk, open_bracket),
+                    _mm256_cmpeq_epi8(chunk, close_bracket)
+                )
+            ),
+            _mm256_or_si256(
+                _mm256_cmpeq_epi8(chunk, comma),
+                _mm256_cmpeq_epi8(chunk, quote)
+            )
+        );
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(structurals);
+
+        if (mask) {
+            return cursor + __builtin_ctz(mask);
+        }
+
+        cursor += 32;
+    }
+#endif
+
+#if defined(__SSE2__)
+    const __m128i open_brace16 = _mm_set1_epi8('{');
+    const __m128i close_brace16 = _mm_set1_epi8('}');
+    const __m128i open_bracket16 = _mm_set1_epi8('[');
+    const __m128i close_bracket16 = _mm_set1_epi8(']');
+    const __m128i comma16 = _mm_set1_epi8(',');
+    const __m128i quote16 = _mm_set1_epi8('"');
+
+    while ((end - cursor) >= 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)cursor);
+        __m128i structurals = _mm_or_si128(
+            _mm_or_si128(
+                _mm_or_si128(
+                    _mm_cmpeq_epi8(chunk, open_brace16),
+                    _mm_cmpeq_epi8(chunk, close_brace16)
+                ),
+                _mm_or_si128(
+                    _mm_cmpeq_epi8(chunk, open_bracket16),
+                    _mm_cmpeq_epi8(chunk, close_bracket16)
+                )
+            ),
+            _mm_or_si128(
+                _mm_cmpeq_epi8(chunk, comma16),
+                _mm_cmpeq_epi8(chunk, quote16)
+            )
+        );
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(structurals);
+
+        if (mask) {
+            return cursor + __builtin_ctz(mask);
+        }
+
+        cursor += 16;
+    }
+#endif
+
+    while (cursor < end) {
+        switch (*cursor) {
+            case '{':
+            case '}':
+            case '[':
+            case ']':
+            case ',':
+            case '"':
+                return cursor;
+            default:
+                cursor++;
+                break;
+        }
+    }
+
+    return end;
+}
+
+static inline
+const char* json_find_non_whitespace(const char *cursor, const char *end) {
+    while ((cursor < end) && ((*cursor == ' ') ||
+                              (*cursor == '\t') ||
+                              (*cursor == '\n') ||
+                              (*cursor == '\r'))) {
+        cursor++;
+    }
+
+    return cursor;
+}
+
+/*
+ * Moves `cursor` (which must be on an opening quote) past the end of the
+ * string without decoding it.
+ */
+static
+bool json_skip_string(const char **cursor, const char *end, Status *status) {
+    const char *c = *cursor + 1;
+
+    while (true) {
+        c = json_find_string_special(c, end);
+
+        if (c == end) {
+            return unexpected_eof(status);
+        }
+
+        if (*c == '"') {
+            break;
+        }
+
+        if (*c != '\\') {
+            return invalid_string(status);
+        }
+
+        if ((end - c) < 2) {
+            return unexpected_eof(status);
+        }
+
+        c += 2;
+    }
+
+    *cursor = c + 1;
+
+    return status_ok(status);
+}
+
+static inline
+JSONIndexEntry* json_document_entry(JSONDocument *document, size_t node) {
+    return array_index_fast(&document->index, node);
+}
+
+/*
+ * Builds the structural index: one entry per container, in document order.
+ * Each entry records the offsets of its brackets, its number of members and
+ * the index of the first entry after its own subtree, so scanning a
+ * container's members can hop over nested containers in one step.
+ */
+static
+bool json_document_build_index(JSONDocument *document, Status *status) {
+    const char *data = document->data;
+    const char *end = data + document->len;
+    const char *cursor = data;
+    JSONIndexEntry *entry = NULL;
+    size_t *open = NULL;
+    Array stack;
+
+    if (!array_init_alloc(&stack, sizeof(size_t), JSON_INIT_CONTAINER_ALLOC,
+                                                  status)) {
+        return false;
+    }
+
+    while ((cursor = json_find_structural(cursor, end)) < end) {
+        switch (*cursor) {
+            case '"':
+                if (!json_skip_string(&cursor, end, status)) {
+                    array_free(&stack);
+                    return false;
+                }
+
+                continue;
+            case '{':
+            case '[':
+                if ((stack.len == 0) && (document->index.len > 0)) {
+                    array_free(&stack);
+                    return trailing_data(status);
+                }
+
+                if (!array_append(&document->index, (void **)&entry,
+                                                    status)) {
+                    array_free(&stack);
+                    return false;
+                }
+
+                entry->open = (size_t)(cursor - data);
+                entry->close = 0;
+                entry->next = 0;
+                entry->len = 0;
+
+                if (!array_append(&stack, (void **)&open, status)) {
+                    array_free(&stack);
+                    return false;
+                }
+
+                *open = document->index.len - 1;
+                break;
+            case ',':
+                if (stack.len == 0) {
+                    array_free(&stack);
+                    return invalid_syntax(status);
+                }
+
+                open = array_index_fast(&stack, stack.len - 1);
+                json_document_entry(document, *open)->len++;
+                break;
+            default:
+                if (stack.len == 0) {
+                    array_free(&stack);
+                    return mismatched_brackets(status);
+                }
+
+                open = array_index_fast(&stack, stack.len - 1);
+                entry = json_document_entry(document, *open);
+
+                if ((data[entry->open] == '{') != (*cursor == '}')) {
+                    array_free(&stack);
+                    return mismatched_brackets(status);
+                }
+
+                entry->close = (size_t)(cursor - data);
+                entry->next = document->index.len;
+
+                /* Members are separated by commas, unless there aren't any */
+                if (json_find_non_whitespace(data + entry->open + 1, end) !=
+                        cursor) {
+                    entry->len++;
+                }
+
+                array_truncate_fast(&stack, stack.len - 1);
+                break;
+        }
+
+        cursor++;
+    }
+
+    if (stack.len > 0) {
+        array_free(&stack);
+        return unexpected_eof(status);
+    }
+
+    array_free(&stack);
+
+    return status_ok(status);
+}
+
+static
+void json_members_free(JSONMembers *members) {
+    for (size_t i = 0; i <= members->mask; i++) {
+        if (members->slots[i].owned) {
+            free((char *)members->slots[i].key);
+        }
+    }
+
+    free(members->slots);
+    free(members);
+}
+
+static
+void json_document_free(JSONDocument *document) {
+    if (document->members) {
+        for (size_t i = 0; i < document->index.len; i++) {
+            if (document->members[i]) {
+                json_members_free(document->members[i]);
+            }
+        }
+
+        free(document->members);
+    }
+
+    array_free(&document->index);
+
+    if (document->owned_data) {
+        free(document->owned_data);
+    }
+
+    if (document->mapping) {
+        munmap(document->mapping, document->len);
+    }
+
+    free(document);
+}
+
+void json_document_retain(JSONDocument *document) {
+    refcount_increment(&document->refcount);
+}
+
+void json_document_release(JSONDocument *document) {
+    if (refcount_decrement(&document->refcount)) {
+        json_document_free(document);
+    }
+}
+
+/*
+ * A reader is a JSONParser used only for parsing scalars out of a document;
+ * none of its containers, scratch or interner are set up unless noted.
+ */
+static
+void json_document_reader_init(JSONDocument *document, JSONParser *reader,
+                                                       const char *cursor) {
+    reader->cursor = cursor;
+    reader->end = document->data + document->len;
+    reader->ctx = document->ctx;
+}
+
+/*
+ * Reads the value at `cursor` into `value` (which must not hold a value).
+ * Containers become lazy values for index entry `node`, which must be the
+ * entry for the container at `cursor`.
+ */
+static
+bool json_document_read_value(JSONDocument *document, const char *cursor,
+                                                      size_t node,
+                                                      Value *value,
+                                                      Status *status) {
+    const char *end = document->data + document->len;
+    const char *special = NULL;
+    JSONParser reader;
+    SSlice string;
+
+    value->type = VALUE_NONE;
+
+    json_document_reader_init(document, &reader, cursor);
+
+    switch (*cursor) {
+        case '{':
+        case '[':
+            json_document_retain(document);
+            value->type = VALUE_JSON;
+            value->as.json.document = document;
+            value->as.json.node = node;
+            return status_ok(status);
+        case '"':
+            special = json_find_string_special(cursor + 1, end);
+
+            if ((special < end) && (*special == '"')) {
+                string.data = cursor + 1;
+                string.byte_len = (size_t)(special - string.data);
+                string.len = utf8_rune_count(string.data, string.byte_len);
+
+                return value_init_string_from_sslice(value, &string, status);
+            }
+
+            if (!string_init(&reader.scratch, "", status)) {
+                return false;
+            }
+
+            if ((!json_parse_string(&reader, &string, status)) ||
+                    (!value_init_string_from_sslice(value, &string,
+                                                           status))) {
+                string_free(&reader.scratch);
+                return false;
+            }
+
+            string_free(&reader.scratch);
+
+            return status_ok(status);
+        case 't':
+            if (!json_parse_literal(&reader, "true", 4, status)) {
+                return false;
+            }
+
+            value_init_boolean(value, true);
+
+            return status_ok(status);
+        case 'f':
+            if (!json_parse_literal(&reader, "false", 5, status)) {
+                return false;
+            }
+
+            value_init_boolean(value, false);
+
+            return status_ok(status);
+        case 'n':
+            return json_parse_literal(&reader, "null", 4, status);
+        default:
+            return json_parse_number(&reader, value, status);
+    }
+}
+
+/*
+ * Moves `cursor` past the value it's on.  `child` is the index entry of the
+ * next container at or after `cursor`, and is advanced past any container
+ * skipped.
+ */
+static
+bool json_document_skip_value(JSONDocument *document, const char **cursor,
+                                                      size_t *child,
+                                                      Status *status) {
+    const char *end = document->data + document->len;
+    const char *c = *cursor;
+    JSONIndexEntry *entry = NULL;
+
+    switch (*c) {
+        case '{':
+        case '[':
+            entry = json_document_entry(document, *child);
+            *cursor = document->data + entry->close + 1;
+            *child = entry->next;
+            return status_ok(status);
+        case '"':
+            return json_skip_string(cursor, end, status);
+        default:
+            while ((c < end) && (*c != ',') &&
+                                (*c != '}') &&
+                                (*c != ']') &&
+                                (*c != ' ') &&
+                                (*c != '\t') &&
+                                (*c != '\n') &&
+                                (*c != '\r')) {
+                c++;
+            }
+
+            *cursor = c;
+            return status_ok(status);
+    }
+}
+
+/*
+ * Skips whitespace after a member, then either the comma separating it from
+ * the next one (setting `more`) or the container's closing bracket.
+ */
+static
+bool json_document_next_member(JSONDocument *document, const char **cursor,
+                                                       bool *more,
+                                                       Status *status) {
+    const char *end = document->data + document->len;
+    const char *c = json_find_non_whitespace(*cursor, end);
+
+    if (c >= end) {
+        return unexpected_eof(status);
+    }
+
+    if (*c == ',') {
+        *cursor = json_find_non_whitespace(c + 1, end);
+        *more = true;
+    }
+    else if ((*c == '}') || (*c == ']')) {
+        *cursor = c;
+        *more = false;
+    }
+    else {
+        return invalid_syntax(status);
+    }
+
+    if (*cursor >= end) {
+        return unexpected_eof(status);
+    }
+
+    return status_ok(status);
+}
+
+/*
+ * Reads the object key at `cursor` into `name` and moves past it and the
+ * following colon.  Keys without escapes are left in place; others are
+ * decoded into `scratch`, and are only valid until the next one is.
+ */
+static
+bool json_document_read_key(JSONDocument *document, const char **cursor,
+                                                    String *scratch,
+                                                    SSlice *name,
+                                                    Status *status) {
+    const char *end = document->data + document->len;
+    const char *start = *cursor;
+    const char *special = NULL;
+    JSONParser reader;
+    bool ok = true;
+
+    if (*start != '"') {
+        return invalid_syntax(status);
+    }
+
+    special = json_find_string_special(start + 1, end);
+
+    if ((special < end) && (*special == '"')) {
+        name->data = start + 1;
+        name->byte_len = (size_t)(special - (start + 1));
+        name->len = name->byte_len;
+        *cursor = special + 1;
+    }
+    else {
+        json_document_reader_init(document, &reader, start);
+        reader.scratch = *scratch;
+        ok = json_parse_string(&reader, name, status);
+        *scratch = reader.scratch;
+
+        if (!ok) {
+            return false;
+        }
+
+        *cursor = reader.cursor;
+    }
+
+    *cursor = json_find_non_whitespace(*cursor, end);
+
+    if ((*cursor >= end) || (**cursor != ':')) {
+        return invalid_syntax(status);
+    }
+
+    *cursor = json_find_non_whitespace(*cursor + 1, end);
+
+    if (*cursor >= end) {
+        return unexpected_eof(status);
+    }
+
+    return status_ok(status);
+}
+
+static inline
+bool json_key_equal(const char *key, size_t byte_len, SSlice *other) {
+    return (
+        (byte_len == other->byte_len) &&
+        (memcmp(key, other->data, byte_len) == 0)
+    );
+}
+
+/*
+ * Adds a member to `members`, replacing any earlier one with the same key,
+ * since the last one wins.  Decoded keys are copied.
+ */
+static
+bool json_members_add(JSONMembers *members, SSlice *key, bool decoded,
+                                                         const char *value,
+                                                         size_t child,
+                                                         Status *status) {
+    size_t slot = hash64(key->data, key->byte_len, 0) & members->mask;
+    JSONMember *member = &members->slots[slot];
+
+    while (member->key && (!json_key_equal(member->key, member->byte_len,
+                                                        key))) {
+        slot = (slot + 1) & members->mask;
+        member = &members->slots[slot];
+    }
+
+    if (!member->key) {
+        char *copy = NULL;
+
+        if (decoded) {
+            copy = malloc(key->byte_len ? key->byte_len : 1);
+
+            if (!copy) {
+                return alloc_failure(status);
+            }
+
+            memcpy(copy, key->data, key->byte_len);
+        }
+
+        member->key = copy ? copy : key->data;
+        member->byte_len = key->byte_len;
+        member->owned = copy != NULL;
+    }
+
+    member->value = value;
+    member->child = child;
+
+    return status_ok(status);
+}
+
+/*
+ * Builds the member table for the object at index entry `node`.
+ */
+static
+bool json_members_build(JSONDocument *document, size_t node,
+                                                JSONMembers **members,
+                                                Status *status) {
+    JSONIndexEntry *entry = json_document_entry(document, node);
+    const char *end = document->data + document->len;
+    const char *cursor = NULL;
+    JSONMembers *new_members = NULL;
+    size_t child = node + 1;
+    size_t slot_count = 1;
+    bool more = entry->len > 0;
+    bool ok = true;
+    String scratch;
+
+    while (slot_count < (entry->len * 2)) {
+        slot_count *= 2;
+    }
+
+    new_members = malloc(sizeof(JSONMembers));
+
+    if (!new_members) {
+        return alloc_failure(status);
+    }
+
+    new_members->mask = slot_count - 1;
+    new_members->slots = calloc(slot_count, sizeof(JSONMember));
+
+    if (!new_members->slots) {
+        free(new_members);
+        return alloc_failure(status);
+    }
+
+    if (!string_init(&scratch, "", status)) {
+        json_members_free(new_members);
+        return false;
+    }
+
+    cursor = json_find_non_whitespace(document->data + entry->open + 1, end);
+
+    while (ok && more) {
+        SSlice key;
+
+        ok = (
+            json_document_read_key(document, &cursor, &scratch, &key,
+                                                                status) &&
+            json_members_add(new_members, &key, key.data == scratch.data,
+                                                cursor,
+                                                child,
+                                                status) &&
+            json_document_skip_value(document, &cursor, &child, status) &&
+            json_document_next_member(document, &cursor, &more, status)
+        );
+    }
+
+    string_free(&scratch);
+
+    if (!ok) {
+        json_members_free(new_members);
+        return false;
+    }
+
+    *members = new_members;
+
+    return status_ok(status);
+}
+
+/*
+ * Finds the member table for the object at index entry `node`, building it
+ * if no thread has yet.  Tables are published with a compare-and-swap, and
+ * never change or go away afterwards while the document's alive.
+ */
+static
+bool json_document_members(JSONDocument *document, size_t node,
+                                                   JSONMembers **members,
+                                                   Status *status) {
+    JSONMembers **all = __atomic_load_n(&document->members, __ATOMIC_ACQUIRE);
+    JSONMembers *expected = NULL;
+
+    if (!all) {
+        JSONMembers **empty = calloc(document->index.len,
+                                     sizeof(JSONMembers *));
+
+        if (!empty) {
+            return alloc_failure(status);
+        }
+
+        if (__atomic_compare_exchange_n(&document->members, &all, empty,
+                                        false,
+                                        __ATOMIC_ACQ_REL,
+                                        __ATOMIC_ACQUIRE)) {
+            all = empty;
+        }
+        else {
+            free(empty);
+        }
+    }
+
+    *members = __atomic_load_n(&all[node], __ATOMIC_ACQUIRE);
+
+    if (*members) {
+        return status_ok(status);
+    }
+
+    if (!json_members_build(document, node, members, status)) {
+        return false;
+    }
+
+    if (!__atomic_compare_exchange_n(&all[node], &expected, *members,
+                                     false,
+                                     __ATOMIC_ACQ_REL,
+                                     __ATOMIC_ACQUIRE)) {
+        json_members_free(*members);
+        *members = expected;
+    }
+
+    return status_ok(status);
+}
+
+static
+bool json_load_lazy(Value *value, JSONDocument *document, Status *status) {
+    const char *end = document->data + document->len;
+    const char *root = json_find_non_whitespace(document->data, end);
+    JSONIndexEntry *entry = NULL;
+
+    value->type = VALUE_NONE;
+
+    if (!array_init_alloc(&document->index, sizeof(JSONIndexEntry),
+                                            JSON_INIT_INDEX_ALLOC,
+                                            status)) {
+        json_document_free(document);
+        return false;
+    }
+
+    if (!json_document_build_index(document, status)) {
+        json_document_free(document);
+        return false;
+    }
+
+    /* There's nothing to be lazy about with a scalar document */
+    if ((root >= end) || ((*root != '{') && (*root != '['))) {
+        bool loaded = json_load_data(value, document->data, document->len,
+                                                            document->ctx,
+                                                            status);
+
+        json_document_free(document);
+
+        return loaded;
+    }
+
+    entry = json_document_entry(document, 0);
+
+    if (json_find_non_whitespace(document->data + entry->close + 1, end) !=
+            end) {
+        json_document_free(document);
+        return trailing_data(status);
+    }
+
+    if (!json_document_read_value(document, root, 0, value, status)) {
+        json_document_free(document);
+        return false;
+    }
+
+    /* `value` holds the only reference now */
+    json_document_release(document);
+
+    return status_ok(status);
+}
+
+static
+bool json_document_new(JSONDocument **document, const char *data,
+                                                size_t len,
+                                                DecimalContext *ctx,
+                                                Status *status) {
+    JSONDocument *new_document = malloc(sizeof(JSONDocument));
+
+    if (!new_document) {
+        return alloc_failure(status);
+    }
+
+    refcount_init(&new_document->refcount);
+    new_document->data = data;
+    new_document->len = len;
+    new_document->owned_data = NULL;
+    new_document->mapping = NULL;
+    new_document->ctx = ctx;
+    new_document->members = NULL;
+
+    *document = new_document;
+
+    return status_ok(status);
+}
+
+bool json_load_lazy_data(Value *value, const char *data, size_t len,
+                                                         DecimalContext *ctx,
+                                                         Status *status) {
+    JSONDocument *document = NULL;
+    char *owned_data = malloc(len ? len : 1);
+
+    if (!owned_data) {
+        return alloc_failure(status);
+    }
+
+    memcpy(owned_data, data, len);
+
+    if (!json_document_new(&document, owned_data, len, ctx, status)) {
+        free(owned_data);
+        return false;
+    }
+
+    document->owned_data = owned_data;
+
+    return json_load_lazy(value, document, status);
+}
+
+bool json_load_lazy_path(Value *value, const char *path,
+                                       DecimalContext *ctx,
+                                       Status *status) {
+    JSONDocument *document = NULL;
+    void *data = NULL;
+    size_t len = 0;
+
+    if (!json_map_path(path, &data, &len, status)) {
+        return false;
+    }
+
+    if (!json_document_new(&document, data, len, ctx, status)) {
+        munmap(data, len);
+        return false;
+    }
+
+    document->mapping = data;
+
+    return json_load_lazy(value, document, status);
+}
+
+bool json_value_is_table(Value *value) {
+    JSONDocument *document = value->as.json.document;
+    JSONIndexEntry *entry = json_document_entry(document,
+                                                value->as.json.node);
+
+    return document->data[entry->open] == '{';
+}
+
+size_t json_value_length(Value *value) {
+    return json_document_entry(
+        value->as.json.document,
+        value->as.json.node
+    )->len;
+}
+
+bool json_value_index(Value *value, size_t index, Value *element,
+                                                  Status *status) {
+    ValueArrayCursor cursor;
+
+    value_array_cursor_init(&cursor);
+
+    return json_value_cursor_index(value, &cursor, index, element, status);
+}
+
+/*
+ * `cursor` holds the position of element `cursor->index` and the index
+ * entry of the first container at or after it, once it's been used.
+ */
+bool json_value_cursor_index(Value *value, ValueArrayCursor *cursor,
+                                           size_t index,
+                                           Value *element,
+                                           Status *status) {
+    JSONDocument *document = value->as.json.document;
+    size_t node = value->as.json.node;
+    JSONIndexEntry *entry = json_document_entry(document, node);
+    const char *end = document->data + document->len;
+    bool more = false;
+    Value tmp;
+
+    if (index >= entry->len) {
+        return index_out_of_bounds(status);
+    }
+
+    if ((!cursor->position) || (index < cursor->index)) {
+        cursor->position = json_find_non_whitespace(
+            document->data + entry->open + 1,
+            end
+        );
+        cursor->child = node + 1;
+        cursor->index = 0;
+    }
+
+    while (cursor->index < index) {
+        if ((!json_document_skip_value(document, &cursor->position,
+                                                 &cursor->child,
+                                                 status)) ||
+                (!json_document_next_member(document, &cursor->position,
+                                                      &more,
+                                                      status))) {
+            cursor->position = NULL;
+            return false;
+        }
+
+        cursor->index++;
+    }
+
+    if (!json_document_read_value(document, cursor->position, cursor->child,
+                                                               &tmp,
+                                                               status)) {
+        return false;
+    }
+
+    value_free(element);
+    value_move(element, &tmp);
+
+    return status_ok(status);
+}
+
+/*
+ * As with the eager loader, when a key appears more than once the last one
+ * wins, so small objects are scanned through to the end, and member tables
+ * keep the last.
+ */
+bool json_value_lookup(Value *value, SSlice *key, Value *element,
+                                                  Status *status) {
+    JSONDocument *document = value->as.json.document;
+    size_t node = value->as.json.node;
+    JSONIndexEntry *entry = json_document_entry(document, node);
+    const char *end = document->data + document->len;
+    const char *cursor = NULL;
+    const char *match = NULL;
+    size_t child = node + 1;
+    size_t match_child = 0;
+    bool more = entry->len > 0;
+    bool ok = true;
+    String scratch;
+    Value tmp;
+
+    if (entry->len >= JSON_MEMBER_INDEX_MIN) {
+        JSONMembers *members = NULL;
+        JSONMember *member = NULL;
+        size_t slot = 0;
+
+        if (!json_document_members(document, node, &members, status)) {
+            return false;
+        }
+
+        slot = hash64(key->data, key->byte_len, 0) & members->mask;
+        member = &members->slots[slot];
+
+        while (member->key && (!json_key_equal(member->key,
+                                               member->byte_len,
+                                               key))) {
+            slot = (slot + 1) & members->mask;
+            member = &members->slots[slot];
+        }
+
+        match = member->key ? member->value : NULL;
+        match_child = member->child;
+        more = false;
+    }
+    else {
+        if (!string_init(&scratch, "", status)) {
+            return false;
+        }
+
+        cursor = json_find_non_whitespace(document->data + entry->open + 1,
+                                          end);
+    }
+
+    while (ok && more) {
+        SSlice name;
+
+        ok = json_document_read_key(document, &cursor, &scratch, &name,
+                                                                 status);
+
+        if (ok && json_key_equal(name.data, name.byte_len, key)) {
+            match = cursor;
+            match_child = child;
+        }
+
+        ok = (
+            ok &&
+            json_document_skip_value(document, &cursor, &child, status) &&
+            json_document_next_member(document, &cursor, &more, status)
+        );
+    }
+
+    if (entry->len < JSON_MEMBER_INDEX_MIN) {
+        string_free(&scratch);
+    }
+
+    if (!ok) {
+        return false;
+    }
+
+    if (!match) {
+        return not_found(status);
+    }
+
+    if (!json_document_read_value(document, match, match_child, &tmp,
+                                                                status)) {
+        return false;
+    }
+
+    value_free(element);
+    value_move(element, &tmp);
+
+    return status_ok(status);
+}
+
+bool json_value_materialize(Value *value, Status *status) {
+    JSONDocument *document = value->as.json.document;
+    JSONIndexEntry *entry = json_document_entry(document,
+                                                value->as.json.node);
+    JSONParser parser;
+    Value tmp;
+
+    if (!json_parser_init(&parser, document->ctx, status)) {
+        return false;
+    }
+
+    if (!json_parser_load(&parser, &tmp, document->data + entry->open,
+                                         entry->close - entry->open + 1,
+                                         status)) {
+        json_parser_free(&parser);
+        return false;
+    }
+
+    json_parser_free(&parser);
+
+    value_free(value);
+    value_move(value, &tmp);
+
+    return status_ok(status);
+}
+
+void json_value_source(Value *value, const char **data, size_t *len) {
+    JSONDocument *document = value->as.json.document;
+    JSONIndexEntry *entry = json_document_entry(document,
+                                                value->as.json.node);
+
+    *data = document->data + entry->open;
+    *len = entry->close - entry->open + 1;
+}
+
+/* vi: set et ts=4 sw=4: */
@@ -0,0 +1,143 @@
+#ifndef JSON_H__
+#define JSON_H__
+
+enum {
+    JSON_UNEXPECTED_EOF = 1,
+    JSON_INVALID_SYNTAX,
+    JSON_INVALID_NUMBER,
+    JSON_INVALID_STRING,
+    JSON_INVALID_ESCAPE,
+    JSON_TRAILING_DATA,
+    JSON_OPENING_FILE_FAILED,
+    JSON_READING_FILE_FAILED,
+    JSON_MISMATCHED_BRACKETS,
+};
+
+typedef struct {
+    const char *cursor;
+    const char *end;
+    DecimalContext *ctx;
+    PArray containers;
+    String scratch;
+    Value interner;
+} JSONParser;
+
+/*
+ * The JSON loader builds a Value tree in a single pass over the input,
+ * without an intermediate document: objects become (insertion-ordered)
+ * tables, arrays become arrays, numbers are parsed straight into Decimals
+ * from their text and null becomes VALUE_NONE.  Strings too long to be
+ * stored inline are interned, so repeated long strings (keys or values)
+ * share one allocation.
+ *
+ * Input is assumed to be valid UTF-8.
+ */
+
+bool json_parser_init(JSONParser *parser, DecimalContext *ctx,
+                                          Status *status);
+bool json_parser_load(JSONParser *parser, Value *value, const char *data,
+                                                        size_t len,
+                                                        Status *status);
+void json_parser_clear(JSONParser *parser);
+void json_parser_free(JSONParser *parser);
+
+bool json_load_data(Value *value, const char *data, size_t len,
+                                                    DecimalContext *ctx,
+                                                    Status *status);
+bool json_load_path(Value *value, const char *path, DecimalContext *ctx,
+                                                    Status *status);
+
+/*
+ * Lazy loading skips building the Value tree up front.  Instead, one pass
+ * over the input records where every object and array starts and ends (the
+ * structural index), and the loaded value is a VALUE_JSON pointing at the
+ * root container.  Lookups walk only the members of the container they're
+ * applied to, jumping over nested containers using the index, and scalars are
+ * parsed when they're reached.  A template that reads a handful of fields
+ * from a large document therefore only pays for the index pass plus the
+ * fields it touches.
+ *
+ * The index pass checks that brackets match and strings are terminated, but
+ * the rest of the grammar is only checked for the parts that get read.
+ *
+ * Indexing scans an array from its start, so loops should read elements
+ * through a ValueArrayCursor (see value.h), which resumes from the last
+ * element read.  Objects with fewer than JSON_MEMBER_INDEX_MIN members are
+ * scanned for each lookup; larger ones get a hash table of their members
+ * the first time they're looked up in, which is kept with the document.
+ *
+ * Documents are immutable and reference counted, so lazy values can be shared
+ * between threads like any other Value.  Member tables are built without a
+ * lock; if two threads build one for the same object at once, the first to
+ * finish keeps it.  `ctx` must outlive the document.
+ * Mutating a lazy value (appending, inserting) materializes it first.
+ * json_value_source gives the document text a lazy value was indexed from.
+ */
+
+#define JSON_MEMBER_INDEX_MIN 8
+
+typedef struct {
+    size_t open;
+    size_t close;
+    size_t next;
+    size_t len;
+} JSONIndexEntry;
+
+/*
+ * An object member: its key (decoded, and `owned`, if it had escapes), where
+ * its value starts and the index entry of the first container at or after
+ * it.  Member tables are open-addressed, `mask + 1` slots long, with unused
+ * slots' `key` NULL.
+ */
+typedef struct {
+    const char *key;
+    size_t byte_len;
+    bool owned;
+    const char *value;
+    size_t child;
+} JSONMember;
+
+typedef struct {
+    size_t mask;
+    JSONMember *slots;
+} JSONMembers;
+
+struct JSONDocument {
+    size_t refcount;
+    const char *data;
+    size_t len;
+    char *owned_data;
+    void *mapping;
+    DecimalContext *ctx;
+    Array index;
+    JSONMembers **members;
+};
+
+typedef struct JSONDocument JSONDocument;
+
+bool json_load_lazy_data(Value *value, const char *data, size_t len,
+                                                         DecimalContext *ctx,
+                                                         Status *status);
+bool json_load_lazy_path(Value *value, const char *path,
+                                       DecimalContext *ctx,
+                                       Status *status);
+
+void json_document_retain(JSONDocument *document);
+void json_document_release(JSONDocument *document);
+
+bool json_value_is_table(Value *value);
+bool json_value_index(Value *value, size_t index, Value *element,
+                                                  Status *status);
+bool json_value_cursor_index(Value *value, ValueArrayCursor *cursor,
+                                           size_t index,
+                                           Value *element,
+                                           Status *status);
+bool json_value_lookup(Value *value, SSlice *key, Value *element,
+                                                  Status *status);
+size_t json_value_length(Value *value);
+bool json_value_materialize(Value *value, Status *status);
+void json_value_source(Value *value, const char **data, size_t *len);
+
+#endif
+
+/* vi: set et ts=4 sw=4: */
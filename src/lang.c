@@ -6,7 +6,7 @@ OperatorInformation OperatorInfo[OP_MAX] = {
     {"||", OP_ASSOC_LEFT,  1, 2},
     {"&&", OP_ASSOC_LEFT,  1, 2},
     {"!",  OP_ASSOC_RIGHT, 2, 1},
-    {"<",  OP_ASSOC_LEFT,  3, 1},
+    {"<",  OP_ASSOC_LEFT,  3, 2},
     {"<=", OP_ASSOC_LEFT,  3, 2},
     {">",  OP_ASSOC_LEFT,  3, 2},
     {">=", OP_ASSOC_LEFT,  3, 2},
@@ -24,7 +24,7 @@ OperatorInformation OperatorInfo[OP_MAX] = {
 
 const char *KeywordValues[KEYWORD_MAX] = {
     "include", "if", "else", "endif", "for", "in", "break", "continue",
-    "endfor", "raw", "endraw"
+    "endfor", "raw", "endraw", "cache", "endcache"
 };
 
 const char *SymbolValues[SYMBOL_MAX] = {
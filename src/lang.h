@@ -82,6 +82,8 @@ typedef enum {
     KEYWORD_ENDFOR,
     KEYWORD_RAW,
     KEYWORD_ENDRAW,
+    KEYWORD_CACHE,
+    KEYWORD_ENDCACHE,
     KEYWORD_MAX
 } Keyword;
 
@@ -283,6 +283,22 @@ bool lexer_handle_keyword_token(Lexer *lexer, Status *status) {
     lexer->code_token.location = lexer->tokenizer.token.location;
     lexer->code_token.as.keyword = lexer->tokenizer.token.as.keyword;
 
+    switch (lexer->code_token.as.keyword) {
+        case KEYWORD_FOR:
+            if (!lexer_push_state(lexer, LEXER_STATE_ITERATION, status)) {
+                return false;
+            }
+            break;
+        case KEYWORD_IN:
+            if (lexer_check_state(lexer, LEXER_STATE_ITERATION) &&
+                    (!lexer_pop_state(lexer, status))) {
+                return false;
+            }
+            break;
+        default:
+            break;
+    }
+
     /* [TODO] Need to handle 'else if' here */
     return lexer_expect_space_or_expression_end(lexer, status);
 }
@@ -338,6 +354,12 @@ void lexer_set_token_array_element_end(Lexer *lexer) {
     lexer->code_token.location = lexer->tokenizer.token.location;
 }
 
+static inline
+void lexer_set_token_iteration_separator(Lexer *lexer) {
+    lexer->code_token.type = CODE_TOKEN_ITERATION_SEPARATOR;
+    lexer->code_token.location = lexer->tokenizer.token.location;
+}
+
 static inline
 void lexer_set_token_index(Lexer *lexer, SSlice *index) {
     lexer->code_token.type = CODE_TOKEN_INDEX_START;
@@ -388,8 +410,8 @@ bool lexer_handle_symbol_token(Lexer *lexer, Status *status) {
                     return unexpected_cbracket(status);
             }
 
-            return lexer_expect_space_or_expression_end(lexer, status) &&
-                   lexer_expect_not_space_and_not_code_end(lexer, status);
+            return lexer_pop_state(lexer, status) &&
+                   lexer_expect_space_or_expression_end(lexer, status);
         case SYMBOL_EXCLAMATION_POINT:
             lexer_set_token_operator(lexer, OP_BOOL_NOT);
             return lexer_expect_not_space_and_not_code_end(lexer, status);
@@ -401,6 +423,9 @@ bool lexer_handle_symbol_token(Lexer *lexer, Status *status) {
                 case LEXER_STATE_ARRAY:
                     lexer_set_token_array_element_end(lexer);
                     return lexer_expect_space_or_cbracket(lexer, status);
+                case LEXER_STATE_ITERATION:
+                    lexer_set_token_iteration_separator(lexer);
+                    return lexer_expect_space(lexer, status);
                 default:
                     return unexpected_comma(status);
             }
@@ -505,6 +530,27 @@ bool lexer_handle_identifier_token(Lexer *lexer, Status *status) {
                         return unexpected_cparen(status);
                 }
                 break;
+            case SYMBOL_CBRACKET:
+                switch (lexer_get_state(lexer)) {
+                    case LEXER_STATE_INDEX:
+                    case LEXER_STATE_ARRAY:
+                        lexer->already_loaded_next = true;
+                        break;
+                    default:
+                        return unexpected_cbracket(status);
+                }
+                break;
+            case SYMBOL_COMMA:
+                switch (lexer_get_state(lexer)) {
+                    case LEXER_STATE_FUNCTION:
+                    case LEXER_STATE_ARRAY:
+                    case LEXER_STATE_ITERATION:
+                        lexer->already_loaded_next = true;
+                        break;
+                    default:
+                        return unexpected_comma(status);
+                }
+                break;
             default:
                 return unexpected_token(status);
         }
@@ -537,6 +583,7 @@ void lexer_clear(Lexer *lexer) {
     lexer->code_token.type = CODE_TOKEN_UNKNOWN;
     lexer->code_token.location = NULL;
     lexer->already_loaded_next = false;
+    lexer->code_start = false;
     array_clear(&lexer->states);
 }
 
@@ -545,6 +592,7 @@ void lexer_free(Lexer *lexer) {
     lexer->code_token.type = CODE_TOKEN_UNKNOWN;
     lexer->code_token.location = NULL;
     lexer->already_loaded_next = false;
+    lexer->code_start = false;
     array_free(&lexer->states);
 }
 
@@ -553,6 +601,7 @@ void lexer_set_data(Lexer *lexer, SSlice *sslice) {
     lexer->code_token.type = CODE_TOKEN_UNKNOWN;
     lexer->code_token.location = NULL;
     lexer->already_loaded_next = false;
+    lexer->code_start = false;
     array_clear(&lexer->states);
 }
 
@@ -561,6 +610,7 @@ bool lexer_init(Lexer *lexer, SSlice *data, Status *status) {
     lexer->code_token.type = CODE_TOKEN_UNKNOWN;
     lexer->code_token.location = NULL;
     lexer->already_loaded_next = false;
+    lexer->code_start = false;
 
     if (!array_init_alloc(&lexer->states, sizeof(LexerState),
                                           INITIAL_STATE_ALLOC,
@@ -572,10 +622,12 @@ bool lexer_init(Lexer *lexer, SSlice *data, Status *status) {
 }
 
 bool lexer_load_next(Lexer *lexer, Status *status) {
+    lexer->code_start = false;
+
     do {
         if (!lexer->already_loaded_next) {
             if (!tokenizer_load_next(&lexer->tokenizer, status)) {
-                if (status_match(status, "token", TOKENIZER_EOF)) {
+                if (status_match(status, "tokenizer", TOKENIZER_EOF)) {
                     return eof(status);
                 }
 
@@ -584,6 +636,10 @@ bool lexer_load_next(Lexer *lexer, Status *status) {
         }
 
         lexer->already_loaded_next = false;
+
+        if (lexer->tokenizer.token.type == TOKEN_CODE_START) {
+            lexer->code_start = true;
+        }
     } while (lexer->tokenizer.token.type == TOKEN_CODE_START);
 
     switch (lexer->tokenizer.token.type) {
@@ -616,7 +672,7 @@ bool lexer_load_next(Lexer *lexer, Status *status) {
 bool code_token_to_string(CodeToken *code_token, String *str, Status *status) {
     switch (code_token->type) {
         case CODE_TOKEN_UNKNOWN:
-            if (!string_assign(str, "<Unknown>", status)) {
+            if (!string_append_cstr(str, "<Unknown>", status)) {
                 return false;
             }
             break;
@@ -725,12 +781,12 @@ bool code_token_to_string(CodeToken *code_token, String *str, Status *status) {
 
             break;
         case CODE_TOKEN_FUNCTION_END:
-            if (!string_assign(str, "<FunctionEnd>", status)) {
+            if (!string_append_cstr(str, "<FunctionEnd>", status)) {
                 return false;
             }
             break;
         case CODE_TOKEN_FUNCTION_ARGUMENT_END:
-            if (!string_assign(str, "<FunctionArgumentEnd>", status)) {
+            if (!string_append_cstr(str, "<FunctionArgumentEnd>", status)) {
                 return false;
             }
             break;
@@ -753,22 +809,27 @@ bool code_token_to_string(CodeToken *code_token, String *str, Status *status) {
 
             break;
         case CODE_TOKEN_INDEX_END:
-            if (!string_assign(str, "<IndexEnd>", status)) {
+            if (!string_append_cstr(str, "<IndexEnd>", status)) {
                 return false;
             }
             break;
         case CODE_TOKEN_ARRAY_START:
-            if (!string_assign(str, "<ArrayStart>", status)) {
+            if (!string_append_cstr(str, "<ArrayStart>", status)) {
                 return false;
             }
             break;
         case CODE_TOKEN_ARRAY_END:
-            if (!string_assign(str, "<ArrayEnd>", status)) {
+            if (!string_append_cstr(str, "<ArrayEnd>", status)) {
                 return false;
             }
             break;
         case CODE_TOKEN_ARRAY_ELEMENT_END:
-            if (!string_assign(str, "<ArrayElementEnd>", status)) {
+            if (!string_append_cstr(str, "<ArrayElementEnd>", status)) {
+                return false;
+            }
+            break;
+        case CODE_TOKEN_ITERATION_SEPARATOR:
+            if (!string_append_cstr(str, "<IterationSeparator>", status)) {
                 return false;
             }
             break;
@@ -34,11 +34,19 @@ typedef enum {
     CODE_TOKEN_ARRAY_END,
     CODE_TOKEN_ARRAY_ELEMENT_END,
     CODE_TOKEN_OPERATOR,
+    CODE_TOKEN_ITERATION_SEPARATOR,
 } CodeTokenType;
 
+/*
+ * `arity` is the number of arguments in a function call or elements in an
+ * array literal; the expression parser fills it in on the FUNCTION_START or
+ * ARRAY_START token once it's seen the matching end.
+ */
+
 typedef struct {
     CodeTokenType type;
     const char *location;
+    size_t arity;
     union {
         SSlice text;
         SSlice number;
@@ -57,12 +65,22 @@ typedef enum {
     LEXER_STATE_PAREN    = 2,
     LEXER_STATE_INDEX    = 4,
     LEXER_STATE_ARRAY    = 8,
+    LEXER_STATE_ITERATION = 16,
 } LexerState;
 
+/*
+ * LEXER_STATE_ITERATION covers the identifiers between `for` and `in`, where
+ * a comma separates a key from a value (`for key, value in table`).
+ *
+ * `code_start` is set when the current code token is the first one after a
+ * `{{`, which is how the parser tells `{{ a }}{{ b }}` from `{{ a b }}`.
+ */
+
 typedef struct {
     Tokenizer tokenizer;
     CodeToken code_token;
     bool already_loaded_next;
+    bool code_start;
     Array states;
 } Lexer;
 
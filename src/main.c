@@ -1,11 +1,209 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
-int main(void) {
-    printf("Not quite ready yet\n");
+#include <cbase.h>
+
+#include "config.h"
+#include "lang.h"
+#include "value.h"
+#include "json.h"
+#include "snapshot.h"
+#include "function.h"
+#include "expression.h"
+#include "expression_evaluator.h"
+#include "template.h"
+#include "template_aot.h"
+#include "template_deps.h"
+#include "builtins.h"
+
+static void usage(void) {
+    fprintf(stderr,
+        "Usage:\n"
+        "  sst snapshot <context.json> <output>\n"
+        "  sst compile --to-c <template> <name> <output.c>\n"
+        "  sst deps <template>\n"
+    );
+}
+
+static int snapshot_command(int argc, char **argv) {
+    DecimalContext ctx;
+    Status status;
+
+    if (argc != 2) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    status_init(&status);
+    decimal_context_set_max(&ctx);
+
+    if (!snapshot_convert_json(argv[0], argv[1], &ctx, &status)) {
+        fprintf(stderr, "Error converting %s: %s\n", argv[0], status.message);
+        return EXIT_FAILURE;
+    }
 
     return EXIT_SUCCESS;
 }
 
-/* vi: set et ts=4 sw=4: */
+static bool compile_to_c(const char *path, const char *name,
+                                           String *output,
+                                           Status *status) {
+    FunctionRegistry functions;
+    Template t;
+    bool ok = false;
+
+    if (!function_registry_init(&functions, status)) {
+        return false;
+    }
+
+    if ((!builtins_register(&functions, status)) ||
+            (!template_init(&t, &functions, status))) {
+        function_registry_free(&functions);
+        return false;
+    }
+
+    ok = (
+        template_parse_path(&t, path, status) &&
+        template_aot_generate(&t, name, output, status)
+    );
+
+    template_free(&t);
+    function_registry_free(&functions);
+
+    return ok;
+}
+
+static int compile_command(int argc, char **argv) {
+    String output;
+    FILE *output_file = NULL;
+    Status status;
+    bool written = false;
+
+    if ((argc != 4) || (strcmp(argv[0], "--to-c") != 0)) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    status_init(&status);
+
+    if (!string_init(&output, "", &status)) {
+        fprintf(stderr, "Error allocating output: %s\n", status.message);
+        return EXIT_FAILURE;
+    }
+
+    if (!compile_to_c(argv[1], argv[2], &output, &status)) {
+        fprintf(stderr, "Error compiling %s: %s\n", argv[1], status.message);
+        string_free(&output);
+        return EXIT_FAILURE;
+    }
+
+    output_file = fopen(argv[3], "wb");
+
+    if (output_file) {
+        written = fwrite(output.data, 1, output.byte_len, output_file) ==
+                  output.byte_len;
+        written = (fclose(output_file) == 0) && written;
+    }
+
+    string_free(&output);
+
+    if (!written) {
+        fprintf(stderr, "Error writing %s\n", argv[3]);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
 
+static bool collect_deps(const char *path, TemplateDeps *deps,
+                                          Status *status) {
+    FunctionRegistry functions;
+    Template t;
+    bool ok = false;
+
+    if (!function_registry_init(&functions, status)) {
+        return false;
+    }
+
+    if ((!builtins_register(&functions, status)) ||
+            (!template_init(&t, &functions, status))) {
+        function_registry_free(&functions);
+        return false;
+    }
+
+    ok = (
+        template_parse_path(&t, path, status) &&
+        template_deps_collect(deps, &t, status)
+    );
+
+    template_free(&t);
+    function_registry_free(&functions);
+
+    return ok;
+}
+
+static void print_deps(const char *kind, PArray *list) {
+    for (size_t i = 0; i < list->len; i++) {
+        printf("%s %s\n", kind, (const char *)parray_index_fast(list, i));
+    }
+}
+
+/*
+ * Prints what a template uses, one `path`, `function` or `local` line each.
+ */
+static int deps_command(int argc, char **argv) {
+    TemplateDeps deps;
+    Status status;
+
+    if (argc != 1) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    status_init(&status);
+
+    if (!template_deps_init(&deps, &status)) {
+        fprintf(stderr, "Error allocating dependencies: %s\n",
+                        status.message);
+        return EXIT_FAILURE;
+    }
+
+    if (!collect_deps(argv[0], &deps, &status)) {
+        fprintf(stderr, "Error analyzing %s: %s\n", argv[0], status.message);
+        template_deps_free(&deps);
+        return EXIT_FAILURE;
+    }
+
+    print_deps("path", &deps.paths);
+    print_deps("function", &deps.functions);
+    print_deps("local", &deps.locals);
+    template_deps_free(&deps);
+
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    if (strcmp(argv[1], "snapshot") == 0) {
+        return snapshot_command(argc - 2, argv + 2);
+    }
+
+    if (strcmp(argv[1], "compile") == 0) {
+        return compile_command(argc - 2, argv + 2);
+    }
+
+    if (strcmp(argv[1], "deps") == 0) {
+        return deps_command(argc - 2, argv + 2);
+    }
+
+    usage();
+
+    return EXIT_FAILURE;
+}
+
+/* vi: set et ts=4 sw=4: */
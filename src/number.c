@@ -0,0 +1,212 @@
+#include <cbase.h>
+
+#include "config.h"
+#include "number.h"
+
+#define invalid_format(status) status_failure( \
+    status,                                    \
+    "number",                                  \
+    NUMBER_INVALID_FORMAT,                     \
+    "Invalid number format"                    \
+)
+
+/*
+ * Writes the coefficient's digits, most significant first, returning how
+ * many there were.  mpdecimal keeps the coefficient in base 10**19 words,
+ * least significant first; every word but the top one is zero-padded.
+ */
+static size_t write_coefficient(Decimal *d, char *buf) {
+    char *cursor = buf + d->digits;
+
+    for (mpd_ssize_t i = 0; i < d->len; i++) {
+        mpd_uint_t word = d->data[i];
+
+        for (size_t j = 0; (j < MPD_RDIGITS) && (cursor > buf); j++) {
+            *--cursor = (char)('0' + (word % 10));
+            word /= 10;
+        }
+    }
+
+    return d->digits;
+}
+
+bool number_write_plain(Decimal *d, bool thousands, char *buf, size_t *len) {
+    char digits[NUMBER_FAST_DIGITS_MAX];
+    size_t digit_count = 0;
+    size_t integer_len = 0;
+    size_t coefficient_integer_len = 0;
+    size_t leading_zeros = 0;
+    size_t fraction_len = 0;
+    char *cursor = buf;
+
+    if (mpd_isspecial(d) || (d->digits > NUMBER_FAST_DIGITS_MAX)) {
+        return false;
+    }
+
+    digit_count = write_coefficient(d, digits);
+
+    if (d->exp >= 0) {
+        if ((size_t)d->exp >= NUMBER_BUF_SIZE) {
+            return false;
+        }
+
+        coefficient_integer_len = digit_count;
+        integer_len = digit_count + d->exp;
+    }
+    else {
+        fraction_len = (size_t)(-d->exp);
+
+        if (fraction_len >= NUMBER_BUF_SIZE) {
+            return false;
+        }
+
+        if (fraction_len < digit_count) {
+            coefficient_integer_len = digit_count - fraction_len;
+        }
+        else {
+            leading_zeros = fraction_len - digit_count;
+        }
+
+        integer_len = coefficient_integer_len;
+    }
+
+    /* Sign, integer part, separators, zero before the point, point */
+    if ((1 + integer_len + (integer_len / 3) + 2 + fraction_len) >
+            NUMBER_BUF_SIZE) {
+        return false;
+    }
+
+    if (mpd_isnegative(d)) {
+        *cursor++ = '-';
+    }
+
+    if (integer_len == 0) {
+        *cursor++ = '0';
+    }
+
+    for (size_t i = 0; i < integer_len; i++) {
+        if (thousands && (i > 0) && (((integer_len - i) % 3) == 0)) {
+            *cursor++ = ',';
+        }
+
+        *cursor++ = i < coefficient_integer_len ? digits[i] : '0';
+    }
+
+    if (fraction_len > 0) {
+        *cursor++ = '.';
+
+        for (size_t i = 0; i < leading_zeros; i++) {
+            *cursor++ = '0';
+        }
+
+        memcpy(cursor, digits + coefficient_integer_len,
+                       digit_count - coefficient_integer_len);
+        cursor += digit_count - coefficient_integer_len;
+    }
+
+    *len = cursor - buf;
+
+    return true;
+}
+
+bool number_to_string(Decimal *d, String *s, Status *status) {
+    char buf[NUMBER_BUF_SIZE];
+    size_t len = 0;
+
+    /*
+     * Scientific notation only switches to plain notation for exponents
+     * <= 0 whose adjusted exponent is >= -6.
+     */
+    if ((!mpd_isspecial(d)) &&
+        (d->exp <= 0) &&
+        (mpd_adjexp(d) >= -6) &&
+        number_write_plain(d, false, buf, &len)) {
+        return string_append_cstr_len(s, buf, len, status);
+    }
+
+    return decimal_to_sci_string(d, false, s, status);
+}
+
+bool number_format_parse(SSlice *spec, NumberFormat *format, Status *status) {
+    const char *cursor = spec->data;
+    const char *end = spec->data + spec->byte_len;
+
+    format->thousands = false;
+    format->fixed = false;
+    format->decimals = 0;
+
+    if ((cursor < end) && (*cursor == ',')) {
+        format->thousands = true;
+        cursor++;
+    }
+
+    if ((cursor < end) && (*cursor == '.')) {
+        cursor++;
+
+        if ((cursor == end) || (*cursor < '0') || (*cursor > '9')) {
+            return invalid_format(status);
+        }
+
+        while ((cursor < end) && (*cursor >= '0') && (*cursor <= '9')) {
+            format->decimals = (format->decimals * 10) + (*cursor - '0');
+
+            if (format->decimals >= NUMBER_BUF_SIZE) {
+                return invalid_format(status);
+            }
+
+            cursor++;
+        }
+
+        format->fixed = true;
+    }
+
+    if ((cursor < end) && (*cursor == 'f')) {
+        cursor++;
+    }
+
+    if (cursor != end) {
+        return invalid_format(status);
+    }
+
+    return status_ok(status);
+}
+
+bool number_format(Decimal *d, NumberFormat *format, DecimalContext *ctx,
+                                                     char *buf,
+                                                     size_t *len,
+                                                     Status *status) {
+    size_t data[DECIMAL_MINALLOC_MAX];
+    Decimal rounded;
+    uint32_t mpd_status = 0;
+    bool written = false;
+
+    if (!format->fixed) {
+        if (!number_write_plain(d, format->thousands, buf, len)) {
+            return invalid_format(status);
+        }
+
+        return status_ok(status);
+    }
+
+    decimal_init(&rounded, data);
+
+    mpd_qrescale(&rounded, d, -((mpd_ssize_t)format->decimals), ctx,
+                                                                &mpd_status);
+
+    if (mpd_status & MPD_Errors) {
+        decimal_free(&rounded);
+        return invalid_format(status);
+    }
+
+    written = number_write_plain(&rounded, format->thousands, buf, len);
+
+    decimal_free(&rounded);
+
+    if (!written) {
+        return invalid_format(status);
+    }
+
+    return status_ok(status);
+}
+
+/* vi: set et ts=4 sw=4: */
@@ -0,0 +1,43 @@
+#ifndef NUMBER_H__
+#define NUMBER_H__
+
+enum {
+    NUMBER_INVALID_FORMAT = 1,
+};
+
+/*
+ * Fast number formatting.  Numbers whose coefficients have at most
+ * NUMBER_FAST_DIGITS_MAX digits (anything that fits in 128 bits) are written
+ * straight from mpdecimal's coefficient words into a stack buffer, instead
+ * of going through mpdecimal's general formatter and a heap-allocated
+ * string.
+ *
+ * number_to_string gives the same output as decimal_to_sci_string, falling
+ * back to it for anything the fast path doesn't cover.
+ *
+ * A format spec is `[,][.N][f]`: `,` groups the integer part in thousands,
+ * and `.N` rounds (per the context, normally half even) to exactly N decimal
+ * places.  number_format always writes plain (not scientific) notation, so
+ * it rejects numbers too long to write that way in NUMBER_BUF_SIZE bytes.
+ */
+
+#define NUMBER_FAST_DIGITS_MAX 40
+#define NUMBER_BUF_SIZE 128
+
+typedef struct {
+    bool thousands;
+    bool fixed;
+    size_t decimals;
+} NumberFormat;
+
+bool number_write_plain(Decimal *d, bool thousands, char *buf, size_t *len);
+bool number_to_string(Decimal *d, String *s, Status *status);
+bool number_format_parse(SSlice *spec, NumberFormat *format, Status *status);
+bool number_format(Decimal *d, NumberFormat *format, DecimalContext *ctx,
+                                                     char *buf,
+                                                     size_t *len,
+                                                     Status *status);
+
+#endif
+
+/* vi: set et ts=4 sw=4: */
@@ -134,6 +134,13 @@
     "\"endfor\" without \"for\""                   \
 )
 
+#define endcache_without_cache(status) status_failure( \
+    status,                                            \
+    "parser",                                          \
+    PARSER_ENDCACHE_WITHOUT_CACHE,                     \
+    "\"endcache\" without \"cache\""                   \
+)
+
 #define extraneous_parentheses(status) status_failure( \
     status,                                            \
     "parser",                                          \
@@ -185,6 +192,8 @@ bool parser_parse_expression(Parser *parser, Status *status) {
         }
 
         code_token->type = parser->lexer.code_token.type;
+        code_token->location = parser->lexer.code_token.location;
+        code_token->arity = 0;
 
         switch (parser->lexer.code_token.type) {
             case CODE_TOKEN_TEXT:
@@ -234,10 +243,19 @@ bool parser_parse_expression(Parser *parser, Status *status) {
         }
 
         if (!lexer_load_next(&parser->lexer, status)) {
+            if (status_match(status, "lexer", LEXER_EOF)) {
+                parser->already_loaded_next = false;
+                break;
+            }
+
             return false;
         }
 
         parser->already_loaded_next = true;
+
+        if (parser->lexer.code_start) {
+            break;
+        }
     }
 
 tokens_gathered:
@@ -250,7 +268,7 @@ tokens_gathered:
 
 static
 bool parser_parse_keyword(Parser *parser, Status *status) {
-    SSlice iteration_identifier;
+    ASTIteration iteration;
 
     switch (parser->lexer.code_token.as.keyword) {
         case KEYWORD_INCLUDE:
@@ -299,7 +317,42 @@ bool parser_parse_keyword(Parser *parser, Status *status) {
                 return else_without_if(status);
             }
 
-            parser->node->type = AST_NODE_ELSE;
+            if (!lexer_load_next(&parser->lexer, status)) {
+                if (!status_match(status, "lexer", LEXER_EOF)) {
+                    return false;
+                }
+
+                parser->node->type = AST_NODE_ELSE;
+                break;
+            }
+
+            if ((parser->lexer.code_start) ||
+                (parser->lexer.code_token.type != CODE_TOKEN_KEYWORD) ||
+                (parser->lexer.code_token.as.keyword != KEYWORD_IF)) {
+                parser->already_loaded_next = true;
+                parser->node->type = AST_NODE_ELSE;
+                break;
+            }
+
+            if (!lexer_load_next(&parser->lexer, status)) {
+                return false;
+            }
+
+            if ((parser->lexer.code_token.type != CODE_TOKEN_NUMBER) &&
+                (parser->lexer.code_token.type != CODE_TOKEN_STRING) &&
+                (parser->lexer.code_token.type != CODE_TOKEN_LOOKUP) &&
+                (parser->lexer.code_token.type != CODE_TOKEN_FUNCTION_START) &&
+                (parser->lexer.code_token.type != CODE_TOKEN_INDEX_START) &&
+                (parser->lexer.code_token.type != CODE_TOKEN_ARRAY_START) &&
+                (parser->lexer.code_token.type != CODE_TOKEN_OPERATOR)) {
+                return expected_expression(status);
+            }
+
+            if (!parser_parse_expression(parser, status)) {
+                return false;
+            }
+
+            parser->node->type = AST_NODE_ELSE_IF;
 
             break;
         case KEYWORD_ENDIF:
@@ -315,7 +368,7 @@ bool parser_parse_keyword(Parser *parser, Status *status) {
         case KEYWORD_FOR:
             parser->iteration_depth++;
 
-            /* expect lookup, KEYWORD_IN, expression */
+            /* expect lookup, [comma, lookup,] KEYWORD_IN, expression */
             if (!lexer_load_next(&parser->lexer, status)) {
                 return false;
             }
@@ -325,14 +378,38 @@ bool parser_parse_keyword(Parser *parser, Status *status) {
             }
 
             sslice_copy(
-                &iteration_identifier,
+                &iteration.identifier,
                 &parser->lexer.code_token.as.lookup
             );
 
+            iteration.value_identifier.data = NULL;
+            iteration.value_identifier.len = 0;
+            iteration.value_identifier.byte_len = 0;
+
             if (!lexer_load_next(&parser->lexer, status)) {
                 return false;
             }
 
+            if (parser->lexer.code_token.type ==
+                    CODE_TOKEN_ITERATION_SEPARATOR) {
+                if (!lexer_load_next(&parser->lexer, status)) {
+                    return false;
+                }
+
+                if (parser->lexer.code_token.type != CODE_TOKEN_LOOKUP) {
+                    return expected_identifier(status);
+                }
+
+                sslice_copy(
+                    &iteration.value_identifier,
+                    &parser->lexer.code_token.as.lookup
+                );
+
+                if (!lexer_load_next(&parser->lexer, status)) {
+                    return false;
+                }
+            }
+
             if ((parser->lexer.code_token.type != CODE_TOKEN_KEYWORD) ||
                 (parser->lexer.code_token.as.keyword != KEYWORD_IN)) {
                 return expected_keyword_in(status);
@@ -358,10 +435,7 @@ bool parser_parse_keyword(Parser *parser, Status *status) {
 
             parser->node->type = AST_NODE_ITERATION;
 
-            sslice_copy(
-                &parser->node->as.iteration_identifier,
-                &iteration_identifier
-            );
+            parser->node->as.iteration = iteration;
 
             break;
         case KEYWORD_IN:
@@ -391,6 +465,40 @@ bool parser_parse_keyword(Parser *parser, Status *status) {
 
             parser->node->type = AST_NODE_ITERATION_END;
 
+            break;
+        case KEYWORD_CACHE:
+            parser->cache_depth++;
+
+            if (!lexer_load_next(&parser->lexer, status)) {
+                return false;
+            }
+
+            if ((parser->lexer.code_token.type != CODE_TOKEN_NUMBER) &&
+                (parser->lexer.code_token.type != CODE_TOKEN_STRING) &&
+                (parser->lexer.code_token.type != CODE_TOKEN_LOOKUP) &&
+                (parser->lexer.code_token.type != CODE_TOKEN_FUNCTION_START) &&
+                (parser->lexer.code_token.type != CODE_TOKEN_INDEX_START) &&
+                (parser->lexer.code_token.type != CODE_TOKEN_ARRAY_START) &&
+                (parser->lexer.code_token.type != CODE_TOKEN_OPERATOR)) {
+                return expected_expression(status);
+            }
+
+            if (!parser_parse_expression(parser, status)) {
+                return false;
+            }
+
+            parser->node->type = AST_NODE_CACHE;
+
+            break;
+        case KEYWORD_ENDCACHE:
+            if (parser->cache_depth == 0) {
+                return endcache_without_cache(status);
+            }
+
+            parser->cache_depth--;
+
+            parser->node->type = AST_NODE_CACHE_END;
+
             break;
         default:
             return unknown_keyword(status);
@@ -411,6 +519,7 @@ bool parser_init(Parser *parser, SSlice *data, Status *status) {
     parser->already_loaded_next = false;
     parser->conditional_depth = 0;
     parser->iteration_depth = 0;
+    parser->cache_depth = 0;
 
     return status_ok(status);
 }
@@ -423,6 +532,7 @@ void parser_clear(Parser *parser) {
     parser->already_loaded_next = false;
     parser->conditional_depth = 0;
     parser->iteration_depth = 0;
+    parser->cache_depth = 0;
 }
 
 void parser_free(Parser *parser) {
@@ -433,12 +543,17 @@ void parser_free(Parser *parser) {
     parser->already_loaded_next = false;
     parser->conditional_depth = 0;
     parser->iteration_depth = 0;
+    parser->cache_depth = 0;
 }
 
 bool parser_load_next(Parser *parser, ASTNode *node, Status *status) {
     if (!parser->already_loaded_next) {
         if (!lexer_load_next(&parser->lexer, status)) {
-            return eof(status);
+            if (status_match(status, "lexer", LEXER_EOF)) {
+                return eof(status);
+            }
+
+            return false;
         }
     }
 
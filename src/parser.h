@@ -7,19 +7,32 @@ typedef enum {
     AST_NODE_EXPRESSION,
     AST_NODE_CONDITIONAL,
     AST_NODE_ELSE,
+    AST_NODE_ELSE_IF,
     AST_NODE_CONDITIONAL_END,
     AST_NODE_ITERATION,
     AST_NODE_BREAK,
     AST_NODE_CONTINUE,
     AST_NODE_ITERATION_END,
+    AST_NODE_CACHE,
+    AST_NODE_CACHE_END,
 } ASTNodeType;
 
+/*
+ * `value_identifier` is empty unless the loop binds keys (or indices) and
+ * values separately: `for key, value in table`.
+ */
+
+typedef struct {
+    SSlice identifier;
+    SSlice value_identifier;
+} ASTIteration;
+
 typedef struct {
     ASTNodeType type;
     union {
         SSlice text;
         SSlice include;
-        SSlice iteration_identifier;
+        ASTIteration iteration;
     } as;
 } ASTNode;
 
@@ -42,6 +55,7 @@ enum {
     PARSER_BREAK_WITHOUT_FOR,
     PARSER_CONTINUE_WITHOUT_FOR,
     PARSER_ENDFOR_WITHOUT_FOR,
+    PARSER_ENDCACHE_WITHOUT_CACHE,
     PARSER_EXTRANEOUS_PARENTHESES,
     PARSER_UNKNOWN_KEYWORD,
     PARSER_EOF,
@@ -54,6 +68,7 @@ typedef struct {
     bool already_loaded_next;
     size_t conditional_depth;
     size_t iteration_depth;
+    size_t cache_depth;
 } Parser;
 
 bool parser_init(Parser *parser, SSlice *data, Status *status);
@@ -0,0 +1,189 @@
+#include <cbase.h>
+
+#include <pthread.h>
+
+#include "config.h"
+#include "refcount.h"
+#include "value.h"
+#include "provider.h"
+
+#define key_not_found(status) status_failure( \
+    status,                                   \
+    "value",                                  \
+    VALUE_KEY_NOT_FOUND,                      \
+    "Key not found"                           \
+)
+
+static void provider_free(Provider *provider) {
+    value_free(&provider->memo);
+    value_free(&provider->misses);
+    pthread_mutex_destroy(&provider->lock);
+    free(provider);
+}
+
+bool provider_init(Value *value, ProviderResolve *resolve, void *data,
+                                                           Status *status) {
+    Provider *provider = malloc(sizeof(Provider));
+
+    if (!provider) {
+        return alloc_failure(status);
+    }
+
+    provider->memo.type = VALUE_NONE;
+    provider->misses.type = VALUE_NONE;
+
+    if (!value_init_table(&provider->memo, status)) {
+        free(provider);
+        return false;
+    }
+
+    if (!value_init_table(&provider->misses, status)) {
+        value_free(&provider->memo);
+        free(provider);
+        return false;
+    }
+
+    if (pthread_mutex_init(&provider->lock, NULL) != 0) {
+        value_free(&provider->memo);
+        value_free(&provider->misses);
+        free(provider);
+        return alloc_failure(status);
+    }
+
+    refcount_init(&provider->refcount);
+    provider->resolve = resolve;
+    provider->data = data;
+
+    value->type = VALUE_PROVIDER;
+    value->as.provider = provider;
+
+    return status_ok(status);
+}
+
+void provider_clear(Value *value) {
+    Provider *provider = value->as.provider;
+
+    pthread_mutex_lock(&provider->lock);
+    value_clear(&provider->memo);
+    value_clear(&provider->misses);
+    pthread_mutex_unlock(&provider->lock);
+}
+
+void provider_retain(Provider *provider) {
+    refcount_increment(&provider->refcount);
+}
+
+void provider_release(Provider *provider) {
+    if (refcount_decrement(&provider->refcount)) {
+        provider_free(provider);
+    }
+}
+
+/*
+ * Checks the memo for `key`.  Returns false with "base"/ERROR_NOT_FOUND if
+ * the key hasn't been resolved yet, or with "value"/VALUE_KEY_NOT_FOUND if
+ * the callback said it doesn't exist.
+ */
+static bool provider_memo_lookup(Provider *provider, SSlice *key,
+                                                     Value *element,
+                                                     Status *status) {
+    Value miss;
+
+    if (value_lookup(&provider->memo, key, element, status)) {
+        return status_ok(status);
+    }
+
+    if (!status_match(status, "value", VALUE_KEY_NOT_FOUND)) {
+        return false;
+    }
+
+    miss.type = VALUE_NONE;
+
+    if (value_lookup(&provider->misses, key, &miss, status)) {
+        value_free(&miss);
+        return key_not_found(status);
+    }
+
+    if (!status_match(status, "value", VALUE_KEY_NOT_FOUND)) {
+        return false;
+    }
+
+    return not_found(status);
+}
+
+static bool provider_memo_store(Provider *provider, SSlice *key,
+                                                    Value *resolved,
+                                                    Status *status) {
+    Value *slot = NULL;
+
+    if (!resolved) {
+        if (!value_table_insert(&provider->misses, key, &slot, status)) {
+            return false;
+        }
+
+        value_set_boolean(slot, true);
+
+        return status_ok(status);
+    }
+
+    if (!value_table_insert(&provider->memo, key, &slot, status)) {
+        return false;
+    }
+
+    return value_copy(slot, resolved, status);
+}
+
+bool provider_value_lookup(Value *value, SSlice *key, Value *element,
+                                                      Status *status) {
+    Provider *provider = value->as.provider;
+    Value resolved;
+    bool stored = false;
+
+    pthread_mutex_lock(&provider->lock);
+    stored = provider_memo_lookup(provider, key, element, status);
+    pthread_mutex_unlock(&provider->lock);
+
+    if (stored) {
+        return status_ok(status);
+    }
+
+    if (!status_match(status, "base", ERROR_NOT_FOUND)) {
+        return false;
+    }
+
+    resolved.type = VALUE_NONE;
+
+    if (!provider->resolve(provider->data, key, &resolved, status)) {
+        value_free(&resolved);
+
+        if (!status_match(status, "base", ERROR_NOT_FOUND)) {
+            return false;
+        }
+
+        pthread_mutex_lock(&provider->lock);
+        stored = provider_memo_store(provider, key, NULL, status);
+        pthread_mutex_unlock(&provider->lock);
+
+        if (!stored) {
+            return false;
+        }
+
+        return not_found(status);
+    }
+
+    pthread_mutex_lock(&provider->lock);
+    stored = provider_memo_store(provider, key, &resolved, status);
+    pthread_mutex_unlock(&provider->lock);
+
+    if (!stored) {
+        value_free(&resolved);
+        return false;
+    }
+
+    value_free(element);
+    value_move(element, &resolved);
+
+    return status_ok(status);
+}
+
+/* vi: set et ts=4 sw=4: */
@@ -0,0 +1,50 @@
+#ifndef PROVIDER_H__
+#define PROVIDER_H__
+
+/*
+ * A provider is a table whose entries are computed on demand by a callback,
+ * so a context can be backed by an in-process cache or a database handle
+ * instead of being built up front.  It reads like a table in value_lookup;
+ * nothing else (indexing, length, insertion) is supported.
+ *
+ * The callback is given the key and a VALUE_NONE Value to fill in.  It
+ * reports a missing key by failing with not_found(status) (value_lookup then
+ * fails with VALUE_KEY_NOT_FOUND), and may return another provider to back a
+ * nested table.  Any other failure is passed through to the lookup unchanged.
+ *
+ * Whatever the callback resolves (including misses) is remembered, so each
+ * key is computed at most once per render no matter how often the template
+ * refers to it.  Copies of a provider Value share that memo, so create one for
+ * each render (they're cheap) or clear it with provider_clear between
+ * renders.  Lookups may come from several threads at once; the callback is
+ * called without the memo locked, so it may be called twice for the same key
+ * if two threads race for it.
+ */
+
+typedef bool (ProviderResolve)(void *data, SSlice *key, Value *value,
+                                                        Status *status);
+
+struct Provider {
+    size_t refcount;
+    ProviderResolve *resolve;
+    void *data;
+    pthread_mutex_t lock;
+    Value memo;
+    Value misses;
+};
+
+typedef struct Provider Provider;
+
+bool provider_init(Value *value, ProviderResolve *resolve, void *data,
+                                                           Status *status);
+void provider_clear(Value *value);
+
+void provider_retain(Provider *provider);
+void provider_release(Provider *provider);
+
+bool provider_value_lookup(Value *value, SSlice *key, Value *element,
+                                                      Status *status);
+
+#endif
+
+/* vi: set et ts=4 sw=4: */
@@ -0,0 +1,33 @@
+#ifndef REFCOUNT_H__
+#define REFCOUNT_H__
+
+/*
+ * Reference counts are shared between threads (a context can be read by
+ * several renders at once), so they're manipulated atomically.  The last
+ * release uses acquire/release ordering so that the thread freeing the object
+ * sees every write made by the threads that released it before.
+ */
+
+static inline
+void refcount_init(size_t *refcount) {
+    __atomic_store_n(refcount, 1, __ATOMIC_RELAXED);
+}
+
+static inline
+void refcount_increment(size_t *refcount) {
+    __atomic_add_fetch(refcount, 1, __ATOMIC_RELAXED);
+}
+
+static inline
+bool refcount_decrement(size_t *refcount) {
+    return __atomic_sub_fetch(refcount, 1, __ATOMIC_ACQ_REL) == 0;
+}
+
+static inline
+bool refcount_is_unique(size_t *refcount) {
+    return __atomic_load_n(refcount, __ATOMIC_ACQUIRE) == 1;
+}
+
+#endif
+
+/* vi: set et ts=4 sw=4: */
@@ -0,0 +1,329 @@
+#include <cbase.h>
+
+#include <pthread.h>
+
+#include "config.h"
+
+#include "lang.h"
+#include "value.h"
+#include "function.h"
+#include "expression.h"
+#include "expression_evaluator.h"
+#include "template.h"
+#include "render_pool.h"
+
+static bool render_worker_take(RenderWorker *worker, size_t *job) {
+    bool taken = false;
+
+    pthread_mutex_lock(&worker->lock);
+
+    if (worker->next < worker->end) {
+        *job = worker->next++;
+        taken = true;
+    }
+
+    pthread_mutex_unlock(&worker->lock);
+
+    return taken;
+}
+
+/*
+ * Moves the back half of the longest other run to `worker`, whose own run is
+ * empty.  Returns false once there's nothing left to steal.
+ */
+static bool render_worker_steal(RenderWorker *worker) {
+    RenderPool *pool = worker->pool;
+
+    while (true) {
+        RenderWorker *victim = NULL;
+        size_t longest = 0;
+        size_t first = 0;
+        size_t end = 0;
+
+        for (size_t i = 0; i < pool->worker_count; i++) {
+            RenderWorker *other = &pool->workers[i];
+            size_t remaining = 0;
+
+            if (other == worker) {
+                continue;
+            }
+
+            pthread_mutex_lock(&other->lock);
+            remaining = other->end - other->next;
+            pthread_mutex_unlock(&other->lock);
+
+            if (remaining > longest) {
+                victim = other;
+                longest = remaining;
+            }
+        }
+
+        if (!victim) {
+            return false;
+        }
+
+        pthread_mutex_lock(&victim->lock);
+
+        if (victim->next < victim->end) {
+            end = victim->end;
+            victim->end -= (victim->end - victim->next + 1) / 2;
+            first = victim->end;
+        }
+
+        pthread_mutex_unlock(&victim->lock);
+
+        /* Another thief may have emptied it since we looked */
+        if (first == end) {
+            continue;
+        }
+
+        pthread_mutex_lock(&worker->lock);
+        worker->next = first;
+        worker->end = end;
+        pthread_mutex_unlock(&worker->lock);
+
+        return true;
+    }
+}
+
+static void render_job_run(void *data, size_t index,
+                                       ExpressionEvaluator *evaluator) {
+    RenderJob *job = &((RenderJob *)data)[index];
+
+    string_clear(job->output);
+    status_init(&job->status);
+
+    job->ok = template_render_with_evaluator(job->template,
+                                             evaluator,
+                                             job->context,
+                                             job->output,
+                                             &job->status);
+}
+
+static void* render_worker_main(void *data) {
+    RenderWorker *worker = data;
+    RenderPool *pool = worker->pool;
+    size_t batch = 0;
+
+    while (true) {
+        RenderTask *task = NULL;
+        void *data = NULL;
+        size_t job = 0;
+
+        pthread_mutex_lock(&pool->lock);
+
+        while ((!pool->stopping) && (pool->batch == batch)) {
+            pthread_cond_wait(&pool->started, &pool->lock);
+        }
+
+        if (pool->stopping) {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+
+        batch = pool->batch;
+        task = pool->task;
+        data = pool->data;
+
+        pthread_mutex_unlock(&pool->lock);
+
+        do {
+            while (render_worker_take(worker, &job)) {
+                task(data, job, &worker->evaluator);
+            }
+        } while (render_worker_steal(worker));
+
+        pthread_mutex_lock(&pool->lock);
+
+        pool->running--;
+
+        if (pool->running == 0) {
+            pthread_cond_signal(&pool->finished);
+        }
+
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+/*
+ * Stops and frees the first `count` workers, whose threads have been
+ * started.
+ */
+static void render_pool_stop(RenderPool *pool, size_t count) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->started);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (size_t i = 0; i < count; i++) {
+        pthread_join(pool->workers[i].thread, NULL);
+        pthread_mutex_destroy(&pool->workers[i].lock);
+        expression_evaluator_free(&pool->workers[i].evaluator);
+    }
+
+    pthread_cond_destroy(&pool->finished);
+    pthread_cond_destroy(&pool->started);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_mutex_destroy(&pool->busy);
+    free(pool->workers);
+}
+
+bool render_pool_init(RenderPool *pool, size_t threads, Status *status) {
+    if (threads == 0) {
+        threads = 1;
+    }
+
+    pool->workers = malloc(sizeof(RenderWorker) * threads);
+
+    if (!pool->workers) {
+        return alloc_failure(status);
+    }
+
+    pool->worker_count = threads;
+    pool->task = NULL;
+    pool->data = NULL;
+    pool->batch = 0;
+    pool->running = 0;
+    pool->stopping = false;
+
+    if (pthread_mutex_init(&pool->busy, NULL) != 0) {
+        free(pool->workers);
+        return alloc_failure(status);
+    }
+
+    if (pthread_mutex_init(&pool->lock, NULL) != 0) {
+        pthread_mutex_destroy(&pool->busy);
+        free(pool->workers);
+        return alloc_failure(status);
+    }
+
+    if (pthread_cond_init(&pool->started, NULL) != 0) {
+        pthread_mutex_destroy(&pool->lock);
+        pthread_mutex_destroy(&pool->busy);
+        free(pool->workers);
+        return alloc_failure(status);
+    }
+
+    if (pthread_cond_init(&pool->finished, NULL) != 0) {
+        pthread_cond_destroy(&pool->started);
+        pthread_mutex_destroy(&pool->lock);
+        pthread_mutex_destroy(&pool->busy);
+        free(pool->workers);
+        return alloc_failure(status);
+    }
+
+    for (size_t i = 0; i < threads; i++) {
+        RenderWorker *worker = &pool->workers[i];
+
+        worker->pool = pool;
+        worker->next = 0;
+        worker->end = 0;
+
+        if (!expression_evaluator_init(&worker->evaluator, status)) {
+            render_pool_stop(pool, i);
+            return false;
+        }
+
+        if (pthread_mutex_init(&worker->lock, NULL) != 0) {
+            expression_evaluator_free(&worker->evaluator);
+            render_pool_stop(pool, i);
+            return alloc_failure(status);
+        }
+
+        if (pthread_create(&worker->thread, NULL, render_worker_main,
+                                                  worker) != 0) {
+            pthread_mutex_destroy(&worker->lock);
+            expression_evaluator_free(&worker->evaluator);
+            render_pool_stop(pool, i);
+            return alloc_failure(status);
+        }
+    }
+
+    return status_ok(status);
+}
+
+/*
+ * Runs a batch on the workers and waits for it to finish; the caller holds
+ * `busy`.
+ */
+static void render_pool_batch(RenderPool *pool, RenderTask *task,
+                                                 void *data,
+                                                 size_t count) {
+    size_t size = count / pool->worker_count;
+    size_t extra = count % pool->worker_count;
+    size_t next = 0;
+
+    pthread_mutex_lock(&pool->lock);
+
+    for (size_t i = 0; i < pool->worker_count; i++) {
+        RenderWorker *worker = &pool->workers[i];
+
+        pthread_mutex_lock(&worker->lock);
+        worker->next = next;
+        worker->end = next + size + (i < extra ? 1 : 0);
+        next = worker->end;
+        pthread_mutex_unlock(&worker->lock);
+    }
+
+    pool->task = task;
+    pool->data = data;
+    pool->running = pool->worker_count;
+    pool->batch++;
+
+    pthread_cond_broadcast(&pool->started);
+
+    while (pool->running > 0) {
+        pthread_cond_wait(&pool->finished, &pool->lock);
+    }
+
+    pool->task = NULL;
+    pool->data = NULL;
+
+    pthread_mutex_unlock(&pool->lock);
+}
+
+bool render_pool_render(RenderPool *pool, RenderJob *jobs, size_t count,
+                                                           Status *status) {
+    return render_pool_run(pool, render_job_run, jobs, count, status);
+}
+
+bool render_pool_run(RenderPool *pool, RenderTask *task, void *data,
+                                                         size_t count,
+                                                         Status *status) {
+    if (count == 0) {
+        return status_ok(status);
+    }
+
+    pthread_mutex_lock(&pool->busy);
+    render_pool_batch(pool, task, data, count);
+    pthread_mutex_unlock(&pool->busy);
+
+    return status_ok(status);
+}
+
+bool render_pool_try_run(RenderPool *pool, RenderTask *task, void *data,
+                                                             size_t count,
+                                                             bool *ran,
+                                                             Status *status) {
+    *ran = false;
+
+    if (pthread_mutex_trylock(&pool->busy) != 0) {
+        return status_ok(status);
+    }
+
+    if (count > 0) {
+        render_pool_batch(pool, task, data, count);
+    }
+
+    pthread_mutex_unlock(&pool->busy);
+
+    *ran = true;
+
+    return status_ok(status);
+}
+
+void render_pool_free(RenderPool *pool) {
+    render_pool_stop(pool, pool->worker_count);
+}
+
+/* vi: set et ts=4 sw=4: */
@@ -0,0 +1,88 @@
+#ifndef RENDER_POOL_H__
+#define RENDER_POOL_H__
+
+/*
+ * A RenderPool renders batches of (template, context) jobs on a fixed set of
+ * threads, started once and reused for every batch.  Each worker keeps its
+ * own ExpressionEvaluator across jobs and batches, so its stack, frame and
+ * memo allocations are reused instead of being made afresh for every render.
+ *
+ * A batch is split into contiguous runs of jobs, one per worker.  Workers
+ * take jobs from the front of their own run, and once it's empty steal the
+ * back half of the longest remaining run, so a few slow jobs don't hold up
+ * the ones queued behind them.
+ *
+ * Each job renders into its own `output` (which is cleared first), recording
+ * whether it succeeded in `ok` and why not in `status`.  render_pool_render
+ * returns once every job has finished, and only fails itself if the batch
+ * can't be run.  Jobs may share templates and contexts (see template.h).
+ *
+ * render_pool_run runs a batch of `count` calls to `task` instead, passing
+ * each its index and the evaluator of the worker running it.  Templates use
+ * this to split parallel loops between a pool's workers (see
+ * template_set_parallel).  A pool runs one batch at a time; others wait
+ * their turn, except with render_pool_try_run, which clears `ran` and
+ * returns straight away if the pool's busy.  That keeps a template rendered
+ * by one of the pool's own workers from waiting on itself.
+ */
+
+typedef void (RenderTask)(void *data, size_t index,
+                                      ExpressionEvaluator *evaluator);
+
+typedef struct {
+    Template *template;
+    Value *context;
+    String *output;
+    Status status;
+    bool ok;
+} RenderJob;
+
+typedef struct RenderPool RenderPool;
+
+/*
+ * `lock` protects `next` and `end`, the worker's run of jobs, which thieves
+ * shorten from the end.
+ */
+typedef struct {
+    RenderPool *pool;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    ExpressionEvaluator evaluator;
+    size_t next;
+    size_t end;
+} RenderWorker;
+
+/*
+ * `batch` counts the batches started, which is how workers tell a new batch
+ * from a spurious wakeup; `running` counts workers still busy with it.
+ * `busy` is held for as long as a batch runs.
+ */
+struct RenderPool {
+    RenderWorker *workers;
+    size_t worker_count;
+    pthread_mutex_t busy;
+    pthread_mutex_t lock;
+    pthread_cond_t started;
+    pthread_cond_t finished;
+    RenderTask *task;
+    void *data;
+    size_t batch;
+    size_t running;
+    bool stopping;
+};
+
+bool render_pool_init(RenderPool *pool, size_t threads, Status *status);
+bool render_pool_render(RenderPool *pool, RenderJob *jobs, size_t count,
+                                                           Status *status);
+bool render_pool_run(RenderPool *pool, RenderTask *task, void *data,
+                                                         size_t count,
+                                                         Status *status);
+bool render_pool_try_run(RenderPool *pool, RenderTask *task, void *data,
+                                                             size_t count,
+                                                             bool *ran,
+                                                             Status *status);
+void render_pool_free(RenderPool *pool);
+
+#endif
+
+/* vi: set et ts=4 sw=4: */
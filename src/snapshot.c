@@ -0,0 +1,1150 @@
+#include <cbase.h>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "refcount.h"
+#include "value.h"
+#include "json.h"
+#include "snapshot.h"
+
+#define SNAPSHOT_ALIGNMENT 8
+#define SNAPSHOT_INIT_ALLOC 4096
+
+/* Each table entry is followed by its slot in the sorted index */
+#define SNAPSHOT_TABLE_ITEM_SIZE \
+    (sizeof(SnapshotTableEntry) + sizeof(uint64_t))
+
+#define opening_file_failed(status) status_failure( \
+    status,                                         \
+    "snapshot",                                     \
+    SNAPSHOT_OPENING_FILE_FAILED,                   \
+    "Opening file failed"                           \
+)
+
+#define reading_file_failed(status) status_failure( \
+    status,                                         \
+    "snapshot",                                     \
+    SNAPSHOT_READING_FILE_FAILED,                   \
+    "Reading file failed"                           \
+)
+
+#define writing_file_failed(status) status_failure( \
+    status,                                         \
+    "snapshot",                                     \
+    SNAPSHOT_WRITING_FILE_FAILED,                   \
+    "Writing file failed"                           \
+)
+
+#define invalid_format(status) status_failure( \
+    status,                                    \
+    "snapshot",                                \
+    SNAPSHOT_INVALID_FORMAT,                   \
+    "Invalid snapshot format"                  \
+)
+
+#define unsupported_version(status) status_failure( \
+    status,                                         \
+    "snapshot",                                     \
+    SNAPSHOT_UNSUPPORTED_VERSION,                   \
+    "Unsupported snapshot version"                  \
+)
+
+#define unsupported_type(status) status_failure( \
+    status,                                      \
+    "snapshot",                                  \
+    SNAPSHOT_UNSUPPORTED_TYPE,                   \
+    "Value type can't be saved in a snapshot"    \
+)
+
+typedef struct {
+    SSlice key;
+    uint64_t offset;
+} SnapshotInternedString;
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t alloc;
+    Table strings;
+    uint64_t none;
+    uint64_t true_node;
+    uint64_t false_node;
+} SnapshotWriter;
+
+typedef struct {
+    const char *data;
+    size_t byte_len;
+    uint64_t index;
+} SnapshotSortKey;
+
+static size_t key_to_hash(const void *key, size_t seed) {
+    SSlice *ss = (SSlice *)key;
+
+    return hash64(ss->data, ss->byte_len, seed);
+}
+
+static void* interned_string_to_key(const void *obj) {
+    return (void *)(&((SnapshotInternedString *)obj)->key);
+}
+
+static bool key_equal(const void *key1, const void *key2) {
+    SSlice *ss1 = (SSlice *)key1;
+    SSlice *ss2 = (SSlice *)key2;
+
+    return (
+        (ss1->byte_len == ss2->byte_len) &&
+        (memcmp(ss1->data, ss2->data, ss1->byte_len) == 0)
+    );
+}
+
+static int compare_keys(const char *data1, size_t byte_len1,
+                        const char *data2, size_t byte_len2) {
+    int res = memcmp(
+        data1,
+        data2,
+        byte_len1 < byte_len2 ? byte_len1 : byte_len2
+    );
+
+    if (res != 0) {
+        return res;
+    }
+
+    if (byte_len1 == byte_len2) {
+        return 0;
+    }
+
+    return byte_len1 < byte_len2 ? -1 : 1;
+}
+
+static int compare_sort_keys(const void *key1, const void *key2) {
+    const SnapshotSortKey *sk1 = key1;
+    const SnapshotSortKey *sk2 = key2;
+
+    return compare_keys(sk1->data, sk1->byte_len, sk2->data, sk2->byte_len);
+}
+
+static
+bool snapshot_writer_init(SnapshotWriter *writer, Status *status) {
+    writer->data = malloc(SNAPSHOT_INIT_ALLOC);
+
+    if (!writer->data) {
+        return alloc_failure(status);
+    }
+
+    writer->len = 0;
+    writer->alloc = SNAPSHOT_INIT_ALLOC;
+    writer->none = 0;
+    writer->true_node = 0;
+    writer->false_node = 0;
+
+    if (!table_init(&writer->strings, key_to_hash,
+                                      interned_string_to_key,
+                                      key_equal,
+                                      0,
+                                      status)) {
+        free(writer->data);
+        return false;
+    }
+
+    return status_ok(status);
+}
+
+static
+void snapshot_writer_free(SnapshotWriter *writer) {
+    TableIterator iter;
+    SnapshotInternedString *string = NULL;
+
+    table_iterator_init(&iter, &writer->strings);
+
+    while (table_iterator_next(&iter, (void **)&string)) {
+        free((char *)string->key.data);
+        free(string);
+    }
+
+    table_free(&writer->strings);
+    free(writer->data);
+}
+
+/*
+ * Appends a zeroed, aligned node of `size` bytes.  `node` is only valid until
+ * the next append.
+ */
+static
+bool snapshot_writer_append(SnapshotWriter *writer, size_t size,
+                                                    uint64_t *offset,
+                                                    void **node,
+                                                    Status *status) {
+    size_t start = (writer->len + (SNAPSHOT_ALIGNMENT - 1)) &
+                   ~((size_t)SNAPSHOT_ALIGNMENT - 1);
+
+    if ((start + size) > writer->alloc) {
+        size_t alloc = writer->alloc * 2;
+        char *data = NULL;
+
+        while (alloc < (start + size)) {
+            alloc *= 2;
+        }
+
+        data = realloc(writer->data, alloc);
+
+        if (!data) {
+            return alloc_failure(status);
+        }
+
+        writer->data = data;
+        writer->alloc = alloc;
+    }
+
+    memset(writer->data + writer->len, 0, (start + size) - writer->len);
+
+    writer->len = start + size;
+    *offset = start;
+    *node = writer->data + start;
+
+    return status_ok(status);
+}
+
+static
+bool snapshot_write_flag(SnapshotWriter *writer, SnapshotNodeType type,
+                                                 uint64_t *cached,
+                                                 uint64_t *offset,
+                                                 Status *status) {
+    uint32_t *node = NULL;
+
+    if (!*cached) {
+        if (!snapshot_writer_append(writer, sizeof(uint32_t), cached,
+                                                              (void **)&node,
+                                                              status)) {
+            return false;
+        }
+
+        *node = type;
+    }
+
+    *offset = *cached;
+
+    return status_ok(status);
+}
+
+static
+bool snapshot_write_number(SnapshotWriter *writer, Decimal *number,
+                                                   uint64_t *offset,
+                                                   Status *status) {
+    size_t words_size = (size_t)number->len * sizeof(mpd_uint_t);
+    SnapshotNumber *node = NULL;
+
+    if (!snapshot_writer_append(writer, sizeof(SnapshotNumber) + words_size,
+                                        offset,
+                                        (void **)&node,
+                                        status)) {
+        return false;
+    }
+
+    node->type = SNAPSHOT_NODE_NUMBER;
+    node->flags = number->flags & (MPD_NEG | MPD_SPECIAL);
+    node->exp = number->exp;
+    node->digits = number->digits;
+    node->len = (uint64_t)number->len;
+
+    memcpy(node + 1, number->data, words_size);
+
+    return status_ok(status);
+}
+
+static
+bool snapshot_write_string(SnapshotWriter *writer, const char *data,
+                                                   size_t len,
+                                                   size_t byte_len,
+                                                   uint64_t *offset,
+                                                   Status *status) {
+    SnapshotInternedString *interned = NULL;
+    SnapshotString *node = NULL;
+    SSlice key;
+    char *key_data = NULL;
+
+    key.data = data;
+    key.len = len;
+    key.byte_len = byte_len;
+
+    if (table_lookup(&writer->strings, &key, (void **)&interned, status)) {
+        *offset = interned->offset;
+        return status_ok(status);
+    }
+
+    if (!status_match(status, "base", ERROR_NOT_FOUND)) {
+        return false;
+    }
+
+    if (!snapshot_writer_append(writer, sizeof(SnapshotString) + byte_len + 1,
+                                        offset,
+                                        (void **)&node,
+                                        status)) {
+        return false;
+    }
+
+    node->type = SNAPSHOT_NODE_STRING;
+    node->len = len;
+    node->byte_len = byte_len;
+
+    memcpy(node + 1, data, byte_len);
+
+    interned = malloc(sizeof(SnapshotInternedString));
+    key_data = malloc(byte_len + 1);
+
+    if ((!interned) || (!key_data)) {
+        free(interned);
+        free(key_data);
+        return alloc_failure(status);
+    }
+
+    memcpy(key_data, data, byte_len);
+    key_data[byte_len] = '\0';
+
+    interned->key.data = key_data;
+    interned->key.len = len;
+    interned->key.byte_len = byte_len;
+    interned->offset = *offset;
+
+    if (!table_insert(&writer->strings, interned, status)) {
+        free(key_data);
+        free(interned);
+        return false;
+    }
+
+    return status_ok(status);
+}
+
+static bool snapshot_write_value(SnapshotWriter *writer, Value *value,
+                                                         uint64_t *offset,
+                                                         Status *status);
+
+static
+bool snapshot_write_array(SnapshotWriter *writer, Value *value,
+                                                  uint64_t *offset,
+                                                  Status *status) {
+    PArray *elements = &value->as.array->elements;
+    uint64_t *element_offsets = malloc(
+        (elements->len ? elements->len : 1) * sizeof(uint64_t)
+    );
+    SnapshotArray *node = NULL;
+
+    if (!element_offsets) {
+        return alloc_failure(status);
+    }
+
+    for (size_t i = 0; i < elements->len; i++) {
+        if (!snapshot_write_value(writer, parray_index_fast(elements, i),
+                                          &element_offsets[i],
+                                          status)) {
+            free(element_offsets);
+            return false;
+        }
+    }
+
+    if (!snapshot_writer_append(writer,
+            sizeof(SnapshotArray) + (elements->len * sizeof(uint64_t)),
+            offset,
+            (void **)&node,
+            status)) {
+        free(element_offsets);
+        return false;
+    }
+
+    node->type = SNAPSHOT_NODE_ARRAY;
+    node->count = elements->len;
+
+    memcpy(node + 1, element_offsets, elements->len * sizeof(uint64_t));
+
+    free(element_offsets);
+
+    return status_ok(status);
+}
+
+static
+bool snapshot_write_table(SnapshotWriter *writer, Value *value,
+                                                  uint64_t *offset,
+                                                  Status *status) {
+    Table *entries = &value->as.table->entries;
+    size_t count = entries->len;
+    SnapshotTableEntry *table_entries = malloc(
+        (count ? count : 1) * sizeof(SnapshotTableEntry)
+    );
+    SnapshotSortKey *sort_keys = malloc(
+        (count ? count : 1) * sizeof(SnapshotSortKey)
+    );
+    SnapshotTable *node = NULL;
+    uint64_t *sorted = NULL;
+    ValueTableEntry *entry = NULL;
+    ValueTableIterator iter;
+    size_t i = 0;
+
+    if ((!table_entries) || (!sort_keys)) {
+        free(table_entries);
+        free(sort_keys);
+        return alloc_failure(status);
+    }
+
+    if (!value_table_iterator_init(&iter, value, status)) {
+        free(table_entries);
+        free(sort_keys);
+        return false;
+    }
+
+    while (value_table_iterator_next(&iter, &entry)) {
+        if ((!snapshot_write_string(writer, value_string_data(&entry->key),
+                                            entry->key.as.string.len,
+                                            entry->key.as.string.byte_len,
+                                            &table_entries[i].key,
+                                            status)) ||
+                (!snapshot_write_value(writer, &entry->value,
+                                               &table_entries[i].value,
+                                               status))) {
+            free(table_entries);
+            free(sort_keys);
+            return false;
+        }
+
+        sort_keys[i].data = value_string_data(&entry->key);
+        sort_keys[i].byte_len = entry->key.as.string.byte_len;
+        sort_keys[i].index = i;
+
+        i++;
+    }
+
+    qsort(sort_keys, count, sizeof(SnapshotSortKey), compare_sort_keys);
+
+    if (!snapshot_writer_append(writer,
+            sizeof(SnapshotTable) +
+            (count * sizeof(SnapshotTableEntry)) +
+            (count * sizeof(uint64_t)),
+            offset,
+            (void **)&node,
+            status)) {
+        free(table_entries);
+        free(sort_keys);
+        return false;
+    }
+
+    node->type = SNAPSHOT_NODE_TABLE;
+    node->count = count;
+
+    memcpy(node + 1, table_entries, count * sizeof(SnapshotTableEntry));
+
+    sorted = (uint64_t *)(((SnapshotTableEntry *)(node + 1)) + count);
+
+    for (i = 0; i < count; i++) {
+        sorted[i] = sort_keys[i].index;
+    }
+
+    free(table_entries);
+    free(sort_keys);
+
+    return status_ok(status);
+}
+
+/*
+ * Lazy values are materialized (into a private copy) and written like any
+ * other table or array.
+ */
+static
+bool snapshot_write_materialized(SnapshotWriter *writer, Value *value,
+                                                         uint64_t *offset,
+                                                         Status *status) {
+    Value tmp;
+
+    tmp.type = VALUE_NONE;
+
+    if (!value_copy(&tmp, value, status)) {
+        return false;
+    }
+
+    if (value->type == VALUE_JSON) {
+        if (!json_value_materialize(&tmp, status)) {
+            value_free(&tmp);
+            return false;
+        }
+    }
+    else if (!snapshot_value_materialize(&tmp, status)) {
+        value_free(&tmp);
+        return false;
+    }
+
+    if (!snapshot_write_value(writer, &tmp, offset, status)) {
+        value_free(&tmp);
+        return false;
+    }
+
+    value_free(&tmp);
+
+    return status_ok(status);
+}
+
+static
+bool snapshot_write_value(SnapshotWriter *writer, Value *value,
+                                                  uint64_t *offset,
+                                                  Status *status) {
+    switch (value->type) {
+        case VALUE_NONE:
+            return snapshot_write_flag(writer, SNAPSHOT_NODE_NONE,
+                                               &writer->none,
+                                               offset,
+                                               status);
+        case VALUE_BOOLEAN:
+            if (value->as.boolean) {
+                return snapshot_write_flag(writer, SNAPSHOT_NODE_TRUE,
+                                                   &writer->true_node,
+                                                   offset,
+                                                   status);
+            }
+
+            return snapshot_write_flag(writer, SNAPSHOT_NODE_FALSE,
+                                               &writer->false_node,
+                                               offset,
+                                               status);
+        case VALUE_NUMBER:
+            return snapshot_write_number(writer, &value->as.number, offset,
+                                                                    status);
+        case VALUE_STRING:
+            return snapshot_write_string(writer, value_string_data(value),
+                                                 value->as.string.len,
+                                                 value->as.string.byte_len,
+                                                 offset,
+                                                 status);
+        case VALUE_ARRAY:
+            return snapshot_write_array(writer, value, offset, status);
+        case VALUE_TABLE:
+            return snapshot_write_table(writer, value, offset, status);
+        case VALUE_JSON:
+        case VALUE_SNAPSHOT:
+            return snapshot_write_materialized(writer, value, offset, status);
+        default:
+            return unsupported_type(status);
+    }
+}
+
+bool snapshot_save(Value *value, const char *path, Status *status) {
+    SnapshotWriter writer;
+    SnapshotHeader *header = NULL;
+    uint64_t header_offset = 0;
+    uint64_t root = 0;
+    FILE *fobj = NULL;
+
+    if (!snapshot_writer_init(&writer, status)) {
+        return false;
+    }
+
+    if ((!snapshot_writer_append(&writer, sizeof(SnapshotHeader),
+                                          &header_offset,
+                                          (void **)&header,
+                                          status)) ||
+            (!snapshot_write_value(&writer, value, &root, status))) {
+        snapshot_writer_free(&writer);
+        return false;
+    }
+
+    header = (SnapshotHeader *)writer.data;
+
+    memcpy(header->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header->version = SNAPSHOT_VERSION;
+    header->byte_order = SNAPSHOT_BYTE_ORDER_MARK;
+    header->word_size = sizeof(mpd_uint_t);
+    header->size = writer.len;
+    header->root = root;
+
+    fobj = fopen(path, "wb");
+
+    if (!fobj) {
+        snapshot_writer_free(&writer);
+        return opening_file_failed(status);
+    }
+
+    if (fwrite(writer.data, 1, writer.len, fobj) != writer.len) {
+        fclose(fobj);
+        snapshot_writer_free(&writer);
+        return writing_file_failed(status);
+    }
+
+    if (fclose(fobj) != 0) {
+        snapshot_writer_free(&writer);
+        return writing_file_failed(status);
+    }
+
+    snapshot_writer_free(&writer);
+
+    return status_ok(status);
+}
+
+void snapshot_retain(Snapshot *snapshot) {
+    refcount_increment(&snapshot->refcount);
+}
+
+void snapshot_release(Snapshot *snapshot) {
+    if (refcount_decrement(&snapshot->refcount)) {
+        munmap((void *)snapshot->data, snapshot->len);
+        free(snapshot);
+    }
+}
+
+/*
+ * Returns the node of at least `size` bytes at `offset`, checking that it's
+ * within the mapping.
+ */
+static inline
+bool snapshot_node(Snapshot *snapshot, uint64_t offset, size_t size,
+                                                        const void **node,
+                                                        Status *status) {
+    if ((offset % SNAPSHOT_ALIGNMENT) ||
+            (offset > snapshot->len) ||
+            (size > (snapshot->len - offset))) {
+        return invalid_format(status);
+    }
+
+    *node = snapshot->data + offset;
+
+    return status_ok(status);
+}
+
+/*
+ * Returns the node at `offset` made of `size` bytes followed by `count`
+ * items of `item_size` bytes, checking that it's within the mapping.  Counts
+ * come from the file, so they're checked by division rather than by
+ * computing a size that could overflow.
+ */
+static inline
+bool snapshot_node_items(Snapshot *snapshot, uint64_t offset,
+                                            size_t size,
+                                            uint64_t count,
+                                            size_t item_size,
+                                            const void **node,
+                                            Status *status) {
+    if ((offset % SNAPSHOT_ALIGNMENT) ||
+            (offset > snapshot->len) ||
+            (size > (snapshot->len - offset)) ||
+            (count > ((snapshot->len - offset - size) / item_size))) {
+        return invalid_format(status);
+    }
+
+    *node = snapshot->data + offset;
+
+    return status_ok(status);
+}
+
+static
+bool snapshot_string(Snapshot *snapshot, uint64_t offset,
+                                         const SnapshotString **node,
+                                         Status *status) {
+    const SnapshotString *string_node = NULL;
+
+    if (!snapshot_node(snapshot, offset, sizeof(SnapshotString),
+                                         (const void **)&string_node,
+                                         status)) {
+        return false;
+    }
+
+    if ((string_node->type != SNAPSHOT_NODE_STRING) ||
+            (!snapshot_node_items(snapshot, offset,
+                                            sizeof(SnapshotString) + 1,
+                                            string_node->byte_len,
+                                            1,
+                                            (const void **)&string_node,
+                                            status))) {
+        return invalid_format(status);
+    }
+
+    *node = string_node;
+
+    return status_ok(status);
+}
+
+static
+bool snapshot_container(Value *value, const SnapshotArray **node,
+                                      Status *status) {
+    return snapshot_node(
+        value->as.snapshot.snapshot,
+        value->as.snapshot.offset,
+        sizeof(SnapshotArray),
+        (const void **)node,
+        status
+    );
+}
+
+/*
+ * Checks a number's fields are ones the writer could have written: only sign
+ * and special flags, an exponent mpdecimal accepts, and `len` coefficient
+ * words holding exactly `digits` digits.  The node's words must already be
+ * known to be within the mapping.
+ */
+static
+bool snapshot_number_valid(const SnapshotNumber *number_node) {
+    const mpd_uint_t *words = (const mpd_uint_t *)(number_node + 1);
+    uint64_t top_digits = 0;
+    mpd_uint_t top_min = 0;
+    mpd_uint_t top_max = 1;
+
+    if ((number_node->flags & ~((uint32_t)(MPD_NEG | MPD_SPECIAL))) ||
+            (number_node->exp < MPD_MIN_ETINY) ||
+            (number_node->exp > MPD_MAX_EMAX)) {
+        return false;
+    }
+
+    /* mpdecimal gives infinities and payloadless NaNs no coefficient */
+    if ((number_node->flags & MPD_SPECIAL) && (number_node->digits == 0)) {
+        return number_node->len == 0;
+    }
+
+    if ((number_node->digits <= 0) ||
+            ((((uint64_t)number_node->digits + MPD_RDIGITS - 1) /
+                MPD_RDIGITS) != number_node->len)) {
+        return false;
+    }
+
+    for (uint64_t i = 0; i < number_node->len; i++) {
+        if (words[i] >= MPD_RADIX) {
+            return false;
+        }
+    }
+
+    top_digits = (uint64_t)number_node->digits -
+                 ((number_node->len - 1) * MPD_RDIGITS);
+
+    for (uint64_t i = 0; i < top_digits; i++) {
+        top_max *= 10;
+    }
+
+    if (top_digits > 1) {
+        top_min = top_max / 10;
+    }
+
+    return (
+        (words[number_node->len - 1] >= top_min) &&
+        (words[number_node->len - 1] < top_max)
+    );
+}
+
+/*
+ * Reads the node at `offset` into `value` (which must not hold a value).
+ * Scalars are copied out; tables and arrays become VALUE_SNAPSHOT.
+ */
+static
+bool snapshot_read_value(Snapshot *snapshot, uint64_t offset, Value *value,
+                                                              Status *status) {
+    const uint32_t *type = NULL;
+    const SnapshotNumber *number_node = NULL;
+    const SnapshotString *string_node = NULL;
+    const SnapshotArray *container_node = NULL;
+    Decimal number;
+
+    value->type = VALUE_NONE;
+
+    if (!snapshot_node(snapshot, offset, sizeof(uint32_t),
+                                         (const void **)&type,
+                                         status)) {
+        return false;
+    }
+
+    switch (*type) {
+        case SNAPSHOT_NODE_NONE:
+            return status_ok(status);
+        case SNAPSHOT_NODE_TRUE:
+            value_init_boolean(value, true);
+            return status_ok(status);
+        case SNAPSHOT_NODE_FALSE:
+            value_init_boolean(value, false);
+            return status_ok(status);
+        case SNAPSHOT_NODE_NUMBER:
+            if ((!snapshot_node(snapshot, offset, sizeof(SnapshotNumber),
+                                                  (const void **)&number_node,
+                                                  status)) ||
+                    (!snapshot_node_items(snapshot, offset,
+                        sizeof(SnapshotNumber),
+                        number_node->len,
+                        sizeof(mpd_uint_t),
+                        (const void **)&number_node,
+                        status))) {
+                return false;
+            }
+
+            if (!snapshot_number_valid(number_node)) {
+                return invalid_format(status);
+            }
+
+            /* Point a read-only Decimal at the coefficient in the mapping */
+            number.flags = (uint8_t)(
+                number_node->flags | MPD_STATIC | MPD_CONST_DATA
+            );
+            number.exp = number_node->exp;
+            number.digits = number_node->digits;
+            number.len = (mpd_ssize_t)number_node->len;
+            number.alloc = (mpd_ssize_t)number_node->len;
+            number.data = (mpd_uint_t *)(number_node + 1);
+
+            value->type = VALUE_NUMBER;
+            decimal_init(&value->as.number, value->decimal_data);
+
+            if (!decimal_copy(&value->as.number, &number, status)) {
+                value->type = VALUE_NONE;
+                return false;
+            }
+
+            return status_ok(status);
+        case SNAPSHOT_NODE_STRING:
+            if (!snapshot_string(snapshot, offset, &string_node, status)) {
+                return false;
+            }
+
+            return value_init_string_full(
+                value,
+                (const char *)(string_node + 1),
+                string_node->len,
+                string_node->byte_len,
+                status
+            );
+        case SNAPSHOT_NODE_ARRAY:
+        case SNAPSHOT_NODE_TABLE:
+            if (!snapshot_node(snapshot, offset,
+                                         sizeof(SnapshotArray),
+                                         (const void **)&container_node,
+                                         status)) {
+                return false;
+            }
+
+            snapshot_retain(snapshot);
+            value->type = VALUE_SNAPSHOT;
+            value->as.snapshot.snapshot = snapshot;
+            value->as.snapshot.offset = offset;
+
+            return status_ok(status);
+        default:
+            return invalid_format(status);
+    }
+}
+
+bool snapshot_load(Value *value, const char *path, Status *status) {
+    struct stat st;
+    const SnapshotHeader *header = NULL;
+    Snapshot *snapshot = NULL;
+    void *data = NULL;
+    int fd = open(path, O_RDONLY);
+
+    value->type = VALUE_NONE;
+
+    if (fd == -1) {
+        return opening_file_failed(status);
+    }
+
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return reading_file_failed(status);
+    }
+
+    if (((size_t)st.st_size) < sizeof(SnapshotHeader)) {
+        close(fd);
+        return invalid_format(status);
+    }
+
+    data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    close(fd);
+
+    if (data == MAP_FAILED) {
+        return reading_file_failed(status);
+    }
+
+    header = data;
+
+    if ((memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0) ||
+            (header->size != (uint64_t)st.st_size)) {
+        munmap(data, (size_t)st.st_size);
+        return invalid_format(status);
+    }
+
+    if ((header->version != SNAPSHOT_VERSION) ||
+            (header->byte_order != SNAPSHOT_BYTE_ORDER_MARK) ||
+            (header->word_size != sizeof(mpd_uint_t))) {
+        munmap(data, (size_t)st.st_size);
+        return unsupported_version(status);
+    }
+
+    snapshot = malloc(sizeof(Snapshot));
+
+    if (!snapshot) {
+        munmap(data, (size_t)st.st_size);
+        return alloc_failure(status);
+    }
+
+    refcount_init(&snapshot->refcount);
+    snapshot->data = data;
+    snapshot->len = (size_t)st.st_size;
+
+    if (!snapshot_read_value(snapshot, header->root, value, status)) {
+        snapshot_release(snapshot);
+        return false;
+    }
+
+    /* Containers hold their own reference; scalars didn't need one */
+    snapshot_release(snapshot);
+
+    return status_ok(status);
+}
+
+bool snapshot_convert_json(const char *json_path, const char *snapshot_path,
+                                                  DecimalContext *ctx,
+                                                  Status *status) {
+    Value value;
+
+    if (!json_load_path(&value, json_path, ctx, status)) {
+        return false;
+    }
+
+    if (!snapshot_save(&value, snapshot_path, status)) {
+        value_free(&value);
+        return false;
+    }
+
+    value_free(&value);
+
+    return status_ok(status);
+}
+
+bool snapshot_value_is_table(Value *value) {
+    const uint32_t *type = (const uint32_t *)(
+        value->as.snapshot.snapshot->data + value->as.snapshot.offset
+    );
+
+    return *type == SNAPSHOT_NODE_TABLE;
+}
+
+size_t snapshot_value_length(Value *value) {
+    const SnapshotArray *node = (const SnapshotArray *)(
+        value->as.snapshot.snapshot->data + value->as.snapshot.offset
+    );
+
+    return node->count;
+}
+
+bool snapshot_value_index(Value *value, size_t index, Value *element,
+                                                      Status *status) {
+    Snapshot *snapshot = value->as.snapshot.snapshot;
+    const SnapshotArray *node = NULL;
+    const uint64_t *elements = NULL;
+    Value tmp;
+
+    if (!snapshot_container(value, &node, status)) {
+        return false;
+    }
+
+    if (index >= node->count) {
+        return index_out_of_bounds(status);
+    }
+
+    if (!snapshot_node_items(snapshot, value->as.snapshot.offset,
+                                       sizeof(SnapshotArray),
+                                       node->count,
+                                       sizeof(uint64_t),
+                                       (const void **)&node,
+                                       status)) {
+        return false;
+    }
+
+    elements = (const uint64_t *)(node + 1);
+
+    if (!snapshot_read_value(snapshot, elements[index], &tmp, status)) {
+        return false;
+    }
+
+    value_free(element);
+    value_move(element, &tmp);
+
+    return status_ok(status);
+}
+
+/* Binary searches the table's sorted entry indices */
+bool snapshot_value_lookup(Value *value, SSlice *key, Value *element,
+                                                      Status *status) {
+    Snapshot *snapshot = value->as.snapshot.snapshot;
+    const SnapshotTable *node = NULL;
+    const SnapshotTableEntry *entries = NULL;
+    const uint64_t *sorted = NULL;
+    size_t low = 0;
+    size_t high = 0;
+    Value tmp;
+
+    if (!snapshot_container(value, &node, status)) {
+        return false;
+    }
+
+    if (!snapshot_node_items(snapshot, value->as.snapshot.offset,
+                                       sizeof(SnapshotTable),
+                                       node->count,
+                                       SNAPSHOT_TABLE_ITEM_SIZE,
+                                       (const void **)&node,
+                                       status)) {
+        return false;
+    }
+
+    entries = (const SnapshotTableEntry *)(node + 1);
+    sorted = (const uint64_t *)(entries + node->count);
+    high = node->count;
+
+    while (low < high) {
+        size_t mid = low + ((high - low) / 2);
+        const SnapshotTableEntry *entry = NULL;
+        const SnapshotString *entry_key = NULL;
+        int res = 0;
+
+        if (sorted[mid] >= node->count) {
+            return invalid_format(status);
+        }
+
+        entry = &entries[sorted[mid]];
+
+        if (!snapshot_string(snapshot, entry->key, &entry_key, status)) {
+            return false;
+        }
+
+        res = compare_keys(
+            (const char *)(entry_key + 1),
+            entry_key->byte_len,
+            key->data,
+            key->byte_len
+        );
+
+        if (res == 0) {
+            if (!snapshot_read_value(snapshot, entry->value, &tmp, status)) {
+                return false;
+            }
+
+            value_free(element);
+            value_move(element, &tmp);
+
+            return status_ok(status);
+        }
+
+        if (res < 0) {
+            low = mid + 1;
+        }
+        else {
+            high = mid;
+        }
+    }
+
+    return not_found(status);
+}
+
+static
+bool snapshot_materialize_node(Snapshot *snapshot, uint64_t offset,
+                                                   Value *value,
+                                                   Status *status) {
+    const SnapshotArray *node = NULL;
+    const uint64_t *elements = NULL;
+    const SnapshotTableEntry *entries = NULL;
+    Value tmp;
+
+    if (!snapshot_read_value(snapshot, offset, &tmp, status)) {
+        return false;
+    }
+
+    if (tmp.type != VALUE_SNAPSHOT) {
+        value_move(value, &tmp);
+        return status_ok(status);
+    }
+
+    node = (const SnapshotArray *)(snapshot->data + offset);
+
+    if (node->type == SNAPSHOT_NODE_ARRAY) {
+        if ((!snapshot_node_items(snapshot, offset,
+                                            sizeof(SnapshotArray),
+                                            node->count,
+                                            sizeof(uint64_t),
+                                            (const void **)&node,
+                                            status)) ||
+                (!value_init_array(value, status))) {
+            value_free(&tmp);
+            return false;
+        }
+
+        elements = (const uint64_t *)(node + 1);
+
+        for (size_t i = 0; i < node->count; i++) {
+            Value *slot = NULL;
+
+            if ((!value_array_append(value, &slot, status)) ||
+                    (!snapshot_materialize_node(snapshot, elements[i],
+                                                          slot,
+                                                          status))) {
+                value_free(value);
+                value_free(&tmp);
+                return false;
+            }
+        }
+    }
+    else {
+        if ((!snapshot_node_items(snapshot, offset,
+                                            sizeof(SnapshotTable),
+                                            node->count,
+                                            SNAPSHOT_TABLE_ITEM_SIZE,
+                                            (const void **)&node,
+                                            status)) ||
+                (!value_init_ordered_table(value, status))) {
+            value_free(&tmp);
+            return false;
+        }
+
+        entries = (const SnapshotTableEntry *)(node + 1);
+
+        for (size_t i = 0; i < node->count; i++) {
+            const SnapshotString *key_node = NULL;
+            Value *slot = NULL;
+            SSlice key;
+
+            if (!snapshot_string(snapshot, entries[i].key, &key_node,
+                                                           status)) {
+                value_free(value);
+                value_free(&tmp);
+                return false;
+            }
+
+            key.data = (const char *)(key_node + 1);
+            key.len = key_node->len;
+            key.byte_len = key_node->byte_len;
+
+            if ((!value_table_insert(value, &key, &slot, status)) ||
+                    (!snapshot_materialize_node(snapshot, entries[i].value,
+                                                          slot,
+                                                          status))) {
+                value_free(value);
+                value_free(&tmp);
+                return false;
+            }
+        }
+    }
+
+    value_free(&tmp);
+
+    return status_ok(status);
+}
+
+bool snapshot_value_materialize(Value *value, Status *status) {
+    Value tmp;
+
+    tmp.type = VALUE_NONE;
+
+    if (!snapshot_materialize_node(value->as.snapshot.snapshot,
+                                   value->as.snapshot.offset,
+                                   &tmp,
+                                   status)) {
+        return false;
+    }
+
+    value_free(value);
+    value_move(value, &tmp);
+
+    return status_ok(status);
+}
+
+/* vi: set et ts=4 sw=4: */
@@ -0,0 +1,119 @@
+#ifndef SNAPSHOT_H__
+#define SNAPSHOT_H__
+
+enum {
+    SNAPSHOT_OPENING_FILE_FAILED = 1,
+    SNAPSHOT_READING_FILE_FAILED,
+    SNAPSHOT_WRITING_FILE_FAILED,
+    SNAPSHOT_INVALID_FORMAT,
+    SNAPSHOT_UNSUPPORTED_VERSION,
+    SNAPSHOT_UNSUPPORTED_TYPE,
+};
+
+/*
+ * A snapshot is a Value tree serialized so that it can be mmap'd and read in
+ * place: loading one maps the file, checks the header and returns a
+ * VALUE_SNAPSHOT for the root container.  Lookups and indexing follow offsets
+ * within the mapping, so nothing is deserialized until a scalar is actually
+ * read.  The mapping is shared by every render using it and is released when
+ * the last Value referring to it goes away.
+ *
+ * Layout (native byte order, every node 8-byte aligned, offsets from the start
+ * of the file):
+ *
+ *   header:  SnapshotHeader
+ *   number:  SnapshotNumber, then `len` mpdecimal coefficient words
+ *   string:  SnapshotString, then `byte_len` bytes and a NUL
+ *   array:   SnapshotArray, then `count` element offsets
+ *   table:   SnapshotTable, then `count` SnapshotTableEntry in iteration
+ *            order (insertion order for ordered tables), then `count` entry
+ *            indices sorted by key.  Tables are materialized as ordered
+ *            tables, so iterating over one gives the same order as iterating
+ *            over the table it was written from
+ *   none, true, false: a bare node type
+ *
+ * Identical strings (keys or values) are stored once.  Snapshots depend on
+ * byte order and the decimal word size, both of which are recorded in the
+ * header and checked when loading.
+ */
+
+#define SNAPSHOT_MAGIC "SSTSNAP"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_BYTE_ORDER_MARK 0x01020304
+
+typedef enum {
+    SNAPSHOT_NODE_NONE,
+    SNAPSHOT_NODE_TRUE,
+    SNAPSHOT_NODE_FALSE,
+    SNAPSHOT_NODE_NUMBER,
+    SNAPSHOT_NODE_STRING,
+    SNAPSHOT_NODE_ARRAY,
+    SNAPSHOT_NODE_TABLE,
+} SnapshotNodeType;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t word_size;
+    uint32_t reserved;
+    uint64_t size;
+    uint64_t root;
+} SnapshotHeader;
+
+typedef struct {
+    uint32_t type;
+    uint32_t flags;
+    int64_t exp;
+    int64_t digits;
+    uint64_t len;
+} SnapshotNumber;
+
+typedef struct {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t len;
+    uint64_t byte_len;
+} SnapshotString;
+
+typedef struct {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t count;
+} SnapshotArray;
+
+typedef SnapshotArray SnapshotTable;
+
+typedef struct {
+    uint64_t key;
+    uint64_t value;
+} SnapshotTableEntry;
+
+struct Snapshot {
+    size_t refcount;
+    const char *data;
+    size_t len;
+};
+
+typedef struct Snapshot Snapshot;
+
+bool snapshot_save(Value *value, const char *path, Status *status);
+bool snapshot_load(Value *value, const char *path, Status *status);
+bool snapshot_convert_json(const char *json_path, const char *snapshot_path,
+                                                  DecimalContext *ctx,
+                                                  Status *status);
+
+void snapshot_retain(Snapshot *snapshot);
+void snapshot_release(Snapshot *snapshot);
+
+bool snapshot_value_is_table(Value *value);
+bool snapshot_value_index(Value *value, size_t index, Value *element,
+                                                      Status *status);
+bool snapshot_value_lookup(Value *value, SSlice *key, Value *element,
+                                                      Status *status);
+size_t snapshot_value_length(Value *value);
+bool snapshot_value_materialize(Value *value, Status *status);
+
+#endif
+
+/* vi: set et ts=4 sw=4: */
@@ -1,5 +1,6 @@
 #include <cbase.h>
 #include <stdio.h>
+#include <pthread.h>
 
 #include "config.h"
 
@@ -9,13 +10,19 @@
 #include "lexer.h"
 #include "expression_parser.h"
 #include "parser.h"
+#include "function.h"
+#include "expression.h"
+#include "expression_evaluator.h"
+#include "builtins.h"
+#include "escape.h"
+#include "fragment_cache.h"
 #include "template.h"
-
-/*
- * [TODO] Create a cache system to avoid re-parsing templates (`include`, etc.)
- */
+#include "render_pool.h"
 
 #define BUF_SIZE 2048
+#define TEMPLATE_INIT_ALLOC 64
+#define TEMPLATE_INCLUDE_DEPTH_MAX 32
+#define TEMPLATE_NO_NODE ((size_t)-1)
 
 #define opening_file_failed(status) status_failure( \
     status,                                         \
@@ -38,198 +45,137 @@
     "Reading file data failed"                           \
 )
 
-#define failed_to_replace_include_node(status) status_failure( \
-    status,                                                    \
-    "template",                                                \
-    TEMPLATE_FAILED_TO_REPLACE_INCLUDE_NODE,                   \
-    "Failed to replace include node"                           \
+#define include_depth_exceeded(status) status_failure( \
+    status,                                            \
+    "template",                                        \
+    TEMPLATE_INCLUDE_DEPTH_EXCEEDED,                   \
+    "Include depth exceeded"                           \
 )
 
-static bool template_render(Template *template, Value *context,
-                                                String *output,
-                                                Status *status) {
-    String buf;
-    Array included_nodes;
-
-    if (!string_init(&buf, "", status)) {
-        return false;
-    }
-
-    if (!string_ensure_capacity(&buf, INIT_RENDER_BUF_ALLOC, status)) {
-        return false;
-    }
-
-    if (!array_init_alloc(&included_nodes, sizeof(ASTNode), INIT_NODE_ALLOC,
-                                                            status)) {
-        string_free(&buf);
-        return false;
-    }
-
-    for (size_t i = 0; i < nodes->len; i++) {
-        ASTNode *node = array_index_fast(nodes, i);
-
-        if (node->type != AST_NODE_INCLUDE) {
-            continue;
-        }
-
-        array_clear(&included_nodes);
-
-        if (!string_assign_slice(&buf, &node->as.include, status)) {
-            string_free(&buf);
-            array_free(&included_nodes);
-            return false;
-        }
-
-        if (!template_parse_path(&included_nodes, buf.data, status)) {
-            string_free(&buf);
-            array_free(&included_nodes);
-            return false;
-        }
+#define mismatched_block_end(status) status_failure( \
+    status,                                          \
+    "template",                                      \
+    TEMPLATE_MISMATCHED_BLOCK_END,                   \
+    "Mismatched block end"                           \
+)
 
-        if (!array_delete(nodes, i, status)) {
-            string_free(&buf);
-            array_free(&included_nodes);
-            return false;
-        }
+#define unterminated_block(status) status_failure( \
+    status,                                        \
+    "template",                                    \
+    TEMPLATE_UNTERMINATED_BLOCK,                   \
+    "Unterminated block"                           \
+)
 
-        array_insert_array_fast(nodes, &included_nodes, i);
-    }
+#define non_boolean_conditional(status) status_failure( \
+    status,                                             \
+    "template",                                         \
+    TEMPLATE_NON_BOOLEAN_CONDITIONAL,                   \
+    "Non-boolean expression in conditional"             \
+)
 
-    for (size_t i = 0; i < nodes->len; i++) {
-        ASTNode *node = array_index_fast(nodes, i);
+#define non_iterable_expression(status) status_failure( \
+    status,                                             \
+    "template",                                         \
+    TEMPLATE_NON_ITERABLE_EXPRESSION,                   \
+    "Non-iterable expression in iteration"              \
+)
 
-        switch(node->type) {
-            case AST_NODE_TEXT:
-                if (!string_append(output, node->as.text, status)) {
-                    string_free(&buf);
-                    array_free(&included_nodes);
-                    return false;
-                }
-                break;
-            case AST_NODE_INCLUDE:
-                string_free(&buf);
-                array_free(&included_nodes);
-                return failed_to_replace_include_node(status);
-            case AST_NODE_EXPRESSION:
-                if (!expression_evaluator_evaluate(
-                        &t->expression_evaluator,
-                        &t->parser.expression_parser.output,
-                        context,
-                        status)) {
-                    string_free(&buf);
-                    array_free(&included_nodes);
-                    return false;
-                }
+#define loop_control_in_cache(status) status_failure( \
+    status,                                           \
+    "template",                                       \
+    TEMPLATE_LOOP_CONTROL_IN_CACHE,                   \
+    "\"break\" or \"continue\" out of a cache block"    \
+)
 
-                string_free(&buf);
-                array_free(&included_nodes);
-                return value_to_string(
-                    &t->parser.expression_parser.output,
-                    output,
-                    status
-                );
-            case AST_NODE_CONDITIONAL:
-                if (!expression_evaluator_evaluate(
-                        &t->expression_evaluator,
-                        &t->parser.expression_parser.output,
-                        context,
-                        status)) {
-                    string_free(&buf);
-                    array_free(&included_nodes);
-                    return false;
-                }
+/*
+ * An open `if`, `for` or `cache` while compiling.  For conditionals, `node`
+ * is the latest branch's CONDITIONAL (TEMPLATE_NO_NODE after `else`) and
+ * `jumps` chains the JUMPs ending each branch through their `jump` fields,
+ * all of which are patched at `endif`.
+ */
+typedef struct {
+    TemplateNodeType type;
+    size_t node;
+    size_t jumps;
+} TemplateBlock;
 
-                if (t->parser.expression_parser.output.type != VALUE_BOOLEAN) {
-                    string_free(&buf);
-                    array_free(&included_nodes);
-                    return non_boolean_expression_in_conditional(status);
-                }
+/*
+ * `locals` holds the loop variables in scope, each one's index being its
+ * frame slot (see expression.h).
+ */
+typedef struct {
+    Template *template;
+    Array blocks;
+    Array locals;
+    DecimalContext ctx;
+    size_t include_depth;
+} TemplateCompiler;
 
-                if (t->parser.expression_parser.output.as.boolean) {
-                    // Execute until ELSE or END
-                }
-                else {
-                    // Skip until ELSE or END
-                }
-                break;
-            case AST_NODE_ITERATION:
-                node_index = i;
-
-                // Have to build an iterator
-                // Save node index
-                //   (incidentally, this has to be updated if `include` happens)
-                // Evaluate iterator expression: array
-                // Make index 0 -> array.len
-                // Assign iterator identifier to array_index(0)
-                // Execute until BREAK, CONTINUE, or END
-                break;
-            case AST_NODE_ELSE:
-            case AST_NODE_CONDITIONAL_END:
-            case AST_NODE_BREAK:
-            case AST_NODE_CONTINUE:
-            case AST_NODE_ITERATION_END:
-            default:
-                string_free(&buf);
-                array_free(&included_nodes);
-                return invalid_ast(status);
-        }
-    }
+/*
+ * How far the line being compiled is from holding nothing but block tags
+ * (see template_set_trim_blocks): `line_start` while there's only been
+ * whitespace on it, `block_line` while there's only been whitespace and
+ * block tags.  `indent` is the TEXT node ending with the line's indentation,
+ * `indent_len` bytes of it, if there is one.
+ */
+typedef struct {
+    bool line_start;
+    bool block_line;
+    size_t indent;
+    size_t indent_len;
+} TemplateLine;
 
-    return status_ok(status);
+static const char *TemplateLoopMetaNames[TEMPLATE_LOOP_META_COUNT] = {
+    "loop.index",
+    "loop.first",
+    "loop.last",
+    "loop.length",
+};
 
-error:
-    string_free(&buf);
-    array_free(&included_nodes);
-    return false;
-}
+/*
+ * Template ids are shared by every thread compiling templates.
+ */
+static size_t template_ids = 0;
 
-void template_init(Template *t) {
-    array_init(&t->nodes);
-    expression_evaluator_init(&t->expression_evaluator);
+static inline
+size_t template_next_id(void) {
+    return __atomic_add_fetch(&template_ids, 1, __ATOMIC_RELAXED);
 }
 
-bool template_init_alloc(Template *t, size_t node_cache_size,
-                                      size_t expression_node_cache_size,
-                                      Status *status) {
-    if (!array_init_alloc(&t->nodes, node_cache_size, status)) {
-        return false;
-    }
-
-    if (!expression_evaluator_init_alloc(&t->expression_evaluator,
-                                         expression_node_cache_size,
-                                         status)) {
-        array_free(&t->nodes);
-        return false;
-    }
-
-    return status_ok(status);
+static inline
+size_t template_node_meta_local(TemplateNode *node) {
+    return node->local + (node->value_text.len > 0 ? 2 : 1);
 }
 
-bool template_parse_path(Template *t, const char *path, Status *status) {
+static bool template_read_file(const char *path, String *s, Status *status) {
     char buf[BUF_SIZE];
-    String s;
     FILE *template_file = fopen(path, "rb");
-    size_t file_size = 0;
+    long file_size = 0;
 
     if (!template_file) {
         return opening_file_failed(status);
     }
 
     if (fseek(template_file, 0, SEEK_END) == -1) {
+        fclose(template_file);
         return seeking_in_file_failed(status);
     }
 
     file_size = ftell(template_file);
 
     if (fseek(template_file, 0, SEEK_SET) == -1) {
+        fclose(template_file);
         return seeking_in_file_failed(status);
     }
 
-    if (!string_init(&s, "", status)) {
+    if (!string_init(s, "", status)) {
+        fclose(template_file);
         return false;
     }
 
-    if (!string_ensure_capacity(&s, file_size + 1, status)) {
+    if (!string_ensure_capacity(s, file_size + 1, status)) {
+        fclose(template_file);
+        string_free(s);
         return false;
     }
 
@@ -239,9 +185,9 @@ bool template_parse_path(Template *t, const char *path, Status *status) {
         bytes_read = fread(buf, sizeof(buf[0]), sizeof(buf), template_file);
 
         if (bytes_read > 0) {
-            if (!string_append_cstr_len(&s, buf, bytes_read, status)) {
+            if (!string_append_cstr_len(s, buf, bytes_read, status)) {
                 fclose(template_file);
-                string_free(&s);
+                string_free(s);
                 return false;
             }
         }
@@ -249,7 +195,7 @@ bool template_parse_path(Template *t, const char *path, Status *status) {
         if (bytes_read != (sizeof(buf[0]) * sizeof(buf))) {
             if (!feof(template_file)) {
                 fclose(template_file);
-                string_free(&s);
+                string_free(s);
                 return reading_file_data_failed(status);
             }
 
@@ -259,76 +205,1985 @@ bool template_parse_path(Template *t, const char *path, Status *status) {
 
     fclose(template_file);
 
-    if (!template_parse_data(t, &s, status)) {
-        string_free(&s);
+    return status_ok(status);
+}
+
+static bool compiler_emit(TemplateCompiler *compiler, TemplateNodeType type,
+                                                      TemplateNode **node,
+                                                      Status *status) {
+    TemplateNode *new_node = NULL;
+
+    if (!array_append(&compiler->template->nodes, (void **)&new_node,
+                                                  status)) {
         return false;
     }
 
-    string_free(&s);
+    new_node->type = type;
+    new_node->text.data = NULL;
+    new_node->text.len = 0;
+    new_node->text.byte_len = 0;
+    new_node->value_text.data = NULL;
+    new_node->value_text.len = 0;
+    new_node->value_text.byte_len = 0;
+    new_node->local = 0;
+    new_node->uses_meta = false;
+    new_node->parallel = false;
+    new_node->expression = 0;
+    new_node->jump = TEMPLATE_NO_NODE;
+    new_node->escape = false;
+
+    *node = new_node;
 
     return status_ok(status);
 }
 
-bool template_parse_data(Template *t, String *input, Status *status) {
-    Parser parser;
-    SSlice data;
+static inline
+TemplateNode* compiler_node(TemplateCompiler *compiler, size_t index) {
+    return array_index_fast(&compiler->template->nodes, index);
+}
+
+static inline
+size_t compiler_next_node(TemplateCompiler *compiler) {
+    return compiler->template->nodes.len;
+}
+
+/*
+ * Marks the loops whose `loop.*` locals `expression` reads.
+ */
+static void compiler_note_meta_uses(TemplateCompiler *compiler,
+                                    Expression *expression) {
+    for (size_t i = 0; i < expression->instructions.len; i++) {
+        Instruction *instruction = array_index_fast(
+            &expression->instructions,
+            i
+        );
+
+        if (instruction->type != INSTRUCTION_LOCAL) {
+            continue;
+        }
+
+        for (size_t j = 0; j < compiler->blocks.len; j++) {
+            TemplateBlock *block = array_index_fast(&compiler->blocks, j);
+            TemplateNode *node = NULL;
+            size_t meta = 0;
+
+            if (block->type != TEMPLATE_NODE_ITERATION) {
+                continue;
+            }
+
+            node = compiler_node(compiler, block->node);
+            meta = template_node_meta_local(node);
+
+            if ((instruction->as.local >= meta) &&
+                (instruction->as.local < meta + TEMPLATE_LOOP_META_COUNT)) {
+                node->uses_meta = true;
+            }
+        }
+    }
+}
 
-    if (!string_slice(buf, 0, buf->len, &data)) {
+/*
+ * Compiles the expression the parser just read, emitting a `type` node for
+ * it.
+ */
+static bool compiler_emit_expression(TemplateCompiler *compiler,
+                                     Parser *parser,
+                                     TemplateNodeType type,
+                                     TemplateNode **node,
+                                     Status *status) {
+    Template *t = compiler->template;
+    Expression *expression = NULL;
+
+    if (!array_append(&t->expressions, (void **)&expression, status)) {
         return false;
     }
 
-    if (!parser_init(&parser, &data, status)) {
+    if (!expression_init(expression, status)) {
+        array_truncate_fast(&t->expressions, t->expressions.len - 1);
         return false;
     }
 
-    while (true) {
-        ASTNode *node = NULL;
-        
-        if (!array_append(&t->nodes, (void **)&node, status)) {
-            parser_free(&parser);
-            return false;
+    if (!expression_compile(expression, &parser->expression_parser.output,
+                                         &compiler->locals,
+                                         t->functions,
+                                         &compiler->ctx,
+                                         status)) {
+        expression_free(expression);
+        array_truncate_fast(&t->expressions, t->expressions.len - 1);
+        return false;
+    }
+
+    if (!compiler_emit(compiler, type, node, status)) {
+        return false;
+    }
+
+    (*node)->expression = t->expressions.len - 1;
+
+    compiler_note_meta_uses(compiler, expression);
+
+    return status_ok(status);
+}
+
+static bool compiler_add_local(TemplateCompiler *compiler, SSlice *name,
+                                                          Status *status) {
+    SSlice *local = NULL;
+
+    if (!array_append(&compiler->locals, (void **)&local, status)) {
+        return false;
+    }
+
+    sslice_copy(local, name);
+
+    return status_ok(status);
+}
+
+static bool compiler_push_block(TemplateCompiler *compiler,
+                                TemplateNodeType type,
+                                size_t node,
+                                Status *status) {
+    TemplateBlock *block = NULL;
+
+    if (!array_append(&compiler->blocks, (void **)&block, status)) {
+        return false;
+    }
+
+    block->type = type;
+    block->node = node;
+    block->jumps = TEMPLATE_NO_NODE;
+
+    return status_ok(status);
+}
+
+static TemplateBlock* compiler_top_block(TemplateCompiler *compiler,
+                                         size_t base,
+                                         TemplateNodeType type) {
+    TemplateBlock *block = NULL;
+
+    if (compiler->blocks.len <= base) {
+        return NULL;
+    }
+
+    block = array_index_fast(&compiler->blocks, compiler->blocks.len - 1);
+
+    if (block->type != type) {
+        return NULL;
+    }
+
+    return block;
+}
+
+static
+TemplateBlock* compiler_innermost_iteration(TemplateCompiler *compiler) {
+    for (size_t i = compiler->blocks.len; i > 0; i--) {
+        TemplateBlock *block = array_index_fast(&compiler->blocks, i - 1);
+
+        if (block->type == TEMPLATE_NODE_ITERATION) {
+            return block;
         }
+    }
 
-        if (!parser_load_next(&parser, node, status)) {
-            if (!status_match(status, "parser", PARSER_EOF)) {
-                parser_free(&parser);
-                return false;
-            }
+    return NULL;
+}
 
+/*
+ * Whether a `cache` block has been opened inside `loop`, which `break` and
+ * `continue` can't jump out of.
+ */
+static bool compiler_caching_in(TemplateCompiler *compiler,
+                                TemplateBlock *loop) {
+    for (size_t i = compiler->blocks.len; i > 0; i--) {
+        TemplateBlock *block = array_index_fast(&compiler->blocks, i - 1);
+
+        if (block == loop) {
             break;
         }
+
+        if (block->type == TEMPLATE_NODE_CACHE) {
+            return true;
+        }
     }
 
-    parser_free(&parser);
+    return false;
+}
+
+static size_t compiler_iteration_depth(TemplateCompiler *compiler) {
+    size_t depth = 0;
+
+    for (size_t i = 0; i < compiler->blocks.len; i++) {
+        TemplateBlock *block = array_index_fast(&compiler->blocks, i);
+
+        if (block->type == TEMPLATE_NODE_ITERATION) {
+            depth++;
+        }
+    }
+
+    return depth;
+}
+
+/*
+ * Ends the current branch of a conditional with a JUMP past its end, and
+ * points the branch's CONDITIONAL at whatever comes next.
+ */
+static bool compiler_end_branch(TemplateCompiler *compiler,
+                                TemplateBlock *block,
+                                Status *status) {
+    TemplateNode *node = NULL;
+
+    if (block->node == TEMPLATE_NO_NODE) {
+        return mismatched_block_end(status);
+    }
+
+    if (!compiler_emit(compiler, TEMPLATE_NODE_JUMP, &node, status)) {
+        return false;
+    }
+
+    node->jump = block->jumps;
+    block->jumps = compiler_next_node(compiler) - 1;
+    compiler_node(compiler, block->node)->jump = compiler_next_node(compiler);
+    block->node = TEMPLATE_NO_NODE;
 
     return status_ok(status);
 }
 
-bool template_render_path(Template *t, const char *path, Value *context,
-                                                         String *output,
-                                                         Status *status) {
-    return (
-        template_parse_path(t, path, status) &&
-        template_render(t, context, output, status)
-    );
+static void compiler_end_conditional(TemplateCompiler *compiler,
+                                     TemplateBlock *block) {
+    size_t end = compiler_next_node(compiler);
+    size_t jump = block->jumps;
+
+    if (block->node != TEMPLATE_NO_NODE) {
+        compiler_node(compiler, block->node)->jump = end;
+    }
+
+    while (jump != TEMPLATE_NO_NODE) {
+        TemplateNode *node = compiler_node(compiler, jump);
+
+        jump = node->jump;
+        node->jump = end;
+    }
+
+    array_truncate_fast(&compiler->blocks, compiler->blocks.len - 1);
 }
 
-bool template_render_data(Template *t, String *input, Value *context,
-                                                      String *output,
-                                                      Status *status) {
+static bool compiler_compile_source(TemplateCompiler *compiler,
+                                    String *source,
+                                    Status *status);
+
+/*
+ * Whether the body of the loop starting at `start` and ending at `end` can
+ * have its iterations rendered independently: it mustn't `break` out of the
+ * loop, and it mustn't call impure functions, which might have side effects
+ * or depend on the order they're called in.
+ */
+static bool compiler_loop_is_parallel(TemplateCompiler *compiler,
+                                      size_t start,
+                                      size_t end) {
+    Template *t = compiler->template;
+
+    for (size_t i = start + 1; i < end; i++) {
+        TemplateNode *node = compiler_node(compiler, i);
+        Expression *expression = NULL;
+
+        if ((node->type == TEMPLATE_NODE_BREAK) && (node->jump == start)) {
+            return false;
+        }
+
+        if ((node->type != TEMPLATE_NODE_EXPRESSION) &&
+            (node->type != TEMPLATE_NODE_CONDITIONAL) &&
+            (node->type != TEMPLATE_NODE_ITERATION) &&
+            (node->type != TEMPLATE_NODE_CACHE)) {
+            continue;
+        }
+
+        expression = array_index_fast(&t->expressions, node->expression);
+
+        for (size_t j = 0; j < expression->instructions.len; j++) {
+            Instruction *instruction = array_index_fast(
+                &expression->instructions,
+                j
+            );
+
+            if ((instruction->type == INSTRUCTION_CALL) &&
+                    (!instruction->as.function->pure)) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Whether `expression` is a call to the `safe` builtin, marking its output
+ * as not to be escaped, or the `escape` builtin, whose output already is.
+ */
+static bool expression_is_safe(Expression *expression) {
+    Instruction *last = array_index_fast(
+        &expression->instructions,
+        expression->instructions.len - 1
+    );
+
     return (
-        template_parse_data(t, input, status) &&
-        template_render(t, context, output, status)
+        (last->type == INSTRUCTION_CALL) &&
+        builtins_is_escaped(last->as.function)
     );
 }
 
-void template_clear(Template *t) {
-    array_clear(&t->nodes);
-    expression_evaluator_clear(&t->expression_evaluator);
+static bool compiler_compile_include(TemplateCompiler *compiler,
+                                     SSlice *include,
+                                     Status *status) {
+    String *source = NULL;
+    char *path = NULL;
+    bool compiled = false;
+
+    if (compiler->include_depth >= TEMPLATE_INCLUDE_DEPTH_MAX) {
+        return include_depth_exceeded(status);
+    }
+
+    path = sslice_to_cstr(include);
+
+    if (!path) {
+        return alloc_failure(status);
+    }
+
+    source = malloc(sizeof(String));
+
+    if (!source) {
+        free(path);
+        return alloc_failure(status);
+    }
+
+    if (!template_read_file(path, source, status)) {
+        free(source);
+        free(path);
+        return false;
+    }
+
+    if (!parray_append(&compiler->template->paths, path, status)) {
+        string_free(source);
+        free(source);
+        free(path);
+        return false;
+    }
+
+    compiler->include_depth++;
+    compiled = compiler_compile_source(compiler, source, status);
+    compiler->include_depth--;
+
+    return compiled;
 }
 
-void template_free(Template *t) {
-    array_free(&t->nodes);
-    expression_evaluator_free(&t->expression_evaluator);
+static bool ast_node_is_block_tag(ASTNode *ast_node) {
+    switch (ast_node->type) {
+        case AST_NODE_CONDITIONAL:
+        case AST_NODE_ELSE:
+        case AST_NODE_ELSE_IF:
+        case AST_NODE_CONDITIONAL_END:
+        case AST_NODE_ITERATION:
+        case AST_NODE_BREAK:
+        case AST_NODE_CONTINUE:
+        case AST_NODE_ITERATION_END:
+        case AST_NODE_CACHE:
+        case AST_NODE_CACHE_END:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/*
+ * Whether `text` starts with the end of a blank line: spaces and tabs, then
+ * a line break, `*len` bytes in all.
+ */
+static bool text_starts_blank_line(SSlice *text, size_t *len) {
+    size_t i = 0;
+
+    while ((i < text->byte_len) &&
+           ((text->data[i] == ' ') || (text->data[i] == '\t'))) {
+        i++;
+    }
+
+    if ((i < text->byte_len) && (text->data[i] == '\r')) {
+        i++;
+    }
+
+    if ((i < text->byte_len) && (text->data[i] == '\n')) {
+        *len = i + 1;
+        return true;
+    }
+
+    return false;
+}
+
+/*
+ * Whether `text` ends with the start of a blank line: a line break (or the
+ * start of `text`, if it starts a line), then `*len` bytes of spaces and
+ * tabs.
+ */
+static bool text_ends_blank_line(SSlice *text, bool line_start,
+                                               size_t *len) {
+    size_t i = text->byte_len;
+
+    while ((i > 0) &&
+           ((text->data[i - 1] == ' ') || (text->data[i - 1] == '\t'))) {
+        i--;
+    }
+
+    *len = text->byte_len - i;
+
+    return (i == 0) ? line_start : (text->data[i - 1] == '\n');
 }
+
+static void compiler_strip_indent(TemplateCompiler *compiler,
+                                  TemplateLine *line) {
+    TemplateNode *node = NULL;
+
+    if (line->indent == TEMPLATE_NO_NODE) {
+        return;
+    }
+
+    /* Whitespace is all ASCII, so it's a byte per rune */
+    node = compiler_node(compiler, line->indent);
+    node->text.len -= line->indent_len;
+    node->text.byte_len -= line->indent_len;
+    line->indent = TEMPLATE_NO_NODE;
+}
+
+/*
+ * Tracks the line `ast_node` is on, and once a line turns out to hold
+ * nothing but block tags, strips its indentation and line break, the latter
+ * from `ast_node` itself.
+ */
+static void compiler_trim_blocks(TemplateCompiler *compiler,
+                                 TemplateLine *line,
+                                 ASTNode *ast_node) {
+    SSlice *text = &ast_node->as.text;
+    size_t len = 0;
+
+    if (ast_node_is_block_tag(ast_node)) {
+        line->block_line = line->line_start || line->block_line;
+        line->line_start = false;
+        return;
+    }
+
+    if (ast_node->type != AST_NODE_TEXT) {
+        line->line_start = false;
+        line->block_line = false;
+        line->indent = TEMPLATE_NO_NODE;
+        return;
+    }
+
+    if (line->block_line && text_starts_blank_line(text, &len)) {
+        compiler_strip_indent(compiler, line);
+        text->data += len;
+        text->len -= len;
+        text->byte_len -= len;
+        line->line_start = true;
+    }
+
+    line->block_line = false;
+    line->line_start = text_ends_blank_line(text, line->line_start, &len);
+    line->indent = line->line_start ? compiler_next_node(compiler) :
+                                      TEMPLATE_NO_NODE;
+    line->indent_len = len;
+}
+
+static bool compiler_compile_node(TemplateCompiler *compiler,
+                                  Parser *parser,
+                                  ASTNode *ast_node,
+                                  size_t base,
+                                  Status *status) {
+    TemplateNode *node = NULL;
+    TemplateBlock *block = NULL;
+    size_t depth = 0;
+
+    switch (ast_node->type) {
+        case AST_NODE_TEXT:
+            if (!compiler_emit(compiler, TEMPLATE_NODE_TEXT, &node, status)) {
+                return false;
+            }
+
+            sslice_copy(&node->text, &ast_node->as.text);
+
+            return status_ok(status);
+        case AST_NODE_INCLUDE:
+            return compiler_compile_include(compiler, &ast_node->as.include,
+                                                      status);
+        case AST_NODE_EXPRESSION:
+            if (!compiler_emit_expression(compiler, parser,
+                                                    TEMPLATE_NODE_EXPRESSION,
+                                                    &node,
+                                                    status)) {
+                return false;
+            }
+
+            node->escape = (
+                compiler->template->autoescape &&
+                !expression_is_safe(array_index_fast(
+                    &compiler->template->expressions,
+                    node->expression
+                ))
+            );
+
+            return status_ok(status);
+        case AST_NODE_CONDITIONAL:
+            return (
+                compiler_emit_expression(compiler, parser,
+                                                   TEMPLATE_NODE_CONDITIONAL,
+                                                   &node,
+                                                   status) &&
+                compiler_push_block(compiler,
+                                    TEMPLATE_NODE_CONDITIONAL,
+                                    compiler_next_node(compiler) - 1,
+                                    status)
+            );
+        case AST_NODE_ELSE_IF:
+            block = compiler_top_block(compiler, base,
+                                                 TEMPLATE_NODE_CONDITIONAL);
+
+            if (!block) {
+                return mismatched_block_end(status);
+            }
+
+            if (!compiler_end_branch(compiler, block, status)) {
+                return false;
+            }
+
+            if (!compiler_emit_expression(compiler, parser,
+                                                    TEMPLATE_NODE_CONDITIONAL,
+                                                    &node,
+                                                    status)) {
+                return false;
+            }
+
+            block->node = compiler_next_node(compiler) - 1;
+
+            return status_ok(status);
+        case AST_NODE_ELSE:
+            block = compiler_top_block(compiler, base,
+                                                 TEMPLATE_NODE_CONDITIONAL);
+
+            if (!block) {
+                return mismatched_block_end(status);
+            }
+
+            return compiler_end_branch(compiler, block, status);
+        case AST_NODE_CONDITIONAL_END:
+            block = compiler_top_block(compiler, base,
+                                                 TEMPLATE_NODE_CONDITIONAL);
+
+            if (!block) {
+                return mismatched_block_end(status);
+            }
+
+            compiler_end_conditional(compiler, block);
+
+            return status_ok(status);
+        case AST_NODE_ITERATION:
+            if (!compiler_emit_expression(compiler, parser,
+                                                    TEMPLATE_NODE_ITERATION,
+                                                    &node,
+                                                    status)) {
+                return false;
+            }
+
+            sslice_copy(&node->text, &ast_node->as.iteration.identifier);
+            sslice_copy(&node->value_text,
+                        &ast_node->as.iteration.value_identifier);
+
+            /* The iterable was compiled outside the loop's scope */
+            node->local = compiler->locals.len;
+
+            if (!compiler_add_local(compiler, &node->text, status)) {
+                return false;
+            }
+
+            if ((node->value_text.len > 0) &&
+                    (!compiler_add_local(compiler, &node->value_text,
+                                                   status))) {
+                return false;
+            }
+
+            for (size_t i = 0; i < TEMPLATE_LOOP_META_COUNT; i++) {
+                SSlice name;
+
+                name.data = TemplateLoopMetaNames[i];
+                name.len = strlen(TemplateLoopMetaNames[i]);
+                name.byte_len = name.len;
+
+                if (!compiler_add_local(compiler, &name, status)) {
+                    return false;
+                }
+            }
+
+            if (!compiler_push_block(compiler,
+                                     TEMPLATE_NODE_ITERATION,
+                                     compiler_next_node(compiler) - 1,
+                                     status)) {
+                return false;
+            }
+
+            depth = compiler_iteration_depth(compiler);
+
+            if (depth > compiler->template->iteration_depth) {
+                compiler->template->iteration_depth = depth;
+            }
+
+            return status_ok(status);
+        case AST_NODE_BREAK:
+        case AST_NODE_CONTINUE:
+            block = compiler_innermost_iteration(compiler);
+
+            if (!block) {
+                return mismatched_block_end(status);
+            }
+
+            if (compiler_caching_in(compiler, block)) {
+                return loop_control_in_cache(status);
+            }
+
+            if (!compiler_emit(compiler,
+                               ast_node->type == AST_NODE_BREAK ?
+                                   TEMPLATE_NODE_BREAK :
+                                   TEMPLATE_NODE_CONTINUE,
+                               &node,
+                               status)) {
+                return false;
+            }
+
+            node->jump = block->node;
+
+            return status_ok(status);
+        case AST_NODE_ITERATION_END:
+            block = compiler_top_block(compiler, base,
+                                                 TEMPLATE_NODE_ITERATION);
+
+            if (!block) {
+                return mismatched_block_end(status);
+            }
+
+            if (!compiler_emit(compiler,
+                               TEMPLATE_NODE_ITERATION_END,
+                               &node,
+                               status)) {
+                return false;
+            }
+
+            node->jump = block->node;
+            compiler_node(compiler, block->node)->jump =
+                compiler_next_node(compiler);
+            compiler_node(compiler, block->node)->parallel =
+                compiler_loop_is_parallel(compiler,
+                                          block->node,
+                                          compiler_next_node(compiler) - 1);
+            array_truncate_fast(&compiler->locals,
+                                compiler_node(compiler, block->node)->local);
+            array_truncate_fast(&compiler->blocks, compiler->blocks.len - 1);
+
+            return status_ok(status);
+        case AST_NODE_CACHE:
+            return (
+                compiler_emit_expression(compiler, parser,
+                                                   TEMPLATE_NODE_CACHE,
+                                                   &node,
+                                                   status) &&
+                compiler_push_block(compiler,
+                                    TEMPLATE_NODE_CACHE,
+                                    compiler_next_node(compiler) - 1,
+                                    status)
+            );
+        case AST_NODE_CACHE_END:
+            block = compiler_top_block(compiler, base, TEMPLATE_NODE_CACHE);
+
+            if (!block) {
+                return mismatched_block_end(status);
+            }
+
+            compiler_node(compiler, block->node)->jump =
+                compiler_next_node(compiler);
+            array_truncate_fast(&compiler->blocks, compiler->blocks.len - 1);
+
+            return status_ok(status);
+    }
+
+    return mismatched_block_end(status);
+}
+
+static bool path_covers(const char *prefix, const char *path) {
+    size_t len = strlen(prefix);
+
+    return (
+        (strncmp(prefix, path, len) == 0) &&
+        ((path[len] == '\0') || (path[len] == '.'))
+    );
+}
+
+/*
+ * Adds `path` to `reads`, unless a path already there covers it, dropping
+ * any it covers.
+ */
+static bool template_add_read(Template *t, const char *path,
+                                           Status *status) {
+    char *read = NULL;
+
+    for (size_t i = 0; i < t->reads.len; i++) {
+        if (path_covers(parray_index_fast(&t->reads, i), path)) {
+            return status_ok(status);
+        }
+    }
+
+    for (size_t i = t->reads.len; i > 0; i--) {
+        char *covered = parray_index_fast(&t->reads, i - 1);
+
+        if (path_covers(path, covered)) {
+            if (!parray_delete(&t->reads, i - 1, status)) {
+                return false;
+            }
+
+            free(covered);
+        }
+    }
+
+    read = strdup(path);
+
+    if (!read) {
+        return alloc_failure(status);
+    }
+
+    if (!parray_append(&t->reads, read, status)) {
+        free(read);
+        return false;
+    }
+
+    return status_ok(status);
+}
+
+/*
+ * Appends the name in constant `constant` of `expression` to `path`.
+ */
+static bool template_append_name(String *path, Expression *expression,
+                                               size_t constant,
+                                               Status *status) {
+    Value *name = parray_index_fast(&expression->constants, constant);
+
+    return string_append_cstr_len(path, value_string_data(name),
+                                        name->as.string.byte_len,
+                                        status);
+}
+
+bool template_expression_path(Expression *expression, size_t *index,
+                                                     String *path,
+                                                     Status *status) {
+    Array *instructions = &expression->instructions;
+    Instruction *instruction = array_index_fast(instructions, *index);
+
+    if ((instruction->type == INSTRUCTION_LOOKUP) &&
+            (!template_append_name(path, expression,
+                                         instruction->as.constant,
+                                         status))) {
+        return false;
+    }
+
+    while ((*index + 1) < instructions->len) {
+        Instruction *member = array_index_fast(instructions, *index + 1);
+
+        if (member->type != INSTRUCTION_MEMBER) {
+            break;
+        }
+
+        if ((!string_append_cstr(path, ".", status)) ||
+                (!template_append_name(path, expression,
+                                             member->as.constant,
+                                             status))) {
+            return false;
+        }
+
+        (*index)++;
+    }
+
+    return status_ok(status);
+}
+
+bool template_analyze(Template *t, Status *status) {
+    String path;
+    bool ok = true;
+
+    for (size_t i = 0; i < t->reads.len; i++) {
+        free(parray_index_fast(&t->reads, i));
+    }
+
+    parray_clear(&t->reads);
+    t->pure = true;
+
+    if (!string_init(&path, "", status)) {
+        return false;
+    }
+
+    for (size_t i = 0; ok && (i < t->expressions.len); i++) {
+        Expression *expression = array_index_fast(&t->expressions, i);
+        Array *instructions = &expression->instructions;
+
+        for (size_t j = 0; ok && (j < instructions->len); j++) {
+            Instruction *instruction = array_index_fast(instructions, j);
+
+            if ((instruction->type == INSTRUCTION_CALL) &&
+                    (!instruction->as.function->pure)) {
+                t->pure = false;
+            }
+
+            if (instruction->type != INSTRUCTION_LOOKUP) {
+                continue;
+            }
+
+            string_clear(&path);
+
+            ok = (
+                template_expression_path(expression, &j, &path, status) &&
+                template_add_read(t, path.data, status)
+            );
+        }
+    }
+
+    string_free(&path);
+
+    if (!ok) {
+        return false;
+    }
+
+    return status_ok(status);
+}
+
+/*
+ * Compiles `source`, taking ownership of it.
+ */
+static bool compiler_compile_source(TemplateCompiler *compiler,
+                                    String *source,
+                                    Status *status) {
+    Parser parser;
+    ASTNode node;
+    SSlice data;
+    TemplateLine line;
+    bool trim_blocks = compiler->template->trim_blocks;
+    size_t base = compiler->blocks.len;
+
+    line.line_start = true;
+    line.block_line = false;
+    line.indent = TEMPLATE_NO_NODE;
+    line.indent_len = 0;
+
+    if (!parray_append(&compiler->template->sources, source, status)) {
+        string_free(source);
+        free(source);
+        return false;
+    }
+
+    if (!string_slice(source, 0, source->len, &data, status)) {
+        return false;
+    }
+
+    if (!parser_init(&parser, &data, status)) {
+        return false;
+    }
+
+    while (parser_load_next(&parser, &node, status)) {
+        if (trim_blocks) {
+            compiler_trim_blocks(compiler, &line, &node);
+        }
+
+        if (!compiler_compile_node(compiler, &parser, &node, base, status)) {
+            parser_free(&parser);
+            return false;
+        }
+    }
+
+    parser_free(&parser);
+
+    if (!status_match(status, "parser", PARSER_EOF)) {
+        return false;
+    }
+
+    /* The last line ends with the source */
+    if (line.block_line) {
+        compiler_strip_indent(compiler, &line);
+    }
+
+    if (compiler->blocks.len != base) {
+        return unterminated_block(status);
+    }
+
+    return status_ok(status);
+}
+
+/*
+ * Appends `text` to `node`'s, copying both into `*merged` (a new source, if
+ * it's NULL) so they're contiguous.
+ */
+static bool template_merge_text(Template *t, TemplateNode *node,
+                                             SSlice *text,
+                                             String **merged,
+                                             Status *status) {
+    if (!*merged) {
+        String *source = malloc(sizeof(String));
+
+        if (!source) {
+            return alloc_failure(status);
+        }
+
+        if (!string_init_len(source, node->text.data, node->text.byte_len,
+                                                      status)) {
+            free(source);
+            return false;
+        }
+
+        if (!parray_append(&t->sources, source, status)) {
+            string_free(source);
+            free(source);
+            return false;
+        }
+
+        *merged = source;
+    }
+
+    return (
+        string_append_cstr_len(*merged, text->data, text->byte_len,
+                                                    status) &&
+        string_slice(*merged, 0, (*merged)->len, &node->text, status)
+    );
+}
+
+/*
+ * Drops empty TEXT nodes and merges runs of adjacent ones (which includes,
+ * raw blocks, whitespace trimming and `endif` all leave) into one node, so
+ * rendering makes a single write for each run.  A node something jumps to
+ * starts a new run, and jumps are renumbered to match.
+ */
+static bool template_coalesce_text(Template *t, Status *status) {
+    size_t count = t->nodes.len;
+    size_t *indices = malloc(sizeof(size_t) * (count + 1));
+    bool *targets = calloc(count + 1, sizeof(bool));
+    String *merged = NULL;
+    size_t run = TEMPLATE_NO_NODE;
+    size_t out = 0;
+    bool target = false;
+
+    if ((!indices) || (!targets)) {
+        free(indices);
+        free(targets);
+        return alloc_failure(status);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        TemplateNode *node = array_index_fast(&t->nodes, i);
+
+        if (node->jump != TEMPLATE_NO_NODE) {
+            targets[node->jump] = true;
+        }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        TemplateNode *node = array_index_fast(&t->nodes, i);
+
+        target = target || targets[i];
+        indices[i] = out;
+
+        if ((node->type == TEMPLATE_NODE_TEXT) &&
+                (node->text.byte_len == 0)) {
+            continue;
+        }
+
+        if ((node->type == TEMPLATE_NODE_TEXT) &&
+                (run != TEMPLATE_NO_NODE) &&
+                (!target)) {
+            if (!template_merge_text(t, array_index_fast(&t->nodes, run),
+                                        &node->text,
+                                        &merged,
+                                        status)) {
+                free(indices);
+                free(targets);
+                return false;
+            }
+
+            continue;
+        }
+
+        if (out != i) {
+            *(TemplateNode *)array_index_fast(&t->nodes, out) = *node;
+        }
+
+        run = (node->type == TEMPLATE_NODE_TEXT) ? out : TEMPLATE_NO_NODE;
+        merged = NULL;
+        target = false;
+        out++;
+    }
+
+    indices[count] = out;
+
+    for (size_t i = 0; i < out; i++) {
+        TemplateNode *node = array_index_fast(&t->nodes, i);
+
+        if (node->jump != TEMPLATE_NO_NODE) {
+            node->jump = indices[node->jump];
+        }
+    }
+
+    array_truncate_fast(&t->nodes, out);
+
+    free(indices);
+    free(targets);
+
+    return status_ok(status);
+}
+
+/*
+ * Compiles `source`, taking ownership of it.  `path` is where it was read
+ * from, if anywhere.
+ */
+static bool template_compile(Template *t, const char *path, String *source,
+                                                            Status *status) {
+    TemplateCompiler compiler;
+    char *template_path = NULL;
+    bool compiled = false;
+
+    template_clear(t);
+
+    if (path) {
+        template_path = strdup(path);
+
+        if (!template_path) {
+            string_free(source);
+            free(source);
+            return alloc_failure(status);
+        }
+
+        if (!parray_append(&t->paths, template_path, status)) {
+            free(template_path);
+            string_free(source);
+            free(source);
+            return false;
+        }
+    }
+
+    if (!array_init_alloc(&compiler.blocks, sizeof(TemplateBlock),
+                                            TEMPLATE_INIT_ALLOC,
+                                            status)) {
+        string_free(source);
+        free(source);
+        return false;
+    }
+
+    if (!array_init_alloc(&compiler.locals, sizeof(SSlice),
+                                            TEMPLATE_INIT_ALLOC,
+                                            status)) {
+        array_free(&compiler.blocks);
+        string_free(source);
+        free(source);
+        return false;
+    }
+
+    compiler.template = t;
+    compiler.include_depth = 0;
+    decimal_context_set_max(&compiler.ctx);
+
+    compiled = (
+        compiler_compile_source(&compiler, source, status) &&
+        template_coalesce_text(t, status) &&
+        template_analyze(t, status)
+    );
+
+    array_free(&compiler.blocks);
+    array_free(&compiler.locals);
+
+    if (!compiled) {
+        template_clear(t);
+        return false;
+    }
+
+    return status_ok(status);
+}
+
+bool template_output(String *output, Value *value, bool escape,
+                                                  Status *status) {
+    if (escape && (value->type == VALUE_STRING)) {
+        return escape_html(output, value_string_data(value),
+                                   value->as.string.byte_len,
+                                   status);
+    }
+
+    return value_to_string(value, output, status);
+}
+
+bool template_condition(Value *result, bool *truth, Status *status) {
+    if (result->type != VALUE_BOOLEAN) {
+        return non_boolean_conditional(status);
+    }
+
+    *truth = result->as.boolean;
+
+    return status_ok(status);
+}
+
+bool template_loop_start(TemplateLoop *loop, Status *status) {
+    if (value_is_array(&loop->iterable)) {
+        loop->table = false;
+        value_array_cursor_init(&loop->cursor);
+    }
+    else if (value_is_table(&loop->iterable)) {
+        loop->table = true;
+
+        if (!value_table_iterator_init(&loop->entries, &loop->iterable,
+                                                       status)) {
+            return false;
+        }
+    }
+    else {
+        return non_iterable_expression(status);
+    }
+
+    return value_length(&loop->iterable, &loop->length, status);
+}
+
+/*
+ * Elements are copied into the loop's own Values, which only takes a
+ * reference for strings, arrays and tables.
+ */
+bool template_loop_load(TemplateLoop *loop, Status *status) {
+    ValueTableEntry *entry = NULL;
+
+    if (loop->uses_meta) {
+        if (!value_set_integer(&loop->meta[TEMPLATE_LOOP_INDEX], loop->index,
+                                                                 status)) {
+            return false;
+        }
+
+        value_set_boolean(&loop->meta[TEMPLATE_LOOP_FIRST], loop->index == 0);
+        value_set_boolean(&loop->meta[TEMPLATE_LOOP_LAST],
+                          loop->index == loop->length - 1);
+    }
+
+    if (!loop->table) {
+        if (!loop->pairs) {
+            return value_array_cursor_index(&loop->cursor, &loop->iterable,
+                                                           loop->index,
+                                                           &loop->element,
+                                                           status);
+        }
+
+        return (
+            value_set_integer(&loop->element, loop->index, status) &&
+            value_array_cursor_index(&loop->cursor, &loop->iterable,
+                                                    loop->index,
+                                                    &loop->value,
+                                                    status)
+        );
+    }
+
+    if (!value_table_iterator_next(&loop->entries, &entry)) {
+        return index_out_of_bounds(status);
+    }
+
+    return (
+        value_copy(&loop->element, &entry->key, status) &&
+        ((!loop->pairs) || value_copy(&loop->value, &entry->value, status))
+    );
+}
+
+bool template_loop_bind(TemplateLoop *loop,
+                        TemplateNode *node,
+                        ExpressionEvaluator *evaluator,
+                        Status *status) {
+    size_t meta = template_node_meta_local(node);
+
+    if ((!expression_evaluator_set_local(evaluator, node->local,
+                                                    &loop->element,
+                                                    status)) ||
+            (loop->pairs &&
+             (!expression_evaluator_set_local(evaluator, node->local + 1,
+                                                         &loop->value,
+                                                         status)))) {
+        return false;
+    }
+
+    if (!loop->uses_meta) {
+        return status_ok(status);
+    }
+
+    if (!value_set_integer(&loop->meta[TEMPLATE_LOOP_LENGTH], loop->length,
+                                                              status)) {
+        return false;
+    }
+
+    for (size_t i = 0; i < TEMPLATE_LOOP_META_COUNT; i++) {
+        if (!expression_evaluator_set_local(evaluator, meta + i,
+                                                       &loop->meta[i],
+                                                       status)) {
+            return false;
+        }
+    }
+
+    return status_ok(status);
+}
+
+void template_loop_free(TemplateLoop *loop) {
+    value_free(&loop->iterable);
+    value_free(&loop->element);
+    value_free(&loop->value);
+
+    for (size_t i = 0; i < TEMPLATE_LOOP_META_COUNT; i++) {
+        value_free(&loop->meta[i]);
+    }
+}
+
+bool template_init(Template *t, FunctionRegistry *functions, Status *status) {
+    t->id = template_next_id();
+    t->functions = functions;
+    t->fragment_cache = NULL;
+    t->render_cache = NULL;
+    t->pure = true;
+    t->iteration_depth = 0;
+    t->autoescape = false;
+    t->trim_blocks = false;
+    t->parallel_pool = NULL;
+    t->parallel_min_length = 0;
+
+    if (!parray_init_alloc(&t->sources, 1, status)) {
+        return false;
+    }
+
+    if (!parray_init_alloc(&t->paths, 1, status)) {
+        parray_free(&t->sources);
+        return false;
+    }
+
+    if (!parray_init_alloc(&t->reads, 1, status)) {
+        parray_free(&t->sources);
+        parray_free(&t->paths);
+        return false;
+    }
+
+    if (!array_init_alloc(&t->nodes, sizeof(TemplateNode),
+                                     TEMPLATE_INIT_ALLOC,
+                                     status)) {
+        parray_free(&t->sources);
+        parray_free(&t->paths);
+        parray_free(&t->reads);
+        return false;
+    }
+
+    if (!array_init_alloc(&t->expressions, sizeof(Expression),
+                                           TEMPLATE_INIT_ALLOC,
+                                           status)) {
+        parray_free(&t->sources);
+        parray_free(&t->paths);
+        parray_free(&t->reads);
+        array_free(&t->nodes);
+        return false;
+    }
+
+    return status_ok(status);
+}
+
+void template_set_autoescape(Template *t, bool autoescape) {
+    t->autoescape = autoescape;
+}
+
+void template_set_trim_blocks(Template *t, bool trim_blocks) {
+    t->trim_blocks = trim_blocks;
+}
+
+void template_set_parallel(Template *t, struct RenderPool *pool,
+                                        size_t min_length) {
+    t->parallel_pool = pool;
+    t->parallel_min_length = min_length;
+}
+
+void template_set_fragment_cache(Template *t, FragmentCache *cache) {
+    t->fragment_cache = cache;
+}
+
+void template_set_render_cache(Template *t, FragmentCache *cache) {
+    t->render_cache = cache;
+}
+
+bool template_parse_path(Template *t, const char *path, Status *status) {
+    String *source = malloc(sizeof(String));
+
+    if (!source) {
+        return alloc_failure(status);
+    }
+
+    if (!template_read_file(path, source, status)) {
+        free(source);
+        return false;
+    }
+
+    return template_compile(t, path, source, status);
+}
+
+bool template_parse_data(Template *t, String *input, Status *status) {
+    String *source = malloc(sizeof(String));
+
+    if (!source) {
+        return alloc_failure(status);
+    }
+
+    if (!string_init_len(source, input->data, input->byte_len, status)) {
+        free(source);
+        return false;
+    }
+
+    return template_compile(t, NULL, source, status);
+}
+
+void template_loop_init(TemplateLoop *loop, size_t index,
+                                            TemplateNode *node) {
+    loop->node = index;
+    loop->iterable.type = VALUE_NONE;
+    loop->element.type = VALUE_NONE;
+    loop->value.type = VALUE_NONE;
+    loop->table = false;
+    value_array_cursor_init(&loop->cursor);
+    loop->pairs = node->value_text.len > 0;
+    loop->uses_meta = node->uses_meta;
+
+    for (size_t i = 0; i < TEMPLATE_LOOP_META_COUNT; i++) {
+        loop->meta[i].type = VALUE_NONE;
+    }
+
+    loop->index = 0;
+    loop->length = 0;
+}
+
+static bool template_execute(Template *t, ExpressionEvaluator *evaluator,
+                                          Value *context,
+                                          TemplateLoop *loops,
+                                          size_t start,
+                                          size_t end,
+                                          bool parallel,
+                                          String *output,
+                                          Status *status);
+
+/*
+ * A contiguous run of a parallel loop's iterations, [first, last), rendered
+ * into its own output by a pool worker, with the worker's evaluator.  `loop`
+ * is the parent's, which is only read.  For tables, `entries` is positioned
+ * at entry `first`.
+ */
+typedef struct {
+    Template *t;
+    ExpressionEvaluator *parent;
+    Value *context;
+    TemplateLoop *loop;
+    size_t first;
+    size_t last;
+    ValueTableIterator entries;
+    String output;
+    size_t memo_hits;
+    size_t memo_misses;
+    Status status;
+    bool ok;
+} TemplateChunk;
+
+static bool template_chunk_render(TemplateChunk *chunk,
+                                  ExpressionEvaluator *evaluator,
+                                  Status *status) {
+    Template *t = chunk->t;
+    TemplateNode *node = array_index_fast(&t->nodes, chunk->loop->node);
+    TemplateLoop *loops = NULL;
+    TemplateLoop loop;
+    bool ok = true;
+
+    if (!expression_evaluator_share_locals(evaluator, chunk->parent,
+                                                      node->local,
+                                                      status)) {
+        return false;
+    }
+
+    loops = malloc(sizeof(TemplateLoop) * t->iteration_depth);
+
+    if (!loops) {
+        return alloc_failure(status);
+    }
+
+    template_loop_init(&loop, chunk->loop->node, node);
+    loop.table = chunk->loop->table;
+    loop.length = chunk->loop->length;
+    loop.index = chunk->first;
+
+    ok = value_copy(&loop.iterable, &chunk->loop->iterable, status);
+
+    if (loop.table) {
+        loop.entries = chunk->entries;
+    }
+
+    ok = (
+        ok &&
+        template_loop_load(&loop, status) &&
+        template_loop_bind(&loop, node, evaluator, status)
+    );
+
+    while (ok) {
+        /* `continue` jumps to ITERATION_END, which ends the body's range */
+        ok = template_execute(t, evaluator, chunk->context,
+                                            loops,
+                                            chunk->loop->node + 1,
+                                            node->jump - 1,
+                                            false,
+                                            &chunk->output,
+                                            status);
+
+        if ((!ok) || (++loop.index >= chunk->last)) {
+            break;
+        }
+
+        ok = template_loop_load(&loop, status);
+    }
+
+    template_loop_free(&loop);
+    free(loops);
+
+    if (!ok) {
+        return false;
+    }
+
+    return status_ok(status);
+}
+
+/*
+ * Workers' evaluators outlive the chunks they render, so the memo is reset
+ * first, as it is for every render.
+ */
+static void template_chunk_task(void *data, size_t index,
+                                            ExpressionEvaluator *evaluator) {
+    TemplateChunk *chunk = &((TemplateChunk *)data)[index];
+
+    expression_evaluator_reset_memo(evaluator);
+
+    chunk->ok = template_chunk_render(chunk, evaluator, &chunk->status);
+    chunk->memo_hits = evaluator->memo_hits;
+    chunk->memo_misses = evaluator->memo_misses;
+}
+
+static void template_chunks_free(TemplateChunk *chunks, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        string_free(&chunks[i].output);
+    }
+
+    free(chunks);
+}
+
+/*
+ * Splits the iterations of `loop`, which has been started, into one chunk
+ * per pool worker, and appends their outputs in order.  `rendered` is left
+ * unset if the pool's busy, in which case the loop is still to be rendered.
+ */
+static bool template_render_parallel(Template *t,
+                                     ExpressionEvaluator *evaluator,
+                                     Value *context,
+                                     TemplateLoop *loop,
+                                     String *output,
+                                     bool *rendered,
+                                     Status *status) {
+    size_t count = t->parallel_pool->worker_count;
+    TemplateChunk *chunks = NULL;
+    ValueTableIterator entries;
+    size_t ready = 0;
+    bool ok = true;
+
+    if (count > loop->length) {
+        count = loop->length;
+    }
+
+    if (loop->table &&
+            (!value_table_iterator_init(&entries, &loop->iterable, status))) {
+        return false;
+    }
+
+    chunks = malloc(sizeof(TemplateChunk) * count);
+
+    if (!chunks) {
+        return alloc_failure(status);
+    }
+
+    for (ready = 0; ready < count; ready++) {
+        TemplateChunk *chunk = &chunks[ready];
+        size_t size = loop->length / count;
+        size_t extra = loop->length % count;
+
+        chunk->t = t;
+        chunk->parent = evaluator;
+        chunk->context = context;
+        chunk->loop = loop;
+        chunk->first = (ready * size) + (ready < extra ? ready : extra);
+        chunk->last = chunk->first + size + (ready < extra ? 1 : 0);
+        chunk->memo_hits = 0;
+        chunk->memo_misses = 0;
+        chunk->ok = false;
+
+        if (!string_init(&chunk->output, "", status)) {
+            template_chunks_free(chunks, ready);
+            return false;
+        }
+
+        /* Each chunk starts where the last ended, so walk the table once */
+        if (loop->table) {
+            ValueTableEntry *entry = NULL;
+
+            chunk->entries = entries;
+
+            for (size_t i = chunk->first; i < chunk->last; i++) {
+                value_table_iterator_next(&entries, &entry);
+            }
+        }
+    }
+
+    if (!render_pool_try_run(t->parallel_pool, template_chunk_task,
+                                               chunks,
+                                               count,
+                                               rendered,
+                                               status)) {
+        template_chunks_free(chunks, count);
+        return false;
+    }
+
+    for (size_t i = 0; (*rendered) && (i < count); i++) {
+        TemplateChunk *chunk = &chunks[i];
+
+        evaluator->memo_hits += chunk->memo_hits;
+        evaluator->memo_misses += chunk->memo_misses;
+
+        if (!ok) {
+            continue;
+        }
+
+        if (!chunk->ok) {
+            *status = chunk->status;
+            ok = false;
+            continue;
+        }
+
+        ok = string_append_cstr_len(output, chunk->output.data,
+                                            chunk->output.byte_len,
+                                            status);
+    }
+
+    template_chunks_free(chunks, count);
+
+    if (!ok) {
+        return false;
+    }
+
+    return status_ok(status);
+}
+
+/*
+ * Renders the cache block starting at `index`, whose key is `expression`,
+ * from the fragment cache if it's there, and otherwise renders its body and
+ * stores that.  Loops opened in the body go after the `depth` loops open
+ * around it.
+ */
+static bool template_render_fragment(Template *t,
+                                     ExpressionEvaluator *evaluator,
+                                     Value *context,
+                                     Expression *expression,
+                                     TemplateLoop *loops,
+                                     size_t depth,
+                                     size_t index,
+                                     bool parallel,
+                                     String *output,
+                                     Status *status) {
+    TemplateNode *node = array_index_fast(&t->nodes, index);
+    size_t len = output->len;
+    size_t byte_len = output->byte_len;
+    bool found = false;
+    bool ok = true;
+    String key;
+    Value value;
+
+    value.type = VALUE_NONE;
+
+    if (!string_init(&key, "", status)) {
+        return false;
+    }
+
+    ok = (
+        expression_evaluator_evaluate(evaluator, expression, context,
+                                                             &value,
+                                                             status) &&
+        fragment_cache_key(&key, t->id, index, &value, status) &&
+        fragment_cache_get(t->fragment_cache, &key, output, &found, status)
+    );
+
+    if (ok && (!found)) {
+        ok = (
+            template_execute(t, evaluator, context,
+                                    loops + depth,
+                                    index + 1,
+                                    node->jump,
+                                    parallel,
+                                    output,
+                                    status) &&
+            fragment_cache_put(t->fragment_cache,
+                               &key,
+                               output->data + byte_len,
+                               output->len - len,
+                               output->byte_len - byte_len,
+                               status)
+        );
+    }
+
+    value_free(&value);
+    string_free(&key);
+
+    if (!ok) {
+        return false;
+    }
+
+    return status_ok(status);
+}
+
+/*
+ * Renders nodes [start, end), with `loops` holding the loops they open.
+ * Loops marked parallel are split between threads if `parallel` is set,
+ * which it isn't for the threads themselves.
+ */
+static bool template_execute(Template *t, ExpressionEvaluator *evaluator,
+                                          Value *context,
+                                          TemplateLoop *loops,
+                                          size_t start,
+                                          size_t end,
+                                          bool parallel,
+                                          String *output,
+                                          Status *status) {
+    TemplateLoop *loop = NULL;
+    size_t depth = 0;
+    size_t i = start;
+    Value result;
+    bool truth = false;
+    bool rendered = false;
+    bool ok = true;
+
+    result.type = VALUE_NONE;
+
+    while (ok && (i < end)) {
+        TemplateNode *node = array_index_fast(&t->nodes, i);
+        Expression *expression = NULL;
+
+        if ((node->type == TEMPLATE_NODE_EXPRESSION) ||
+            (node->type == TEMPLATE_NODE_CONDITIONAL) ||
+            (node->type == TEMPLATE_NODE_ITERATION) ||
+            (node->type == TEMPLATE_NODE_CACHE)) {
+            expression = array_index_fast(&t->expressions, node->expression);
+        }
+
+        switch (node->type) {
+            case TEMPLATE_NODE_TEXT:
+                ok = string_append_sslice(output, &node->text, status);
+                i++;
+                break;
+            case TEMPLATE_NODE_EXPRESSION:
+                ok = (
+                    expression_evaluator_evaluate(evaluator, expression,
+                                                             context,
+                                                             &result,
+                                                             status) &&
+                    template_output(output, &result, node->escape, status)
+                );
+                i++;
+                break;
+            case TEMPLATE_NODE_CONDITIONAL:
+                ok = (
+                    expression_evaluator_evaluate(evaluator, expression,
+                                                             context,
+                                                             &result,
+                                                             status) &&
+                    template_condition(&result, &truth, status)
+                );
+
+                if (!ok) {
+                    break;
+                }
+
+                i = truth ? i + 1 : node->jump;
+                break;
+            case TEMPLATE_NODE_JUMP:
+                i = node->jump;
+                break;
+            case TEMPLATE_NODE_ITERATION:
+                loop = &loops[depth];
+                template_loop_init(loop, i, node);
+
+                ok = (
+                    expression_evaluator_evaluate(evaluator, expression,
+                                                             context,
+                                                             &loop->iterable,
+                                                             status) &&
+                    template_loop_start(loop, status)
+                );
+
+                if ((!ok) || (loop->length == 0)) {
+                    template_loop_free(loop);
+                    i = node->jump;
+                    break;
+                }
+
+                rendered = false;
+
+                if (parallel && node->parallel && t->parallel_pool &&
+                        (loop->length >= t->parallel_min_length)) {
+                    ok = template_render_parallel(t, evaluator, context,
+                                                                loop,
+                                                                output,
+                                                                &rendered,
+                                                                status);
+                }
+
+                if ((!ok) || rendered) {
+                    template_loop_free(loop);
+                    i = node->jump;
+                    break;
+                }
+
+                ok = (
+                    template_loop_load(loop, status) &&
+                    template_loop_bind(loop, node, evaluator, status)
+                );
+
+                if (!ok) {
+                    template_loop_free(loop);
+                    break;
+                }
+
+                depth++;
+                i++;
+                break;
+            case TEMPLATE_NODE_ITERATION_END:
+                loop = &loops[depth - 1];
+                loop->index++;
+
+                if (loop->index < loop->length) {
+                    ok = template_loop_load(loop, status);
+                    i = loop->node + 1;
+                    break;
+                }
+
+                template_loop_free(loop);
+                depth--;
+                i++;
+                break;
+            case TEMPLATE_NODE_BREAK:
+                loop = &loops[depth - 1];
+                template_loop_free(loop);
+                depth--;
+                i = ((TemplateNode *)array_index_fast(
+                    &t->nodes,
+                    node->jump
+                ))->jump;
+                break;
+            case TEMPLATE_NODE_CONTINUE:
+                i = ((TemplateNode *)array_index_fast(
+                    &t->nodes,
+                    node->jump
+                ))->jump - 1;
+                break;
+            case TEMPLATE_NODE_CACHE:
+                if (!t->fragment_cache) {
+                    i++;
+                    break;
+                }
+
+                ok = template_render_fragment(t, evaluator, context,
+                                                            expression,
+                                                            loops,
+                                                            depth,
+                                                            i,
+                                                            parallel,
+                                                            output,
+                                                            status);
+                i = node->jump;
+                break;
+        }
+    }
+
+    while (depth > 0) {
+        template_loop_free(&loops[depth - 1]);
+        depth--;
+    }
+
+    value_free(&result);
+
+    if (!ok) {
+        return false;
+    }
+
+    return status_ok(status);
+}
+
+static bool template_render_nodes(Template *t,
+                                  ExpressionEvaluator *evaluator,
+                                  Value *context,
+                                  String *output,
+                                  Status *status) {
+    TemplateLoop *loops = NULL;
+    bool rendered = false;
+
+    if (t->iteration_depth > 0) {
+        loops = malloc(sizeof(TemplateLoop) * t->iteration_depth);
+
+        if (!loops) {
+            return alloc_failure(status);
+        }
+    }
+
+    rendered = template_execute(t, evaluator, context, loops, 0, t->nodes.len,
+                                                                  true,
+                                                                  output,
+                                                                  status);
+
+    free(loops);
+
+    return rendered;
+}
+
+/*
+ * Renders from the render cache if the output for `context` is there, and
+ * otherwise renders as usual and stores the output.
+ */
+static bool template_render_cached(Template *t,
+                                   ExpressionEvaluator *evaluator,
+                                   Value *context,
+                                   String *output,
+                                   Status *status) {
+    size_t len = output->len;
+    size_t byte_len = output->byte_len;
+    bool found = false;
+    bool ok = true;
+    String key;
+
+    if (!string_init(&key, "", status)) {
+        return false;
+    }
+
+    if (!fragment_cache_render_key(&key, t->id, &t->reads, context,
+                                                           status)) {
+        string_free(&key);
+
+        if (!status_match(status, "fragment_cache",
+                                  FRAGMENT_CACHE_INVALID_KEY)) {
+            return false;
+        }
+
+        return template_render_nodes(t, evaluator, context, output, status);
+    }
+
+    ok = fragment_cache_get(t->render_cache, &key, output, &found, status);
+
+    if (ok && (!found)) {
+        ok = (
+            template_render_nodes(t, evaluator, context, output, status) &&
+            fragment_cache_put(t->render_cache,
+                               &key,
+                               output->data + byte_len,
+                               output->len - len,
+                               output->byte_len - byte_len,
+                               status)
+        );
+    }
+
+    string_free(&key);
+
+    if (!ok) {
+        return false;
+    }
+
+    return status_ok(status);
+}
+
+bool template_render_with_evaluator(Template *t,
+                                    ExpressionEvaluator *evaluator,
+                                    Value *context,
+                                    String *output,
+                                    Status *status) {
+    expression_evaluator_reset_memo(evaluator);
+
+    if (t->render_cache && t->pure) {
+        return template_render_cached(t, evaluator, context, output, status);
+    }
+
+    return template_render_nodes(t, evaluator, context, output, status);
+}
+
+bool template_render(Template *t, Value *context, String *output,
+                                                  Status *status) {
+    ExpressionEvaluator evaluator;
+    bool rendered = false;
+
+    if (!expression_evaluator_init(&evaluator, status)) {
+        return false;
+    }
+
+    rendered = template_render_with_evaluator(t, &evaluator, context,
+                                                             output,
+                                                             status);
+
+    expression_evaluator_free(&evaluator);
+
+    return rendered;
+}
+
+bool template_render_path(Template *t, const char *path, Value *context,
+                                                         String *output,
+                                                         Status *status) {
+    return (
+        template_parse_path(t, path, status) &&
+        template_render(t, context, output, status)
+    );
+}
+
+bool template_render_data(Template *t, String *input, Value *context,
+                                                      String *output,
+                                                      Status *status) {
+    return (
+        template_parse_data(t, input, status) &&
+        template_render(t, context, output, status)
+    );
+}
+
+void template_clear(Template *t) {
+    for (size_t i = 0; i < t->sources.len; i++) {
+        String *source = parray_index_fast(&t->sources, i);
+
+        string_free(source);
+        free(source);
+    }
+
+    for (size_t i = 0; i < t->paths.len; i++) {
+        free(parray_index_fast(&t->paths, i));
+    }
+
+    for (size_t i = 0; i < t->reads.len; i++) {
+        free(parray_index_fast(&t->reads, i));
+    }
+
+    for (size_t i = 0; i < t->expressions.len; i++) {
+        expression_free(array_index_fast(&t->expressions, i));
+    }
+
+    parray_clear(&t->sources);
+    parray_clear(&t->paths);
+    parray_clear(&t->reads);
+    array_clear(&t->nodes);
+    array_clear(&t->expressions);
+    t->pure = true;
+    t->iteration_depth = 0;
+    t->id = template_next_id();
+}
+
+void template_free(Template *t) {
+    template_clear(t);
+    parray_free(&t->sources);
+    parray_free(&t->paths);
+    parray_free(&t->reads);
+    array_free(&t->nodes);
+    array_free(&t->expressions);
+}
+
 /* vi: set et ts=4 sw=4: */
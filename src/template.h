@@ -5,25 +5,227 @@ enum {
     TEMPLATE_OPENING_FILE_FAILED = 1,
     TEMPLATE_SEEKING_IN_FILE_FAILED,
     TEMPLATE_READING_FILE_DATA_FAILED,
-    TEMPLATE_FAILED_TO_REPLACE_INCLUDE_NODE,
+    TEMPLATE_INCLUDE_DEPTH_EXCEEDED,
+    TEMPLATE_MISMATCHED_BLOCK_END,
+    TEMPLATE_UNTERMINATED_BLOCK,
+    TEMPLATE_NON_BOOLEAN_CONDITIONAL,
+    TEMPLATE_NON_ITERABLE_EXPRESSION,
+    TEMPLATE_LOOP_CONTROL_IN_CACHE,
 };
 
+/*
+ * Templates are compiled into a flat list of nodes.  Control flow is
+ * resolved to node indices when compiling, so rendering is a loop over the
+ * list with jumps:
+ *
+ *   TEXT:           output `text`
+ *   EXPRESSION:     output the result of expression `expression`
+ *   CONDITIONAL:    evaluate `expression`, jumping to `jump` (the next
+ *                   branch, or past the end) if it's false
+ *   JUMP:           jump to `jump` (past the end of a conditional)
+ *   ITERATION:      evaluate `expression` and start looping over it, binding
+ *                   each element (or key, for tables) to `text`; jumps to
+ *                   `jump` (past the end) if it's empty.  If `value_text`
+ *                   is set, indices (or keys) are bound to `text` and
+ *                   elements (or values) to `value_text`.  They're bound to
+ *                   frame slots `local` and `local + 1`, followed by
+ *                   `loop.index`, `loop.first`, `loop.last` and
+ *                   `loop.length`, which are only updated if `uses_meta`
+ *   ITERATION_END:  move to the next element, jumping back to the start of
+ *                   the body if there is one
+ *   BREAK/CONTINUE: leave the loop that starts at `jump`, or move to its
+ *                   next element
+ *   CACHE:          with a fragment cache, evaluate `expression` and output
+ *                   what's stored for it, jumping to `jump` (past the end),
+ *                   or else render the nodes up to `jump` and store them;
+ *                   without one, just carry on into the body
+ *
+ * Included templates are compiled in place.  Text refers to the template
+ * sources, which the Template keeps.  `paths` lists the files it was compiled
+ * from (the template itself, if it was parsed from a path, and everything it
+ * includes), so callers can tell which file changes affect it.  If it was
+ * parsed from a path, the first `paths.len` sources are those files'
+ * contents, in the same order.
+ *
+ * Inside a loop, `loop.index` (counting from 0), `loop.first`, `loop.last`
+ * and `loop.length` describe the innermost loop's progress.
+ *
+ * A compiled Template isn't modified by rendering, so it may be rendered by
+ * several threads at once.
+ *
+ * With autoescaping on (template_set_autoescape, before parsing), string
+ * results of expressions are HTML-escaped as they're output, unless the
+ * expression is a call to the `safe` builtin, or to `escape`, which isn't
+ * escaped twice.  Without it, `escape` escapes a single expression.
+ *
+ * `{{-` and `-}}` trim whitespace before and after a tag (see tokenizer.h).
+ * With template_set_trim_blocks (before parsing), lines holding nothing but
+ * block tags (`if`, `else`, `endif`, `for`, `endfor`, `break`, `continue`,
+ * `cache` and `endcache`) and whitespace are left out entirely, indentation
+ * and line break included.  Either way, adjacent text is merged into a
+ * single TEXT node when compiling.
+ *
+ * With template_set_fragment_cache, `{{ cache key }} ... {{ endcache }}`
+ * blocks are rendered once for each key value and then copied out of the
+ * cache (see fragment_cache.h).  Without one they're rendered every time, as
+ * if the tags weren't there.  `id` identifies the compiled template in
+ * cache keys; each parse (or load) gets a new one, so fragments from an
+ * older version of a template are never reused.  `break` and `continue`
+ * can't leave a loop from inside a cache block.
+ *
+ * template_analyze, run after every parse (or load), lists the context paths
+ * the template's expressions read in `reads`: each lookup's dotted path,
+ * dropping any path another one covers (`site` covers `site.title`).
+ * `pure` is false if any expression calls an impure function.
+ *
+ * template_expression_path appends the path read by the LOOKUP or LOCAL at
+ * instruction `*index` of `expression` and the MEMBERs following it to
+ * `path`, leaving `*index` at the last of them.  A LOCAL adds nothing
+ * itself, so callers start `path` with whatever it stands for.
+ *
+ * With template_set_render_cache, whole renders of a pure template are
+ * stored in a fragment cache, keyed by a fingerprint of the values at
+ * `reads` (see fragment_cache.h), and rendering it again with a context that
+ * agrees on those values copies the stored output instead.  Contexts that
+ * can't be fingerprinted are rendered as usual.
+ *
+ * template_render_with_evaluator renders with the caller's evaluator, which
+ * can then be reused, and whose memo counters describe the render.
+ *
+ * template_set_parallel opts into rendering loops of at least `min_length`
+ * elements on the workers of `pool` (see render_pool.h), which the caller
+ * owns and must outlive the template's renders.  Each worker renders a
+ * contiguous chunk of the iterations into its own buffer with its own
+ * evaluator; the chunks are then output in order.  Only loops marked
+ * `parallel` when compiling qualify: their bodies don't `break` out of them
+ * or call impure functions.  Loops nested in a parallel loop are rendered
+ * serially by the worker running it, as are parallel loops met while the
+ * pool is busy with another batch.  A NULL `pool` turns this off.
+ */
+
+/*
+ * Every loop has locals for `loop.index` and friends after its own
+ * variables, but they're only kept up to date if the loop's body uses them.
+ */
+typedef enum {
+    TEMPLATE_LOOP_INDEX,
+    TEMPLATE_LOOP_FIRST,
+    TEMPLATE_LOOP_LAST,
+    TEMPLATE_LOOP_LENGTH,
+    TEMPLATE_LOOP_META_COUNT,
+} TemplateLoopMeta;
+
+typedef enum {
+    TEMPLATE_NODE_TEXT,
+    TEMPLATE_NODE_EXPRESSION,
+    TEMPLATE_NODE_CONDITIONAL,
+    TEMPLATE_NODE_JUMP,
+    TEMPLATE_NODE_ITERATION,
+    TEMPLATE_NODE_ITERATION_END,
+    TEMPLATE_NODE_BREAK,
+    TEMPLATE_NODE_CONTINUE,
+    TEMPLATE_NODE_CACHE,
+} TemplateNodeType;
+
+typedef struct {
+    TemplateNodeType type;
+    SSlice text;
+    SSlice value_text;
+    size_t local;
+    bool uses_meta;
+    bool parallel;
+    size_t expression;
+    size_t jump;
+    bool escape;
+} TemplateNode;
+
+struct FragmentCache;
+struct RenderPool;
+
 typedef struct {
+    size_t id;
+    FunctionRegistry *functions;
+    struct FragmentCache *fragment_cache;
+    struct FragmentCache *render_cache;
+    PArray sources;
+    PArray paths;
+    PArray reads;
+    bool pure;
     Array nodes;
-    ExpressionEvaluator expression_evaluator
+    Array expressions;
+    size_t iteration_depth;
+    bool autoescape;
+    bool trim_blocks;
+    struct RenderPool *parallel_pool;
+    size_t parallel_min_length;
 } Template;
 
-void template_init(Template *t);
-bool template_init_alloc(Template *t, size_t node_cache_size,
-                                      size_t expression_node_cache_size,
-                                      Status *status);
+/*
+ * A loop being rendered.  Tables are stepped through with `entries`; arrays
+ * by `index`, with `cursor` so lazy JSON arrays aren't rescanned for each
+ * element.  `value` is only bound for `for key, value in x` loops, and
+ * `meta` only updated if the body uses it.
+ *
+ * Rendering an ITERATION node inits a loop, evaluates its expression into
+ * `iterable`, starts it, then loads and binds the first element; each
+ * ITERATION_END bumps `index` and loads the next.  These steps, along with
+ * template_output and template_condition (which checks a conditional's
+ * result is a boolean), are public for code generated ahead of time (see
+ * template_aot.h).
+ */
+typedef struct {
+    size_t node;
+    Value iterable;
+    Value element;
+    Value value;
+    Value meta[TEMPLATE_LOOP_META_COUNT];
+    ValueTableIterator entries;
+    ValueArrayCursor cursor;
+    bool table;
+    bool pairs;
+    bool uses_meta;
+    size_t index;
+    size_t length;
+} TemplateLoop;
+
+bool template_init(Template *t, FunctionRegistry *functions, Status *status);
+void template_set_autoescape(Template *t, bool autoescape);
+void template_set_trim_blocks(Template *t, bool trim_blocks);
+void template_set_parallel(Template *t, struct RenderPool *pool,
+                                        size_t min_length);
+void template_set_fragment_cache(Template *t, struct FragmentCache *cache);
+void template_set_render_cache(Template *t, struct FragmentCache *cache);
 bool template_parse_path(Template *t, const char *path, Status *status);
 bool template_parse_data(Template *t, String *input, Status *status);
+bool template_analyze(Template *t, Status *status);
+bool template_expression_path(Expression *expression, size_t *index,
+                                                     String *path,
+                                                     Status *status);
+bool template_render(Template *t, Value *context, String *output,
+                                                  Status *status);
+bool template_render_with_evaluator(Template *t,
+                                    ExpressionEvaluator *evaluator,
+                                    Value *context,
+                                    String *output,
+                                    Status *status);
 bool template_render_path(Template *t, const char *path, Value *context,
                                                          String *output,
                                                          Status *status);
-bool template_render_data(Template *t, String *buf, String *output,
-                                                    Status *status);
+bool template_render_data(Template *t, String *input, Value *context,
+                                                      String *output,
+                                                      Status *status);
+void template_loop_init(TemplateLoop *loop, size_t index,
+                                            TemplateNode *node);
+bool template_loop_start(TemplateLoop *loop, Status *status);
+bool template_loop_load(TemplateLoop *loop, Status *status);
+bool template_loop_bind(TemplateLoop *loop,
+                        TemplateNode *node,
+                        ExpressionEvaluator *evaluator,
+                        Status *status);
+void template_loop_free(TemplateLoop *loop);
+bool template_output(String *output, Value *value, bool escape,
+                                                  Status *status);
+bool template_condition(Value *result, bool *truth, Status *status);
 void template_clear(Template *t);
 void template_free(Template *t);
 
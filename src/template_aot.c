@@ -0,0 +1,1025 @@
+#include <cbase.h>
+
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "config.h"
+
+#include "lang.h"
+#include "value.h"
+#include "function.h"
+#include "expression.h"
+#include "expression_evaluator.h"
+#include "template.h"
+#include "template_aot.h"
+
+#define TEMPLATE_AOT_INIT_ALLOC 8
+#define TEMPLATE_AOT_BUF_SIZE 256
+#define TEMPLATE_AOT_LINE_BYTES 64
+
+#define invalid_name(status) status_failure( \
+    status,                                  \
+    "template_aot",                          \
+    TEMPLATE_AOT_INVALID_NAME,               \
+    "Name isn't a valid C identifier"        \
+)
+
+#define unsupported_constant(status) status_failure( \
+    status,                                          \
+    "template_aot",                                  \
+    TEMPLATE_AOT_UNSUPPORTED_CONSTANT,               \
+    "Constant can't be written as C"                 \
+)
+
+#define wrong_arity(status) status_failure( \
+    status,                                 \
+    "template_aot",                         \
+    TEMPLATE_AOT_WRONG_ARITY,               \
+    "Function's arity has changed"          \
+)
+
+static const char *OperatorNames[OP_MAX] = {
+    [OP_BOOL_OR] = "OP_BOOL_OR",
+    [OP_BOOL_AND] = "OP_BOOL_AND",
+    [OP_BOOL_NOT] = "OP_BOOL_NOT",
+    [OP_BOOL_LESS_THAN] = "OP_BOOL_LESS_THAN",
+    [OP_BOOL_LESS_THAN_OR_EQUAL] = "OP_BOOL_LESS_THAN_OR_EQUAL",
+    [OP_BOOL_GREATER_THAN] = "OP_BOOL_GREATER_THAN",
+    [OP_BOOL_GREATER_THAN_OR_EQUAL] = "OP_BOOL_GREATER_THAN_OR_EQUAL",
+    [OP_BOOL_NOT_EQUAL] = "OP_BOOL_NOT_EQUAL",
+    [OP_BOOL_EQUAL] = "OP_BOOL_EQUAL",
+    [OP_MATH_ADD] = "OP_MATH_ADD",
+    [OP_MATH_SUBTRACT] = "OP_MATH_SUBTRACT",
+    [OP_MATH_MULTIPLY] = "OP_MATH_MULTIPLY",
+    [OP_MATH_DIVIDE] = "OP_MATH_DIVIDE",
+    [OP_MATH_REMAINDER] = "OP_MATH_REMAINDER",
+    [OP_MATH_POSITIVE] = "OP_MATH_POSITIVE",
+    [OP_MATH_NEGATIVE] = "OP_MATH_NEGATIVE",
+    [OP_MATH_EXPONENT] = "OP_MATH_EXPONENT",
+};
+
+/*
+ * `constants` holds each expression's first index into <name>_constants,
+ * and `functions` the distinct functions called, indexing
+ * <name>_functions.  `fails` is set once the render function has a path to
+ * its error handling.
+ */
+typedef struct {
+    Template *t;
+    const char *name;
+    String *output;
+    size_t *constants;
+    size_t constant_count;
+    PArray functions;
+    bool fails;
+} TemplateAotWriter;
+
+static bool aot_printf(TemplateAotWriter *writer, Status *status,
+                                                  const char *format,
+                                                  ...) {
+    char buf[TEMPLATE_AOT_BUF_SIZE];
+    char *data = buf;
+    va_list args;
+    int len = 0;
+    bool ok = false;
+
+    va_start(args, format);
+    len = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+
+    if ((size_t)len >= sizeof(buf)) {
+        data = malloc((size_t)len + 1);
+
+        if (!data) {
+            return alloc_failure(status);
+        }
+
+        va_start(args, format);
+        vsnprintf(data, (size_t)len + 1, format, args);
+        va_end(args);
+    }
+
+    ok = string_append_cstr_len(writer->output, data, (size_t)len, status);
+
+    if (data != buf) {
+        free(data);
+    }
+
+    return ok;
+}
+
+/*
+ * Writes `data` as a static byte array, a string literal broken after
+ * newlines and every so often, with anything but printable ASCII escaped.
+ */
+static bool aot_write_data(TemplateAotWriter *writer, const char *kind,
+                                                      size_t index,
+                                                      const char *data,
+                                                      size_t byte_len,
+                                                      Status *status) {
+    size_t line = 0;
+
+    if (!aot_printf(writer, status, "static const char %s_%s_%zu[] =\n"
+                                    "    \"",
+                                    writer->name,
+                                    kind,
+                                    index)) {
+        return false;
+    }
+
+    for (size_t i = 0; i < byte_len; i++) {
+        unsigned char c = (unsigned char)data[i];
+        bool ok = false;
+
+        switch (c) {
+            case '\n':
+                ok = string_append_cstr(writer->output, "\\n", status);
+                line = TEMPLATE_AOT_LINE_BYTES;
+                break;
+            case '\t':
+                ok = string_append_cstr(writer->output, "\\t", status);
+                break;
+            case '"':
+            case '\\':
+            case '?':
+                ok = aot_printf(writer, status, "\\%c", c);
+                break;
+            default:
+                if ((c < 0x20) || (c > 0x7e)) {
+                    ok = aot_printf(writer, status, "\\%03o", c);
+                }
+                else {
+                    ok = aot_printf(writer, status, "%c", c);
+                }
+                break;
+        }
+
+        if (!ok) {
+            return false;
+        }
+
+        if ((++line >= TEMPLATE_AOT_LINE_BYTES) && (i + 1 < byte_len)) {
+            if (!string_append_cstr(writer->output, "\"\n    \"", status)) {
+                return false;
+            }
+
+            line = 0;
+        }
+    }
+
+    return string_append_cstr(writer->output, "\";\n\n", status);
+}
+
+static void aot_label(Template *t, size_t node, char *buf, size_t size) {
+    if (node >= t->nodes.len) {
+        snprintf(buf, size, "done");
+    }
+    else {
+        snprintf(buf, size, "node_%zu", node);
+    }
+}
+
+static bool aot_function_index(TemplateAotWriter *writer,
+                               FunctionEntry *function,
+                               size_t *index,
+                               Status *status) {
+    for (size_t i = 0; i < writer->functions.len; i++) {
+        if (parray_index_fast(&writer->functions, i) == function) {
+            *index = i;
+            return status_ok(status);
+        }
+    }
+
+    *index = writer->functions.len;
+
+    return parray_append(&writer->functions, function, status);
+}
+
+static bool aot_write_header(TemplateAotWriter *writer, Status *status) {
+    Template *t = writer->t;
+    const char *path = t->paths.len ? parray_index_fast(&t->paths, 0) : NULL;
+
+    return (
+        aot_printf(writer, status,
+            "/*\n"
+            " * Generated by `sst compile --to-c` from %s; don't edit.\n"
+            " */\n\n"
+            "#include <cbase.h>\n\n"
+            "#include \"lang.h\"\n"
+            "#include \"value.h\"\n"
+            "#include \"function.h\"\n"
+            "#include \"expression.h\"\n"
+            "#include \"expression_evaluator.h\"\n"
+            "#include \"template.h\"\n"
+            "#include \"template_aot.h\"\n\n"
+            "TEMPLATE_AOT_DECLARE(%s);\n\n",
+            path ? path : "a template",
+            writer->name
+        )
+    );
+}
+
+/*
+ * Writes the byte arrays for text and constants, and numbers the constants
+ * and functions.
+ */
+static bool aot_write_data_arrays(TemplateAotWriter *writer,
+                                  Status *status) {
+    Template *t = writer->t;
+
+    for (size_t i = 0; i < t->nodes.len; i++) {
+        TemplateNode *node = array_index_fast(&t->nodes, i);
+
+        if ((node->type == TEMPLATE_NODE_TEXT) && (node->text.byte_len > 0) &&
+                (!aot_write_data(writer, "text", i, node->text.data,
+                                                    node->text.byte_len,
+                                                    status))) {
+            return false;
+        }
+    }
+
+    writer->constants = malloc(sizeof(size_t) * (t->expressions.len + 1));
+
+    if (!writer->constants) {
+        return alloc_failure(status);
+    }
+
+    for (size_t i = 0; i < t->expressions.len; i++) {
+        Expression *expression = array_index_fast(&t->expressions, i);
+
+        writer->constants[i] = writer->constant_count;
+
+        for (size_t j = 0; j < expression->constants.len; j++) {
+            Value *constant = parray_index_fast(&expression->constants, j);
+            size_t index = writer->constant_count++;
+            String number;
+            bool ok = false;
+
+            switch (constant->type) {
+                case VALUE_NUMBER:
+                    if (!string_init(&number, "", status)) {
+                        return false;
+                    }
+
+                    ok = (
+                        value_to_string(constant, &number, status) &&
+                        aot_write_data(writer, "constant", index,
+                                                           number.data,
+                                                           number.byte_len,
+                                                           status)
+                    );
+
+                    string_free(&number);
+
+                    if (!ok) {
+                        return false;
+                    }
+
+                    break;
+                case VALUE_STRING:
+                    if ((constant->as.string.byte_len > 0) &&
+                            (!aot_write_data(
+                                writer,
+                                "constant",
+                                index,
+                                value_string_data(constant),
+                                constant->as.string.byte_len,
+                                status))) {
+                        return false;
+                    }
+
+                    break;
+                default:
+                    return unsupported_constant(status);
+            }
+        }
+
+        for (size_t j = 0; j < expression->instructions.len; j++) {
+            Instruction *instruction = array_index_fast(
+                &expression->instructions,
+                j
+            );
+            size_t index = 0;
+
+            if (instruction->type != INSTRUCTION_CALL) {
+                continue;
+            }
+
+            if (!aot_function_index(writer, instruction->as.function,
+                                            &index,
+                                            status)) {
+                return false;
+            }
+
+            if ((index == writer->functions.len - 1) &&
+                    (!aot_write_data(writer, "function", index,
+                        instruction->as.function->name.data,
+                        instruction->as.function->name.byte_len,
+                        status))) {
+                return false;
+            }
+        }
+    }
+
+    writer->constants[t->expressions.len] = writer->constant_count;
+
+    return status_ok(status);
+}
+
+static bool aot_write_globals(TemplateAotWriter *writer, Status *status) {
+    Template *t = writer->t;
+
+    if ((writer->constant_count > 0) &&
+            (!aot_printf(writer, status, "static Value %s_constants[%zu];\n",
+                                         writer->name,
+                                         writer->constant_count))) {
+        return false;
+    }
+
+    if ((writer->functions.len > 0) &&
+            (!aot_printf(writer, status,
+                "static FunctionEntry *%s_functions[%zu];\n",
+                writer->name,
+                writer->functions.len))) {
+        return false;
+    }
+
+    if (!string_append_cstr(writer->output, "\n", status)) {
+        return false;
+    }
+
+    for (size_t i = 0; i < t->nodes.len; i++) {
+        TemplateNode *node = array_index_fast(&t->nodes, i);
+
+        if (node->type != TEMPLATE_NODE_ITERATION) {
+            continue;
+        }
+
+        if (!aot_printf(writer, status,
+                "static TemplateNode %s_node_%zu = {\n"
+                "    .type = TEMPLATE_NODE_ITERATION,\n"
+                "    .value_text = {.len = %zu, .byte_len = %zu},\n"
+                "    .local = %zu,\n"
+                "    .uses_meta = %s,\n"
+                "};\n\n",
+                writer->name,
+                i,
+                node->value_text.len,
+                node->value_text.byte_len,
+                node->local,
+                node->uses_meta ? "true" : "false")) {
+            return false;
+        }
+    }
+
+    return status_ok(status);
+}
+
+static bool aot_write_instruction(TemplateAotWriter *writer,
+                                  size_t expression_index,
+                                  Instruction *instruction,
+                                  size_t *top,
+                                  Status *status) {
+    size_t base = writer->constants[expression_index];
+    const char *name = writer->name;
+    size_t pops = 0;
+    size_t index = 0;
+
+    switch (instruction->type) {
+        case INSTRUCTION_PUSH:
+            return aot_printf(writer, status,
+                "        value_copy(&stack[%zu], &%s_constants[%zu], "
+                "status) &&\n",
+                (*top)++,
+                name,
+                base + instruction->as.constant
+            );
+        case INSTRUCTION_LOOKUP:
+            return aot_printf(writer, status,
+                "        expression_evaluator_lookup(context, "
+                "&%s_constants[%zu], &stack[%zu], status) &&\n",
+                name,
+                base + instruction->as.constant,
+                (*top)++
+            );
+        case INSTRUCTION_LOCAL:
+            return aot_printf(writer, status,
+                "        value_copy(&stack[%zu], "
+                "expression_evaluator_local(evaluator, %zu), status) &&\n",
+                (*top)++,
+                instruction->as.local
+            );
+        case INSTRUCTION_MEMBER:
+            return aot_printf(writer, status,
+                "        expression_evaluator_member(&stack[%zu], "
+                "&%s_constants[%zu], status) &&\n",
+                *top - 1,
+                name,
+                base + instruction->as.constant
+            );
+        case INSTRUCTION_INDEX:
+            *top -= 1;
+
+            return aot_printf(writer, status,
+                "        expression_evaluator_index(&stack[%zu], status) "
+                "&&\n",
+                *top - 1
+            );
+        case INSTRUCTION_ARRAY:
+            pops = instruction->as.count;
+            *top = *top - pops + 1;
+
+            return aot_printf(writer, status,
+                "        expression_evaluator_array(&stack[%zu], %zu, "
+                "status) &&\n",
+                *top - 1,
+                pops
+            );
+        case INSTRUCTION_CALL:
+            pops = instruction->as.function->signature.arity;
+            *top = *top - pops + 1;
+
+            if (!aot_function_index(writer, instruction->as.function,
+                                            &index,
+                                            status)) {
+                return false;
+            }
+
+            return aot_printf(writer, status,
+                "        expression_evaluator_call(evaluator, "
+                "%s_functions[%zu], &stack[%zu], status) &&\n",
+                name,
+                index,
+                *top - 1
+            );
+        case INSTRUCTION_OPERATOR:
+            pops = OperatorInfo[instruction->as.op].arity;
+            *top = *top - pops + 1;
+
+            return aot_printf(writer, status,
+                "        expression_evaluator_operator(evaluator, %s, "
+                "&stack[%zu], status) &&\n",
+                OperatorNames[instruction->as.op],
+                *top - 1
+            );
+    }
+
+    return status_ok(status);
+}
+
+static bool aot_write_expression(TemplateAotWriter *writer, size_t index,
+                                                            Status *status) {
+    Expression *expression = array_index_fast(&writer->t->expressions, index);
+    size_t top = 0;
+
+    if (!aot_printf(writer, status,
+            "static bool %s_expression_%zu(\n"
+            "    ExpressionEvaluator *evaluator,\n"
+            "    Value *context,\n"
+            "    Value *result,\n"
+            "    Status *status\n"
+            ") {\n"
+            "    Value stack[%zu];\n"
+            "    bool ok = false;\n\n"
+            "    (void)evaluator;\n"
+            "    (void)context;\n\n"
+            "    for (size_t i = 0; i < %zu; i++) {\n"
+            "        stack[i].type = VALUE_NONE;\n"
+            "    }\n\n"
+            "    ok = (\n",
+            writer->name,
+            index,
+            expression->stack_size,
+            expression->stack_size)) {
+        return false;
+    }
+
+    for (size_t i = 0; i < expression->instructions.len; i++) {
+        if (!aot_write_instruction(writer, index,
+                                   array_index_fast(
+                                       &expression->instructions,
+                                       i
+                                   ),
+                                   &top,
+                                   status)) {
+            return false;
+        }
+    }
+
+    return aot_printf(writer, status,
+        "        true\n"
+        "    );\n\n"
+        "    if (!ok) {\n"
+        "        for (size_t i = 0; i < %zu; i++) {\n"
+        "            value_free(&stack[i]);\n"
+        "        }\n\n"
+        "        return false;\n"
+        "    }\n\n"
+        "    value_free(result);\n"
+        "    value_move(result, &stack[0]);\n\n"
+        "    return status_ok(status);\n"
+        "}\n\n",
+        expression->stack_size
+    );
+}
+
+static bool aot_write_init(TemplateAotWriter *writer, Status *status) {
+    Template *t = writer->t;
+    const char *name = writer->name;
+    size_t functions = 0;
+
+    if (!aot_printf(writer, status,
+            "bool %s_init(FunctionRegistry *functions, Status *status) {\n"
+            "    bool ok = false;\n\n"
+            "    (void)functions;\n\n",
+            name)) {
+        return false;
+    }
+
+    if ((writer->constant_count > 0) &&
+            (!aot_printf(writer, status,
+                "    for (size_t i = 0; i < %zu; i++) {\n"
+                "        %s_constants[i].type = VALUE_NONE;\n"
+                "    }\n\n",
+                writer->constant_count,
+                name))) {
+        return false;
+    }
+
+    if (!string_append_cstr(writer->output, "    ok = (\n", status)) {
+        return false;
+    }
+
+    for (size_t i = 0; i < t->expressions.len; i++) {
+        Expression *expression = array_index_fast(&t->expressions, i);
+
+        for (size_t j = 0; j < expression->constants.len; j++) {
+            Value *constant = parray_index_fast(&expression->constants, j);
+            size_t index = writer->constants[i] + j;
+            char data[TEMPLATE_AOT_BUF_SIZE];
+            bool ok = false;
+
+            snprintf(data, sizeof(data), "%s_constant_%zu", name, index);
+
+            if (constant->type == VALUE_NUMBER) {
+                ok = aot_printf(writer, status,
+                    "        template_aot_number(&%s_constants[%zu], %s, "
+                    "sizeof(%s) - 1, status) &&\n",
+                    name,
+                    index,
+                    data,
+                    data
+                );
+            }
+            else {
+                ok = aot_printf(writer, status,
+                    "        value_init_string_full(&%s_constants[%zu], %s, "
+                    "%zu, %zu, status) &&\n",
+                    name,
+                    index,
+                    constant->as.string.byte_len > 0 ? data : "\"\"",
+                    constant->as.string.len,
+                    constant->as.string.byte_len
+                );
+            }
+
+            if (!ok) {
+                return false;
+            }
+        }
+
+        for (size_t j = 0; j < expression->instructions.len; j++) {
+            Instruction *instruction = array_index_fast(
+                &expression->instructions,
+                j
+            );
+            size_t index = 0;
+
+            if (instruction->type != INSTRUCTION_CALL) {
+                continue;
+            }
+
+            if (!aot_function_index(writer, instruction->as.function,
+                                            &index,
+                                            status)) {
+                return false;
+            }
+
+            if (index < functions) {
+                continue;
+            }
+
+            functions++;
+
+            if (!aot_printf(writer, status,
+                    "        template_aot_function(functions, "
+                    "%s_function_%zu, %zu, %u, &%s_functions[%zu], "
+                    "status) &&\n",
+                    name,
+                    index,
+                    instruction->as.function->name.byte_len,
+                    instruction->as.function->signature.arity,
+                    name,
+                    index)) {
+                return false;
+            }
+        }
+    }
+
+    if (!aot_printf(writer, status,
+            "        true\n"
+            "    );\n\n"
+            "    if (!ok) {\n"
+            "        %s_free();\n"
+            "        return false;\n"
+            "    }\n\n"
+            "    return status_ok(status);\n"
+            "}\n\n"
+            "void %s_free(void) {\n",
+            name,
+            name)) {
+        return false;
+    }
+
+    if ((writer->constant_count > 0) &&
+            (!aot_printf(writer, status,
+                "    for (size_t i = 0; i < %zu; i++) {\n"
+                "        value_free(&%s_constants[i]);\n"
+                "    }\n",
+                writer->constant_count,
+                name))) {
+        return false;
+    }
+
+    return string_append_cstr(writer->output, "}\n\n", status);
+}
+
+static bool aot_write_node(TemplateAotWriter *writer, size_t index,
+                                                      size_t *loops,
+                                                      size_t *depth,
+                                                      Status *status) {
+    Template *t = writer->t;
+    const char *name = writer->name;
+    TemplateNode *node = array_index_fast(&t->nodes, index);
+    TemplateNode *loop_node = NULL;
+    char label[TEMPLATE_AOT_BUF_SIZE];
+
+    switch (node->type) {
+        case TEMPLATE_NODE_TEXT:
+            if (node->text.byte_len == 0) {
+                return status_ok(status);
+            }
+
+            writer->fails = true;
+
+            return aot_printf(writer, status,
+                "    if (!string_append_cstr_full(output, %s_text_%zu, "
+                "%zu, %zu, status)) {\n"
+                "        goto failed;\n"
+                "    }\n\n",
+                name,
+                index,
+                node->text.len,
+                node->text.byte_len
+            );
+        case TEMPLATE_NODE_EXPRESSION:
+            writer->fails = true;
+
+            return aot_printf(writer, status,
+                "    if ((!%s_expression_%zu(evaluator, context, &result, "
+                "status)) ||\n"
+                "            (!template_output(output, &result, %s, "
+                "status))) {\n"
+                "        goto failed;\n"
+                "    }\n\n",
+                name,
+                node->expression,
+                node->escape ? "true" : "false"
+            );
+        case TEMPLATE_NODE_CONDITIONAL:
+            writer->fails = true;
+
+            aot_label(t, node->jump, label, sizeof(label));
+
+            return aot_printf(writer, status,
+                "    if ((!%s_expression_%zu(evaluator, context, &result, "
+                "status)) ||\n"
+                "            (!template_condition(&result, &truth, "
+                "status))) {\n"
+                "        goto failed;\n"
+                "    }\n\n"
+                "    if (!truth) {\n"
+                "        goto %s;\n"
+                "    }\n\n",
+                name,
+                node->expression,
+                label
+            );
+        case TEMPLATE_NODE_JUMP:
+            aot_label(t, node->jump, label, sizeof(label));
+
+            return aot_printf(writer, status, "    goto %s;\n\n", label);
+        case TEMPLATE_NODE_ITERATION:
+            writer->fails = true;
+            loops[(*depth)++] = index;
+            aot_label(t, node->jump, label, sizeof(label));
+
+            return aot_printf(writer, status,
+                "    loop = &loops[depth];\n"
+                "    template_loop_init(loop, %zu, &%s_node_%zu);\n\n"
+                "    if ((!%s_expression_%zu(evaluator, context, "
+                "&loop->iterable, status)) ||\n"
+                "            (!template_loop_start(loop, status))) {\n"
+                "        template_loop_free(loop);\n"
+                "        goto failed;\n"
+                "    }\n\n"
+                "    if (loop->length == 0) {\n"
+                "        template_loop_free(loop);\n"
+                "        goto %s;\n"
+                "    }\n\n"
+                "    if ((!template_loop_load(loop, status)) ||\n"
+                "            (!template_loop_bind(loop, &%s_node_%zu, "
+                "evaluator, status))) {\n"
+                "        template_loop_free(loop);\n"
+                "        goto failed;\n"
+                "    }\n\n"
+                "    depth++;\n\n",
+                index,
+                name,
+                index,
+                name,
+                node->expression,
+                label,
+                name,
+                index
+            );
+        case TEMPLATE_NODE_ITERATION_END:
+            aot_label(t, loops[--(*depth)] + 1, label, sizeof(label));
+
+            return aot_printf(writer, status,
+                "    loop = &loops[depth - 1];\n\n"
+                "    if (++loop->index < loop->length) {\n"
+                "        if (!template_loop_load(loop, status)) {\n"
+                "            goto failed;\n"
+                "        }\n\n"
+                "        goto %s;\n"
+                "    }\n\n"
+                "    template_loop_free(loop);\n"
+                "    depth--;\n\n",
+                label
+            );
+        case TEMPLATE_NODE_BREAK:
+            loop_node = array_index_fast(&t->nodes, node->jump);
+            aot_label(t, loop_node->jump, label, sizeof(label));
+
+            return aot_printf(writer, status,
+                "    template_loop_free(&loops[depth - 1]);\n"
+                "    depth--;\n"
+                "    goto %s;\n\n",
+                label
+            );
+        case TEMPLATE_NODE_CONTINUE:
+            loop_node = array_index_fast(&t->nodes, node->jump);
+            aot_label(t, loop_node->jump - 1, label, sizeof(label));
+
+            return aot_printf(writer, status, "    goto %s;\n\n", label);
+        case TEMPLATE_NODE_CACHE:
+            /* There's no fragment cache to use, so render the body */
+            return status_ok(status);
+    }
+
+    return status_ok(status);
+}
+
+/*
+ * Marks the nodes jumped to, which get labels; `targets` has a slot for the
+ * end too.
+ */
+static void aot_find_targets(Template *t, bool *targets) {
+    for (size_t i = 0; i < t->nodes.len; i++) {
+        TemplateNode *node = array_index_fast(&t->nodes, i);
+        TemplateNode *loop_node = NULL;
+
+        switch (node->type) {
+            case TEMPLATE_NODE_CONDITIONAL:
+            case TEMPLATE_NODE_JUMP:
+            case TEMPLATE_NODE_ITERATION:
+                targets[node->jump] = true;
+
+                if (node->type == TEMPLATE_NODE_ITERATION) {
+                    targets[i + 1] = true;
+                }
+
+                break;
+            case TEMPLATE_NODE_BREAK:
+                loop_node = array_index_fast(&t->nodes, node->jump);
+                targets[loop_node->jump] = true;
+                break;
+            case TEMPLATE_NODE_CONTINUE:
+                loop_node = array_index_fast(&t->nodes, node->jump);
+                targets[loop_node->jump - 1] = true;
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+static bool aot_write_render(TemplateAotWriter *writer, Status *status) {
+    Template *t = writer->t;
+    const char *name = writer->name;
+    size_t *loops = NULL;
+    bool *targets = NULL;
+    size_t depth = 0;
+    bool ok = true;
+
+    targets = calloc(t->nodes.len + 1, sizeof(bool));
+
+    if (!targets) {
+        return alloc_failure(status);
+    }
+
+    if (t->iteration_depth > 0) {
+        loops = malloc(sizeof(size_t) * t->iteration_depth);
+
+        if (!loops) {
+            free(targets);
+            return alloc_failure(status);
+        }
+    }
+
+    aot_find_targets(t, targets);
+
+    ok = aot_printf(writer, status,
+        "bool %s_render(\n"
+        "    ExpressionEvaluator *evaluator,\n"
+        "    Value *context,\n"
+        "    String *output,\n"
+        "    Status *status\n"
+        ") {\n",
+        name
+    );
+
+    if (ok && (t->iteration_depth > 0)) {
+        ok = aot_printf(writer, status,
+            "    TemplateLoop loops[%zu];\n"
+            "    TemplateLoop *loop = NULL;\n"
+            "    size_t depth = 0;\n",
+            t->iteration_depth
+        );
+    }
+
+    ok = ok && aot_printf(writer, status,
+        "    Value result;\n"
+        "    bool truth = false;\n\n"
+        "    (void)context;\n"
+        "    (void)truth;\n\n"
+        "    result.type = VALUE_NONE;\n\n"
+        "    expression_evaluator_reset_memo(evaluator);\n\n"
+    );
+
+    for (size_t i = 0; ok && (i < t->nodes.len); i++) {
+        if (targets[i]) {
+            ok = aot_printf(writer, status, "node_%zu:\n", i);
+        }
+
+        ok = ok && aot_write_node(writer, i, loops, &depth, status);
+    }
+
+    if (ok && targets[t->nodes.len]) {
+        ok = string_append_cstr(writer->output, "done:\n", status);
+    }
+
+    ok = ok && string_append_cstr(writer->output,
+        "    value_free(&result);\n\n"
+        "    return status_ok(status);\n",
+        status
+    );
+
+    if (ok && writer->fails) {
+        ok = string_append_cstr(writer->output, "\nfailed:\n", status);
+
+        if (ok && (t->iteration_depth > 0)) {
+            ok = string_append_cstr(writer->output,
+                "    while (depth > 0) {\n"
+                "        template_loop_free(&loops[--depth]);\n"
+                "    }\n\n",
+                status
+            );
+        }
+
+        ok = ok && string_append_cstr(writer->output,
+            "    value_free(&result);\n\n"
+            "    return false;\n",
+            status
+        );
+    }
+
+    ok = ok && string_append_cstr(writer->output, "}\n", status);
+
+    free(loops);
+    free(targets);
+
+    return ok;
+}
+
+bool template_aot_generate(Template *t, const char *name, String *output,
+                                                          Status *status) {
+    TemplateAotWriter writer;
+    bool ok = false;
+
+    if ((!isalpha((unsigned char)name[0])) && (name[0] != '_')) {
+        return invalid_name(status);
+    }
+
+    for (const char *c = name; *c; c++) {
+        if ((!isalnum((unsigned char)*c)) && (*c != '_')) {
+            return invalid_name(status);
+        }
+    }
+
+    writer.t = t;
+    writer.name = name;
+    writer.output = output;
+    writer.constants = NULL;
+    writer.constant_count = 0;
+    writer.fails = false;
+
+    if (!parray_init_alloc(&writer.functions, TEMPLATE_AOT_INIT_ALLOC,
+                                             status)) {
+        return false;
+    }
+
+    ok = (
+        aot_write_header(&writer, status) &&
+        aot_write_data_arrays(&writer, status) &&
+        aot_write_globals(&writer, status)
+    );
+
+    /* Cache keys are never evaluated, so they don't get functions */
+    for (size_t i = 0; ok && (i < t->nodes.len); i++) {
+        TemplateNode *node = array_index_fast(&t->nodes, i);
+
+        if ((node->type == TEMPLATE_NODE_EXPRESSION) ||
+            (node->type == TEMPLATE_NODE_CONDITIONAL) ||
+            (node->type == TEMPLATE_NODE_ITERATION)) {
+            ok = aot_write_expression(&writer, node->expression, status);
+        }
+    }
+
+    ok = (
+        ok &&
+        aot_write_init(&writer, status) &&
+        aot_write_render(&writer, status)
+    );
+
+    free(writer.constants);
+    parray_free(&writer.functions);
+
+    if (!ok) {
+        return false;
+    }
+
+    return status_ok(status);
+}
+
+bool template_aot_number(Value *value, const char *data, size_t byte_len,
+                                                         Status *status) {
+    DecimalContext ctx;
+    SSlice ss;
+
+    decimal_context_set_max(&ctx);
+
+    ss.data = data;
+    ss.len = byte_len;
+    ss.byte_len = byte_len;
+
+    return value_init_number_from_sslice(value, &ss, &ctx, status);
+}
+
+bool template_aot_function(FunctionRegistry *functions,
+                           const char *name,
+                           size_t byte_len,
+                           unsigned int arity,
+                           FunctionEntry **entry,
+                           Status *status) {
+    SSlice ss;
+
+    ss.data = name;
+    ss.len = byte_len;
+    ss.byte_len = byte_len;
+
+    if (!function_registry_lookup(functions, &ss, entry, status)) {
+        return false;
+    }
+
+    if ((*entry)->signature.arity != arity) {
+        *entry = NULL;
+        return wrong_arity(status);
+    }
+
+    return status_ok(status);
+}
+
+/* vi: set et ts=4 sw=4: */
@@ -0,0 +1,63 @@
+#ifndef TEMPLATE_AOT_H__
+#define TEMPLATE_AOT_H__
+
+enum {
+    TEMPLATE_AOT_INVALID_NAME = 1,
+    TEMPLATE_AOT_UNSUPPORTED_CONSTANT,
+    TEMPLATE_AOT_WRONG_ARITY,
+};
+
+/*
+ * template_aot_generate writes a compiled template out as C source, to be
+ * compiled and linked into a program instead of parsing and interpreting
+ * the template at runtime (`sst compile --to-c` does this from the command
+ * line).  The source defines:
+ *
+ *   bool <name>_init(FunctionRegistry *functions, Status *status);
+ *   bool <name>_render(ExpressionEvaluator *evaluator, Value *context,
+ *                                                      String *output,
+ *                                                      Status *status);
+ *   void <name>_free(void);
+ *
+ * which TEMPLATE_AOT_DECLARE(<name>) declares.  <name>_init builds the
+ * constants and looks up the functions the template calls (by name, in
+ * `functions`), and must be called once before rendering; <name>_free
+ * releases them.  Expressions are generated for the arity each function had
+ * when the template was compiled, so <name>_init fails with
+ * TEMPLATE_AOT_WRONG_ARITY if one's been registered with another since.
+ * <name>_render renders like template_render_with_evaluator, and may be
+ * called by several threads at once, each with its own evaluator.
+ *
+ * Text is stored as static byte arrays, control flow becomes jumps between
+ * labels, and each expression becomes a function making the evaluator's
+ * instruction steps (see expression_evaluator.h) directly, on a stack of its
+ * own, so there's no dispatching on node or instruction types.  Loops are
+ * always rendered serially, and `cache` blocks are always rendered, as
+ * there's no fragment cache.  Only number and string constants can be
+ * written out, which are all the compiler produces.
+ *
+ * template_aot_number and template_aot_function are what the generated
+ * <name>_init calls.
+ */
+
+#define TEMPLATE_AOT_DECLARE(name)                                     \
+    bool name##_init(FunctionRegistry *functions, Status *status);     \
+    bool name##_render(ExpressionEvaluator *evaluator, Value *context, \
+                                                       String *output, \
+                                                       Status *status); \
+    void name##_free(void)
+
+bool template_aot_generate(Template *t, const char *name, String *output,
+                                                          Status *status);
+bool template_aot_number(Value *value, const char *data, size_t byte_len,
+                                                         Status *status);
+bool template_aot_function(FunctionRegistry *functions,
+                           const char *name,
+                           size_t byte_len,
+                           unsigned int arity,
+                           FunctionEntry **entry,
+                           Status *status);
+
+#endif
+
+/* vi: set et ts=4 sw=4: */
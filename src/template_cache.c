@@ -0,0 +1,1257 @@
+#include <cbase.h>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "config.h"
+
+#include "lang.h"
+#include "value.h"
+#include "function.h"
+#include "expression.h"
+#include "expression_evaluator.h"
+#include "template.h"
+#include "template_cache.h"
+
+#define TEMPLATE_CACHE_INIT_ALLOC 4096
+#define TEMPLATE_CACHE_SUFFIX ".sstc"
+#define TEMPLATE_CACHE_TEMP_SUFFIX ".XXXXXX"
+
+#define TEMPLATE_CACHE_NODE_USES_META (1 << 0)
+#define TEMPLATE_CACHE_NODE_PARALLEL  (1 << 1)
+#define TEMPLATE_CACHE_NODE_ESCAPE    (1 << 2)
+
+#define opening_file_failed(status) status_failure( \
+    status,                                         \
+    "template_cache",                               \
+    TEMPLATE_CACHE_OPENING_FILE_FAILED,             \
+    "Opening file failed"                           \
+)
+
+#define reading_file_failed(status) status_failure( \
+    status,                                         \
+    "template_cache",                               \
+    TEMPLATE_CACHE_READING_FILE_FAILED,             \
+    "Reading file failed"                           \
+)
+
+#define writing_file_failed(status) status_failure( \
+    status,                                         \
+    "template_cache",                               \
+    TEMPLATE_CACHE_WRITING_FILE_FAILED,             \
+    "Writing file failed"                           \
+)
+
+#define invalid_format(status) status_failure( \
+    status,                                    \
+    "template_cache",                          \
+    TEMPLATE_CACHE_INVALID_FORMAT,             \
+    "Invalid template cache format"            \
+)
+
+#define unsupported_version(status) status_failure( \
+    status,                                         \
+    "template_cache",                               \
+    TEMPLATE_CACHE_UNSUPPORTED_VERSION,             \
+    "Unsupported template cache version"            \
+)
+
+#define stale(status) status_failure( \
+    status,                           \
+    "template_cache",                 \
+    TEMPLATE_CACHE_STALE,             \
+    "Template cache is stale"         \
+)
+
+#define not_cacheable(status) status_failure( \
+    status,                                   \
+    "template_cache",                         \
+    TEMPLATE_CACHE_NOT_CACHEABLE,             \
+    "Template can't be cached"                \
+)
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t alloc;
+    String text;
+    size_t dependency_count;
+} TemplateCacheWriter;
+
+typedef struct {
+    const char *data;
+    size_t len;
+    size_t offset;
+    const char *text;
+    size_t text_size;
+    String *pool;
+} TemplateCacheReader;
+
+static
+bool cache_writer_init(TemplateCacheWriter *writer, size_t dependency_count,
+                                                    Status *status) {
+    writer->data = malloc(TEMPLATE_CACHE_INIT_ALLOC);
+
+    if (!writer->data) {
+        return alloc_failure(status);
+    }
+
+    writer->len = 0;
+    writer->alloc = TEMPLATE_CACHE_INIT_ALLOC;
+    writer->dependency_count = dependency_count;
+
+    if (!string_init(&writer->text, "", status)) {
+        free(writer->data);
+        return false;
+    }
+
+    return status_ok(status);
+}
+
+static
+void cache_writer_free(TemplateCacheWriter *writer) {
+    string_free(&writer->text);
+    free(writer->data);
+}
+
+/*
+ * Appends `size` zeroed bytes.  Record sizes are multiples of 8, so records
+ * stay aligned.  `record` is only valid until the next append.
+ */
+static
+bool cache_writer_append(TemplateCacheWriter *writer, size_t size,
+                                                      void **record,
+                                                      Status *status) {
+    if ((writer->len + size) > writer->alloc) {
+        size_t alloc = writer->alloc * 2;
+        char *data = NULL;
+
+        while (alloc < (writer->len + size)) {
+            alloc *= 2;
+        }
+
+        data = realloc(writer->data, alloc);
+
+        if (!data) {
+            return alloc_failure(status);
+        }
+
+        writer->data = data;
+        writer->alloc = alloc;
+    }
+
+    memset(writer->data + writer->len, 0, size);
+
+    *record = writer->data + writer->len;
+    writer->len += size;
+
+    return status_ok(status);
+}
+
+/*
+ * Copies text to the end of the file.
+ */
+static
+bool cache_writer_text(TemplateCacheWriter *writer, const char *data,
+                                                    size_t len,
+                                                    size_t byte_len,
+                                                    TemplateCacheText *text,
+                                                    Status *status) {
+    text->source = TEMPLATE_CACHE_TEXT;
+    text->offset = writer->text.byte_len;
+    text->len = len;
+    text->byte_len = byte_len;
+
+    if (byte_len == 0) {
+        return status_ok(status);
+    }
+
+    return string_append_cstr_full(&writer->text, data, len, byte_len,
+                                                             status);
+}
+
+/*
+ * Refers to node text by its place in a dependency's source, copying it to
+ * the end of the file only if it isn't in one.
+ */
+static
+bool cache_writer_node_text(TemplateCacheWriter *writer,
+                            Template *t,
+                            SSlice *ss,
+                            TemplateCacheText *text,
+                            Status *status) {
+    for (size_t i = 0; (ss->byte_len > 0) &&
+                       (i < writer->dependency_count); i++) {
+        String *source = parray_index_fast(&t->sources, i);
+
+        if ((ss->data >= source->data) &&
+                ((ss->data + ss->byte_len) <=
+                 (source->data + source->byte_len))) {
+            text->source = i;
+            text->offset = (uint64_t)(ss->data - source->data);
+            text->len = ss->len;
+            text->byte_len = ss->byte_len;
+
+            return status_ok(status);
+        }
+    }
+
+    return cache_writer_text(writer, ss->data, ss->len, ss->byte_len, text,
+                                                                     status);
+}
+
+static
+bool cache_write_dependencies(TemplateCacheWriter *writer, Template *t,
+                                                           Status *status) {
+    for (size_t i = 0; i < t->paths.len; i++) {
+        const char *path = parray_index_fast(&t->paths, i);
+        String *source = parray_index_fast(&t->sources, i);
+        TemplateCacheDependency *dependency = NULL;
+
+        if (!cache_writer_append(writer, sizeof(TemplateCacheDependency),
+                                         (void **)&dependency,
+                                         status)) {
+            return false;
+        }
+
+        dependency->size = source->byte_len;
+        dependency->hash = hash64(source->data, source->byte_len, 0);
+
+        if (!cache_writer_text(writer, path, strlen(path),
+                                             strlen(path),
+                                             &dependency->path,
+                                             status)) {
+            return false;
+        }
+    }
+
+    return status_ok(status);
+}
+
+static
+bool cache_write_nodes(TemplateCacheWriter *writer, Template *t,
+                                                    Status *status) {
+    for (size_t i = 0; i < t->nodes.len; i++) {
+        TemplateNode *node = array_index_fast(&t->nodes, i);
+        TemplateCacheNode *record = NULL;
+
+        if (!cache_writer_append(writer, sizeof(TemplateCacheNode),
+                                         (void **)&record,
+                                         status)) {
+            return false;
+        }
+
+        record->type = node->type;
+        record->flags = (
+            (node->uses_meta ? TEMPLATE_CACHE_NODE_USES_META : 0) |
+            (node->parallel ? TEMPLATE_CACHE_NODE_PARALLEL : 0) |
+            (node->escape ? TEMPLATE_CACHE_NODE_ESCAPE : 0)
+        );
+        record->local = node->local;
+        record->expression = node->expression;
+        record->jump = node->jump;
+
+        if ((!cache_writer_node_text(writer, t, &node->text, &record->text,
+                                                             status)) ||
+                (!cache_writer_node_text(writer, t, &node->value_text,
+                                                    &record->value_text,
+                                                    status))) {
+            return false;
+        }
+    }
+
+    return status_ok(status);
+}
+
+static
+bool cache_write_constant(TemplateCacheWriter *writer, Value *constant,
+                                                       Status *status) {
+    TemplateCacheConstant *record = NULL;
+    size_t offset = writer->text.byte_len;
+
+    if (!cache_writer_append(writer, sizeof(TemplateCacheConstant),
+                                     (void **)&record,
+                                     status)) {
+        return false;
+    }
+
+    record->type = constant->type;
+
+    switch (constant->type) {
+        case VALUE_NUMBER:
+            if (!value_to_string(constant, &writer->text, status)) {
+                return false;
+            }
+
+            record->text.source = TEMPLATE_CACHE_TEXT;
+            record->text.offset = offset;
+            record->text.len = writer->text.byte_len - offset;
+            record->text.byte_len = writer->text.byte_len - offset;
+
+            return status_ok(status);
+        case VALUE_STRING:
+            return cache_writer_text(writer, value_string_data(constant),
+                                             constant->as.string.len,
+                                             constant->as.string.byte_len,
+                                             &record->text,
+                                             status);
+        default:
+            return not_cacheable(status);
+    }
+}
+
+static
+bool cache_write_expressions(TemplateCacheWriter *writer, Template *t,
+                                                          Status *status) {
+    for (size_t i = 0; i < t->expressions.len; i++) {
+        Expression *expression = array_index_fast(&t->expressions, i);
+        TemplateCacheExpression *record = NULL;
+
+        if (!cache_writer_append(writer, sizeof(TemplateCacheExpression),
+                                         (void **)&record,
+                                         status)) {
+            return false;
+        }
+
+        record->instruction_count = expression->instructions.len;
+        record->constant_count = expression->constants.len;
+        record->stack_size = expression->stack_size;
+
+        for (size_t j = 0; j < expression->instructions.len; j++) {
+            Instruction *instruction = array_index_fast(
+                &expression->instructions,
+                j
+            );
+            TemplateCacheInstruction *instruction_record = NULL;
+            Function *signature = NULL;
+
+            if (!cache_writer_append(writer,
+                                     sizeof(TemplateCacheInstruction),
+                                     (void **)&instruction_record,
+                                     status)) {
+                return false;
+            }
+
+            instruction_record->type = instruction->type;
+
+            switch (instruction->type) {
+                case INSTRUCTION_PUSH:
+                case INSTRUCTION_LOOKUP:
+                case INSTRUCTION_MEMBER:
+                    instruction_record->operand = instruction->as.constant;
+                    break;
+                case INSTRUCTION_LOCAL:
+                    instruction_record->operand = instruction->as.local;
+                    break;
+                case INSTRUCTION_ARRAY:
+                    instruction_record->operand = instruction->as.count;
+                    break;
+                case INSTRUCTION_OPERATOR:
+                    instruction_record->operand = instruction->as.op;
+                    break;
+                case INSTRUCTION_CALL:
+                    signature = &instruction->as.function->signature;
+                    instruction_record->operand = signature->arity;
+
+                    if ((!cache_writer_text(
+                            writer,
+                            instruction->as.function->name.data,
+                            instruction->as.function->name.len,
+                            instruction->as.function->name.byte_len,
+                            &instruction_record->function,
+                            status)) ||
+                            (!cache_writer_text(
+                                writer,
+                                signature->argument_types,
+                                strlen(signature->argument_types),
+                                strlen(signature->argument_types),
+                                &instruction_record->argument_types,
+                                status))) {
+                        return false;
+                    }
+                    break;
+                case INSTRUCTION_INDEX:
+                    break;
+            }
+        }
+
+        for (size_t j = 0; j < expression->constants.len; j++) {
+            if (!cache_write_constant(
+                    writer,
+                    parray_index_fast(&expression->constants, j),
+                    status)) {
+                return false;
+            }
+        }
+    }
+
+    return status_ok(status);
+}
+
+/*
+ * Writes `len` bytes to a temporary file next to `path`, then renames it
+ * into place.
+ */
+static
+bool cache_write_file(const char *path, const char *data, size_t len,
+                                                          Status *status) {
+    String temp_path;
+    FILE *fobj = NULL;
+    int fd = -1;
+
+    if (!string_init(&temp_path, path, status)) {
+        return false;
+    }
+
+    if (!string_append_cstr(&temp_path, TEMPLATE_CACHE_TEMP_SUFFIX,
+                                        status)) {
+        string_free(&temp_path);
+        return false;
+    }
+
+    fd = mkstemp(temp_path.data);
+
+    if (fd == -1) {
+        string_free(&temp_path);
+        return opening_file_failed(status);
+    }
+
+    fobj = fdopen(fd, "wb");
+
+    if (!fobj) {
+        close(fd);
+        unlink(temp_path.data);
+        string_free(&temp_path);
+        return opening_file_failed(status);
+    }
+
+    if ((fwrite(data, 1, len, fobj) != len) || (fclose(fobj) != 0)) {
+        unlink(temp_path.data);
+        string_free(&temp_path);
+        return writing_file_failed(status);
+    }
+
+    if (rename(temp_path.data, path) == -1) {
+        unlink(temp_path.data);
+        string_free(&temp_path);
+        return writing_file_failed(status);
+    }
+
+    string_free(&temp_path);
+
+    return status_ok(status);
+}
+
+bool template_cache_save(Template *t, const char *path, Status *status) {
+    TemplateCacheWriter writer;
+    TemplateCacheHeader *header = NULL;
+    char *text = NULL;
+    bool saved = false;
+
+    if ((t->paths.len == 0) || (t->sources.len < t->paths.len)) {
+        return not_cacheable(status);
+    }
+
+    if (!cache_writer_init(&writer, t->paths.len, status)) {
+        return false;
+    }
+
+    if ((!cache_writer_append(&writer, sizeof(TemplateCacheHeader),
+                                       (void **)&header,
+                                       status)) ||
+            (!cache_write_dependencies(&writer, t, status)) ||
+            (!cache_write_nodes(&writer, t, status)) ||
+            (!cache_write_expressions(&writer, t, status))) {
+        cache_writer_free(&writer);
+        return false;
+    }
+
+    header = (TemplateCacheHeader *)writer.data;
+
+    memcpy(header->magic, TEMPLATE_CACHE_MAGIC, sizeof(TEMPLATE_CACHE_MAGIC));
+    header->version = TEMPLATE_CACHE_VERSION;
+    header->byte_order = TEMPLATE_CACHE_BYTE_ORDER_MARK;
+    header->autoescape = t->autoescape;
+    header->trim_blocks = t->trim_blocks;
+    header->size = writer.len + writer.text.byte_len;
+    header->iteration_depth = t->iteration_depth;
+    header->dependency_count = t->paths.len;
+    header->node_count = t->nodes.len;
+    header->expression_count = t->expressions.len;
+    header->text_size = writer.text.byte_len;
+
+    if (!cache_writer_append(&writer, writer.text.byte_len, (void **)&text,
+                                                            status)) {
+        cache_writer_free(&writer);
+        return false;
+    }
+
+    memcpy(text, writer.text.data, writer.text.byte_len);
+
+    saved = cache_write_file(path, writer.data, writer.len, status);
+
+    cache_writer_free(&writer);
+
+    return saved;
+}
+
+/*
+ * Returns the next record of `size` bytes, checking that it's before the
+ * text.
+ */
+static
+bool cache_reader_next(TemplateCacheReader *reader, size_t size,
+                                                    const void **record,
+                                                    Status *status) {
+    if (size > (reader->len - reader->offset)) {
+        return invalid_format(status);
+    }
+
+    *record = reader->data + reader->offset;
+    reader->offset += size;
+
+    return status_ok(status);
+}
+
+/*
+ * Points `ss` at text stored at the end of the file, which is only valid
+ * until it's unmapped.
+ */
+static
+bool cache_reader_text(TemplateCacheReader *reader,
+                       const TemplateCacheText *text,
+                       SSlice *ss,
+                       Status *status) {
+    if ((text->source != TEMPLATE_CACHE_TEXT) ||
+            (text->offset > reader->text_size) ||
+            (text->byte_len > (reader->text_size - text->offset))) {
+        return invalid_format(status);
+    }
+
+    ss->data = reader->text + text->offset;
+    ss->len = text->len;
+    ss->byte_len = text->byte_len;
+
+    return status_ok(status);
+}
+
+/*
+ * Points `ss` at node text, which is either in a dependency's source or
+ * copied (all of it, the first time) to a source of its own.
+ */
+static
+bool cache_reader_node_text(TemplateCacheReader *reader,
+                            Template *t,
+                            size_t dependencies,
+                            const TemplateCacheText *text,
+                            SSlice *ss,
+                            Status *status) {
+    String *source = NULL;
+
+    if (text->source == TEMPLATE_CACHE_TEXT) {
+        if (!cache_reader_text(reader, text, ss, status)) {
+            return false;
+        }
+
+        if (!reader->pool) {
+            String *pool = malloc(sizeof(String));
+
+            if (!pool) {
+                return alloc_failure(status);
+            }
+
+            if (!string_init_len(pool, reader->text, reader->text_size,
+                                                     status)) {
+                free(pool);
+                return false;
+            }
+
+            if (!parray_append(&t->sources, pool, status)) {
+                string_free(pool);
+                free(pool);
+                return false;
+            }
+
+            reader->pool = pool;
+        }
+
+        ss->data = reader->pool->data + text->offset;
+
+        return status_ok(status);
+    }
+
+    if (text->source >= dependencies) {
+        return invalid_format(status);
+    }
+
+    source = parray_index_fast(&t->sources, text->source);
+
+    if ((text->offset > source->byte_len) ||
+            (text->byte_len > (source->byte_len - text->offset))) {
+        return invalid_format(status);
+    }
+
+    ss->data = source->data + text->offset;
+    ss->len = text->len;
+    ss->byte_len = text->byte_len;
+
+    return status_ok(status);
+}
+
+/*
+ * Reads the file at `path` into `source` if it's still the size and hash
+ * recorded in `dependency`.
+ */
+static
+bool cache_read_dependency(const char *path,
+                           const TemplateCacheDependency *dependency,
+                           String *source,
+                           Status *status) {
+    struct stat st;
+    void *data = NULL;
+    int fd = open(path, O_RDONLY);
+
+    if (fd == -1) {
+        return stale(status);
+    }
+
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return reading_file_failed(status);
+    }
+
+    if ((uint64_t)st.st_size != dependency->size) {
+        close(fd);
+        return stale(status);
+    }
+
+    if (st.st_size == 0) {
+        close(fd);
+
+        if (dependency->hash != hash64("", 0, 0)) {
+            return stale(status);
+        }
+
+        return string_init(source, "", status);
+    }
+
+    data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    close(fd);
+
+    if (data == MAP_FAILED) {
+        return reading_file_failed(status);
+    }
+
+    if (hash64(data, (size_t)st.st_size, 0) != dependency->hash) {
+        munmap(data, (size_t)st.st_size);
+        return stale(status);
+    }
+
+    if (!string_init_len(source, data, (size_t)st.st_size, status)) {
+        munmap(data, (size_t)st.st_size);
+        return false;
+    }
+
+    munmap(data, (size_t)st.st_size);
+
+    return status_ok(status);
+}
+
+static
+bool cache_read_dependencies(TemplateCacheReader *reader, Template *t,
+                                                          size_t count,
+                                                          Status *status) {
+    for (size_t i = 0; i < count; i++) {
+        const TemplateCacheDependency *dependency = NULL;
+        String *source = NULL;
+        char *path = NULL;
+        SSlice ss;
+
+        if ((!cache_reader_next(reader, sizeof(TemplateCacheDependency),
+                                        (const void **)&dependency,
+                                        status)) ||
+                (!cache_reader_text(reader, &dependency->path, &ss,
+                                                               status))) {
+            return false;
+        }
+
+        path = strndup(ss.data, ss.byte_len);
+
+        if (!path) {
+            return alloc_failure(status);
+        }
+
+        if (!parray_append(&t->paths, path, status)) {
+            free(path);
+            return false;
+        }
+
+        source = malloc(sizeof(String));
+
+        if (!source) {
+            return alloc_failure(status);
+        }
+
+        if (!cache_read_dependency(path, dependency, source, status)) {
+            free(source);
+            return false;
+        }
+
+        if (!parray_append(&t->sources, source, status)) {
+            string_free(source);
+            free(source);
+            return false;
+        }
+    }
+
+    return status_ok(status);
+}
+
+static
+bool cache_read_nodes(TemplateCacheReader *reader,
+                      Template *t,
+                      const TemplateCacheHeader *header,
+                      Status *status) {
+    size_t dependencies = header->dependency_count;
+
+    for (size_t i = 0; i < header->node_count; i++) {
+        const TemplateCacheNode *record = NULL;
+        TemplateNode *node = NULL;
+
+        if (!cache_reader_next(reader, sizeof(TemplateCacheNode),
+                                       (const void **)&record,
+                                       status)) {
+            return false;
+        }
+
+        if ((record->type > TEMPLATE_NODE_CACHE) ||
+                ((record->jump > header->node_count) &&
+                 (record->jump != (uint64_t)-1))) {
+            return invalid_format(status);
+        }
+
+        if (((record->type == TEMPLATE_NODE_EXPRESSION) ||
+             (record->type == TEMPLATE_NODE_CONDITIONAL) ||
+             (record->type == TEMPLATE_NODE_ITERATION) ||
+             (record->type == TEMPLATE_NODE_CACHE)) &&
+                (record->expression >= header->expression_count)) {
+            return invalid_format(status);
+        }
+
+        if (!array_append(&t->nodes, (void **)&node, status)) {
+            return false;
+        }
+
+        node->type = record->type;
+        node->local = record->local;
+        node->uses_meta = record->flags & TEMPLATE_CACHE_NODE_USES_META;
+        node->parallel = record->flags & TEMPLATE_CACHE_NODE_PARALLEL;
+        node->expression = record->expression;
+        node->jump = record->jump;
+        node->escape = record->flags & TEMPLATE_CACHE_NODE_ESCAPE;
+
+        if ((!cache_reader_node_text(reader, t, dependencies,
+                                                &record->text,
+                                                &node->text,
+                                                status)) ||
+                (!cache_reader_node_text(reader, t, dependencies,
+                                                    &record->value_text,
+                                                    &node->value_text,
+                                                    status))) {
+            return false;
+        }
+    }
+
+    return status_ok(status);
+}
+
+static
+bool cache_read_instruction(TemplateCacheReader *reader,
+                            Template *t,
+                            Expression *expression,
+                            uint64_t constants,
+                            Status *status) {
+    const TemplateCacheInstruction *record = NULL;
+    Instruction *instruction = NULL;
+    FunctionEntry *function = NULL;
+    SSlice name;
+    SSlice argument_types;
+
+    if (!cache_reader_next(reader, sizeof(TemplateCacheInstruction),
+                                   (const void **)&record,
+                                   status)) {
+        return false;
+    }
+
+    switch (record->type) {
+        case INSTRUCTION_PUSH:
+        case INSTRUCTION_LOOKUP:
+        case INSTRUCTION_MEMBER:
+            if (record->operand >= constants) {
+                return invalid_format(status);
+            }
+            break;
+        case INSTRUCTION_OPERATOR:
+            if (record->operand >= OP_MAX) {
+                return invalid_format(status);
+            }
+            break;
+        case INSTRUCTION_CALL:
+            if ((!cache_reader_text(reader, &record->function, &name,
+                                                               status)) ||
+                    (!cache_reader_text(reader, &record->argument_types,
+                                                &argument_types,
+                                                status))) {
+                return false;
+            }
+
+            if (!function_registry_lookup(t->functions, &name, &function,
+                                                               status)) {
+                if (status_match(status, "base", ERROR_NOT_FOUND)) {
+                    return stale(status);
+                }
+
+                return false;
+            }
+
+            /* The compiled stack depths depend on the arity */
+            if ((function->signature.arity != record->operand) ||
+                    (strlen(function->signature.argument_types) !=
+                     argument_types.byte_len) ||
+                    (memcmp(function->signature.argument_types,
+                            argument_types.data,
+                            argument_types.byte_len) != 0)) {
+                return stale(status);
+            }
+            break;
+        case INSTRUCTION_LOCAL:
+        case INSTRUCTION_INDEX:
+        case INSTRUCTION_ARRAY:
+            break;
+        default:
+            return invalid_format(status);
+    }
+
+    if (!array_append(&expression->instructions, (void **)&instruction,
+                                                  status)) {
+        return false;
+    }
+
+    instruction->type = record->type;
+
+    switch (record->type) {
+        case INSTRUCTION_PUSH:
+        case INSTRUCTION_LOOKUP:
+        case INSTRUCTION_MEMBER:
+            instruction->as.constant = record->operand;
+            break;
+        case INSTRUCTION_LOCAL:
+            instruction->as.local = record->operand;
+            break;
+        case INSTRUCTION_ARRAY:
+            instruction->as.count = record->operand;
+            break;
+        case INSTRUCTION_OPERATOR:
+            instruction->as.op = (Operator)record->operand;
+            break;
+        case INSTRUCTION_CALL:
+            instruction->as.function = function;
+            break;
+        default:
+            break;
+    }
+
+    return status_ok(status);
+}
+
+static
+bool cache_read_constant(TemplateCacheReader *reader, Expression *expression,
+                                                      DecimalContext *ctx,
+                                                      Status *status) {
+    const TemplateCacheConstant *record = NULL;
+    Value *constant = NULL;
+    SSlice ss;
+
+    if ((!cache_reader_next(reader, sizeof(TemplateCacheConstant),
+                                    (const void **)&record,
+                                    status)) ||
+            (!cache_reader_text(reader, &record->text, &ss, status))) {
+        return false;
+    }
+
+    constant = malloc(sizeof(Value));
+
+    if (!constant) {
+        return alloc_failure(status);
+    }
+
+    switch (record->type) {
+        case VALUE_NUMBER:
+            if (!value_init_number_from_sslice(constant, &ss, ctx, status)) {
+                free(constant);
+                return false;
+            }
+            break;
+        case VALUE_STRING:
+            if (!value_init_string_full(constant, ss.data, ss.len,
+                                                           ss.byte_len,
+                                                           status)) {
+                free(constant);
+                return false;
+            }
+            break;
+        default:
+            free(constant);
+            return invalid_format(status);
+    }
+
+    if (!parray_append(&expression->constants, constant, status)) {
+        value_free(constant);
+        free(constant);
+        return false;
+    }
+
+    return status_ok(status);
+}
+
+/*
+ * Checks that `expression`'s instructions only use values already on the
+ * stack, never push it past `stack_size`, and leave exactly one value, as
+ * the compiler guarantees and the evaluator relies on.
+ */
+static
+bool cache_check_stack(Expression *expression, Status *status) {
+    size_t depth = 0;
+
+    for (size_t i = 0; i < expression->instructions.len; i++) {
+        Instruction *instruction = array_index_fast(
+            &expression->instructions,
+            i
+        );
+        size_t pops = 0;
+        size_t pushes = 1;
+
+        switch (instruction->type) {
+            case INSTRUCTION_MEMBER:
+                pops = 1;
+                break;
+            case INSTRUCTION_INDEX:
+                pops = 2;
+                break;
+            case INSTRUCTION_ARRAY:
+                pops = instruction->as.count;
+                break;
+            case INSTRUCTION_CALL:
+                pops = instruction->as.function->signature.arity;
+                break;
+            case INSTRUCTION_OPERATOR:
+                pops = OperatorInfo[instruction->as.op].arity;
+                break;
+            default:
+                break;
+        }
+
+        if (depth < pops) {
+            return invalid_format(status);
+        }
+
+        depth = depth - pops + pushes;
+
+        if (depth > expression->stack_size) {
+            return invalid_format(status);
+        }
+    }
+
+    if (depth != 1) {
+        return invalid_format(status);
+    }
+
+    return status_ok(status);
+}
+
+static
+bool cache_check_locals(Expression *expression, size_t in_scope) {
+    for (size_t i = 0; i < expression->instructions.len; i++) {
+        Instruction *instruction = array_index_fast(
+            &expression->instructions,
+            i
+        );
+
+        if ((instruction->type == INSTRUCTION_LOCAL) &&
+                (instruction->as.local >= in_scope)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static
+bool cache_read_expressions(TemplateCacheReader *reader, Template *t,
+                                                         size_t count,
+                                                         Status *status) {
+    DecimalContext ctx;
+
+    decimal_context_set_max(&ctx);
+
+    for (size_t i = 0; i < count; i++) {
+        const TemplateCacheExpression *record = NULL;
+        Expression *expression = NULL;
+
+        if (!cache_reader_next(reader, sizeof(TemplateCacheExpression),
+                                       (const void **)&record,
+                                       status)) {
+            return false;
+        }
+
+        if (!array_append(&t->expressions, (void **)&expression, status)) {
+            return false;
+        }
+
+        if (!expression_init(expression, status)) {
+            array_truncate_fast(&t->expressions, t->expressions.len - 1);
+            return false;
+        }
+
+        expression->stack_size = record->stack_size;
+
+        for (size_t j = 0; j < record->instruction_count; j++) {
+            if (!cache_read_instruction(reader, t, expression,
+                                                   record->constant_count,
+                                                   status)) {
+                return false;
+            }
+        }
+
+        for (size_t j = 0; j < record->constant_count; j++) {
+            if (!cache_read_constant(reader, expression, &ctx, status)) {
+                return false;
+            }
+        }
+
+        if (!cache_check_stack(expression, status)) {
+            return false;
+        }
+    }
+
+    return status_ok(status);
+}
+
+/*
+ * Checks that each loop's locals start where the enclosing loops' end, that
+ * loops nest no deeper than `iteration_depth`, that loop ends and loop
+ * control jump to loops, and that expressions only read locals in scope.
+ * The renderer and evaluator trust all of these.
+ */
+static
+bool cache_check_loops(Template *t, const TemplateCacheHeader *header,
+                                    Status *status) {
+    Array scopes;
+    bool ok = true;
+
+    if (!array_init_alloc(&scopes, sizeof(size_t),
+                                   (size_t)header->iteration_depth + 1,
+                                   status)) {
+        return false;
+    }
+
+    for (size_t i = 0; ok && (i < t->nodes.len); i++) {
+        TemplateNode *node = array_index_fast(&t->nodes, i);
+        size_t in_scope = 0;
+        size_t *scope = NULL;
+
+        if (scopes.len > 0) {
+            in_scope = *(size_t *)array_index_fast(&scopes, scopes.len - 1);
+        }
+
+        switch (node->type) {
+            case TEMPLATE_NODE_EXPRESSION:
+            case TEMPLATE_NODE_CONDITIONAL:
+            case TEMPLATE_NODE_ITERATION:
+            case TEMPLATE_NODE_CACHE:
+                ok = cache_check_locals(
+                    array_index_fast(&t->expressions, node->expression),
+                    in_scope
+                );
+                break;
+            case TEMPLATE_NODE_ITERATION_END:
+            case TEMPLATE_NODE_BREAK:
+            case TEMPLATE_NODE_CONTINUE:
+                ok = (
+                    (scopes.len > 0) &&
+                    (node->jump < i) &&
+                    (((TemplateNode *)array_index_fast(
+                        &t->nodes,
+                        node->jump
+                    ))->type == TEMPLATE_NODE_ITERATION)
+                );
+                break;
+            default:
+                break;
+        }
+
+        if (!ok) {
+            break;
+        }
+
+        if (node->type == TEMPLATE_NODE_ITERATION) {
+            if ((node->local != in_scope) ||
+                    (scopes.len >= header->iteration_depth)) {
+                ok = false;
+                break;
+            }
+
+            if (!array_append(&scopes, (void **)&scope, status)) {
+                array_free(&scopes);
+                return false;
+            }
+
+            *scope = node->local + TEMPLATE_LOOP_META_COUNT +
+                     (node->value_text.len > 0 ? 2 : 1);
+        }
+        else if (node->type == TEMPLATE_NODE_ITERATION_END) {
+            array_truncate_fast(&scopes, scopes.len - 1);
+        }
+    }
+
+    ok = ok && (scopes.len == 0);
+
+    array_free(&scopes);
+
+    if (!ok) {
+        return invalid_format(status);
+    }
+
+    return status_ok(status);
+}
+
+bool template_cache_load(Template *t, const char *path, Status *status) {
+    struct stat st;
+    const TemplateCacheHeader *header = NULL;
+    TemplateCacheReader reader;
+    void *data = NULL;
+    int fd = open(path, O_RDONLY);
+
+    if (fd == -1) {
+        return opening_file_failed(status);
+    }
+
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return reading_file_failed(status);
+    }
+
+    if (((size_t)st.st_size) < sizeof(TemplateCacheHeader)) {
+        close(fd);
+        return invalid_format(status);
+    }
+
+    data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    close(fd);
+
+    if (data == MAP_FAILED) {
+        return reading_file_failed(status);
+    }
+
+    header = data;
+
+    if ((memcmp(header->magic, TEMPLATE_CACHE_MAGIC,
+                               sizeof(TEMPLATE_CACHE_MAGIC)) != 0) ||
+            (header->size != (uint64_t)st.st_size) ||
+            (header->text_size >
+             (header->size - sizeof(TemplateCacheHeader)))) {
+        munmap(data, (size_t)st.st_size);
+        return invalid_format(status);
+    }
+
+    if ((header->version != TEMPLATE_CACHE_VERSION) ||
+            (header->byte_order != TEMPLATE_CACHE_BYTE_ORDER_MARK)) {
+        munmap(data, (size_t)st.st_size);
+        return unsupported_version(status);
+    }
+
+    if ((((bool)header->autoescape) != t->autoescape) ||
+            (((bool)header->trim_blocks) != t->trim_blocks)) {
+        munmap(data, (size_t)st.st_size);
+        return stale(status);
+    }
+
+    reader.data = data;
+    reader.len = (size_t)(header->size - header->text_size);
+    reader.offset = sizeof(TemplateCacheHeader);
+    reader.text = reader.data + reader.len;
+    reader.text_size = (size_t)header->text_size;
+    reader.pool = NULL;
+
+    template_clear(t);
+
+    if ((!cache_read_dependencies(&reader, t, header->dependency_count,
+                                              status)) ||
+            (!cache_read_nodes(&reader, t, header, status)) ||
+            (!cache_read_expressions(&reader, t, header->expression_count,
+                                                 status)) ||
+            (!cache_check_loops(t, header, status))) {
+        template_clear(t);
+        munmap(data, (size_t)st.st_size);
+        return false;
+    }
+
+    t->iteration_depth = header->iteration_depth;
+
+    munmap(data, (size_t)st.st_size);
+
+    if (!template_analyze(t, status)) {
+        template_clear(t);
+        return false;
+    }
+
+    return status_ok(status);
+}
+
+bool template_parse_path_cached(Template *t, const char *path,
+                                             const char *cache_dir,
+                                             Status *status) {
+    char name[sizeof(uint64_t) * 2 + sizeof(TEMPLATE_CACHE_SUFFIX)];
+    String cache_path;
+    Status cache_status;
+
+    snprintf(name, sizeof(name), "%016llx" TEMPLATE_CACHE_SUFFIX,
+             (unsigned long long)hash64(path, strlen(path), 0));
+
+    if (!string_init(&cache_path, cache_dir, status)) {
+        return false;
+    }
+
+    if ((!string_append_cstr(&cache_path, "/", status)) ||
+            (!string_append_cstr(&cache_path, name, status))) {
+        string_free(&cache_path);
+        return false;
+    }
+
+    status_init(&cache_status);
+
+    if (template_cache_load(t, cache_path.data, &cache_status)) {
+        string_free(&cache_path);
+        return status_ok(status);
+    }
+
+    if (!template_parse_path(t, path, status)) {
+        string_free(&cache_path);
+        return false;
+    }
+
+    /* The template's fine; it'll just be parsed again next time */
+    status_init(&cache_status);
+    template_cache_save(t, cache_path.data, &cache_status);
+
+    string_free(&cache_path);
+
+    return status_ok(status);
+}
+
+/* vi: set et ts=4 sw=4: */
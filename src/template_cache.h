@@ -0,0 +1,132 @@
+#ifndef TEMPLATE_CACHE_H__
+#define TEMPLATE_CACHE_H__
+
+enum {
+    TEMPLATE_CACHE_OPENING_FILE_FAILED = 1,
+    TEMPLATE_CACHE_READING_FILE_FAILED,
+    TEMPLATE_CACHE_WRITING_FILE_FAILED,
+    TEMPLATE_CACHE_INVALID_FORMAT,
+    TEMPLATE_CACHE_UNSUPPORTED_VERSION,
+    TEMPLATE_CACHE_STALE,
+    TEMPLATE_CACHE_NOT_CACHEABLE,
+};
+
+/*
+ * The template cache saves compiled templates to disk, so that they can be
+ * loaded at startup without tokenizing, lexing or parsing anything.
+ *
+ * A cache file records the nodes and expressions as compiled, and the path,
+ * size and hash of each file the template was compiled from (see `paths` in
+ * template.h).  Loading maps the cache file and reads those files again, since
+ * node text refers to them.  It fails with TEMPLATE_CACHE_STALE if any of
+ * them is missing or hashes differently, if a function the template calls
+ * isn't in the registry anymore or has a different signature, or if the
+ * template was compiled with different autoescape or trim_blocks settings
+ * than the Template it's loaded into has, since both are baked into the
+ * nodes.  Everything else is copied out of the mapping, which is released
+ * before returning.
+ *
+ * Records are checked before they're used: constants, operators, jumps and
+ * locals must be in range, loops must nest no deeper than
+ * `iteration_depth`, and each expression's instructions must leave exactly
+ * one value on a stack no deeper than `stack_size`.  Files failing those
+ * checks are rejected with TEMPLATE_CACHE_INVALID_FORMAT.
+ *
+ * Layout (native byte order, every record 8-byte aligned):
+ *
+ *   header:        TemplateCacheHeader
+ *   dependencies:  `dependency_count` TemplateCacheDependency
+ *   nodes:         `node_count` TemplateCacheNode
+ *   expressions:   `expression_count` of a TemplateCacheExpression, then its
+ *                  TemplateCacheInstructions, then its TemplateCacheConstants
+ *   text:          `text_size` bytes
+ *
+ * A TemplateCacheText refers to `byte_len` bytes at `offset` in the source
+ * of dependency `source`, or in the text at the end of the file if `source`
+ * is TEMPLATE_CACHE_TEXT.  Paths, function names and argument types, and
+ * constants are always stored there.  A CALL's operand is its function's
+ * arity.
+ *
+ * Numbers are stored as their string form.  TEMPLATE_CACHE_VERSION changes
+ * whenever the compiled form does, so caches written by another version of
+ * the library are rejected, as are ones written with a different byte
+ * order.  Only templates parsed from a path can be saved.
+ *
+ * template_parse_path_cached loads a template from `cache_dir` if it's
+ * there and current, and otherwise parses it and saves it there.  Failing to
+ * save isn't an error; the template is still parsed.  Cache files are
+ * written to a temporary name and renamed into place, so concurrent
+ * processes never see half a file.
+ */
+
+#define TEMPLATE_CACHE_MAGIC "SSTTMPL"
+#define TEMPLATE_CACHE_VERSION 3
+#define TEMPLATE_CACHE_BYTE_ORDER_MARK 0x01020304
+#define TEMPLATE_CACHE_TEXT ((uint64_t)-1)
+
+typedef struct {
+    uint64_t source;
+    uint64_t offset;
+    uint64_t len;
+    uint64_t byte_len;
+} TemplateCacheText;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t autoescape;
+    uint32_t trim_blocks;
+    uint64_t size;
+    uint64_t iteration_depth;
+    uint64_t dependency_count;
+    uint64_t node_count;
+    uint64_t expression_count;
+    uint64_t text_size;
+} TemplateCacheHeader;
+
+typedef struct {
+    TemplateCacheText path;
+    uint64_t size;
+    uint64_t hash;
+} TemplateCacheDependency;
+
+typedef struct {
+    uint32_t type;
+    uint32_t flags;
+    TemplateCacheText text;
+    TemplateCacheText value_text;
+    uint64_t local;
+    uint64_t expression;
+    uint64_t jump;
+} TemplateCacheNode;
+
+typedef struct {
+    uint64_t instruction_count;
+    uint64_t constant_count;
+    uint64_t stack_size;
+} TemplateCacheExpression;
+
+typedef struct {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t operand;
+    TemplateCacheText function;
+    TemplateCacheText argument_types;
+} TemplateCacheInstruction;
+
+typedef struct {
+    uint32_t type;
+    uint32_t reserved;
+    TemplateCacheText text;
+} TemplateCacheConstant;
+
+bool template_cache_save(Template *t, const char *path, Status *status);
+bool template_cache_load(Template *t, const char *path, Status *status);
+bool template_parse_path_cached(Template *t, const char *path,
+                                             const char *cache_dir,
+                                             Status *status);
+
+#endif
+
+/* vi: set et ts=4 sw=4: */
@@ -0,0 +1,349 @@
+#include <cbase.h>
+
+#include "config.h"
+
+#include "lang.h"
+#include "value.h"
+#include "function.h"
+#include "expression.h"
+#include "expression_evaluator.h"
+#include "template.h"
+#include "template_deps.h"
+
+#define TEMPLATE_DEPS_INIT_ALLOC 8
+
+/*
+ * A loop being walked.  Its variables are locals `local` through
+ * `local + count - 1`, the last of which holds the element.  `iterable` is
+ * the path it loops over, if it loops over a path, and `used` is whether its
+ * element has been read.
+ */
+typedef struct {
+    size_t local;
+    size_t count;
+    char *iterable;
+    bool used;
+} DepsLoop;
+
+static void deps_list_clear(PArray *list) {
+    for (size_t i = 0; i < list->len; i++) {
+        free(parray_index_fast(list, i));
+    }
+
+    parray_clear(list);
+}
+
+static bool deps_list_add(PArray *list, const char *data, size_t len,
+                                                          Status *status) {
+    char *entry = NULL;
+
+    for (size_t i = 0; i < list->len; i++) {
+        const char *existing = parray_index_fast(list, i);
+
+        if ((strlen(existing) == len) && (memcmp(existing, data, len) == 0)) {
+            return status_ok(status);
+        }
+    }
+
+    entry = malloc(len + 1);
+
+    if (!entry) {
+        return alloc_failure(status);
+    }
+
+    memcpy(entry, data, len);
+    entry[len] = '\0';
+
+    if (!parray_append(list, entry, status)) {
+        free(entry);
+        return false;
+    }
+
+    return status_ok(status);
+}
+
+static void deps_loops_free(Array *loops) {
+    for (size_t i = 0; i < loops->len; i++) {
+        DepsLoop *loop = array_index_fast(loops, i);
+
+        free(loop->iterable);
+    }
+
+    array_free(loops);
+}
+
+/*
+ * Finds the loop that local `local` belongs to, setting `variable` if it's
+ * one of its variables rather than `loop.index` and friends.
+ */
+static DepsLoop* deps_find_loop(Array *loops, size_t local,
+                                              bool *variable) {
+    for (size_t i = loops->len; i > 0; i--) {
+        DepsLoop *loop = array_index_fast(loops, i - 1);
+
+        if (local >= loop->local) {
+            *variable = (local - loop->local) < loop->count;
+            return loop;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Writes the path read by the LOOKUP or LOCAL at instruction `*index` of
+ * `expression` and the MEMBERs following it into `path`, leaving `*index`
+ * at the last of them.  `found` is set if it's a context path, which loop
+ * metadata and the variables of loops over anything but a path aren't.  Nor
+ * are the keys and indices of loops over a path; they leave the loop unused,
+ * so it lists only the path itself.
+ */
+static bool deps_path(Array *loops, Expression *expression, size_t *index,
+                                                            String *path,
+                                                            bool *found,
+                                                            Status *status) {
+    Instruction *instruction = array_index_fast(&expression->instructions,
+                                                *index);
+
+    string_clear(path);
+    *found = true;
+
+    if (instruction->type == INSTRUCTION_LOCAL) {
+        bool variable = false;
+        DepsLoop *loop = deps_find_loop(loops, instruction->as.local,
+                                               &variable);
+
+        bool element = loop && variable && (
+            instruction->as.local == (loop->local + loop->count - 1)
+        );
+
+        if (element) {
+            loop->used = true;
+        }
+
+        if ((!element) || (!loop->iterable)) {
+            *found = false;
+        }
+        else if ((!string_append_cstr(path, loop->iterable, status)) ||
+                 (!string_append_cstr(path, ".*", status))) {
+            return false;
+        }
+    }
+
+    return template_expression_path(expression, index, path, status);
+}
+
+static bool deps_walk_expression(TemplateDeps *deps, Array *loops,
+                                                     Expression *expression,
+                                                     String *path,
+                                                     Status *status) {
+    Array *instructions = &expression->instructions;
+
+    for (size_t i = 0; i < instructions->len; i++) {
+        Instruction *instruction = array_index_fast(instructions, i);
+        bool found = false;
+
+        switch (instruction->type) {
+            case INSTRUCTION_LOOKUP:
+            case INSTRUCTION_LOCAL:
+                if (!deps_path(loops, expression, &i, path, &found, status)) {
+                    return false;
+                }
+
+                if (found && (!deps_list_add(&deps->paths, path->data,
+                                                           path->byte_len,
+                                                           status))) {
+                    return false;
+                }
+
+                break;
+            case INSTRUCTION_CALL:
+                if (!deps_list_add(&deps->functions,
+                                   instruction->as.function->name.data,
+                                   instruction->as.function->name.byte_len,
+                                   status)) {
+                    return false;
+                }
+
+                break;
+            default:
+                break;
+        }
+    }
+
+    return status_ok(status);
+}
+
+/*
+ * Starts walking the loop at `node`: its iterable is read outside the loop,
+ * and if it's a path, its variables stand for that path's elements.
+ */
+static bool deps_start_loop(TemplateDeps *deps, Array *loops,
+                                                TemplateNode *node,
+                                                Expression *expression,
+                                                String *path,
+                                                Status *status) {
+    Instruction *instruction = NULL;
+    DepsLoop *loop = NULL;
+    char *iterable = NULL;
+    bool found = false;
+    size_t i = 0;
+
+    if (expression->instructions.len > 0) {
+        instruction = array_index_fast(&expression->instructions, 0);
+    }
+
+    if (instruction && ((instruction->type == INSTRUCTION_LOOKUP) ||
+                        (instruction->type == INSTRUCTION_LOCAL))) {
+        if (!deps_path(loops, expression, &i, path, &found, status)) {
+            return false;
+        }
+    }
+
+    if (found && ((i + 1) == expression->instructions.len)) {
+        iterable = strdup(path->data);
+
+        if (!iterable) {
+            return alloc_failure(status);
+        }
+    }
+    else if (!deps_walk_expression(deps, loops, expression, path, status)) {
+        return false;
+    }
+
+    if (!array_append(loops, (void **)&loop, status)) {
+        free(iterable);
+        return false;
+    }
+
+    loop->local = node->local;
+    loop->count = node->value_text.len > 0 ? 2 : 1;
+    loop->iterable = iterable;
+    loop->used = false;
+
+    return (
+        deps_list_add(&deps->locals, node->text.data, node->text.byte_len,
+                                                      status) &&
+        ((node->value_text.len == 0) ||
+         deps_list_add(&deps->locals, node->value_text.data,
+                                      node->value_text.byte_len,
+                                      status))
+    );
+}
+
+static bool deps_end_loop(TemplateDeps *deps, Array *loops,
+                                              Status *status) {
+    DepsLoop *loop = array_index_fast(loops, loops->len - 1);
+    char *iterable = loop->iterable;
+    bool used = loop->used;
+    bool ok = true;
+
+    array_truncate_fast(loops, loops->len - 1);
+
+    if (iterable && (!used)) {
+        ok = deps_list_add(&deps->paths, iterable, strlen(iterable), status);
+    }
+
+    free(iterable);
+
+    if (!ok) {
+        return false;
+    }
+
+    return status_ok(status);
+}
+
+bool template_deps_init(TemplateDeps *deps, Status *status) {
+    if (!parray_init_alloc(&deps->paths, TEMPLATE_DEPS_INIT_ALLOC, status)) {
+        return false;
+    }
+
+    if (!parray_init_alloc(&deps->functions, TEMPLATE_DEPS_INIT_ALLOC,
+                                             status)) {
+        parray_free(&deps->paths);
+        return false;
+    }
+
+    if (!parray_init_alloc(&deps->locals, TEMPLATE_DEPS_INIT_ALLOC,
+                                          status)) {
+        parray_free(&deps->paths);
+        parray_free(&deps->functions);
+        return false;
+    }
+
+    return status_ok(status);
+}
+
+/*
+ * Walks `t`'s nodes in order, keeping track of the loops they're in, so
+ * LOCALs can be traced back to the paths their loops iterate over.
+ */
+bool template_deps_collect(TemplateDeps *deps, Template *t, Status *status) {
+    Array loops;
+    String path;
+    bool ok = true;
+
+    template_deps_clear(deps);
+
+    if (!array_init_alloc(&loops, sizeof(DepsLoop), TEMPLATE_DEPS_INIT_ALLOC,
+                                                    status)) {
+        return false;
+    }
+
+    if (!string_init(&path, "", status)) {
+        array_free(&loops);
+        return false;
+    }
+
+    for (size_t i = 0; ok && (i < t->nodes.len); i++) {
+        TemplateNode *node = array_index_fast(&t->nodes, i);
+        Expression *expression = NULL;
+
+        switch (node->type) {
+            case TEMPLATE_NODE_EXPRESSION:
+            case TEMPLATE_NODE_CONDITIONAL:
+            case TEMPLATE_NODE_CACHE:
+                expression = array_index_fast(&t->expressions,
+                                              node->expression);
+                ok = deps_walk_expression(deps, &loops, expression, &path,
+                                                                    status);
+                break;
+            case TEMPLATE_NODE_ITERATION:
+                expression = array_index_fast(&t->expressions,
+                                              node->expression);
+                ok = deps_start_loop(deps, &loops, node, expression, &path,
+                                                                     status);
+                break;
+            case TEMPLATE_NODE_ITERATION_END:
+                ok = deps_end_loop(deps, &loops, status);
+                break;
+            default:
+                break;
+        }
+    }
+
+    string_free(&path);
+    deps_loops_free(&loops);
+
+    if (!ok) {
+        template_deps_clear(deps);
+        return false;
+    }
+
+    return status_ok(status);
+}
+
+void template_deps_clear(TemplateDeps *deps) {
+    deps_list_clear(&deps->paths);
+    deps_list_clear(&deps->functions);
+    deps_list_clear(&deps->locals);
+}
+
+void template_deps_free(TemplateDeps *deps) {
+    template_deps_clear(deps);
+    parray_free(&deps->paths);
+    parray_free(&deps->functions);
+    parray_free(&deps->locals);
+}
+
+/* vi: set et ts=4 sw=4: */
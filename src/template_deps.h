@@ -0,0 +1,38 @@
+#ifndef TEMPLATE_DEPS_H__
+#define TEMPLATE_DEPS_H__
+
+/*
+ * template_deps_collect lists what a compiled template depends on, so hosts
+ * can build contexts holding only what it uses (`sst deps` prints it from
+ * the command line).  Included templates are compiled in place, so what
+ * they use is listed too.  Each list holds owned strings, without
+ * duplicates, in the order they're first used:
+ *
+ *   paths:     the context paths expressions read, dotted like `site.title`.
+ *              `*` stands for every element of an array (or value of a
+ *              table) being looped over, so reading `p.name` in
+ *              `{{ for p in people }}` lists `people.*.name`.  A path means
+ *              the whole value there is used: a loop over a path whose
+ *              variables are never read lists the path itself, and loops
+ *              over anything other than a path list what that reads
+ *   functions: the names of the functions expressions call
+ *   locals:    the names of loop variables
+ *
+ * Unlike `reads` (see template.h), paths another one covers are kept, and
+ * element paths are followed through loop variables.
+ */
+
+typedef struct {
+    PArray paths;
+    PArray functions;
+    PArray locals;
+} TemplateDeps;
+
+bool template_deps_init(TemplateDeps *deps, Status *status);
+bool template_deps_collect(TemplateDeps *deps, Template *t, Status *status);
+void template_deps_clear(TemplateDeps *deps);
+void template_deps_free(TemplateDeps *deps);
+
+#endif
+
+/* vi: set et ts=4 sw=4: */
@@ -0,0 +1,475 @@
+#include <cbase.h>
+
+#include <pthread.h>
+
+#include "config.h"
+
+#include "lang.h"
+#include "utils.h"
+#include "value.h"
+#include "function.h"
+#include "expression.h"
+#include "expression_evaluator.h"
+#include "template.h"
+#include "template_registry.h"
+
+#define TEMPLATE_REGISTRY_INIT_ALLOC 16
+
+static size_t key_to_hash(const void *key, size_t seed) {
+    SSlice *ss = (SSlice *)key;
+
+    return hash64(ss->data, ss->byte_len, seed);
+}
+
+static void* entry_to_key(const void *obj) {
+    return (void *)(&((TemplateRegistryEntry *)obj)->name);
+}
+
+static bool key_equal(const void *key1, const void *key2) {
+    SSlice *ss1 = (SSlice *)key1;
+    SSlice *ss2 = (SSlice *)key2;
+
+    return (
+        (ss1->byte_len == ss2->byte_len) &&
+        (memcmp(ss1->data, ss2->data, ss1->byte_len) == 0)
+    );
+}
+
+static void registry_template_free(Template *t) {
+    template_free(t);
+    free(t);
+}
+
+/*
+ * Compiles a new version from `path`, or from `input` if `path` is NULL.
+ */
+static bool registry_compile(TemplateRegistry *registry, const char *path,
+                                                         String *input,
+                                                         Template **t,
+                                                         Status *status) {
+    Template *new_template = malloc(sizeof(Template));
+
+    if (!new_template) {
+        return alloc_failure(status);
+    }
+
+    if (!template_init(new_template, registry->functions, status)) {
+        free(new_template);
+        return false;
+    }
+
+    if (path) {
+        if (!template_parse_path(new_template, path, status)) {
+            registry_template_free(new_template);
+            return false;
+        }
+    }
+    else if (!template_parse_data(new_template, input, status)) {
+        registry_template_free(new_template);
+        return false;
+    }
+
+    *t = new_template;
+
+    return status_ok(status);
+}
+
+static bool registry_entry_new(TemplateRegistry *registry,
+                               const char *name,
+                               const char *path,
+                               TemplateRegistryEntry **new_entry,
+                               Status *status) {
+    TemplateRegistryEntry *entry = malloc(sizeof(TemplateRegistryEntry));
+
+    if (!entry) {
+        return alloc_failure(status);
+    }
+
+    entry->name.data = strdup(name);
+
+    if (!entry->name.data) {
+        free(entry);
+        return alloc_failure(status);
+    }
+
+    entry->name.byte_len = strlen(name);
+    entry->name.len = utf8_rune_count(name, entry->name.byte_len);
+    entry->path = NULL;
+    entry->template = NULL;
+
+    if (path) {
+        entry->path = strdup(path);
+
+        if (!entry->path) {
+            free((char *)entry->name.data);
+            free(entry);
+            return alloc_failure(status);
+        }
+    }
+
+    if (!table_insert(&registry->entries, entry, status)) {
+        free(entry->path);
+        free((char *)entry->name.data);
+        free(entry);
+        return false;
+    }
+
+    *new_entry = entry;
+
+    return status_ok(status);
+}
+
+static bool registry_lookup(TemplateRegistry *registry,
+                            const char *name,
+                            TemplateRegistryEntry **entry,
+                            Status *status) {
+    SSlice key;
+
+    key.data = name;
+    key.len = strlen(name);
+    key.byte_len = key.len;
+
+    return table_lookup(&registry->entries, &key, (void **)entry, status);
+}
+
+/*
+ * Frees the retired versions no reader can still be using.  Called with
+ * `lock` held.
+ */
+static void registry_collect(TemplateRegistry *registry) {
+    size_t oldest = SIZE_MAX;
+    size_t kept = 0;
+
+    for (size_t i = 0; i < registry->readers.len; i++) {
+        TemplateRegistryReader *reader = parray_index_fast(
+            &registry->readers,
+            i
+        );
+        size_t epoch = __atomic_load_n(&reader->epoch, __ATOMIC_SEQ_CST);
+
+        if ((epoch != 0) && (epoch < oldest)) {
+            oldest = epoch;
+        }
+    }
+
+    for (size_t i = 0; i < registry->retired.len; i++) {
+        TemplateRegistryRetired *retired = array_index_fast(
+            &registry->retired,
+            i
+        );
+
+        if (retired->epoch < oldest) {
+            registry_template_free(retired->template);
+            continue;
+        }
+
+        *(TemplateRegistryRetired *)array_index_fast(&registry->retired,
+                                                     kept) = *retired;
+        kept++;
+    }
+
+    array_truncate_fast(&registry->retired, kept);
+}
+
+/*
+ * Swaps `t` into the entry for `name` (creating it if need be), retiring
+ * whatever it replaces.  Everything that can fail is done before a new entry
+ * is added, so a failure never leaves one behind without a template.
+ */
+static bool registry_publish(TemplateRegistry *registry, const char *name,
+                                                         const char *path,
+                                                         Template *t,
+                                                         Status *status) {
+    TemplateRegistryEntry *entry = NULL;
+    TemplateRegistryRetired *retired = NULL;
+    Template *old = NULL;
+
+    pthread_mutex_lock(&registry->lock);
+
+    /* Make room first so that the swap can't fail halfway */
+    if (!array_append(&registry->retired, (void **)&retired, status)) {
+        pthread_mutex_unlock(&registry->lock);
+        return false;
+    }
+
+    if (!registry_lookup(registry, name, &entry, status)) {
+        if ((!status_match(status, "base", ERROR_NOT_FOUND)) ||
+                (!registry_entry_new(registry, name, path, &entry, status))) {
+            array_truncate_fast(&registry->retired,
+                                registry->retired.len - 1);
+            pthread_mutex_unlock(&registry->lock);
+            return false;
+        }
+    }
+    else if (path && ((!entry->path) || (strcmp(entry->path, path) != 0))) {
+        char *new_path = strdup(path);
+
+        if (!new_path) {
+            array_truncate_fast(&registry->retired,
+                                registry->retired.len - 1);
+            pthread_mutex_unlock(&registry->lock);
+            return alloc_failure(status);
+        }
+
+        free(entry->path);
+        entry->path = new_path;
+    }
+
+    old = __atomic_exchange_n(&entry->template, t, __ATOMIC_SEQ_CST);
+
+    if (old) {
+        retired->template = old;
+        retired->epoch = __atomic_load_n(&registry->epoch, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&registry->epoch, 1, __ATOMIC_SEQ_CST);
+    }
+    else {
+        array_truncate_fast(&registry->retired, registry->retired.len - 1);
+    }
+
+    registry_collect(registry);
+
+    pthread_mutex_unlock(&registry->lock);
+
+    return status_ok(status);
+}
+
+static bool registry_set(TemplateRegistry *registry, const char *name,
+                                                     const char *path,
+                                                     String *input,
+                                                     Status *status) {
+    Template *t = NULL;
+
+    if (!registry_compile(registry, path, input, &t, status)) {
+        return false;
+    }
+
+    if (!registry_publish(registry, name, path, t, status)) {
+        registry_template_free(t);
+        return false;
+    }
+
+    return status_ok(status);
+}
+
+bool template_registry_init(TemplateRegistry *registry,
+                            FunctionRegistry *functions,
+                            Status *status) {
+    registry->functions = functions;
+    registry->epoch = 1;
+
+    if (!table_init(&registry->entries, key_to_hash, entry_to_key,
+                                                     key_equal,
+                                                     0,
+                                                     status)) {
+        return false;
+    }
+
+    if (!parray_init_alloc(&registry->readers, TEMPLATE_REGISTRY_INIT_ALLOC,
+                                               status)) {
+        table_free(&registry->entries);
+        return false;
+    }
+
+    if (!array_init_alloc(&registry->retired, sizeof(TemplateRegistryRetired),
+                                              TEMPLATE_REGISTRY_INIT_ALLOC,
+                                              status)) {
+        parray_free(&registry->readers);
+        table_free(&registry->entries);
+        return false;
+    }
+
+    if (pthread_mutex_init(&registry->lock, NULL) != 0) {
+        array_free(&registry->retired);
+        parray_free(&registry->readers);
+        table_free(&registry->entries);
+        return alloc_failure(status);
+    }
+
+    return status_ok(status);
+}
+
+bool template_registry_set_path(TemplateRegistry *registry,
+                                const char *name,
+                                const char *path,
+                                Status *status) {
+    return registry_set(registry, name, path, NULL, status);
+}
+
+bool template_registry_set_data(TemplateRegistry *registry,
+                                const char *name,
+                                String *input,
+                                Status *status) {
+    return registry_set(registry, name, NULL, input, status);
+}
+
+bool template_registry_reload(TemplateRegistry *registry,
+                              TemplateRegistryEntry *entry,
+                              Status *status) {
+    char *path = NULL;
+    bool reloaded = false;
+
+    pthread_mutex_lock(&registry->lock);
+
+    if (!entry->path) {
+        pthread_mutex_unlock(&registry->lock);
+        return status_ok(status);
+    }
+
+    path = strdup(entry->path);
+
+    pthread_mutex_unlock(&registry->lock);
+
+    if (!path) {
+        return alloc_failure(status);
+    }
+
+    reloaded = registry_set(registry, entry->name.data, path, NULL, status);
+
+    free(path);
+
+    return reloaded;
+}
+
+bool template_registry_find(TemplateRegistry *registry,
+                            const char *name,
+                            TemplateRegistryEntry **entry,
+                            Status *status) {
+    bool found = false;
+
+    pthread_mutex_lock(&registry->lock);
+    found = registry_lookup(registry, name, entry, status);
+    pthread_mutex_unlock(&registry->lock);
+
+    if (!found) {
+        return false;
+    }
+
+    return status_ok(status);
+}
+
+bool template_registry_reader_init(TemplateRegistry *registry,
+                                   TemplateRegistryReader **reader,
+                                   Status *status) {
+    TemplateRegistryReader *new_reader = NULL;
+
+    pthread_mutex_lock(&registry->lock);
+
+    for (size_t i = 0; i < registry->readers.len; i++) {
+        TemplateRegistryReader *released = parray_index_fast(
+            &registry->readers,
+            i
+        );
+
+        if (!released->in_use) {
+            released->in_use = true;
+            pthread_mutex_unlock(&registry->lock);
+            *reader = released;
+            return status_ok(status);
+        }
+    }
+
+    new_reader = malloc(sizeof(TemplateRegistryReader));
+
+    if (!new_reader) {
+        pthread_mutex_unlock(&registry->lock);
+        return alloc_failure(status);
+    }
+
+    new_reader->epoch = 0;
+    new_reader->in_use = true;
+
+    if (!parray_append(&registry->readers, new_reader, status)) {
+        pthread_mutex_unlock(&registry->lock);
+        free(new_reader);
+        return false;
+    }
+
+    pthread_mutex_unlock(&registry->lock);
+
+    *reader = new_reader;
+
+    return status_ok(status);
+}
+
+void template_registry_reader_release(TemplateRegistry *registry,
+                                      TemplateRegistryReader *reader) {
+    pthread_mutex_lock(&registry->lock);
+    reader->in_use = false;
+    pthread_mutex_unlock(&registry->lock);
+}
+
+/*
+ * The reader's epoch is published before the template is loaded, so a
+ * writer that swaps the template afterwards either sees the epoch and keeps
+ * the old version, or swapped it before the load and we get the new one.
+ */
+Template* template_registry_enter(TemplateRegistry *registry,
+                                  TemplateRegistryReader *reader,
+                                  TemplateRegistryEntry *entry) {
+    __atomic_store_n(&reader->epoch,
+                     __atomic_load_n(&registry->epoch, __ATOMIC_SEQ_CST),
+                     __ATOMIC_SEQ_CST);
+
+    return __atomic_load_n(&entry->template, __ATOMIC_SEQ_CST);
+}
+
+void template_registry_exit(TemplateRegistryReader *reader) {
+    __atomic_store_n(&reader->epoch, 0, __ATOMIC_SEQ_CST);
+}
+
+bool template_registry_render(TemplateRegistry *registry,
+                              TemplateRegistryReader *reader,
+                              TemplateRegistryEntry *entry,
+                              ExpressionEvaluator *evaluator,
+                              Value *context,
+                              String *output,
+                              Status *status) {
+    Template *t = template_registry_enter(registry, reader, entry);
+    bool rendered = template_render_with_evaluator(t, evaluator, context,
+                                                                 output,
+                                                                 status);
+
+    template_registry_exit(reader);
+
+    return rendered;
+}
+
+void template_registry_collect(TemplateRegistry *registry) {
+    pthread_mutex_lock(&registry->lock);
+    registry_collect(registry);
+    pthread_mutex_unlock(&registry->lock);
+}
+
+void template_registry_free(TemplateRegistry *registry) {
+    TableIterator iter;
+    TemplateRegistryEntry *entry = NULL;
+
+    for (size_t i = 0; i < registry->retired.len; i++) {
+        TemplateRegistryRetired *retired = array_index_fast(
+            &registry->retired,
+            i
+        );
+
+        registry_template_free(retired->template);
+    }
+
+    table_iterator_init(&iter, &registry->entries);
+
+    while (table_iterator_next(&iter, (void **)&entry)) {
+        registry_template_free(entry->template);
+        free(entry->path);
+        free((char *)entry->name.data);
+        free(entry);
+    }
+
+    for (size_t i = 0; i < registry->readers.len; i++) {
+        free(parray_index_fast(&registry->readers, i));
+    }
+
+    pthread_mutex_destroy(&registry->lock);
+    array_free(&registry->retired);
+    parray_free(&registry->readers);
+    table_free(&registry->entries);
+}
+
+/* vi: set et ts=4 sw=4: */
@@ -0,0 +1,91 @@
+#ifndef TEMPLATE_REGISTRY_H__
+#define TEMPLATE_REGISTRY_H__
+
+/*
+ * A TemplateRegistry holds compiled templates by name, and lets them be
+ * replaced while they're being rendered.
+ *
+ * Setting a template compiles the new version first, then swaps it into the
+ * entry atomically; renders already using the old version carry on with it.
+ * Old versions are reclaimed by epoch: each rendering thread has a reader,
+ * which records the registry's epoch when it enters and clears it when it
+ * exits.  Replacing a template retires the old version at the current epoch
+ * and advances it, and retired versions are freed once no reader is still
+ * in an epoch at or before the one they were retired in.  Readers never take
+ * a lock or wait for a writer; writers are serialized by `lock`.
+ *
+ * Entries are never removed, so look them up (template_registry_find) once
+ * and keep them.  A reader is used by one thread at a time, and is in at most
+ * one template at a time.  Retired versions are reclaimed whenever a template
+ * is set, or by template_registry_collect.
+ *
+ * Entries set from a path remember it (`path` is protected by `lock`), and
+ * template_registry_reload compiles them from it again; it leaves entries
+ * set from data alone.
+ */
+
+typedef struct {
+    SSlice name;
+    char *path;
+    Template *template;
+} TemplateRegistryEntry;
+
+typedef struct {
+    size_t epoch;
+    bool in_use;
+} TemplateRegistryReader;
+
+typedef struct {
+    Template *template;
+    size_t epoch;
+} TemplateRegistryRetired;
+
+typedef struct {
+    FunctionRegistry *functions;
+    pthread_mutex_t lock;
+    Table entries;
+    PArray readers;
+    Array retired;
+    size_t epoch;
+} TemplateRegistry;
+
+bool template_registry_init(TemplateRegistry *registry,
+                            FunctionRegistry *functions,
+                            Status *status);
+bool template_registry_set_path(TemplateRegistry *registry,
+                                const char *name,
+                                const char *path,
+                                Status *status);
+bool template_registry_set_data(TemplateRegistry *registry,
+                                const char *name,
+                                String *input,
+                                Status *status);
+bool template_registry_reload(TemplateRegistry *registry,
+                              TemplateRegistryEntry *entry,
+                              Status *status);
+bool template_registry_find(TemplateRegistry *registry,
+                            const char *name,
+                            TemplateRegistryEntry **entry,
+                            Status *status);
+bool template_registry_reader_init(TemplateRegistry *registry,
+                                   TemplateRegistryReader **reader,
+                                   Status *status);
+void template_registry_reader_release(TemplateRegistry *registry,
+                                      TemplateRegistryReader *reader);
+Template* template_registry_enter(TemplateRegistry *registry,
+                                  TemplateRegistryReader *reader,
+                                  TemplateRegistryEntry *entry);
+void template_registry_exit(TemplateRegistryReader *reader);
+bool template_registry_render(TemplateRegistry *registry,
+                              TemplateRegistryReader *reader,
+                              TemplateRegistryEntry *entry,
+                              ExpressionEvaluator *evaluator,
+                              Value *context,
+                              String *output,
+                              Status *status);
+void template_registry_collect(TemplateRegistry *registry);
+void template_registry_free(TemplateRegistry *registry);
+
+#endif
+
+/* vi: set et ts=4 sw=4: */
@@ -0,0 +1,450 @@
+#include <cbase.h>
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "config.h"
+
+#include "lang.h"
+#include "utils.h"
+#include "value.h"
+#include "function.h"
+#include "expression.h"
+#include "expression_evaluator.h"
+#include "template.h"
+#include "template_registry.h"
+#include "template_watcher.h"
+
+#define TEMPLATE_WATCHER_INIT_ALLOC 16
+#define TEMPLATE_WATCHER_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO)
+
+#define init_failed(status) status_failure( \
+    status,                                 \
+    "template_watcher",                     \
+    TEMPLATE_WATCHER_INIT_FAILED,           \
+    "Initializing inotify failed"           \
+)
+
+#define watch_failed(status) status_failure( \
+    status,                                  \
+    "template_watcher",                      \
+    TEMPLATE_WATCHER_WATCH_FAILED,           \
+    "Watching directory failed"              \
+)
+
+#define read_failed(status) status_failure( \
+    status,                                 \
+    "template_watcher",                     \
+    TEMPLATE_WATCHER_READ_FAILED,           \
+    "Reading inotify events failed"         \
+)
+
+static size_t key_to_hash(const void *key, size_t seed) {
+    SSlice *ss = (SSlice *)key;
+
+    return hash64(ss->data, ss->byte_len, seed);
+}
+
+static void* file_to_key(const void *obj) {
+    return (void *)(&((TemplateWatchFile *)obj)->path);
+}
+
+static bool key_equal(const void *key1, const void *key2) {
+    SSlice *ss1 = (SSlice *)key1;
+    SSlice *ss2 = (SSlice *)key2;
+
+    return (
+        (ss1->byte_len == ss2->byte_len) &&
+        (memcmp(ss1->data, ss2->data, ss1->byte_len) == 0)
+    );
+}
+
+static void watcher_files_clear(TemplateWatcher *watcher) {
+    TableIterator iter;
+    TemplateWatchFile *file = NULL;
+
+    table_iterator_init(&iter, &watcher->files);
+
+    while (table_iterator_next(&iter, (void **)&file)) {
+        parray_free(&file->dependents);
+        free((char *)file->path.data);
+        free(file);
+    }
+
+    table_clear(&watcher->files);
+}
+
+/*
+ * Makes sure the directory holding `path` (which is canonical) is watched.
+ */
+static bool watcher_watch_directory(TemplateWatcher *watcher,
+                                    const char *path,
+                                    Status *status) {
+    TemplateWatchDirectory *directory = NULL;
+    const char *slash = strrchr(path, '/');
+    size_t len = slash == path ? 1 : (size_t)(slash - path);
+    char *dir = NULL;
+    int wd = -1;
+
+    for (size_t i = 0; i < watcher->directories.len; i++) {
+        directory = array_index_fast(&watcher->directories, i);
+
+        if ((strlen(directory->path) == len) &&
+                (memcmp(directory->path, path, len) == 0)) {
+            return status_ok(status);
+        }
+    }
+
+    dir = strndup(path, len);
+
+    if (!dir) {
+        return alloc_failure(status);
+    }
+
+    wd = inotify_add_watch(watcher->fd, dir, TEMPLATE_WATCHER_EVENTS);
+
+    if (wd == -1) {
+        free(dir);
+        return watch_failed(status);
+    }
+
+    if (!array_append(&watcher->directories, (void **)&directory, status)) {
+        inotify_rm_watch(watcher->fd, wd);
+        free(dir);
+        return false;
+    }
+
+    directory->wd = wd;
+    directory->path = dir;
+
+    return status_ok(status);
+}
+
+/*
+ * Records that `entry` depends on `path`, which is canonical and is taken
+ * over by the graph (or freed).
+ */
+static bool watcher_add_edge(TemplateWatcher *watcher,
+                             char *path,
+                             TemplateRegistryEntry *entry,
+                             Status *status) {
+    TemplateWatchFile *file = NULL;
+    SSlice key;
+
+    key.data = path;
+    key.byte_len = strlen(path);
+    key.len = key.byte_len;
+
+    if (table_lookup(&watcher->files, &key, (void **)&file, status)) {
+        free(path);
+
+        for (size_t i = 0; i < file->dependents.len; i++) {
+            if (parray_index_fast(&file->dependents, i) == entry) {
+                return status_ok(status);
+            }
+        }
+
+        return parray_append(&file->dependents, entry, status);
+    }
+
+    if (!status_match(status, "base", ERROR_NOT_FOUND)) {
+        free(path);
+        return false;
+    }
+
+    if (!watcher_watch_directory(watcher, path, status)) {
+        free(path);
+        return false;
+    }
+
+    file = malloc(sizeof(TemplateWatchFile));
+
+    if (!file) {
+        free(path);
+        return alloc_failure(status);
+    }
+
+    file->path = key;
+
+    if (!parray_init_alloc(&file->dependents, 1, status)) {
+        free(path);
+        free(file);
+        return false;
+    }
+
+    if ((!parray_append(&file->dependents, entry, status)) ||
+            (!table_insert(&watcher->files, file, status))) {
+        parray_free(&file->dependents);
+        free(path);
+        free(file);
+        return false;
+    }
+
+    return status_ok(status);
+}
+
+static bool watcher_add_entry(TemplateWatcher *watcher,
+                              TemplateRegistryEntry *entry,
+                              Status *status) {
+    Template *t = entry->template;
+
+    for (size_t i = 0; i < t->paths.len; i++) {
+        char *path = realpath(parray_index_fast(&t->paths, i), NULL);
+
+        /* Gone since it was compiled; there's nothing to watch */
+        if (!path) {
+            continue;
+        }
+
+        if (!watcher_add_edge(watcher, path, entry, status)) {
+            return false;
+        }
+    }
+
+    return status_ok(status);
+}
+
+/*
+ * Adds the entries depending on `name` in the directory watched by `wd` to
+ * `pending`, once each.
+ */
+static bool watcher_note_change(TemplateWatcher *watcher, int wd,
+                                                          const char *name,
+                                                          PArray *pending,
+                                                          Status *status) {
+    TemplateWatchDirectory *directory = NULL;
+    TemplateWatchFile *file = NULL;
+    String path;
+    SSlice key;
+
+    for (size_t i = 0; i < watcher->directories.len; i++) {
+        TemplateWatchDirectory *watched = array_index_fast(
+            &watcher->directories,
+            i
+        );
+
+        if (watched->wd == wd) {
+            directory = watched;
+            break;
+        }
+    }
+
+    if (!directory) {
+        return status_ok(status);
+    }
+
+    if (!string_init(&path, directory->path, status)) {
+        return false;
+    }
+
+    if (((strcmp(directory->path, "/") != 0) &&
+            (!string_append_cstr(&path, "/", status))) ||
+            (!string_append_cstr(&path, name, status))) {
+        string_free(&path);
+        return false;
+    }
+
+    key.data = path.data;
+    key.byte_len = path.byte_len;
+    key.len = path.byte_len;
+
+    if (!table_lookup(&watcher->files, &key, (void **)&file, status)) {
+        string_free(&path);
+
+        if (!status_match(status, "base", ERROR_NOT_FOUND)) {
+            return false;
+        }
+
+        return status_ok(status);
+    }
+
+    string_free(&path);
+
+    for (size_t i = 0; i < file->dependents.len; i++) {
+        TemplateRegistryEntry *entry = parray_index_fast(&file->dependents,
+                                                         i);
+        bool seen = false;
+
+        for (size_t j = 0; (!seen) && (j < pending->len); j++) {
+            seen = parray_index_fast(pending, j) == entry;
+        }
+
+        if ((!seen) && (!parray_append(pending, entry, status))) {
+            return false;
+        }
+    }
+
+    return status_ok(status);
+}
+
+/*
+ * Reads the pending events into `pending` without blocking.
+ */
+static bool watcher_read_events(TemplateWatcher *watcher, PArray *pending,
+                                                          Status *status) {
+    union {
+        struct inotify_event event;
+        char data[(sizeof(struct inotify_event) + NAME_MAX + 1) * 16];
+    } buf;
+
+    while (true) {
+        ssize_t bytes_read = read(watcher->fd, buf.data, sizeof(buf.data));
+
+        if (bytes_read == -1) {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+                return status_ok(status);
+            }
+
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return read_failed(status);
+        }
+
+        if (bytes_read == 0) {
+            return status_ok(status);
+        }
+
+        for (char *p = buf.data; p < buf.data + bytes_read;) {
+            struct inotify_event *event = (struct inotify_event *)p;
+
+            if ((event->len > 0) &&
+                    (!watcher_note_change(watcher, event->wd, event->name,
+                                                              pending,
+                                                              status))) {
+                return false;
+            }
+
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+}
+
+bool template_watcher_init(TemplateWatcher *watcher,
+                           TemplateRegistry *registry,
+                           Status *status) {
+    watcher->registry = registry;
+    watcher->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    if (watcher->fd == -1) {
+        return init_failed(status);
+    }
+
+    if (!table_init(&watcher->files, key_to_hash, file_to_key,
+                                                  key_equal,
+                                                  0,
+                                                  status)) {
+        close(watcher->fd);
+        return false;
+    }
+
+    if (!array_init_alloc(&watcher->directories,
+                          sizeof(TemplateWatchDirectory),
+                          TEMPLATE_WATCHER_INIT_ALLOC,
+                          status)) {
+        table_free(&watcher->files);
+        close(watcher->fd);
+        return false;
+    }
+
+    return status_ok(status);
+}
+
+bool template_watcher_sync(TemplateWatcher *watcher, Status *status) {
+    TemplateRegistry *registry = watcher->registry;
+    TableIterator iter;
+    TemplateRegistryEntry *entry = NULL;
+
+    watcher_files_clear(watcher);
+
+    pthread_mutex_lock(&registry->lock);
+
+    table_iterator_init(&iter, &registry->entries);
+
+    while (table_iterator_next(&iter, (void **)&entry)) {
+        if (!entry->path) {
+            continue;
+        }
+
+        if (!watcher_add_entry(watcher, entry, status)) {
+            pthread_mutex_unlock(&registry->lock);
+            return false;
+        }
+    }
+
+    pthread_mutex_unlock(&registry->lock);
+
+    return status_ok(status);
+}
+
+bool template_watcher_process(TemplateWatcher *watcher, size_t *reloaded,
+                                                        Status *status) {
+    PArray pending;
+    Status reload_status;
+    bool ok = true;
+
+    *reloaded = 0;
+
+    if (!parray_init_alloc(&pending, TEMPLATE_WATCHER_INIT_ALLOC, status)) {
+        return false;
+    }
+
+    if (!watcher_read_events(watcher, &pending, status)) {
+        parray_free(&pending);
+        return false;
+    }
+
+    for (size_t i = 0; i < pending.len; i++) {
+        status_init(&reload_status);
+
+        if (template_registry_reload(watcher->registry,
+                                     parray_index_fast(&pending, i),
+                                     &reload_status)) {
+            (*reloaded)++;
+        }
+        else if (ok) {
+            *status = reload_status;
+            ok = false;
+        }
+    }
+
+    parray_free(&pending);
+
+    /* Reloaded templates may include different files now */
+    if (!ok) {
+        if (*reloaded > 0) {
+            template_watcher_sync(watcher, &reload_status);
+        }
+
+        return false;
+    }
+
+    if ((*reloaded > 0) && (!template_watcher_sync(watcher, status))) {
+        return false;
+    }
+
+    return status_ok(status);
+}
+
+void template_watcher_free(TemplateWatcher *watcher) {
+    watcher_files_clear(watcher);
+
+    for (size_t i = 0; i < watcher->directories.len; i++) {
+        TemplateWatchDirectory *directory = array_index_fast(
+            &watcher->directories,
+            i
+        );
+
+        free(directory->path);
+    }
+
+    close(watcher->fd);
+    array_free(&watcher->directories);
+    table_free(&watcher->files);
+}
+
+/* vi: set et ts=4 sw=4: */
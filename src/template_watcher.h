@@ -0,0 +1,59 @@
+#ifndef TEMPLATE_WATCHER_H__
+#define TEMPLATE_WATCHER_H__
+
+enum {
+    TEMPLATE_WATCHER_INIT_FAILED = 1,
+    TEMPLATE_WATCHER_WATCH_FAILED,
+    TEMPLATE_WATCHER_READ_FAILED,
+};
+
+/*
+ * A TemplateWatcher reloads a registry's templates when the files they were
+ * compiled from change, using inotify instead of checking modification
+ * times.
+ *
+ * template_watcher_sync builds a dependency graph from the registry: every
+ * file a path-backed template was compiled from (itself and its includes,
+ * see template.h) maps to the entries that depend on it.  Directories are
+ * watched rather than files, so editors that save by renaming over the
+ * original are noticed too.
+ *
+ * template_watcher_process reads whatever events are pending without
+ * blocking, reloads exactly the entries that depend on the changed files,
+ * and syncs again so that changed includes are followed.  Hosts call it
+ * when `fd` is readable, or every so often.  If a reload fails (a template
+ * saved halfway through an edit, say), the entry keeps its current version,
+ * the other entries are still reloaded, and the first failure is returned.
+ *
+ * Entries added to the registry after the last sync aren't watched until
+ * the next one.
+ */
+
+typedef struct {
+    SSlice path;
+    PArray dependents;
+} TemplateWatchFile;
+
+typedef struct {
+    int wd;
+    char *path;
+} TemplateWatchDirectory;
+
+typedef struct {
+    TemplateRegistry *registry;
+    int fd;
+    Table files;
+    Array directories;
+} TemplateWatcher;
+
+bool template_watcher_init(TemplateWatcher *watcher,
+                           TemplateRegistry *registry,
+                           Status *status);
+bool template_watcher_sync(TemplateWatcher *watcher, Status *status);
+bool template_watcher_process(TemplateWatcher *watcher, size_t *reloaded,
+                                                        Status *status);
+void template_watcher_free(TemplateWatcher *watcher);
+
+#endif
+
+/* vi: set et ts=4 sw=4: */
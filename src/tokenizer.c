@@ -162,15 +162,63 @@ bool tokenizer_set_token_code_start(Tokenizer *tokenizer, Status *status) {
     tokenizer->token.type = TOKEN_CODE_START;
     tokenizer->token.location = tokenizer->data->data;
 
+    /* "{{- " is 4 runes, "{{ " is 3 */
+    if (sslice_starts_with_cstr(tokenizer->data, "{{-")) {
+        return tokenizer_skip_runes(tokenizer, 4, status);
+    }
+
     return tokenizer_skip_runes(tokenizer, 3, status);
 }
 
 static inline
-bool tokenizer_set_token_code_end(Tokenizer *tokenizer, Status *status) {
+bool tokenizer_set_token_code_end(Tokenizer *tokenizer, bool trim,
+                                                        Status *status) {
     tokenizer->token.type = TOKEN_CODE_END;
     tokenizer->token.location = tokenizer->data->data;
+    tokenizer->trim_next = trim;
 
-    return tokenizer_skip_runes(tokenizer, 3, status);
+    /* " -}}" is 4 runes, " }}" is 3 */
+    return tokenizer_skip_runes(tokenizer, trim ? 4 : 3, status);
+}
+
+static inline
+bool tokenizer_is_trimmed(char c) {
+    return (c == ' ') || (c == '\t') || (c == '\r') || (c == '\n');
+}
+
+/*
+ * Drops the whitespace a `{{-` marker trims from the end of `text`.
+ * Whitespace is all ASCII, so it's a byte per rune.
+ */
+static
+void tokenizer_trim_text_end(SSlice *text) {
+    while ((text->byte_len > 0) &&
+           tokenizer_is_trimmed(text->data[text->byte_len - 1])) {
+        text->len--;
+        text->byte_len--;
+    }
+}
+
+/*
+ * Skips the whitespace a `-}}` marker trims from the start of the next text.
+ */
+static
+bool tokenizer_trim_data_start(Tokenizer *tokenizer, Status *status) {
+    while ((tokenizer->data->byte_len > 0) &&
+           tokenizer_is_trimmed(tokenizer->data->data[0])) {
+        bool newline = tokenizer->data->data[0] == '\n';
+
+        if (!tokenizer_skip_rune(tokenizer, status)) {
+            return false;
+        }
+
+        if (newline) {
+            tokenizer->line++;
+            tokenizer->column = 1;
+        }
+    }
+
+    return status_ok(status);
 }
 
 static
@@ -224,6 +272,10 @@ bool tokenizer_seek_to_next_code_tag_start(Tokenizer *tokenizer,
             return false;
         }
 
+        if ((r == '-') && (!sslice_pop_rune(&cursor, &r, status))) {
+            return false;
+        }
+
         if (r != ' ') {
             return invalid_syntax(status);
         }
@@ -437,7 +489,7 @@ bool tokenizer_handle_symbol(Tokenizer *tokenizer, rune r, Status *status) {
         }
 
         tokenizer_set_token_symbol(tokenizer, SYMBOL_EXCLAMATION_POINT);
-        return status_ok(status);
+        return tokenizer_skip_rune(tokenizer, status);
     }
 
     if (r == '<') {
@@ -447,7 +499,7 @@ bool tokenizer_handle_symbol(Tokenizer *tokenizer, rune r, Status *status) {
         }
 
         tokenizer_set_token_symbol(tokenizer, SYMBOL_LESS_THAN);
-        return status_ok(status);
+        return tokenizer_skip_rune(tokenizer, status);
     }
 
     if (r == '>') {
@@ -460,7 +512,7 @@ bool tokenizer_handle_symbol(Tokenizer *tokenizer, rune r, Status *status) {
         }
 
         tokenizer_set_token_symbol(tokenizer, SYMBOL_GREATER_THAN);
-        return status_ok(status);
+        return tokenizer_skip_rune(tokenizer, status);
     }
 
     return not_handled(status);
@@ -583,6 +635,7 @@ void tokenizer_clear(Tokenizer *tokenizer) {
     tokenizer->token.type = TOKEN_UNKNOWN;
     tokenizer->token.location = NULL;
     tokenizer->in_code = false;
+    tokenizer->trim_next = false;
 }
 
 bool tokenizer_load_next(Tokenizer *tokenizer, Status *status) {
@@ -595,7 +648,12 @@ bool tokenizer_load_next(Tokenizer *tokenizer, Status *status) {
 
         if (sslice_starts_with_cstr(tokenizer->data, " }}")) {
             tokenizer->in_code = false;
-            return tokenizer_set_token_code_end(tokenizer, status);
+            return tokenizer_set_token_code_end(tokenizer, false, status);
+        }
+
+        if (sslice_starts_with_cstr(tokenizer->data, " -}}")) {
+            tokenizer->in_code = false;
+            return tokenizer_set_token_code_end(tokenizer, true, status);
         }
 
         if (!tokenizer_load_next_code_token(tokenizer, status)) {
@@ -609,6 +667,14 @@ bool tokenizer_load_next(Tokenizer *tokenizer, Status *status) {
         return status_ok(status);
     }
 
+    if (tokenizer->trim_next) {
+        tokenizer->trim_next = false;
+
+        if (!tokenizer_trim_data_start(tokenizer, status)) {
+            return false;
+        }
+    }
+
     if (sslice_empty(tokenizer->data)) {
         return eof(status);
     }
@@ -621,9 +687,15 @@ bool tokenizer_load_next(Tokenizer *tokenizer, Status *status) {
                 return false;
             }
 
-            tokenizer_set_token_text(tokenizer, &start);
+            if (sslice_starts_with_cstr(tokenizer->data, "{{-")) {
+                tokenizer_trim_text_end(&start);
+            }
+
+            if (start.byte_len > 0) {
+                tokenizer_set_token_text(tokenizer, &start);
 
-            return status_ok(status);
+                return status_ok(status);
+            }
         }
 
         if (sslice_starts_with_cstr(tokenizer->data, "{{ raw }}")) {
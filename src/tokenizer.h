@@ -38,12 +38,20 @@ typedef struct {
     } as;
 } Token;
 
+/*
+ * `{{- ` and ` -}}` open and close a code tag like `{{ ` and ` }}`, but also
+ * trim whitespace (line breaks included) from the end of the text before it,
+ * or the start of the text after it.  `trim_next` is set after a ` -}}`.
+ * Text trimmed away entirely isn't returned as a token.
+ */
+
 typedef struct {
     SSlice *data;
     size_t line;
     size_t column;
     Token token;
     bool in_code;
+    bool trim_next;
 } Tokenizer;
 
 void tokenizer_init(Tokenizer *tokenizer, SSlice *data);
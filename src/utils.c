@@ -1,6 +1,113 @@
 #include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "utils.h"
+
+#define ONES   ((uint64_t)0x0101010101010101ULL)
+#define HIGHS  ((uint64_t)0x8080808080808080ULL)
+
+static inline uint64_t load_word(const char *data) {
+    uint64_t word;
+
+    memcpy(&word, data, sizeof(word));
+
+    return word;
+}
+
+/*
+ * Counts runes by counting the bytes that aren't UTF-8 continuation bytes
+ * (0b10xxxxxx).  The input is assumed to be valid UTF-8.
+ *
+ * This works a word at a time: a byte is a continuation byte when its top
+ * bit is set and the next one down isn't, which `w & ~(w << 1)` leaves in
+ * each byte's top bit, and the multiply sums those bits into the top byte.
+ */
+size_t utf8_rune_count(const char *data, size_t byte_len) {
+    size_t len = byte_len;
+    size_t i = 0;
+
+    for (; (i + sizeof(uint64_t)) <= byte_len; i += sizeof(uint64_t)) {
+        uint64_t word = load_word(data + i);
+        uint64_t continuations = (word & ~(word << 1)) & HIGHS;
+
+        len -= (size_t)(((continuations >> 7) * ONES) >> 56);
+    }
+
+    for (; i < byte_len; i++) {
+        if ((((unsigned char)data[i]) & 0xC0) == 0x80) {
+            len--;
+        }
+    }
+
+    return len;
+}
+
+bool utf8_is_ascii(const char *data, size_t byte_len) {
+    uint64_t bits = 0;
+    size_t i = 0;
+
+    for (; (i + sizeof(uint64_t)) <= byte_len; i += sizeof(uint64_t)) {
+        bits |= load_word(data + i);
+    }
+
+    if (bits & HIGHS) {
+        return false;
+    }
+
+    for (; i < byte_len; i++) {
+        if (((unsigned char)data[i]) & 0x80) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Maps ASCII letters between cases a word at a time.  For each byte, adding
+ * (0x80 - first) sets its top bit if it's >= `first`, and adding
+ * (0x7F - last) sets it if it's > `last`; the difference marks the letters
+ * to flip, and 0x80 >> 2 is the 0x20 between cases.  Only valid for ASCII,
+ * where no byte has its top bit set to begin with.
+ */
+static void ascii_change_case(char *dst, const char *src, size_t byte_len,
+                                                          char first,
+                                                          char last) {
+    uint64_t at_least_first = ONES * (uint64_t)(0x80 - first);
+    uint64_t past_last = ONES * (uint64_t)(0x7F - last);
+    size_t i = 0;
+
+    for (; (i + sizeof(uint64_t)) <= byte_len; i += sizeof(uint64_t)) {
+        uint64_t word = load_word(src + i);
+        uint64_t letters = (
+            (word + at_least_first) & ~(word + past_last) & HIGHS
+        );
+
+        word ^= letters >> 2;
+        memcpy(dst + i, &word, sizeof(word));
+    }
+
+    for (; i < byte_len; i++) {
+        char c = src[i];
+
+        if ((c >= first) && (c <= last)) {
+            c ^= 0x20;
+        }
+
+        dst[i] = c;
+    }
+}
+
+void ascii_to_upper(char *dst, const char *src, size_t byte_len) {
+    ascii_change_case(dst, src, byte_len, 'a', 'z');
+}
+
+void ascii_to_lower(char *dst, const char *src, size_t byte_len) {
+    ascii_change_case(dst, src, byte_len, 'A', 'Z');
+}
+
 /* vi: set et ts=4 sw=4: */
@@ -1,7 +1,12 @@
+
 #ifndef UTILS_H__
 #define UTILS_H__
 
 void die(const char *format, ...);
+size_t utf8_rune_count(const char *data, size_t byte_len);
+bool utf8_is_ascii(const char *data, size_t byte_len);
+void ascii_to_upper(char *dst, const char *src, size_t byte_len);
+void ascii_to_lower(char *dst, const char *src, size_t byte_len);
 
 #endif
 
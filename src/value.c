@@ -1,8 +1,16 @@
 #include <cbase.h>
 
+#include <pthread.h>
+
 #include "config.h"
 
+#include "refcount.h"
+#include "utils.h"
+#include "number.h"
 #include "value.h"
+#include "json.h"
+#include "snapshot.h"
+#include "provider.h"
 
 #define unknown_type(status) status_failure( \
     status,                                  \
@@ -46,21 +54,415 @@
     "Mismatched function arity and types"                           \
 )
 
+#define key_not_found(status) status_failure( \
+    status,                                    \
+    "value",                                   \
+    VALUE_KEY_NOT_FOUND,                       \
+    "Key not found"                            \
+)
+
 static size_t key_to_hash(const void *key, size_t seed) {
-    String *s = (String *)key;
+    SSlice *ss = (SSlice *)key;
 
-    return hash64(s->data, s->byte_len, seed);
+    return hash64(ss->data, ss->byte_len, seed);
 }
 
-static void* value_to_key(const void *obj) {
-    return (void *)(&((Value *)obj)->as.string);
+static void* entry_to_key(const void *obj) {
+    return (void *)(&((ValueTableEntry *)obj)->key_data);
 }
 
 static bool key_equal(const void *key1, const void *key2) {
-    String *s1 = (String *)key1;
-    String *s2 = (String *)key2;
+    SSlice *ss1 = (SSlice *)key1;
+    SSlice *ss2 = (SSlice *)key2;
+
+    return (
+        (ss1->byte_len == ss2->byte_len) &&
+        (memcmp(ss1->data, ss2->data, ss1->byte_len) == 0)
+    );
+}
+
+static void shared_string_release(SharedString *string) {
+    if (refcount_decrement(&string->refcount)) {
+        string_free(&string->string);
+        free(string);
+    }
+}
+
+static void shared_array_release(SharedArray *array) {
+    if (!refcount_decrement(&array->refcount)) {
+        return;
+    }
+
+    for (size_t i = 0; i < array->elements.len; i++) {
+        Value *element = parray_index_fast(&array->elements, i);
+
+        value_free(element);
+        free(element);
+    }
+
+    parray_free(&array->elements);
+    free(array);
+}
+
+static void table_entries_free(SharedTable *table) {
+    TableIterator iter;
+    ValueTableEntry *entry = NULL;
+
+    table_iterator_init(&iter, &table->entries);
+
+    while (table_iterator_next(&iter, (void **)&entry)) {
+        value_free(&entry->key);
+        value_free(&entry->value);
+        free(entry);
+    }
+
+    table_clear(&table->entries);
+    parray_clear(&table->order);
+}
+
+static void shared_table_release(SharedTable *table) {
+    if (!refcount_decrement(&table->refcount)) {
+        return;
+    }
+
+    table_entries_free(table);
+    table_free(&table->entries);
+    parray_free(&table->order);
+    free(table);
+}
+
+static bool shared_array_new(SharedArray **array, size_t alloc,
+                                                  Status *status) {
+    SharedArray *new_array = malloc(sizeof(SharedArray));
+
+    if (!new_array) {
+        return alloc_failure(status);
+    }
+
+    if (!parray_init_alloc(&new_array->elements, alloc, status)) {
+        free(new_array);
+        return false;
+    }
+
+    refcount_init(&new_array->refcount);
+
+    *array = new_array;
+
+    return status_ok(status);
+}
+
+static bool shared_table_new(SharedTable **table, bool ordered,
+                                                 Status *status) {
+    SharedTable *new_table = malloc(sizeof(SharedTable));
+
+    if (!new_table) {
+        return alloc_failure(status);
+    }
+
+    if (!table_init(&new_table->entries, key_to_hash,
+                                         entry_to_key,
+                                         key_equal,
+                                         0,
+                                         status)) {
+        free(new_table);
+        return false;
+    }
+
+    refcount_init(&new_table->refcount);
+    new_table->ordered = ordered;
+    parray_init(&new_table->order);
+
+    *table = new_table;
+
+    return status_ok(status);
+}
+
+/*
+ * Lazy tables and arrays (VALUE_JSON, VALUE_SNAPSHOT and VALUE_RANGE) are
+ * read through their own modules (or computed, for ranges), and turned into
+ * ordinary ones before being modified.
+ */
+static bool value_is_lazy(Value *value) {
+    return (
+        (value->type == VALUE_JSON) ||
+        (value->type == VALUE_SNAPSHOT) ||
+        (value->type == VALUE_RANGE)
+    );
+}
+
+static bool value_is_lazy_table(Value *value) {
+    switch (value->type) {
+        case VALUE_JSON:
+            return json_value_is_table(value);
+        case VALUE_SNAPSHOT:
+            return snapshot_value_is_table(value);
+        default:
+            return false;
+    }
+}
+
+static bool value_is_lazy_array(Value *value) {
+    return value_is_lazy(value) && (!value_is_lazy_table(value));
+}
+
+bool value_set_integer(Value *value, mpd_ssize_t n, Status *status) {
+    DecimalContext ctx;
+    uint32_t mpd_status = 0;
+
+    decimal_context_set_max(&ctx);
+    value_set_type(value, VALUE_NUMBER);
+    mpd_qset_ssize(&value->as.number, n, &ctx, &mpd_status);
+
+    if (mpd_status & MPD_Errors) {
+        return conversion_failure(status);
+    }
+
+    return status_ok(status);
+}
+
+static bool range_materialize(Value *value, Status *status) {
+    ValueRange range = value->as.range;
+    Value array;
+
+    if (!value_init_array(&array, status)) {
+        return false;
+    }
+
+    for (mpd_ssize_t n = range.start; n < range.stop; n++) {
+        Value *element = NULL;
+
+        if ((!value_array_append(&array, &element, status)) ||
+            (!value_set_integer(element, n, status))) {
+            value_free(&array);
+            return false;
+        }
+    }
+
+    value_free(value);
+    value_move(value, &array);
+
+    return status_ok(status);
+}
+
+static bool value_materialize(Value *value, Status *status) {
+    if (value->type == VALUE_JSON) {
+        return json_value_materialize(value, status);
+    }
+
+    if (value->type == VALUE_RANGE) {
+        return range_materialize(value, status);
+    }
+
+    return snapshot_value_materialize(value, status);
+}
+
+/*
+ * Initializes `dst` (which must not hold a value) so that it shares `src`'s
+ * storage.  Numbers live inline in the Value, so they're copied.
+ */
+static bool value_share(Value *dst, Value *src, Status *status) {
+    dst->type = src->type;
+
+    switch (src->type) {
+        case VALUE_NONE:
+            break;
+        case VALUE_BOOLEAN:
+            dst->as.boolean = src->as.boolean;
+            break;
+        case VALUE_NUMBER:
+            decimal_init(&dst->as.number, dst->decimal_data);
+
+            if (!decimal_copy(&dst->as.number, &src->as.number, status)) {
+                dst->type = VALUE_NONE;
+                return false;
+            }
+
+            break;
+        case VALUE_STRING:
+            if (src->as.string.shared) {
+                refcount_increment(&src->as.string.shared->refcount);
+            }
+            else {
+                memcpy(
+                    dst->decimal_data,
+                    src->decimal_data,
+                    src->as.string.byte_len + 1
+                );
+            }
+
+            dst->as.string = src->as.string;
+            break;
+        case VALUE_ARRAY:
+            refcount_increment(&src->as.array->refcount);
+            dst->as.array = src->as.array;
+            break;
+        case VALUE_TABLE:
+            refcount_increment(&src->as.table->refcount);
+            dst->as.table = src->as.table;
+            break;
+        case VALUE_JSON:
+            json_document_retain(src->as.json.document);
+            dst->as.json = src->as.json;
+            break;
+        case VALUE_SNAPSHOT:
+            snapshot_retain(src->as.snapshot.snapshot);
+            dst->as.snapshot = src->as.snapshot;
+            break;
+        case VALUE_PROVIDER:
+            provider_retain(src->as.provider);
+            dst->as.provider = src->as.provider;
+            break;
+        case VALUE_RANGE:
+            dst->as.range = src->as.range;
+            break;
+        default:
+            dst->type = VALUE_NONE;
+            return unknown_type(status);
+    }
+
+    return status_ok(status);
+}
+
+static bool table_entry_new(SharedTable *table, Value *key,
+                                               ValueTableEntry **entry,
+                                               Status *status) {
+    ValueTableEntry *new_entry = malloc(sizeof(ValueTableEntry));
+
+    if (!new_entry) {
+        return alloc_failure(status);
+    }
+
+    if (!value_share(&new_entry->key, key, status)) {
+        free(new_entry);
+        return false;
+    }
+
+    new_entry->value.type = VALUE_NONE;
+    new_entry->key_data.data = value_string_data(&new_entry->key);
+    new_entry->key_data.len = new_entry->key.as.string.len;
+    new_entry->key_data.byte_len = new_entry->key.as.string.byte_len;
+
+    if (!table_insert(&table->entries, new_entry, status)) {
+        value_free(&new_entry->key);
+        free(new_entry);
+        return false;
+    }
+
+    if (table->ordered &&
+            (!parray_append(&table->order, new_entry, status))) {
+        Status remove_status;
+
+        status_init(&remove_status);
+        table_remove(&table->entries, &new_entry->key_data, &remove_status);
+        value_free(&new_entry->key);
+        free(new_entry);
+        return false;
+    }
+
+    *entry = new_entry;
+
+    return status_ok(status);
+}
+
+static bool table_entry_copy(SharedTable *dst, ValueTableEntry *entry,
+                                                Status *status) {
+    ValueTableEntry *new_entry = NULL;
+
+    return (
+        table_entry_new(dst, &entry->key, &new_entry, status) &&
+        value_share(&new_entry->value, &entry->value, status)
+    );
+}
+
+static void table_iterator_start(ValueTableIterator *iter,
+                                 SharedTable *table) {
+    iter->table = table;
+    iter->index = 0;
+    table_iterator_init(&iter->iterator, &table->entries);
+}
+
+static bool table_entries_copy(SharedTable *dst, SharedTable *src,
+                                                 Status *status) {
+    ValueTableIterator iter;
+    ValueTableEntry *entry = NULL;
+
+    table_iterator_start(&iter, src);
+
+    while (value_table_iterator_next(&iter, &entry)) {
+        if (!table_entry_copy(dst, entry, status)) {
+            return false;
+        }
+    }
 
-    return (s1->byte_len == s2->byte_len) && (strcmp(s1->data, s2->data) == 0);
+    return status_ok(status);
+}
+
+static bool array_elements_copy(PArray *dst, PArray *src, Status *status) {
+    for (size_t i = 0; i < src->len; i++) {
+        Value *element = malloc(sizeof(Value));
+
+        if (!element) {
+            return alloc_failure(status);
+        }
+
+        if (!value_share(element, parray_index_fast(src, i), status)) {
+            free(element);
+            return false;
+        }
+
+        if (!parray_append(dst, element, status)) {
+            value_free(element);
+            free(element);
+            return false;
+        }
+    }
+
+    return status_ok(status);
+}
+
+static bool value_array_make_unique(Value *value, Status *status) {
+    SharedArray *array = NULL;
+
+    if (refcount_is_unique(&value->as.array->refcount)) {
+        return status_ok(status);
+    }
+
+    if (!shared_array_new(&array, value->as.array->elements.len, status)) {
+        return false;
+    }
+
+    if (!array_elements_copy(&array->elements, &value->as.array->elements,
+                                               status)) {
+        shared_array_release(array);
+        return false;
+    }
+
+    shared_array_release(value->as.array);
+    value->as.array = array;
+
+    return status_ok(status);
+}
+
+static bool value_table_make_unique(Value *value, Status *status) {
+    SharedTable *table = NULL;
+
+    if (refcount_is_unique(&value->as.table->refcount)) {
+        return status_ok(status);
+    }
+
+    if (!shared_table_new(&table, value->as.table->ordered, status)) {
+        return false;
+    }
+
+    if (!table_entries_copy(table, value->as.table, status)) {
+        shared_table_release(table);
+        return false;
+    }
+
+    shared_table_release(value->as.table);
+    value->as.table = table;
+
+    return status_ok(status);
 }
 
 void value_init_boolean(Value *value, bool b) {
@@ -82,27 +484,99 @@ bool value_init_number(Value *value, const char *num, DecimalContext *ctx,
 }
 
 bool value_init_string(Value *value, const char *string, Status *status) {
+    return value_init_string_len(value, string, strlen(string), status);
+}
+
+bool value_init_string_len(Value *value, const char *data, size_t byte_len,
+                                                           Status *status) {
+    return value_init_string_full(
+        value,
+        data,
+        utf8_rune_count(data, byte_len),
+        byte_len,
+        status
+    );
+}
+
+bool value_init_string_full(Value *value, const char *data, size_t len,
+                                                            size_t byte_len,
+                                                            Status *status) {
+    SharedString *shared_string = NULL;
+    SSlice ss;
+
+    if (byte_len <= VALUE_INLINE_STRING_MAX) {
+        char *inline_data = (char *)value->decimal_data;
+
+        memcpy(inline_data, data, byte_len);
+        inline_data[byte_len] = '\0';
+
+        value->type = VALUE_STRING;
+        value->as.string.shared = NULL;
+        value->as.string.len = len;
+        value->as.string.byte_len = byte_len;
+
+        return status_ok(status);
+    }
+
+    shared_string = malloc(sizeof(SharedString));
+
+    if (!shared_string) {
+        return alloc_failure(status);
+    }
+
+    ss.data = data;
+    ss.len = len;
+    ss.byte_len = byte_len;
+
+    if (!string_init_from_sslice(&shared_string->string, &ss, status)) {
+        free(shared_string);
+        return false;
+    }
+
+    refcount_init(&shared_string->refcount);
+
     value->type = VALUE_STRING;
+    value->as.string.shared = shared_string;
+    value->as.string.len = len;
+    value->as.string.byte_len = byte_len;
 
-    return string_init(&value->as.string, string, status);
+    return status_ok(status);
 }
 
-void value_init_array(Value *value) {
+bool value_init_array(Value *value, Status *status) {
+    if (!shared_array_new(&value->as.array, 0, status)) {
+        return false;
+    }
+
     value->type = VALUE_ARRAY;
-    parray_init(&value->as.array);
+
+    return status_ok(status);
 }
 
 bool value_init_table(Value *value, Status *status) {
+    if (!shared_table_new(&value->as.table, false, status)) {
+        return false;
+    }
+
     value->type = VALUE_TABLE;
 
-    return table_init(
-        &value->as.table,
-        key_to_hash,
-        value_to_key,
-        key_equal,
-        0,
-        status
-    );
+    return status_ok(status);
+}
+
+bool value_init_ordered_table(Value *value, Status *status) {
+    if (!shared_table_new(&value->as.table, true, status)) {
+        return false;
+    }
+
+    value->type = VALUE_TABLE;
+
+    return status_ok(status);
+}
+
+void value_init_range(Value *value, mpd_ssize_t start, mpd_ssize_t stop) {
+    value->type = VALUE_RANGE;
+    value->as.range.start = start;
+    value->as.range.stop = stop < start ? start : stop;
 }
 
 bool value_init_boolean_from_sslice(Value *value, SSlice *ss, Status *status) {
@@ -139,8 +613,13 @@ bool value_init_number_from_sslice(Value *value, SSlice *ss,
 }
 
 bool value_init_string_from_sslice(Value *value, SSlice *ss, Status *status) {
-    value_set_type(value, VALUE_STRING);
-    return string_init_from_sslice(&value->as.string, ss, status);
+    return value_init_string_full(
+        value,
+        ss->data,
+        ss->len,
+        ss->byte_len,
+        status
+    );
 }
 
 void value_clear(Value *value) {
@@ -154,13 +633,76 @@ void value_clear(Value *value) {
             decimal_set_zero(&value->as.number);
             break;
         case VALUE_STRING:
-            string_clear(&value->as.string);
+            if (value->as.string.shared) {
+                shared_string_release(value->as.string.shared);
+                value->as.string.shared = NULL;
+            }
+
+            ((char *)value->decimal_data)[0] = '\0';
+            value->as.string.len = 0;
+            value->as.string.byte_len = 0;
             break;
         case VALUE_ARRAY:
-            parray_clear(&value->as.array);
+            if (refcount_is_unique(&value->as.array->refcount)) {
+                for (size_t i = 0; i < value->as.array->elements.len; i++) {
+                    Value *element = parray_index_fast(
+                        &value->as.array->elements,
+                        i
+                    );
+
+                    value_free(element);
+                    free(element);
+                }
+
+                parray_clear(&value->as.array->elements);
+            }
+            else {
+                Status status;
+
+                value_free(value);
+                status_init(&status);
+                value_init_array(value, &status);
+            }
             break;
         case VALUE_TABLE:
-            table_clear(&value->as.table);
+            if (refcount_is_unique(&value->as.table->refcount)) {
+                table_entries_free(value->as.table);
+            }
+            else {
+                Status status;
+                bool ordered = value->as.table->ordered;
+
+                value_free(value);
+                status_init(&status);
+
+                if (ordered) {
+                    value_init_ordered_table(value, &status);
+                }
+                else {
+                    value_init_table(value, &status);
+                }
+            }
+            break;
+        case VALUE_JSON:
+        case VALUE_SNAPSHOT:
+        case VALUE_RANGE:
+            if (value_is_lazy_table(value)) {
+                Status status;
+
+                value_free(value);
+                status_init(&status);
+                value_init_table(value, &status);
+            }
+            else {
+                Status status;
+
+                value_free(value);
+                status_init(&status);
+                value_init_array(value, &status);
+            }
+            break;
+        case VALUE_PROVIDER:
+            provider_clear(value);
             break;
         default:
             break;
@@ -176,67 +718,369 @@ void value_set_boolean(Value *value, bool b) {
 }
 
 bool value_set_number(Value *value, Decimal *n, Status *status) {
-    if (value->type != VALUE_NUMBER) {
-        value_free(value);
-    }
+    value_set_type(value, VALUE_NUMBER);
 
     return decimal_copy(&value->as.number, n, status);
 }
 
 bool value_set_string(Value *value, String *s, Status *status) {
-    if (value->type != VALUE_STRING) {
-        value_free(value);
+    Value tmp;
+
+    if (!value_init_string_full(&tmp, s->data, s->len, s->byte_len,
+                                                       status)) {
+        return false;
     }
 
-    return value_init_string(value, s->data, status);
+    value_free(value);
+    value_move(value, &tmp);
+
+    return status_ok(status);
 }
 
 bool value_set_array(Value *value, PArray *parray, Status *status) {
-    if (value->type != VALUE_ARRAY) {
-        value_free(value);
+    Value tmp;
+
+    if (!shared_array_new(&tmp.as.array, parray->len, status)) {
+        return false;
+    }
+
+    tmp.type = VALUE_ARRAY;
+
+    if (!array_elements_copy(&tmp.as.array->elements, parray, status)) {
+        value_free(&tmp);
+        return false;
     }
 
-    value_init_array(value);
+    value_free(value);
+    value_move(value, &tmp);
 
-    return parray_copy(&value->as.array, parray, status);
+    return status_ok(status);
 }
 
 bool value_set_table(Value *value, Table *table, Status *status) {
-    value_set_type(value, VALUE_TABLE);
+    TableIterator iter;
+    ValueTableEntry *entry = NULL;
+    Value tmp;
 
-    if (!value_init_table(value, status)) {
+    if (!value_init_table(&tmp, status)) {
         return false;
     }
 
-    return table_copy(&value->as.table, table, status);
+    table_iterator_init(&iter, table);
+
+    while (table_iterator_next(&iter, (void **)&entry)) {
+        if (!table_entry_copy(tmp.as.table, entry, status)) {
+            value_free(&tmp);
+            return false;
+        }
+    }
+
+    value_free(value);
+    value_move(value, &tmp);
+
+    return status_ok(status);
 }
 
-bool value_index(Value *value, size_t index, Value **element, Status *status) {
+bool value_copy(Value *dst, Value *src, Status *status) {
+    Value tmp;
+
+    if (dst == src) {
+        return status_ok(status);
+    }
+
+    /*
+     * `src` may live inside `dst` (copying an element over its container),
+     * so take our reference before letting go of `dst`.
+     */
+    if (!value_share(&tmp, src, status)) {
+        return false;
+    }
+
+    value_free(dst);
+    value_move(dst, &tmp);
+
+    return status_ok(status);
+}
+
+void value_move(Value *dst, Value *src) {
+    *dst = *src;
+
+    if ((dst->type == VALUE_NUMBER) &&
+        (dst->as.number.data == (mpd_uint_t *)src->decimal_data)) {
+        dst->as.number.data = (mpd_uint_t *)dst->decimal_data;
+    }
+
+    src->type = VALUE_NONE;
+}
+
+bool value_array_append(Value *value, Value **element, Status *status) {
+    Value *new_element = NULL;
+
+    if (value_is_lazy_array(value)) {
+        if (!value_materialize(value, status)) {
+            return false;
+        }
+    }
+
+    if (value->type != VALUE_ARRAY) {
+        return invalid_type(status);
+    }
+
+    if (!value_array_make_unique(value, status)) {
+        return false;
+    }
+
+    new_element = malloc(sizeof(Value));
+
+    if (!new_element) {
+        return alloc_failure(status);
+    }
+
+    new_element->type = VALUE_NONE;
+
+    if (!parray_append(&value->as.array->elements, new_element, status)) {
+        free(new_element);
+        return false;
+    }
+
+    *element = new_element;
+
+    return status_ok(status);
+}
+
+bool value_table_insert(Value *value, SSlice *key, Value **element,
+                                                   Status *status) {
+    ValueTableEntry *entry = NULL;
+    Value key_value;
+
+    if (value_is_lazy_table(value)) {
+        if (!value_materialize(value, status)) {
+            return false;
+        }
+    }
+
+    if (value->type != VALUE_TABLE) {
+        return invalid_type(status);
+    }
+
+    if (!value_table_make_unique(value, status)) {
+        return false;
+    }
+
+    if (table_lookup(&value->as.table->entries, key, (void **)&entry,
+                                                      status)) {
+        *element = &entry->value;
+        return status_ok(status);
+    }
+
+    if (!status_match(status, "base", ERROR_NOT_FOUND)) {
+        return false;
+    }
+
+    if (!value_init_string_from_sslice(&key_value, key, status)) {
+        return false;
+    }
+
+    if (!value_table_insert_key(value, &key_value, element, status)) {
+        value_free(&key_value);
+        return false;
+    }
+
+    value_free(&key_value);
+
+    return status_ok(status);
+}
+
+bool value_table_insert_key(Value *value, Value *key, Value **element,
+                                                      Status *status) {
+    ValueTableEntry *entry = NULL;
+    SSlice key_data;
+
+    if (value_is_lazy_table(value)) {
+        if (!value_materialize(value, status)) {
+            return false;
+        }
+    }
+
+    if ((value->type != VALUE_TABLE) || (key->type != VALUE_STRING)) {
+        return invalid_type(status);
+    }
+
+    if (!value_table_make_unique(value, status)) {
+        return false;
+    }
+
+    key_data.data = value_string_data(key);
+    key_data.len = key->as.string.len;
+    key_data.byte_len = key->as.string.byte_len;
+
+    if (table_lookup(&value->as.table->entries, &key_data, (void **)&entry,
+                                                             status)) {
+        *element = &entry->value;
+        return status_ok(status);
+    }
+
+    if (!status_match(status, "base", ERROR_NOT_FOUND)) {
+        return false;
+    }
+
+    if (!table_entry_new(value->as.table, key, &entry, status)) {
+        return false;
+    }
+
+    *element = &entry->value;
+
+    return status_ok(status);
+}
+
+bool value_index(Value *value, size_t index, Value *element, Status *status) {
     void *e = NULL;
 
+    if (value_is_lazy_array(value)) {
+        if (value->type == VALUE_JSON) {
+            return json_value_index(value, index, element, status);
+        }
+
+        if (value->type == VALUE_RANGE) {
+            ValueRange *range = &value->as.range;
+
+            if (index >= (size_t)(range->stop - range->start)) {
+                return index_out_of_bounds(status);
+            }
+
+            return value_set_integer(element, range->start + index, status);
+        }
+
+        return snapshot_value_index(value, index, element, status);
+    }
+
     if (value->type != VALUE_ARRAY) {
         return invalid_type(status);
     }
 
-    if (!parray_index(&value->as.array, index, &e, status)) {
+    if (!parray_index(&value->as.array->elements, index, &e, status)) {
         return false;
     }
 
-    *element = e;
+    return value_copy(element, e, status);
+}
+
+void value_array_cursor_init(ValueArrayCursor *cursor) {
+    cursor->position = NULL;
+    cursor->child = 0;
+    cursor->index = 0;
+}
+
+bool value_array_cursor_index(ValueArrayCursor *cursor, Value *value,
+                                                        size_t index,
+                                                        Value *element,
+                                                        Status *status) {
+    if (value->type == VALUE_JSON) {
+        return json_value_cursor_index(value, cursor, index, element,
+                                                             status);
+    }
+
+    return value_index(value, index, element, status);
+}
+
+bool value_table_iterator_init(ValueTableIterator *iter, Value *value,
+                                                       Status *status) {
+    if (value_is_lazy_table(value)) {
+        if (!value_materialize(value, status)) {
+            return false;
+        }
+    }
+
+    if (value->type != VALUE_TABLE) {
+        return invalid_type(status);
+    }
+
+    table_iterator_start(iter, value->as.table);
 
     return status_ok(status);
 }
 
+bool value_table_iterator_next(ValueTableIterator *iter,
+                               ValueTableEntry **entry) {
+    if (!iter->table->ordered) {
+        return table_iterator_next(&iter->iterator, (void **)entry);
+    }
+
+    if (iter->index >= iter->table->order.len) {
+        return false;
+    }
+
+    *entry = parray_index_fast(&iter->table->order, iter->index++);
+
+    return true;
+}
+
+bool value_lookup(Value *value, SSlice *key, Value *element, Status *status) {
+    ValueTableEntry *entry = NULL;
+
+    if (value_is_lazy_table(value)) {
+        bool found = value->type == VALUE_JSON ?
+            json_value_lookup(value, key, element, status) :
+            snapshot_value_lookup(value, key, element, status);
+
+        if (!found) {
+            if (status_match(status, "base", ERROR_NOT_FOUND)) {
+                return key_not_found(status);
+            }
+
+            return false;
+        }
+
+        return status_ok(status);
+    }
+
+    if (value->type == VALUE_PROVIDER) {
+        if (!provider_value_lookup(value, key, element, status)) {
+            if (status_match(status, "base", ERROR_NOT_FOUND)) {
+                return key_not_found(status);
+            }
+
+            return false;
+        }
+
+        return status_ok(status);
+    }
+
+    if (value->type != VALUE_TABLE) {
+        return invalid_type(status);
+    }
+
+    if (!table_lookup(&value->as.table->entries, key, (void **)&entry,
+                                                      status)) {
+        if (status_match(status, "base", ERROR_NOT_FOUND)) {
+            return key_not_found(status);
+        }
+
+        return false;
+    }
+
+    return value_copy(element, &entry->value, status);
+}
+
 bool value_length(Value *value, size_t *length, Status *status) {
     switch (value->type) {
         case VALUE_STRING:
             *length = value->as.string.len;
             break;
         case VALUE_TABLE:
-            *length = value->as.table.len;
+            *length = value->as.table->entries.len;
             break;
         case VALUE_ARRAY:
-            *length = value->as.array.len;
+            *length = value->as.array->elements.len;
+            break;
+        case VALUE_JSON:
+            *length = json_value_length(value);
+            break;
+        case VALUE_SNAPSHOT:
+            *length = snapshot_value_length(value);
+            break;
+        case VALUE_RANGE:
+            *length = value->as.range.stop - value->as.range.start;
             break;
         default:
             return invalid_type(status);
@@ -330,6 +1174,45 @@ bool value_rem(Value *result, Value *op1, Value *op2, DecimalContext *ctx,
     return status_ok(status);
 }
 
+bool value_pow(Value *result, Value *op1, Value *op2, DecimalContext *ctx,
+                                                      Status *status) {
+    if ((op1->type != VALUE_NUMBER) || (op2->type != VALUE_NUMBER)) {
+        return invalid_type(status);
+    }
+
+    value_set_type(result, VALUE_NUMBER);
+
+    if (!decimal_pow(&result->as.number, &op1->as.number, &op2->as.number,
+                                                          ctx,
+                                                          status)) {
+        return false;
+    }
+
+    return status_ok(status);
+}
+
+bool value_negate(Value *result, Value *op1, DecimalContext *ctx,
+                                             Status *status) {
+    Value zero;
+
+    if (op1->type != VALUE_NUMBER) {
+        return invalid_type(status);
+    }
+
+    zero.type = VALUE_NUMBER;
+    decimal_init(&zero.as.number, zero.decimal_data);
+    decimal_set_zero(&zero.as.number);
+
+    if (!value_sub(result, &zero, op1, ctx, status)) {
+        value_free(&zero);
+        return false;
+    }
+
+    value_free(&zero);
+
+    return status_ok(status);
+}
+
 bool value_and(Value *result, Value *op1, Value *op2, Status *status) {
     if ((op1->type != VALUE_BOOLEAN) || (op2->type != VALUE_BOOLEAN)) {
         return invalid_type(status);
@@ -382,11 +1265,15 @@ bool value_equal(Value *result, Value *op1, Value *op2, Status *status) {
         result->as.boolean = cmp_res == 0;
     }
     else if ((op1->type == VALUE_STRING) && (op2->type == VALUE_STRING)) {
-        value_set_type(result, VALUE_BOOLEAN);
-        result->as.boolean = (
+        bool equal = (
             (op1->as.string.byte_len == op2->as.string.byte_len) &&
-            (strcmp(op1->as.string.data, op2->as.string.data) == 0)
+            (memcmp(value_string_data(op1),
+                    value_string_data(op2),
+                    op1->as.string.byte_len) == 0)
         );
+
+        value_set_type(result, VALUE_BOOLEAN);
+        result->as.boolean = equal;
     }
     else {
         return invalid_type(status);
@@ -395,19 +1282,101 @@ bool value_equal(Value *result, Value *op1, Value *op2, Status *status) {
     return status_ok(status);
 }
 
+bool value_compare(Value *op1, Value *op2, int *result, Status *status) {
+    if ((op1->type == VALUE_NUMBER) && (op2->type == VALUE_NUMBER)) {
+        return decimal_cmp(&op1->as.number, &op2->as.number, result, status);
+    }
+
+    if ((op1->type == VALUE_STRING) && (op2->type == VALUE_STRING)) {
+        size_t len = op1->as.string.byte_len < op2->as.string.byte_len ?
+            op1->as.string.byte_len :
+            op2->as.string.byte_len;
+        int cmp_res = memcmp(value_string_data(op1), value_string_data(op2),
+                                                     len);
+
+        if (cmp_res == 0) {
+            cmp_res = (op1->as.string.byte_len > op2->as.string.byte_len) -
+                      (op1->as.string.byte_len < op2->as.string.byte_len);
+        }
+
+        *result = (cmp_res > 0) - (cmp_res < 0);
+
+        return status_ok(status);
+    }
+
+    return invalid_type(status);
+}
+
+bool value_to_integer(Value *value, mpd_ssize_t *integer, Status *status) {
+    uint32_t mpd_status = 0;
+    mpd_ssize_t n = 0;
+
+    if (value->type != VALUE_NUMBER) {
+        return invalid_type(status);
+    }
+
+    if (!mpd_isinteger(&value->as.number)) {
+        return conversion_failure(status);
+    }
+
+    n = mpd_qget_ssize(&value->as.number, &mpd_status);
+
+    if (mpd_status) {
+        return conversion_failure(status);
+    }
+
+    *integer = n;
+
+    return status_ok(status);
+}
+
+bool value_to_index(Value *value, size_t *index, Status *status) {
+    mpd_ssize_t n = 0;
+
+    if (!value_to_integer(value, &n, status)) {
+        return false;
+    }
+
+    if (n < 0) {
+        return conversion_failure(status);
+    }
+
+    *index = (size_t)n;
+
+    return status_ok(status);
+}
+
+bool value_is_array(Value *value) {
+    return (value->type == VALUE_ARRAY) || value_is_lazy_array(value);
+}
+
+bool value_is_table(Value *value) {
+    return (
+        (value->type == VALUE_TABLE) ||
+        (value->type == VALUE_PROVIDER) ||
+        value_is_lazy_table(value)
+    );
+}
+
 bool value_to_string(Value *value, String *s, Status *status) {
     switch (value->type) {
         case VALUE_NONE:
-            return string_append_cstr("Uninitialized value", status);
+            return string_append_cstr(s, "Uninitialized value", status);
         case VALUE_BOOLEAN:
             if (value->as.boolean) {
-                return string_append_cstr("true", status);
+                return string_append_cstr(s, "true", status);
             }
-            return string_append_cstr("false", status);
+            return string_append_cstr(s, "false", status);
         case VALUE_NUMBER:
-            return decimal_to_sci_string(&value->as.number, false, s, status);
+            return number_to_string(&value->as.number, s, status);
         case VALUE_STRING:
-            return string_append_string(value->as.string, status)
+            return string_append_cstr_full(
+                s,
+                value_string_data(value),
+                value->as.string.len,
+                value->as.string.byte_len,
+                status
+            );
         default:
             return invalid_type(status);
     }
@@ -435,7 +1404,7 @@ bool value_to_cstr(Value *value, char **s, Status *status) {
             }
             break;
         case VALUE_STRING:
-            local_s = strdup(value->as.string.data);
+            local_s = strdup(value_string_data(value));
             break;
         default:
             return invalid_type(status);
@@ -461,13 +1430,26 @@ void value_free(Value *value) {
             decimal_free(&value->as.number);
             break;
         case VALUE_STRING:
-            string_free(&value->as.string);
+            if (value->as.string.shared) {
+                shared_string_release(value->as.string.shared);
+            }
             break;
         case VALUE_ARRAY:
-            parray_free(&value->as.array);
+            shared_array_release(value->as.array);
             break;
         case VALUE_TABLE:
-            table_free(&value->as.table);
+            shared_table_release(value->as.table);
+            break;
+        case VALUE_JSON:
+            json_document_release(value->as.json.document);
+            break;
+        case VALUE_SNAPSHOT:
+            snapshot_release(value->as.snapshot.snapshot);
+            break;
+        case VALUE_PROVIDER:
+            provider_release(value->as.provider);
+            break;
+        case VALUE_RANGE:
             break;
     }
 
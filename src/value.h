@@ -8,6 +8,7 @@ enum {
     VALUE_INVALID_BOOLEAN_VALUE,
     VALUE_INVALID_FUNCTION_ARGUMENT_TYPE,
     VALUE_MISMATCHED_FUNCTION_ARITY_AND_TYPES,
+    VALUE_KEY_NOT_FOUND,
 };
 
 typedef enum {
@@ -17,6 +18,10 @@ typedef enum {
     VALUE_STRING,
     VALUE_ARRAY,
     VALUE_TABLE,
+    VALUE_JSON,
+    VALUE_SNAPSHOT,
+    VALUE_PROVIDER,
+    VALUE_RANGE,
 } ValueType;
 
 typedef struct {
@@ -24,25 +29,156 @@ typedef struct {
     const char *argument_types;
 } Function;
 
+/*
+ * Strings, arrays and tables are reference counted and copy-on-write:
+ * value_copy only bumps a reference count, and the mutating functions below
+ * (value_array_append, value_table_insert) make a private copy first if the
+ * storage is shared.  Copying an array or table duplicates only its spine;
+ * the elements themselves are shared in turn.
+ */
+
+typedef struct {
+    size_t refcount;
+    String string;
+} SharedString;
+
+/*
+ * Short strings don't get a SharedString at all: they're stored inline in the
+ * Value's decimal_data (which is otherwise unused by non-numbers), in which
+ * case `shared` is NULL.  Use value_string_data to get at the bytes.
+ */
+
+#define VALUE_INLINE_STRING_MAX ((sizeof(size_t) * DECIMAL_MINALLOC_MAX) - 1)
+
+typedef struct {
+    SharedString *shared;
+    size_t len;
+    size_t byte_len;
+} ValueString;
+
+typedef struct {
+    size_t refcount;
+    PArray elements;
+} SharedArray;
+
+/*
+ * Tables made with value_init_ordered_table also keep their entries in
+ * insertion order, so iterating over them is deterministic.
+ */
+
+typedef struct {
+    size_t refcount;
+    Table entries;
+    bool ordered;
+    PArray order;
+} SharedTable;
+
+/*
+ * A VALUE_JSON is an object or array in a lazily-loaded JSON document that
+ * hasn't been turned into a table or array (see json.h).  It reads like one
+ * in value_index, value_lookup and value_length.
+ */
+
+struct JSONDocument;
+
+typedef struct {
+    struct JSONDocument *document;
+    size_t node;
+} ValueJSON;
+
+/*
+ * A VALUE_SNAPSHOT is likewise a table or array read in place from a mapped
+ * snapshot file (see snapshot.h).
+ */
+
+struct Snapshot;
+
+typedef struct {
+    struct Snapshot *snapshot;
+    size_t offset;
+} ValueSnapshot;
+
+/*
+ * A VALUE_PROVIDER is a table whose entries are resolved on demand by a
+ * callback (see provider.h).
+ */
+
+struct Provider;
+
+/*
+ * A VALUE_RANGE is an array of the integers from `start` up to (but not
+ * including) `stop`.  Its elements are computed by value_index, so iterating
+ * over one uses no memory beyond the element itself.
+ */
+
+typedef struct {
+    mpd_ssize_t start;
+    mpd_ssize_t stop;
+} ValueRange;
+
 typedef struct {
     ValueType type;
     size_t decimal_data[DECIMAL_MINALLOC_MAX];
     union {
-        String string;
+        ValueString string;
         Decimal number;
         bool boolean;
-        PArray array;
-        Table table;
+        SharedArray *array;
+        SharedTable *table;
+        ValueJSON json;
+        ValueSnapshot snapshot;
+        struct Provider *provider;
+        ValueRange range;
         Function function;
     } as;
 } Value;
 
+typedef struct {
+    Value key;
+    Value value;
+    SSlice key_data;
+} ValueTableEntry;
+
+/*
+ * Iterates over a table's entries in place, without copying them: in
+ * insertion order for ordered tables and in hash order otherwise.  Lazy
+ * tables are materialized by value_table_iterator_init, so `value` should be
+ * the caller's own reference.  The table mustn't be modified while it's
+ * being iterated over (copies of it may be).
+ */
+
+typedef struct {
+    SharedTable *table;
+    TableIterator iterator;
+    size_t index;
+} ValueTableIterator;
+
+/*
+ * Reads an array's elements by index, remembering where the last one was so
+ * that reading them in order is cheap for every kind of array.  Lazy JSON
+ * arrays otherwise have to be scanned from the start for each element (see
+ * json.h); with a cursor, a step forward only scans the elements skipped.
+ * Stepping backward starts over.
+ */
+typedef struct {
+    const char *position;
+    size_t child;
+    size_t index;
+} ValueArrayCursor;
+
 void value_init_boolean(Value *value, bool b);
 bool value_init_number(Value *value, const char *num, DecimalContext *ctx,
                                                       Status *status);
 bool value_init_string(Value *value, const char *string, Status *status);
-void value_init_array(Value *value);
+bool value_init_string_len(Value *value, const char *data, size_t byte_len,
+                                                           Status *status);
+bool value_init_string_full(Value *value, const char *data, size_t len,
+                                                            size_t byte_len,
+                                                            Status *status);
+bool value_init_array(Value *value, Status *status);
 bool value_init_table(Value *value, Status *status);
+bool value_init_ordered_table(Value *value, Status *status);
+void value_init_range(Value *value, mpd_ssize_t start, mpd_ssize_t stop);
 bool value_init_function(Value *value, unsigned int arity,
                                        const char *argument_types,
                                        Status *status);
@@ -55,11 +191,30 @@ bool value_init_string_from_sslice(Value *value, SSlice *ss, Status *status);
 void value_clear(Value *value);
 void value_set_boolean(Value *value, bool b);
 bool value_set_number(Value *value, Decimal *n, Status *status);
+bool value_set_integer(Value *value, mpd_ssize_t n, Status *status);
 bool value_set_string(Value *value, String *s, Status *status);
 bool value_set_array(Value *value, PArray *parray, Status *status);
 bool value_set_table(Value *value, Table *table, Status *status);
+bool value_copy(Value *dst, Value *src, Status *status);
+void value_move(Value *dst, Value *src);
 
-bool value_index(Value *value, size_t index, Value **element, Status *status);
+bool value_array_append(Value *value, Value **element, Status *status);
+bool value_table_insert(Value *value, SSlice *key, Value **element,
+                                                   Status *status);
+bool value_table_insert_key(Value *value, Value *key, Value **element,
+                                                      Status *status);
+
+bool value_index(Value *value, size_t index, Value *element, Status *status);
+void value_array_cursor_init(ValueArrayCursor *cursor);
+bool value_array_cursor_index(ValueArrayCursor *cursor, Value *value,
+                                                        size_t index,
+                                                        Value *element,
+                                                        Status *status);
+bool value_table_iterator_init(ValueTableIterator *iter, Value *value,
+                                                       Status *status);
+bool value_table_iterator_next(ValueTableIterator *iter,
+                               ValueTableEntry **entry);
+bool value_lookup(Value *value, SSlice *key, Value *element, Status *status);
 bool value_length(Value *value, size_t *length, Status *status);
 
 bool value_add(Value *result, Value *op1, Value *op2, DecimalContext *ctx,
@@ -74,18 +229,38 @@ bool value_rem(Value *result, Value *op1, Value *op2, DecimalContext *ctx,
                                                       Status *status);
 bool value_pow(Value *result, Value *op1, Value *op2, DecimalContext *ctx,
                                                       Status *status);
+bool value_negate(Value *result, Value *op1, DecimalContext *ctx,
+                                             Status *status);
 bool value_and(Value *result, Value *op1, Value *op2, Status *status);
 bool value_or(Value *result, Value *op1, Value *op2, Status *status);
 bool value_not(Value *result, Value *op1, Status *status);
 bool value_equal(Value *result, Value *op1, Value *op2, Status *status);
+bool value_compare(Value *op1, Value *op2, int *result, Status *status);
+bool value_to_integer(Value *value, mpd_ssize_t *integer, Status *status);
+bool value_to_index(Value *value, size_t *index, Status *status);
+bool value_is_array(Value *value);
+bool value_is_table(Value *value);
 bool value_to_string(Value *value, String *s, Status *status);
 bool value_to_cstr(Value *value, char **s, Status *status);
 void value_free(Value *value);
 
+static inline
+const char* value_string_data(Value *value) {
+    if (value->as.string.shared) {
+        return value->as.string.shared->string.data;
+    }
+
+    return (const char *)value->decimal_data;
+}
+
 static inline
 void value_set_type(Value *value, ValueType type) {
     if (value->type != type) {
         value_free(value);
+
+        if (type == VALUE_NUMBER) {
+            decimal_init(&value->as.number, value->decimal_data);
+        }
     }
 
     value->type = type;
@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <setjmp.h>
+
+#include <cbase.h>
+
+#include <cmocka.h>
+
+#include "utils.h"
+#include "lang.h"
+#include "value.h"
+#include "json.h"
+#include "function.h"
+#include "builtins.h"
+#include "expression.h"
+#include "expression_evaluator.h"
+#include "template.h"
+
+#include "data.h"
+
+#define HTML_CONTEXT \
+"{\"html\": \"<a href=\\\"/x?a=1&b=2\\\">Tom's longer link</a>\", \"n\": 2}"
+
+#define HTML_ESCAPED \
+"&lt;a href=&quot;/x?a=1&amp;b=2&quot;&gt;Tom&#39;s longer link&lt;/a&gt;"
+
+#define HTML_RAW "<a href=\"/x?a=1&b=2\">Tom's longer link</a>"
+
+static bool fn_identity(Value *result, Value *arguments, DecimalContext *ctx,
+                                                          Status *status) {
+    (void)ctx;
+
+    return value_copy(result, &arguments[0], status);
+}
+
+static void render(Template *t, const char *input, Value *context,
+                                                   const char *expected) {
+    String template_input;
+    String output;
+    Status status;
+
+    status_init(&status);
+
+    assert_true(string_init(&template_input, input, &status));
+    assert_true(string_init(&output, "", &status));
+    assert_true(template_render_data(t, &template_input, context, &output,
+                                                                  &status));
+    assert_string_equal(output.data, expected);
+    string_free(&template_input);
+    string_free(&output);
+}
+
+void test_builtins(void **state) {
+    const char *mixed = "Mixed ASCII and \xc3\xb6 \xf0\x9f\x98\x80 text";
+    FunctionRegistry functions;
+    DecimalContext ctx;
+    Template t;
+    Value context;
+    Value html;
+    Value range;
+    Value number;
+    Value *element = NULL;
+    mpd_ssize_t integer = 0;
+    size_t length = 0;
+    String output;
+    Status status;
+
+    (void)state;
+
+    status_init(&status);
+
+    decimal_context_set_max(&ctx);
+
+    context.type = VALUE_NONE;
+    html.type = VALUE_NONE;
+    number.type = VALUE_NONE;
+
+    assert_int_equal(utf8_rune_count(mixed, strlen(mixed)), 24);
+    assert_true(utf8_is_ascii("Plain old ASCII text", 20));
+    assert_false(utf8_is_ascii(mixed, strlen(mixed)));
+
+    assert_true(function_registry_init(&functions, &status));
+    assert_true(builtins_register(&functions, &status));
+    assert_true(template_init(&t, &functions, &status));
+
+    assert_true(json_load_data(&context, JSON_CONTEXT, strlen(JSON_CONTEXT),
+                                                       &ctx,
+                                                       &status));
+
+    render(&t, "{{ upper('Some ASCII, [z] {a} @ `here`') }}", &context,
+               "SOME ASCII, [Z] {A} @ `HERE`");
+    render(&t, "{{ lower('Some ASCII, [Z] {A} @ `HERE`') }}", &context,
+               "some ascii, [z] {a} @ `here`");
+    render(
+        &t,
+        "{{ for person in people }}"
+            "{{ if person.age < 16 }}"
+                "{{ upper(person.name) }}/{{ length(person.name) }}"
+            "{{ endif }}"
+        "{{ endfor }}",
+        &context,
+        "B\xc3\x96" "B \xf0\x9f\x98\x80/5"
+    );
+    render(&t, "{{ length(people) }} {{ length('') }}", &context, "3 0");
+    render(
+        &t,
+        "{{ contains(message, 'Escapes') }} "
+        "{{ contains(message, 'escapes') }} "
+        "{{ contains('abcabd', 'abd') }} "
+        "{{ contains('ab', 'abc') }} "
+        "{{ contains('ab', '') }}",
+        &context,
+        "true false true false true"
+    );
+
+    assert_true(json_load_data(&html, HTML_CONTEXT, strlen(HTML_CONTEXT),
+                                                    &ctx,
+                                                    &status));
+
+    render(&t, "{{ html }}|{{ escape(html) }}", &html,
+               HTML_RAW "|" HTML_ESCAPED);
+
+    render(&t, "{{ format(tax_rate * 1234567, ',.2f') }}", &context,
+               "308,641.75");
+
+    render(
+        &t,
+        "{{ for i in range(-2, 3) }}{{ i }},{{ endfor }}"
+        "{{ for i in range(5, 2) }}never{{ endfor }}"
+        "{{ length(range(0, 1000000)) }}",
+        &context,
+        "-2,-1,0,1,2,1000000"
+    );
+    render(
+        &t,
+        "{{ for i in range(0, 1000000) }}"
+            "{{ if i == 999999 }}{{ i }}{{ endif }}"
+        "{{ endfor }}",
+        &context,
+        "999999"
+    );
+
+    assert_true(string_init(&output, "{{ range(0, 1.5) }}", &status));
+    assert_false(template_render_data(&t, &output, &context, &output,
+                                                             &status));
+    assert_true(status_match(&status, "value", VALUE_CONVERSION_FAILURE));
+    string_free(&output);
+
+    /* Appending to a range turns it into an ordinary array */
+    value_init_range(&range, 3, 5);
+    assert_true(value_array_append(&range, &element, &status));
+    value_init_boolean(element, true);
+    assert_int_equal(range.type, VALUE_ARRAY);
+    assert_true(value_length(&range, &length, &status));
+    assert_int_equal(length, 3);
+    assert_true(value_index(&range, 1, &number, &status));
+    assert_true(value_to_integer(&number, &integer, &status));
+    assert_int_equal(integer, 4);
+    value_free(&number);
+    value_free(&range);
+
+    template_set_autoescape(&t, true);
+    render(&t, "{{ html }}|{{ safe(html) }}|{{ n }}|{{ 'plain text' }}",
+               &html,
+               HTML_ESCAPED "|" HTML_RAW "|2|plain text");
+
+    /* escape's output isn't escaped again */
+    render(&t, "{{ escape(html) }}", &html, HTML_ESCAPED);
+
+    template_free(&t);
+    function_registry_free(&functions);
+
+    /* Only the builtin `safe` opts out, not others with the same name */
+    assert_true(function_registry_init(&functions, &status));
+    assert_true(function_registry_add_pure(&functions, "safe", 1, "s",
+                                                                  fn_identity,
+                                                                  &status));
+    assert_true(template_init(&t, &functions, &status));
+    template_set_autoescape(&t, true);
+    render(&t, "{{ safe(html) }}", &html, HTML_ESCAPED);
+
+    template_free(&t);
+    value_free(&html);
+    value_free(&context);
+    function_registry_free(&functions);
+}
+
+/* vi: set et ts=4 sw=4: */
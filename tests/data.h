@@ -48,4 +48,15 @@
 #define EXPRESSION_TEMPLATE "{{ 3 + 4 * 2 / (1 - 5) ^ 2 ^ 3 }}"
 #define EXPRESSION_ANSWER "3.0001220703125"
 
+#define JSON_CONTEXT \
+"{\n"                                                                       \
+"    \"tax_rate\": 0.25,\n"                                                 \
+"    \"people\": [\n"                                                       \
+"        {\"name\": \"Alice\", \"age\": 34, \"income\": 1.2e5},\n"          \
+"        {\"name\": \"B\\u00f6b \\ud83d\\ude00\", \"age\": 15},\n"          \
+"        {\"name\": null, \"age\": 17, \"registered\": false}\n"            \
+"    ],\n"                                                                  \
+"    \"message\": \"Escapes: \\\"\\t\\/\\n\"\n"                             \
+"}\n"
+
 #endif
@@ -0,0 +1,462 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <setjmp.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <cbase.h>
+
+#include <cmocka.h>
+
+#include "lang.h"
+#include "value.h"
+#include "json.h"
+#include "provider.h"
+#include "tokenizer.h"
+#include "lexer.h"
+#include "expression_parser.h"
+#include "parser.h"
+#include "function.h"
+#include "expression.h"
+#include "expression_evaluator.h"
+#include "builtins.h"
+#include "fragment_cache.h"
+#include "template.h"
+
+#define RENDER_THREADS 4
+#define RENDERS 100
+
+#define PEOPLE_JSON                                                   \
+    "{\"people\": [{\"id\": 1, \"name\": \"Al\", \"pets\": [\"a\"]}, " \
+                  "{\"id\": 2, \"name\": \"Bo\", \"pets\": []}, "      \
+                  "{\"id\": 1, \"name\": \"Al\", \"pets\": [\"a\"]}]}"
+
+#define PEOPLE_TEMPLATE                                 \
+    "{{ for p in people }}"                             \
+        "{{ cache p.id }}"                              \
+            "<{{ tally(p.name) }}"                      \
+            "{{ for pet in p.pets }}:{{ pet }}{{ endfor }}>" \
+        "{{ endcache }}"                                \
+    "{{ endfor }}"
+
+typedef struct {
+    Template *t;
+    Value *context;
+    bool ok;
+} Renderer;
+
+static size_t tallies = 0;
+
+static bool fn_tally(Value *result, Value *arguments, DecimalContext *ctx,
+                                                      Status *status) {
+    (void)ctx;
+
+    __atomic_add_fetch(&tallies, 1, __ATOMIC_RELAXED);
+
+    return value_copy(result, &arguments[0], status);
+}
+
+static void parse(Template *t, const char *input) {
+    String template_input;
+    Status status;
+
+    status_init(&status);
+
+    assert_true(string_init(&template_input, input, &status));
+    assert_true(template_parse_data(t, &template_input, &status));
+    string_free(&template_input);
+}
+
+static void render(Template *t, Value *context, const char *expected) {
+    String output;
+    Status status;
+
+    status_init(&status);
+
+    assert_true(string_init(&output, "", &status));
+    assert_true(template_render(t, context, &output, &status));
+    assert_string_equal(output.data, expected);
+    string_free(&output);
+}
+
+static void compile_fails(Template *t, const char *input, const char *domain,
+                                                          int code) {
+    String template_input;
+    Status status;
+
+    status_init(&status);
+
+    assert_true(string_init(&template_input, input, &status));
+    assert_false(template_parse_data(t, &template_input, &status));
+    assert_true(status_match(&status, domain, code));
+    string_free(&template_input);
+}
+
+static bool cached(FragmentCache *cache, const char *key_data,
+                                         const char *expected) {
+    String key;
+    String output;
+    bool found = false;
+    Status status;
+
+    status_init(&status);
+
+    assert_true(string_init(&key, key_data, &status));
+    assert_true(string_init(&output, "", &status));
+    assert_true(fragment_cache_get(cache, &key, &output, &found, &status));
+
+    if (found) {
+        assert_string_equal(output.data, expected);
+    }
+
+    string_free(&key);
+    string_free(&output);
+
+    return found;
+}
+
+static void store(FragmentCache *cache, const char *key_data,
+                                        const char *data) {
+    String key;
+    Status status;
+
+    status_init(&status);
+
+    assert_true(string_init(&key, key_data, &status));
+    assert_true(fragment_cache_put(cache, &key, data, strlen(data),
+                                                      strlen(data),
+                                                      &status));
+    string_free(&key);
+}
+
+static bool resolve(void *data, SSlice *key, Value *value, Status *status) {
+    if (sslice_equals_cstr(key, "name")) {
+        return value_init_string(value, "Al", status);
+    }
+
+    if (sslice_equals_cstr(key, "address")) {
+        return provider_init(value, resolve, data, status);
+    }
+
+    return not_found(status);
+}
+
+static void load(Value *context, const char *json, DecimalContext *ctx) {
+    Status status;
+
+    status_init(&status);
+
+    value_free(context);
+    assert_true(json_load_data(context, json, strlen(json), ctx, &status));
+}
+
+static void read_paths(Template *t, size_t count, ...) {
+    va_list args;
+
+    assert_int_equal(t->reads.len, count);
+
+    va_start(args, count);
+
+    for (size_t i = 0; i < count; i++) {
+        assert_string_equal(parray_index_fast(&t->reads, i),
+                            va_arg(args, const char *));
+    }
+
+    va_end(args);
+}
+
+static void* render_loop(void *data) {
+    Renderer *renderer = data;
+    String output;
+    Status status;
+
+    status_init(&status);
+
+    renderer->ok = string_init(&output, "", &status);
+
+    for (size_t i = 0; renderer->ok && (i < RENDERS); i++) {
+        string_clear(&output);
+
+        renderer->ok = (
+            template_render(renderer->t, renderer->context, &output,
+                                                            &status) &&
+            (strcmp(output.data, "<Al:a><Bo><Al:a>") == 0)
+        );
+    }
+
+    string_free(&output);
+
+    return NULL;
+}
+
+void test_fragment_cache(void **state) {
+    FunctionRegistry functions;
+    FragmentCache cache;
+    DecimalContext ctx;
+    Template t;
+    Value context;
+    String output;
+    Renderer renderers[RENDER_THREADS];
+    pthread_t threads[RENDER_THREADS];
+    FragmentCacheStats stats;
+    Status status;
+
+    (void)state;
+
+    status_init(&status);
+
+    decimal_context_set_max(&ctx);
+
+    assert_true(json_load_data(&context, PEOPLE_JSON, strlen(PEOPLE_JSON),
+                                                      &ctx,
+                                                      &status));
+    assert_true(function_registry_init(&functions, &status));
+    assert_true(function_registry_add(&functions, "tally", 1, "s", fn_tally,
+                                                                   &status));
+    assert_true(fragment_cache_init(&cache, 0, 0, &status));
+    assert_true(template_init(&t, &functions, &status));
+    assert_true(string_init(&output, "", &status));
+
+    /* Without a cache, blocks are rendered every time */
+    parse(&t, PEOPLE_TEMPLATE);
+    render(&t, &context, "<Al:a><Bo><Al:a>");
+    assert_int_equal(tallies, 3);
+
+    /* With one, each key's body is rendered once */
+    template_set_fragment_cache(&t, &cache);
+    render(&t, &context, "<Al:a><Bo><Al:a>");
+    assert_int_equal(tallies, 5);
+    render(&t, &context, "<Al:a><Bo><Al:a>");
+    assert_int_equal(tallies, 5);
+    fragment_cache_stats(&cache, &stats);
+    assert_int_equal(stats.entries, 2);
+    assert_int_equal(stats.hits, 4);
+    assert_int_equal(stats.misses, 2);
+
+    /* Parsing again gets the template a new id, so nothing stale is used */
+    parse(&t, "{{ cache 'k' }}A{{ endcache }}");
+    render(&t, &context, "A");
+    parse(&t, "{{ cache 'k' }}B{{ endcache }}");
+    render(&t, &context, "B");
+
+    /* Keys can be arrays, and nest */
+    parse(&t, "{{ for p in people }}"
+                  "{{ cache [p.id, 'outer'] }}"
+                      "{{ p.name }}"
+                      "{{ cache [p.id, 'inner'] }}"
+                          "({{ tally(p.name) }})"
+                      "{{ endcache }}"
+                  "{{ endcache }}"
+              "{{ endfor }}");
+    render(&t, &context, "Al(Al)Bo(Bo)Al(Al)");
+    assert_int_equal(tallies, 7);
+
+    /* Or tables */
+    parse(&t, "{{ cache people }}{{ tally('x') }}{{ endcache }}");
+    render(&t, &context, "x");
+    render(&t, &context, "x");
+    assert_int_equal(tallies, 8);
+
+    /* Loops can't be left from inside a cache block */
+    compile_fails(&t, "{{ for p in people }}"
+                          "{{ cache p.id }}{{ break }}{{ endcache }}"
+                      "{{ endfor }}",
+                      "template",
+                      TEMPLATE_LOOP_CONTROL_IN_CACHE);
+    compile_fails(&t, "{{ for p in people }}"
+                          "{{ cache p.id }}{{ continue }}{{ endcache }}"
+                      "{{ endfor }}",
+                      "template",
+                      TEMPLATE_LOOP_CONTROL_IN_CACHE);
+    parse(&t, "{{ cache 1 }}"
+                  "{{ for p in people }}{{ p.id }}{{ break }}{{ endfor }}"
+              "{{ endcache }}");
+    render(&t, &context, "1");
+    compile_fails(&t, "{{ endcache }}", "parser",
+                                        PARSER_ENDCACHE_WITHOUT_CACHE);
+    compile_fails(&t, "{{ cache 1 }}x", "template",
+                                        TEMPLATE_UNTERMINATED_BLOCK);
+    compile_fails(&t, "{{ if true }}{{ cache 1 }}{{ endif }}{{ endcache }}",
+                      "template",
+                      TEMPLATE_MISMATCHED_BLOCK_END);
+
+    /* Threads share the cache */
+    fragment_cache_clear(&cache);
+    parse(&t, PEOPLE_TEMPLATE);
+
+    for (size_t i = 0; i < RENDER_THREADS; i++) {
+        renderers[i].t = &t;
+        renderers[i].context = &context;
+        renderers[i].ok = false;
+        assert_int_equal(pthread_create(&threads[i], NULL, render_loop,
+                                                           &renderers[i]), 0);
+    }
+
+    for (size_t i = 0; i < RENDER_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+        assert_true(renderers[i].ok);
+    }
+
+    fragment_cache_stats(&cache, &stats);
+    assert_int_equal(stats.entries, 2);
+    assert_int_equal(stats.hits + stats.misses, RENDER_THREADS * RENDERS * 3);
+    fragment_cache_free(&cache);
+
+    /* The least recently used entries are evicted first */
+    assert_true(fragment_cache_init(&cache, 2, 0, &status));
+    store(&cache, "k1", "one");
+    store(&cache, "k2", "two");
+    assert_true(cached(&cache, "k1", "one"));
+    store(&cache, "k3", "three");
+    assert_false(cached(&cache, "k2", NULL));
+    assert_true(cached(&cache, "k1", "one"));
+    assert_true(cached(&cache, "k3", "three"));
+    store(&cache, "k3", "tres");
+    assert_true(cached(&cache, "k3", "tres"));
+    fragment_cache_stats(&cache, &stats);
+    assert_int_equal(stats.entries, 2);
+    assert_int_equal(stats.bytes, strlen("k1one") + strlen("k3tres"));
+    assert_int_equal(stats.evictions, 1);
+    fragment_cache_free(&cache);
+
+    /* As are entries taking the cache over its size */
+    assert_true(fragment_cache_init(&cache, 0, 16, &status));
+    store(&cache, "k1", "1234567");
+    store(&cache, "k2", "1234567");
+    assert_false(cached(&cache, "k1", NULL));
+    assert_true(cached(&cache, "k2", "1234567"));
+    store(&cache, "k3", "this is too big to cache");
+    assert_false(cached(&cache, "k3", NULL));
+    assert_true(cached(&cache, "k2", "1234567"));
+    fragment_cache_free(&cache);
+
+    template_free(&t);
+    string_free(&output);
+    value_free(&context);
+    function_registry_free(&functions);
+}
+
+void test_render_cache(void **state) {
+    FunctionRegistry functions;
+    FragmentCache cache;
+    FragmentCacheStats stats;
+    DecimalContext ctx;
+    Template t;
+    Value context;
+    String output;
+    struct timespec pause;
+    Status status;
+
+    (void)state;
+
+    status_init(&status);
+
+    decimal_context_set_max(&ctx);
+
+    context.type = VALUE_NONE;
+    tallies = 0;
+
+    assert_true(function_registry_init(&functions, &status));
+    assert_true(builtins_register(&functions, &status));
+    assert_true(function_registry_add(&functions, "tally", 1, "s", fn_tally,
+                                                                   &status));
+    assert_true(fragment_cache_init(&cache, 0, 0, &status));
+    assert_true(template_init(&t, &functions, &status));
+    assert_true(string_init(&output, "", &status));
+    template_set_render_cache(&t, &cache);
+
+    /* Reads are lookup paths, minus any that another covers */
+    parse(&t, "{{ site.title }}{{ for p in people }}{{ p.name }}{{ endfor }}"
+              "{{ site.title }}{{ user.name }}{{ upper(site.owner.name) }}");
+    read_paths(&t, 4, "site.title", "people", "user.name", "site.owner.name");
+    assert_true(t.pure);
+    parse(&t, "{{ site.title }}{{ site['owner'] }}{{ for p in people }}"
+                  "{{ loop.index }}"
+              "{{ endfor }}");
+    read_paths(&t, 2, "site", "people");
+
+    /* Renders agreeing on what's read are copied from the cache */
+    parse(&t, "{{ site.title }}:{{ for p in people }}{{ p }}{{ endfor }}");
+    load(&context, "{\"site\": {\"title\": \"T\", \"x\": 1}, "
+                    "\"people\": [\"a\", \"b\"]}", &ctx);
+    render(&t, &context, "T:ab");
+    render(&t, &context, "T:ab");
+    load(&context, "{\"site\": {\"title\": \"T\", \"x\": 2}, "
+                    "\"people\": [\"a\", \"b\"], \"y\": 3}", &ctx);
+    render(&t, &context, "T:ab");
+    fragment_cache_stats(&cache, &stats);
+    assert_int_equal(stats.entries, 1);
+    assert_int_equal(stats.hits, 2);
+    assert_int_equal(stats.misses, 1);
+
+    /* Changing anything read renders again */
+    load(&context, "{\"site\": {\"title\": \"U\"}, "
+                    "\"people\": [\"a\", \"b\"]}", &ctx);
+    render(&t, &context, "U:ab");
+    load(&context, "{\"site\": {\"title\": \"U\"}, "
+                    "\"people\": [\"a\", \"c\"]}", &ctx);
+    render(&t, &context, "U:ac");
+    load(&context, "{\"site\": {\"title\": 1}, "
+                    "\"people\": [\"a\", \"c\"]}", &ctx);
+    render(&t, &context, "1:ac");
+    load(&context, "{\"site\": {\"title\": \"1\"}, "
+                    "\"people\": [\"a\", \"c\"]}", &ctx);
+    render(&t, &context, "1:ac");
+    fragment_cache_stats(&cache, &stats);
+    assert_int_equal(stats.entries, 5);
+    assert_int_equal(stats.hits, 2);
+
+    /* Templates calling impure functions aren't cached */
+    parse(&t, "{{ tally(site.title) }}");
+    assert_false(t.pure);
+    render(&t, &context, "1");
+    render(&t, &context, "1");
+    assert_int_equal(tallies, 2);
+
+    /* Nor are contexts that can't be fingerprinted */
+    value_free(&context);
+    assert_true(provider_init(&context, resolve, NULL, &status));
+    parse(&t, "{{ name }}{{ address.name }}");
+    render(&t, &context, "AlAl");
+    render(&t, &context, "AlAl");
+    parse(&t, "{{ address['name'] }}");
+    render(&t, &context, "Al");
+    render(&t, &context, "Al");
+
+    /* Which aren't valid block keys either */
+    template_set_render_cache(&t, NULL);
+    template_set_fragment_cache(&t, &cache);
+    parse(&t, "{{ cache address }}x{{ endcache }}");
+    assert_false(template_render(&t, &context, &output, &status));
+    assert_true(status_match(&status, "fragment_cache",
+                                      FRAGMENT_CACHE_INVALID_KEY));
+    template_set_fragment_cache(&t, NULL);
+    template_set_render_cache(&t, &cache);
+    fragment_cache_stats(&cache, &stats);
+    assert_int_equal(stats.hits, 3);
+    assert_int_equal(stats.misses, 6);
+
+    /* Entries expire after the cache's TTL */
+    fragment_cache_clear(&cache);
+    fragment_cache_set_ttl(&cache, 50);
+    parse(&t, "{{ name }}");
+    render(&t, &context, "Al");
+    render(&t, &context, "Al");
+    pause.tv_sec = 0;
+    pause.tv_nsec = 100 * 1000 * 1000;
+    nanosleep(&pause, NULL);
+    render(&t, &context, "Al");
+    fragment_cache_stats(&cache, &stats);
+    assert_int_equal(stats.hits, 1);
+    assert_int_equal(stats.misses, 2);
+    assert_int_equal(stats.expirations, 1);
+    assert_int_equal(stats.entries, 1);
+
+    template_free(&t);
+    fragment_cache_free(&cache);
+    string_free(&output);
+    value_free(&context);
+    function_registry_free(&functions);
+}
+
+/* vi: set et ts=4 sw=4: */
@@ -0,0 +1,246 @@
+#include <stdio.h>
+#include <setjmp.h>
+
+#include <cbase.h>
+
+#include <cmocka.h>
+
+#include "value.h"
+#include "json.h"
+
+#include "data.h"
+
+#define LARGE_OBJECT \
+"{\"a\": 1, \"b\": 2, \"c\": 3, \"d\": 4, \"e\\\"\": 5, " \
+"\"f\": {\"g\": 7}, \"h\": 8, \"a\": 9}"
+
+static void lookup_cstr(Value *value, const char *key, Value *element) {
+    SSlice ss;
+    Status status;
+
+    ss.data = key;
+    ss.len = strlen(key);
+    ss.byte_len = ss.len;
+
+    assert_true(value_lookup(value, &ss, element, &status));
+}
+
+static void assert_value_string(Value *value, const char *expected) {
+    char *s = NULL;
+    Status status;
+
+    assert_true(value_to_cstr(value, &s, &status));
+    assert_string_equal(s, expected);
+    free(s);
+}
+
+void test_json(void **state) {
+    Value context;
+    Value people;
+    Value person;
+    Value field;
+    size_t length = 0;
+    Status status;
+    DecimalContext ctx;
+    JSONParser parser;
+
+    (void)state;
+
+    status_init(&status);
+
+    decimal_context_set_max(&ctx);
+
+    context.type = VALUE_NONE;
+    people.type = VALUE_NONE;
+    person.type = VALUE_NONE;
+    field.type = VALUE_NONE;
+
+    assert_true(json_load_data(&context, JSON_CONTEXT, strlen(JSON_CONTEXT),
+                                                       &ctx,
+                                                       &status));
+    assert_int_equal(context.type, VALUE_TABLE);
+
+    lookup_cstr(&context, "tax_rate", &field);
+    assert_int_equal(field.type, VALUE_NUMBER);
+    assert_value_string(&field, "0.25");
+
+    lookup_cstr(&context, "people", &people);
+    assert_true(value_length(&people, &length, &status));
+    assert_int_equal(length, 3);
+
+    assert_true(value_index(&people, 0, &person, &status));
+    lookup_cstr(&person, "income", &field);
+    assert_value_string(&field, "1.2E+5");
+
+    assert_true(value_index(&people, 1, &person, &status));
+    lookup_cstr(&person, "name", &field);
+    assert_int_equal(field.type, VALUE_STRING);
+    assert_int_equal(field.as.string.len, 5);
+    assert_string_equal(value_string_data(&field),
+                        "B\xc3\xb6" "b \xf0\x9f\x98\x80");
+
+    assert_true(value_index(&people, 2, &person, &status));
+    lookup_cstr(&person, "name", &field);
+    assert_int_equal(field.type, VALUE_NONE);
+    lookup_cstr(&person, "registered", &field);
+    assert_int_equal(field.type, VALUE_BOOLEAN);
+    assert_false(field.as.boolean);
+
+    lookup_cstr(&context, "message", &field);
+    assert_string_equal(value_string_data(&field), "Escapes: \"\t/\n");
+
+    assert_true(json_parser_init(&parser, &ctx, &status));
+
+    assert_false(json_parser_load(&parser, &field, "[1, 2", 5, &status));
+    assert_true(status_match(&status, "json", JSON_UNEXPECTED_EOF));
+
+    assert_false(json_parser_load(&parser, &field, "[01]", 4, &status));
+    assert_true(status_match(&status, "json", JSON_INVALID_NUMBER));
+
+    assert_false(json_parser_load(&parser, &field, "{\"a\" 1}", 7, &status));
+    assert_true(status_match(&status, "json", JSON_INVALID_SYNTAX));
+
+    assert_false(json_parser_load(&parser, &field, "\"\\x\"", 4, &status));
+    assert_true(status_match(&status, "json", JSON_INVALID_ESCAPE));
+
+    assert_false(json_parser_load(&parser, &field, "true false", 10,
+                                                                  &status));
+    assert_true(status_match(&status, "json", JSON_TRAILING_DATA));
+
+    assert_true(json_parser_load(&parser, &field, " [[], {}] ", 10,
+                                                                  &status));
+    assert_true(value_length(&field, &length, &status));
+    assert_int_equal(length, 2);
+
+    json_parser_free(&parser);
+
+    value_free(&field);
+    value_free(&person);
+    value_free(&people);
+    value_free(&context);
+}
+
+void test_lazy_json(void **state) {
+    Value context;
+    Value people;
+    Value person;
+    Value field;
+    Value *slot = NULL;
+    ValueArrayCursor cursor;
+    SSlice key;
+    size_t length = 0;
+    Status status;
+    DecimalContext ctx;
+
+    (void)state;
+
+    status_init(&status);
+
+    decimal_context_set_max(&ctx);
+
+    context.type = VALUE_NONE;
+    people.type = VALUE_NONE;
+    person.type = VALUE_NONE;
+    field.type = VALUE_NONE;
+
+    assert_true(json_load_lazy_data(&context, JSON_CONTEXT,
+                                              strlen(JSON_CONTEXT),
+                                              &ctx,
+                                              &status));
+    assert_int_equal(context.type, VALUE_JSON);
+    assert_true(value_length(&context, &length, &status));
+    assert_int_equal(length, 3);
+
+    lookup_cstr(&context, "tax_rate", &field);
+    assert_value_string(&field, "0.25");
+
+    lookup_cstr(&context, "people", &people);
+    assert_int_equal(people.type, VALUE_JSON);
+    assert_ptr_equal(people.as.json.document, context.as.json.document);
+    assert_true(value_length(&people, &length, &status));
+    assert_int_equal(length, 3);
+
+    assert_true(value_index(&people, 1, &person, &status));
+    lookup_cstr(&person, "name", &field);
+    assert_string_equal(value_string_data(&field),
+                        "B\xc3\xb6" "b \xf0\x9f\x98\x80");
+
+    assert_true(value_index(&people, 2, &person, &status));
+    lookup_cstr(&person, "registered", &field);
+    assert_int_equal(field.type, VALUE_BOOLEAN);
+    assert_false(field.as.boolean);
+
+    assert_false(value_index(&people, 3, &person, &status));
+
+    key.data = "missing";
+    key.len = 7;
+    key.byte_len = 7;
+
+    assert_false(value_lookup(&person, &key, &field, &status));
+    assert_true(status_match(&status, "value", VALUE_KEY_NOT_FOUND));
+
+    /* Writing to a lazy value turns it into a table, leaving others alone */
+    assert_true(value_table_insert(&person, &key, &slot, &status));
+    value_init_boolean(slot, true);
+    assert_int_equal(person.type, VALUE_TABLE);
+    assert_true(value_length(&person, &length, &status));
+    assert_int_equal(length, 4);
+
+    value_free(&person);
+    assert_true(value_index(&people, 2, &person, &status));
+    assert_int_equal(person.type, VALUE_JSON);
+
+    /* Cursors step forward from the last element read, or start over */
+    value_array_cursor_init(&cursor);
+    assert_true(value_array_cursor_index(&cursor, &people, 2, &person,
+                                                              &status));
+    lookup_cstr(&person, "registered", &field);
+    assert_false(field.as.boolean);
+    assert_true(value_array_cursor_index(&cursor, &people, 1, &person,
+                                                              &status));
+    lookup_cstr(&person, "name", &field);
+    assert_string_equal(value_string_data(&field),
+                        "B\xc3\xb6" "b \xf0\x9f\x98\x80");
+    assert_false(value_array_cursor_index(&cursor, &people, 3, &person,
+                                                               &status));
+
+    value_free(&context);
+    value_free(&people);
+
+    assert_true(json_load_lazy_data(&context, "{\"a\": 1, \"a\": [2]}",
+                                              18,
+                                              &ctx,
+                                              &status));
+    lookup_cstr(&context, "a", &field);
+    assert_int_equal(field.type, VALUE_JSON);
+    value_free(&context);
+
+    /* Larger objects are looked up through a member table */
+    assert_true(json_load_lazy_data(&context, LARGE_OBJECT,
+                                              strlen(LARGE_OBJECT),
+                                              &ctx,
+                                              &status));
+    lookup_cstr(&context, "a", &field);
+    assert_value_string(&field, "9");
+    lookup_cstr(&context, "e\"", &field);
+    assert_value_string(&field, "5");
+    lookup_cstr(&context, "f", &person);
+    assert_int_equal(person.type, VALUE_JSON);
+    lookup_cstr(&person, "g", &field);
+    assert_value_string(&field, "7");
+    assert_false(value_lookup(&context, &key, &field, &status));
+    assert_true(status_match(&status, "value", VALUE_KEY_NOT_FOUND));
+    value_free(&context);
+
+    assert_false(json_load_lazy_data(&context, "{\"a\": [1}", 9, &ctx,
+                                                                  &status));
+    assert_true(status_match(&status, "json", JSON_MISMATCHED_BRACKETS));
+
+    assert_false(json_load_lazy_data(&context, "[\"]\"", 4, &ctx, &status));
+    assert_true(status_match(&status, "json", JSON_UNEXPECTED_EOF));
+
+    value_free(&field);
+    value_free(&person);
+}
+
+/* vi: set et ts=4 sw=4: */
@@ -6,9 +6,28 @@
 #include <cmocka.h>
 
 void test_add(void **state);
+void test_copy_on_write(void **state);
+void test_small_strings(void **state);
+void test_json(void **state);
+void test_lazy_json(void **state);
+void test_snapshot(void **state);
+void test_provider(void **state);
 void test_tokenizer(void **state);
 void test_lexer(void **state);
 void test_parser(void **state);
+void test_template(void **state);
+void test_template_cache(void **state);
+void test_template_aot(void **state);
+void test_fragment_cache(void **state);
+void test_render_cache(void **state);
+void test_template_deps(void **state);
+void test_render_pool(void **state);
+void test_template_registry(void **state);
+#ifdef HAVE_INOTIFY
+void test_template_watcher(void **state);
+#endif
+void test_builtins(void **state);
+void test_number(void **state);
 
 int main(void) {
     int failed_test_count = 0;
@@ -17,9 +36,28 @@ int main(void) {
 
     const struct CMUnitTest tests[] = {
         cmocka_unit_test(test_add), /* 5 (7), 1,341 */
+        cmocka_unit_test(test_copy_on_write),
+        cmocka_unit_test(test_small_strings),
+        cmocka_unit_test(test_json),
+        cmocka_unit_test(test_lazy_json),
+        cmocka_unit_test(test_snapshot),
+        cmocka_unit_test(test_provider),
         cmocka_unit_test(test_tokenizer), /* 1 (3), 1,978 */
         cmocka_unit_test(test_lexer), /* 2 (4), 2,042 */
         cmocka_unit_test(test_parser), /* 5 (7), 3,834 */
+        cmocka_unit_test(test_template),
+        cmocka_unit_test(test_template_cache),
+        cmocka_unit_test(test_template_aot),
+        cmocka_unit_test(test_fragment_cache),
+        cmocka_unit_test(test_render_cache),
+        cmocka_unit_test(test_template_deps),
+        cmocka_unit_test(test_render_pool),
+        cmocka_unit_test(test_template_registry),
+#ifdef HAVE_INOTIFY
+        cmocka_unit_test(test_template_watcher),
+#endif
+        cmocka_unit_test(test_builtins),
+        cmocka_unit_test(test_number),
     };
 
     failed_test_count = cmocka_run_group_tests(tests, NULL, NULL);
@@ -0,0 +1,95 @@
+#include <stdio.h>
+#include <setjmp.h>
+
+#include <cbase.h>
+
+#include <cmocka.h>
+
+#include "number.h"
+
+#include "data.h"
+
+static void assert_same_as_sci(const char *num, DecimalContext *ctx) {
+    size_t data[DECIMAL_MINALLOC_MAX];
+    Decimal d;
+    String fast;
+    String sci;
+    Status status;
+
+    status_init(&status);
+
+    assert_true(decimal_init_cstr(&d, num, ctx, data, &status));
+    assert_true(string_init(&fast, "", &status));
+    assert_true(string_init(&sci, "", &status));
+    assert_true(number_to_string(&d, &fast, &status));
+    assert_true(decimal_to_sci_string(&d, false, &sci, &status));
+    assert_string_equal(fast.data, sci.data);
+    string_free(&fast);
+    string_free(&sci);
+    decimal_free(&d);
+}
+
+static void assert_format(const char *num, const char *spec,
+                                           const char *expected,
+                                           DecimalContext *ctx) {
+    size_t data[DECIMAL_MINALLOC_MAX];
+    char buf[NUMBER_BUF_SIZE];
+    NumberFormat format;
+    size_t len = 0;
+    Decimal d;
+    SSlice ss;
+    Status status;
+
+    status_init(&status);
+
+    ss.data = spec;
+    ss.len = strlen(spec);
+    ss.byte_len = ss.len;
+
+    assert_true(decimal_init_cstr(&d, num, ctx, data, &status));
+    assert_true(number_format_parse(&ss, &format, &status));
+    assert_true(number_format(&d, &format, ctx, buf, &len, &status));
+    buf[len] = '\0';
+    assert_string_equal(buf, expected);
+    decimal_free(&d);
+}
+
+void test_number(void **state) {
+    const char *numbers[] = {
+        "0", "-0", "7", "-42", "0.5", "-0.25", "100.00", "0.000001",
+        "0.0000001", "1.2e5", "12e-3", "3.0001220703125",
+        "12345678901234567890", "-1234567890123456789.0123456789",
+        NUMBER1, NUMBER2, NUMBER5, "1e100",
+    };
+    NumberFormat format;
+    DecimalContext ctx;
+    SSlice ss;
+    Status status;
+
+    (void)state;
+
+    status_init(&status);
+
+    decimal_context_set_max(&ctx);
+
+    for (size_t i = 0; i < sizeof(numbers) / sizeof(numbers[0]); i++) {
+        assert_same_as_sci(numbers[i], &ctx);
+    }
+
+    assert_format("1234567.891", ",.2f", "1,234,567.89", &ctx);
+    assert_format("1234567.891", ".0", "1234568", &ctx);
+    assert_format("-999.5", ",.0f", "-1,000", &ctx);
+    assert_format("0.125", ".2", "0.12", &ctx);
+    assert_format("3", ".3f", "3.000", &ctx);
+    assert_format("1.2e5", ",", "120,000", &ctx);
+    assert_format("0.0005", "", "0.0005", &ctx);
+    assert_format("123", ",", "123", &ctx);
+
+    ss.data = ",.x";
+    ss.len = 3;
+    ss.byte_len = 3;
+    assert_false(number_format_parse(&ss, &format, &status));
+    assert_true(status_match(&status, "number", NUMBER_INVALID_FORMAT));
+}
+
+/* vi: set et ts=4 sw=4: */
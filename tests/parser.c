@@ -89,7 +89,7 @@ bool print_iteration_node(ASTNode *node, ExpressionParser *expression_parser,
     char *es = NULL;
     char *cs = NULL;
 
-    cs = sslice_to_cstr(&node->as.iteration_identifier);
+    cs = sslice_to_cstr(&node->as.iteration.identifier);
 
     if (!expression_to_cstr(&expression_parser->output, &es, status)) {
         return false;
@@ -141,6 +141,12 @@ void test_parser(void **state) {
             case AST_NODE_ELSE:
                 puts("<Conditional (else)>");
                 break;
+            case AST_NODE_ELSE_IF:
+                if (!print_conditional_node(&parser.expression_parser,
+                                            &status)) {
+                    printf("Error: %s\n", status.message);
+                }
+                break;
             case AST_NODE_CONDITIONAL_END:
                 puts("<Conditional (end)>");
                 break;
@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <setjmp.h>
+#include <pthread.h>
+
+#include <cbase.h>
+
+#include <cmocka.h>
+
+#include "value.h"
+#include "provider.h"
+
+typedef struct {
+    size_t calls;
+} Source;
+
+static bool resolve(void *data, SSlice *key, Value *value, Status *status) {
+    Source *source = (Source *)data;
+
+    source->calls++;
+
+    if (sslice_equals_cstr(key, "name")) {
+        return value_init_string(value, "Alice", status);
+    }
+
+    if (sslice_equals_cstr(key, "address")) {
+        return provider_init(value, resolve, data, status);
+    }
+
+    if (sslice_equals_cstr(key, "broken")) {
+        return status_failure(status, "test", 1, "Backend unavailable");
+    }
+
+    return not_found(status);
+}
+
+static bool lookup_cstr(Value *value, const char *key, Value *element,
+                                                       Status *status) {
+    SSlice ss;
+
+    ss.data = key;
+    ss.len = strlen(key);
+    ss.byte_len = ss.len;
+
+    return value_lookup(value, &ss, element, status);
+}
+
+void test_provider(void **state) {
+    Value context;
+    Value copy;
+    Value address;
+    Value field;
+    Source source;
+    Status status;
+
+    (void)state;
+
+    status_init(&status);
+
+    source.calls = 0;
+    copy.type = VALUE_NONE;
+    address.type = VALUE_NONE;
+    field.type = VALUE_NONE;
+
+    assert_true(provider_init(&context, resolve, &source, &status));
+    assert_int_equal(context.type, VALUE_PROVIDER);
+    assert_int_equal(source.calls, 0);
+
+    assert_true(lookup_cstr(&context, "name", &field, &status));
+    assert_string_equal(value_string_data(&field), "Alice");
+    assert_int_equal(source.calls, 1);
+
+    /* Copies share the memo, so the callback isn't called again */
+    assert_true(value_copy(&copy, &context, &status));
+    assert_true(lookup_cstr(&copy, "name", &field, &status));
+    assert_string_equal(value_string_data(&field), "Alice");
+    assert_int_equal(source.calls, 1);
+
+    /* Misses are remembered too */
+    assert_false(lookup_cstr(&context, "missing", &field, &status));
+    assert_true(status_match(&status, "value", VALUE_KEY_NOT_FOUND));
+    assert_false(lookup_cstr(&context, "missing", &field, &status));
+    assert_true(status_match(&status, "value", VALUE_KEY_NOT_FOUND));
+    assert_int_equal(source.calls, 2);
+
+    /* Other failures aren't, and are passed through */
+    assert_false(lookup_cstr(&context, "broken", &field, &status));
+    assert_true(status_match(&status, "test", 1));
+    assert_false(lookup_cstr(&context, "broken", &field, &status));
+    assert_int_equal(source.calls, 4);
+
+    assert_true(lookup_cstr(&context, "address", &address, &status));
+    assert_int_equal(address.type, VALUE_PROVIDER);
+    assert_true(lookup_cstr(&address, "name", &field, &status));
+    assert_int_equal(source.calls, 6);
+
+    assert_false(value_index(&context, 0, &field, &status));
+    assert_true(status_match(&status, "value", VALUE_INVALID_TYPE));
+
+    /* Clearing starts a new render */
+    value_clear(&context);
+    assert_true(lookup_cstr(&copy, "name", &field, &status));
+    assert_int_equal(source.calls, 7);
+
+    value_free(&field);
+    value_free(&address);
+    value_free(&copy);
+    value_free(&context);
+}
+
+/* vi: set et ts=4 sw=4: */
@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <setjmp.h>
+#include <pthread.h>
+
+#include <cbase.h>
+
+#include <cmocka.h>
+
+#include "lang.h"
+#include "value.h"
+#include "json.h"
+#include "function.h"
+#include "expression.h"
+#include "expression_evaluator.h"
+#include "template.h"
+#include "render_pool.h"
+
+#define JOB_COUNT 203
+
+static const char *PEOPLE_CONTEXT =
+    "{\"people\": [{\"name\": \"Al\", \"age\": 40}, "
+                  "{\"name\": \"Bo\", \"age\": 12}]}";
+
+static const char *TOTAL_CONTEXT = "{\"prices\": [1.5, 2.25, 3]}";
+
+static void parse(Template *t, const char *input) {
+    String template_input;
+    Status status;
+
+    status_init(&status);
+
+    assert_true(string_init(&template_input, input, &status));
+    assert_true(template_parse_data(t, &template_input, &status));
+    string_free(&template_input);
+}
+
+static void render_batch(RenderPool *pool, RenderJob *jobs) {
+    Status status;
+
+    status_init(&status);
+
+    assert_true(render_pool_render(pool, jobs, JOB_COUNT, &status));
+
+    for (size_t i = 0; i < JOB_COUNT; i++) {
+        RenderJob *job = &jobs[i];
+
+        if ((i % 50) == 49) {
+            assert_false(job->ok);
+            assert_true(status_match(&job->status, "value",
+                                                   VALUE_KEY_NOT_FOUND));
+        }
+        else if ((i % 2) == 0) {
+            assert_true(job->ok);
+            assert_string_equal(job->output->data, "Al 40; Bo 12; ");
+        }
+        else {
+            assert_true(job->ok);
+            assert_string_equal(job->output->data, "1.5+2.25+3+");
+        }
+    }
+}
+
+void test_render_pool(void **state) {
+    FunctionRegistry functions;
+    DecimalContext ctx;
+    Template people;
+    Template total;
+    Template broken;
+    Value people_context;
+    Value total_context;
+    RenderPool pool;
+    RenderJob jobs[JOB_COUNT];
+    String outputs[JOB_COUNT];
+    Status status;
+
+    (void)state;
+
+    status_init(&status);
+    decimal_context_set_max(&ctx);
+
+    assert_true(function_registry_init(&functions, &status));
+    assert_true(json_load_data(&people_context, PEOPLE_CONTEXT,
+                                                strlen(PEOPLE_CONTEXT),
+                                                &ctx,
+                                                &status));
+    assert_true(json_load_data(&total_context, TOTAL_CONTEXT,
+                                               strlen(TOTAL_CONTEXT),
+                                               &ctx,
+                                               &status));
+
+    assert_true(template_init(&people, &functions, &status));
+    assert_true(template_init(&total, &functions, &status));
+    assert_true(template_init(&broken, &functions, &status));
+    parse(&people, "{{ for p in people }}{{ p.name }} {{ p.age }}; "
+                   "{{ endfor }}");
+    parse(&total, "{{ for price in prices }}{{ price }}+{{ endfor }}");
+    parse(&broken, "{{ for p in people }}{{ missing }}{{ endfor }}");
+
+    for (size_t i = 0; i < JOB_COUNT; i++) {
+        assert_true(string_init(&outputs[i], "", &status));
+
+        jobs[i].output = &outputs[i];
+
+        if ((i % 50) == 49) {
+            jobs[i].template = &broken;
+            jobs[i].context = &people_context;
+        }
+        else if ((i % 2) == 0) {
+            jobs[i].template = &people;
+            jobs[i].context = &people_context;
+        }
+        else {
+            jobs[i].template = &total;
+            jobs[i].context = &total_context;
+        }
+    }
+
+    /* Workers and their evaluators are reused from batch to batch */
+    assert_true(render_pool_init(&pool, 4, &status));
+    render_batch(&pool, jobs);
+    render_batch(&pool, jobs);
+    assert_true(render_pool_render(&pool, jobs, 0, &status));
+    render_pool_free(&pool);
+
+    /* More workers than jobs leaves some with nothing but stealing to do */
+    assert_true(render_pool_init(&pool, JOB_COUNT + 5, &status));
+    render_batch(&pool, jobs);
+    render_pool_free(&pool);
+
+    for (size_t i = 0; i < JOB_COUNT; i++) {
+        string_free(&outputs[i]);
+    }
+
+    template_free(&people);
+    template_free(&total);
+    template_free(&broken);
+    value_free(&people_context);
+    value_free(&total_context);
+    function_registry_free(&functions);
+}
+
+/* vi: set et ts=4 sw=4: */
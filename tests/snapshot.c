@@ -0,0 +1,283 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <setjmp.h>
+#include <unistd.h>
+
+#include <cbase.h>
+
+#include <cmocka.h>
+
+#include "lang.h"
+#include "value.h"
+#include "json.h"
+#include "snapshot.h"
+#include "function.h"
+#include "expression.h"
+#include "expression_evaluator.h"
+#include "template.h"
+
+#include "data.h"
+
+#define ORDERED_CONTEXT \
+"{\"t\": {\"zed\": 1, \"al\": 2, \"mo\": 3, \"bo\": 4, \"yu\": 5, " \
+"\"cy\": 6, \"xi\": 7, \"di\": 8}}"
+
+#define ORDERED_OUTPUT "zed1al2mo3bo4yu5cy6xi7di8"
+
+static void render(Value *context, const char *expected) {
+    FunctionRegistry functions;
+    Template t;
+    String input;
+    String output;
+    Status status;
+
+    status_init(&status);
+
+    assert_true(function_registry_init(&functions, &status));
+    assert_true(template_init(&t, &functions, &status));
+    assert_true(string_init(&input, "{{ for k, v in t }}{{ k }}{{ v }}"
+                                    "{{ endfor }}",
+                                    &status));
+    assert_true(string_init(&output, "", &status));
+    assert_true(template_render_data(&t, &input, context, &output,
+                                                          &status));
+    assert_string_equal(output.data, expected);
+
+    string_free(&input);
+    string_free(&output);
+    template_free(&t);
+    function_registry_free(&functions);
+}
+
+static void lookup_cstr(Value *value, const char *key, Value *element) {
+    SSlice ss;
+    Status status;
+
+    ss.data = key;
+    ss.len = strlen(key);
+    ss.byte_len = ss.len;
+
+    assert_true(value_lookup(value, &ss, element, &status));
+}
+
+static void lookup_cstr_fails(Value *value, const char *key) {
+    Value element;
+    SSlice ss;
+    Status status;
+
+    ss.data = key;
+    ss.len = strlen(key);
+    ss.byte_len = ss.len;
+
+    status_init(&status);
+
+    assert_false(value_lookup(value, &ss, &element, &status));
+    assert_true(status_match(&status, "snapshot", SNAPSHOT_INVALID_FORMAT));
+}
+
+static void save_json(char *path, const char *json) {
+    Value value;
+    DecimalContext ctx;
+    Status status;
+    int fd = mkstemp(path);
+
+    status_init(&status);
+    decimal_context_set_max(&ctx);
+
+    assert_int_not_equal(fd, -1);
+    close(fd);
+
+    assert_true(json_load_data(&value, json, strlen(json), &ctx, &status));
+    assert_true(snapshot_save(&value, path, &status));
+    value_free(&value);
+}
+
+/* Overwrites the 64-bit field at `field` in the root node */
+static void corrupt_root(const char *path, size_t field, uint64_t value) {
+    SnapshotHeader header;
+    FILE *file = fopen(path, "r+b");
+
+    assert_non_null(file);
+    assert_int_equal(fread(&header, sizeof(header), 1, file), 1);
+    assert_int_equal(fseek(file, (long)(header.root + field), SEEK_SET), 0);
+    assert_int_equal(fwrite(&value, sizeof(value), 1, file), 1);
+    fclose(file);
+}
+
+static void test_corrupted(void) {
+    char path[] = "/tmp/sst_test_snapshot_XXXXXX";
+    char array_path[] = "/tmp/sst_test_snapshot_XXXXXX";
+    char string_path[] = "/tmp/sst_test_snapshot_XXXXXX";
+    char number_path[] = "/tmp/sst_test_snapshot_XXXXXX";
+    Value loaded;
+    Value element;
+    Status status;
+
+    status_init(&status);
+
+    /*
+     * Counts chosen so the node sizes they imply wrap around to something
+     * that would fit in the file
+     */
+    save_json(path, "{\"a\": 1}");
+    corrupt_root(path, offsetof(SnapshotTable, count),
+                       (UINT64_MAX / (sizeof(SnapshotTableEntry) +
+                                      sizeof(uint64_t))) + 1);
+    assert_true(snapshot_load(&loaded, path, &status));
+    unlink(path);
+    lookup_cstr_fails(&loaded, "a");
+    assert_false(snapshot_value_materialize(&loaded, &status));
+    assert_true(status_match(&status, "snapshot", SNAPSHOT_INVALID_FORMAT));
+    value_free(&loaded);
+
+    save_json(array_path, "[1, 2]");
+    corrupt_root(array_path, offsetof(SnapshotArray, count),
+                             (UINT64_MAX / sizeof(uint64_t)) + 1);
+    assert_true(snapshot_load(&loaded, array_path, &status));
+    unlink(array_path);
+    assert_false(value_index(&loaded, 0, &element, &status));
+    assert_true(status_match(&status, "snapshot", SNAPSHOT_INVALID_FORMAT));
+    value_free(&loaded);
+
+    save_json(string_path, "\"abc\"");
+    corrupt_root(string_path, offsetof(SnapshotString, byte_len), UINT64_MAX);
+    assert_false(snapshot_load(&loaded, string_path, &status));
+    assert_true(status_match(&status, "snapshot", SNAPSHOT_INVALID_FORMAT));
+    unlink(string_path);
+
+    /* One word can't hold 40 digits */
+    save_json(number_path, "12");
+    corrupt_root(number_path, offsetof(SnapshotNumber, digits), 40);
+    assert_false(snapshot_load(&loaded, number_path, &status));
+    assert_true(status_match(&status, "snapshot", SNAPSHOT_INVALID_FORMAT));
+    unlink(number_path);
+}
+
+void test_snapshot(void **state) {
+    Value context;
+    Value loaded;
+    Value people;
+    Value person;
+    Value field;
+    Value *slot = NULL;
+    SSlice key;
+    char path[] = "/tmp/sst_test_snapshot_XXXXXX";
+    char ordered_path[] = "/tmp/sst_test_snapshot_XXXXXX";
+    char *s = NULL;
+    size_t length = 0;
+    int fd = -1;
+    Status status;
+    DecimalContext ctx;
+
+    (void)state;
+
+    status_init(&status);
+
+    decimal_context_set_max(&ctx);
+
+    loaded.type = VALUE_NONE;
+    people.type = VALUE_NONE;
+    person.type = VALUE_NONE;
+    field.type = VALUE_NONE;
+
+    fd = mkstemp(path);
+    assert_int_not_equal(fd, -1);
+    close(fd);
+
+    /* Saving a lazy context writes it out in full */
+    assert_true(json_load_lazy_data(&context, JSON_CONTEXT,
+                                              strlen(JSON_CONTEXT),
+                                              &ctx,
+                                              &status));
+    assert_true(snapshot_save(&context, path, &status));
+    value_free(&context);
+
+    assert_true(snapshot_load(&loaded, path, &status));
+    unlink(path);
+
+    assert_int_equal(loaded.type, VALUE_SNAPSHOT);
+    assert_true(value_length(&loaded, &length, &status));
+    assert_int_equal(length, 3);
+
+    lookup_cstr(&loaded, "tax_rate", &field);
+    assert_int_equal(field.type, VALUE_NUMBER);
+    assert_true(value_to_cstr(&field, &s, &status));
+    assert_string_equal(s, "0.25");
+    free(s);
+
+    lookup_cstr(&loaded, "people", &people);
+    assert_int_equal(people.type, VALUE_SNAPSHOT);
+    assert_true(value_length(&people, &length, &status));
+    assert_int_equal(length, 3);
+
+    assert_true(value_index(&people, 0, &person, &status));
+    lookup_cstr(&person, "name", &field);
+    assert_string_equal(value_string_data(&field), "Alice");
+    lookup_cstr(&person, "income", &field);
+    assert_true(value_to_cstr(&field, &s, &status));
+    assert_string_equal(s, "1.2E+5");
+    free(s);
+
+    assert_true(value_index(&people, 2, &person, &status));
+    lookup_cstr(&person, "name", &field);
+    assert_int_equal(field.type, VALUE_NONE);
+    lookup_cstr(&person, "registered", &field);
+    assert_int_equal(field.type, VALUE_BOOLEAN);
+    assert_false(field.as.boolean);
+
+    assert_false(value_index(&people, 3, &person, &status));
+
+    key.data = "missing";
+    key.len = 7;
+    key.byte_len = 7;
+
+    assert_false(value_lookup(&person, &key, &field, &status));
+    assert_true(status_match(&status, "value", VALUE_KEY_NOT_FOUND));
+
+    /* Snapshots are read-only; writing makes a private table */
+    assert_true(value_table_insert(&person, &key, &slot, &status));
+    value_init_boolean(slot, true);
+    assert_int_equal(person.type, VALUE_TABLE);
+    assert_true(value_length(&person, &length, &status));
+    assert_int_equal(length, 4);
+
+    /* The mapping outlives the root value while anything still uses it */
+    value_free(&loaded);
+    assert_true(value_index(&people, 1, &person, &status));
+    lookup_cstr(&person, "age", &field);
+    assert_int_equal(field.type, VALUE_NUMBER);
+
+    value_free(&field);
+    value_free(&person);
+    value_free(&people);
+
+    /* Tables keep their order through a snapshot */
+    fd = mkstemp(ordered_path);
+    assert_int_not_equal(fd, -1);
+    close(fd);
+
+    assert_true(json_load_data(&context, ORDERED_CONTEXT,
+                                         strlen(ORDERED_CONTEXT),
+                                         &ctx,
+                                         &status));
+    render(&context, ORDERED_OUTPUT);
+    assert_true(snapshot_save(&context, ordered_path, &status));
+    value_free(&context);
+
+    assert_true(snapshot_load(&loaded, ordered_path, &status));
+    unlink(ordered_path);
+    render(&loaded, ORDERED_OUTPUT);
+
+    lookup_cstr(&loaded, "t", &field);
+    assert_true(value_table_insert(&field, &key, &slot, &status));
+    value_init_boolean(slot, true);
+    assert_int_equal(field.type, VALUE_TABLE);
+    assert_true(field.as.table->ordered);
+
+    value_free(&field);
+    value_free(&loaded);
+
+    test_corrupted();
+}
+
+/* vi: set et ts=4 sw=4: */
@@ -0,0 +1,569 @@
+#include <stdio.h>
+#include <setjmp.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <cbase.h>
+
+#include <cmocka.h>
+
+#include "lang.h"
+#include "value.h"
+#include "json.h"
+#include "function.h"
+#include "expression.h"
+#include "expression_evaluator.h"
+#include "template.h"
+#include "render_pool.h"
+
+#include "data.h"
+
+#define FIBS_CONTEXT "{\"fibs\": [1, 1, 2, 3, 5, 8, 13]}"
+
+#define SCORES_CONTEXT \
+"{\"scores\": {\"zoe\": 3, \"al\": 10, \"mo\": 7, \"al\": 1}, \"n\": 2}"
+
+#define LARGE_ARRAY_LENGTH 50000
+
+static size_t upper_calls = 0;
+
+static bool fn_double(Value *result, Value *arguments, DecimalContext *ctx,
+                                                       Status *status) {
+    return value_add(result, &arguments[0], &arguments[0], ctx, status);
+}
+
+static bool fn_min(Value *result, Value *arguments, DecimalContext *ctx,
+                                                    Status *status) {
+    int cmp = 0;
+
+    (void)ctx;
+
+    if (!value_compare(&arguments[0], &arguments[1], &cmp, status)) {
+        return false;
+    }
+
+    return value_copy(result, cmp <= 0 ? &arguments[0] : &arguments[1],
+                              status);
+}
+
+static bool fn_max(Value *result, Value *arguments, DecimalContext *ctx,
+                                                    Status *status) {
+    int cmp = 0;
+
+    (void)ctx;
+
+    if (!value_compare(&arguments[0], &arguments[1], &cmp, status)) {
+        return false;
+    }
+
+    return value_copy(result, cmp >= 0 ? &arguments[0] : &arguments[1],
+                              status);
+}
+
+static bool fn_upper(Value *result, Value *arguments, DecimalContext *ctx,
+                                                      Status *status) {
+    char *s = NULL;
+    bool ok = false;
+
+    (void)ctx;
+
+    __atomic_add_fetch(&upper_calls, 1, __ATOMIC_RELAXED);
+
+    if (!value_to_cstr(&arguments[0], &s, status)) {
+        return false;
+    }
+
+    for (char *c = s; *c; c++) {
+        *c = toupper((unsigned char)*c);
+    }
+
+    ok = value_init_string(result, s, status);
+
+    free(s);
+
+    return ok;
+}
+
+static void render(Template *t, const char *input, Value *context,
+                                                   String *output) {
+    String template_input;
+    Status status;
+
+    status_init(&status);
+
+    assert_true(string_init(&template_input, input, &status));
+    assert_true(template_parse_data(t, &template_input, &status));
+    string_free(&template_input);
+
+    string_clear(output);
+    assert_true(template_render(t, context, output, &status));
+}
+
+static void compile_fails(Template *t, const char *input, const char *domain,
+                                                          int code) {
+    String template_input;
+    Status status;
+
+    status_init(&status);
+
+    assert_true(string_init(&template_input, input, &status));
+    assert_false(template_parse_data(t, &template_input, &status));
+    assert_true(status_match(&status, domain, code));
+    string_free(&template_input);
+}
+
+static void render_fails(Template *t, const char *input, Value *context,
+                                                         const char *domain,
+                                                         int code) {
+    String template_input;
+    String output;
+    Status status;
+
+    status_init(&status);
+
+    assert_true(string_init(&template_input, input, &status));
+    assert_true(string_init(&output, "", &status));
+    assert_true(template_parse_data(t, &template_input, &status));
+    assert_false(template_render(t, context, &output, &status));
+    assert_true(status_match(&status, domain, code));
+    string_free(&template_input);
+    string_free(&output);
+}
+
+void test_template(void **state) {
+    char path[] = "/tmp/sst_test_template_XXXXXX";
+    char include[64];
+    char element[32];
+    FunctionRegistry functions;
+    ExpressionEvaluator evaluator;
+    DecimalContext ctx;
+    RenderPool pool;
+    RenderJob job;
+    FunctionEntry *function = NULL;
+    Template t;
+    Value context;
+    Value fibs;
+    Value scores;
+    Value argument;
+    Value *table = NULL;
+    Value *slot = NULL;
+    SSlice key;
+    String output;
+    String data;
+    String expected;
+    Status status;
+    FILE *include_file = NULL;
+    int fd = -1;
+
+    (void)state;
+
+    status_init(&status);
+
+    decimal_context_set_max(&ctx);
+
+    context.type = VALUE_NONE;
+    fibs.type = VALUE_NONE;
+    scores.type = VALUE_NONE;
+
+    assert_true(function_registry_init(&functions, &status));
+    assert_true(function_registry_add(&functions, "double", 1, "n",
+                                                               fn_double,
+                                                               &status));
+    assert_true(function_registry_add(&functions, "min", 2, "nn", fn_min,
+                                                                  &status));
+    assert_true(function_registry_add(&functions, "max", 2, "nn", fn_max,
+                                                                  &status));
+    assert_true(function_registry_add_pure(&functions, "upper", 1, "s",
+                                                                   fn_upper,
+                                                                   &status));
+    assert_false(function_registry_add(&functions, "upper", 1, "s",
+                                                               fn_upper,
+                                                               &status));
+    assert_true(status_match(&status, "function",
+                                      FUNCTION_ALREADY_REGISTERED));
+    assert_false(function_registry_add(&functions, "broken", 2, "n",
+                                                                fn_double,
+                                                                &status));
+    assert_true(status_match(&status, "function",
+                                      FUNCTION_INVALID_ARGUMENT_TYPES));
+
+    assert_true(json_load_data(&context, JSON_CONTEXT, strlen(JSON_CONTEXT),
+                                                       &ctx,
+                                                       &status));
+    assert_true(json_load_data(&fibs, FIBS_CONTEXT, strlen(FIBS_CONTEXT),
+                                                    &ctx,
+                                                    &status));
+
+    assert_true(template_init(&t, &functions, &status));
+    assert_true(string_init(&output, "", &status));
+
+    render(&t, EXPRESSION_TEMPLATE, &context, &output);
+    assert_string_equal(output.data, EXPRESSION_ANSWER);
+
+    render(
+        &t,
+        "{{ for person in people }}"
+            "{{ if person.age >= 18 }}"
+                "{{ upper(person.name) }} votes"
+            "{{ else if person.age >= 16 }}"
+                "{{ person.age }} nearly"
+            "{{ else }}"
+                "{{ continue }}"
+            "{{ endif }};"
+        "{{ endfor }}",
+        &context,
+        &output
+    );
+    assert_string_equal(output.data, "ALICE votes;17 nearly;");
+
+    render(
+        &t,
+        "{{ for fib in [1, 2, 3, 4, 5, 4 + 4] }}"
+            "{{ if fib == 4 }}{{ break }}{{ endif }}"
+            "{{ double(fib) }}/{{ fibs[min(6, max(0, fib + 2))] }},"
+        "{{ endfor }}"
+        "{{ for fib in [] }}never{{ endfor }}done",
+        &fibs,
+        &output
+    );
+    assert_string_equal(output.data, "2/3,4/5,6/8,done");
+
+    /* Loop variables live in frame slots, shadowing context keys */
+    render(
+        &t,
+        "{{ for tax_rate in [1, 2] }}{{ tax_rate }}{{ endfor }} "
+        "{{ tax_rate }} "
+        "{{ for xs in [[1, 2], [3]] }}"
+            "{{ for x in xs }}{{ x }}{{ endfor }};"
+        "{{ endfor }} "
+        "{{ for a in [1] }}{{ a }}{{ endfor }}"
+        "{{ for b in [2] }}{{ b }}{{ endfor }}",
+        &context,
+        &output
+    );
+    assert_string_equal(output.data, "12 0.25 12;3; 12");
+    render_fails(&t, "{{ for x in [1] }}{{ endfor }}{{ x }}",
+                     &context,
+                     "value",
+                     VALUE_KEY_NOT_FOUND);
+
+    render(
+        &t,
+        "{{ for fib in fibs }}"
+            "{{ if loop.first }}[{{ endif }}"
+            "{{ if loop.index % 2 == 1 }}-{{ endif }}{{ fib }}"
+            "{{ if loop.last }}]/{{ loop.length }}"
+            "{{ else }}, {{ endif }}"
+        "{{ endfor }} "
+        "{{ for a in [1, 2] }}"
+            "{{ for k, v in [3, 4, 5] }}{{ loop.index }}{{ endfor }}"
+            "{{ loop.index }};"
+        "{{ endfor }}",
+        &fibs,
+        &output
+    );
+    assert_string_equal(output.data, "[1, -1, 2, -3, 5, -8, 13]/7 0120;0121;");
+
+    /* Tables iterate in place, JSON objects in document order */
+    render(&t, "{{ for i, fib in fibs }}{{ i }}:{{ fib }} {{ endfor }}",
+               &fibs,
+               &output);
+    assert_string_equal(output.data, "0:1 1:1 2:2 3:3 4:5 5:8 6:13 ");
+
+    assert_true(json_load_data(&scores, SCORES_CONTEXT,
+                                        strlen(SCORES_CONTEXT),
+                                        &ctx,
+                                        &status));
+    render(
+        &t,
+        "{{ for name in scores }}{{ name }} {{ endfor }}"
+        "{{ for name, score in scores }}"
+            "{{ if score == n }}{{ break }}{{ endif }}"
+            "{{ for i, c in [name] }}{{ c }}{{ endfor }}={{ score }},"
+        "{{ endfor }}"
+        "{{ for k, v in scores }}{{ continue }}{{ endfor }}",
+        &scores,
+        &output
+    );
+    assert_string_equal(output.data, "zoe al mo zoe=3,al=1,mo=7,");
+    value_free(&scores);
+
+    assert_true(json_load_lazy_data(&scores, SCORES_CONTEXT,
+                                             strlen(SCORES_CONTEXT),
+                                             &ctx,
+                                             &status));
+    render(&t, "{{ for name, score in scores }}{{ name }}{{ score }}"
+               "{{ endfor }}",
+               &scores,
+               &output);
+    assert_string_equal(output.data, "zoe3al1mo7");
+    value_free(&scores);
+
+    /* Loops over lazy arrays step through them rather than rescanning */
+    assert_true(string_init(&data, "{\"xs\": [", &status));
+    assert_true(string_init(&expected, "", &status));
+
+    for (size_t i = 0; i < LARGE_ARRAY_LENGTH; i++) {
+        snprintf(element, sizeof(element), "%s{\"a\": [%zu]}",
+                                           i > 0 ? ", " : "",
+                                           i % 10);
+        assert_true(string_append_cstr(&data, element, &status));
+        snprintf(element, sizeof(element), "%zu", i % 10);
+        assert_true(string_append_cstr(&expected, element, &status));
+    }
+
+    assert_true(string_append_cstr(&data, "]}", &status));
+    assert_true(json_load_lazy_data(&scores, data.data, data.byte_len,
+                                                        &ctx,
+                                                        &status));
+    render(&t, "{{ for x in xs }}{{ x.a[0] }}{{ endfor }}", &scores,
+                                                            &output);
+    assert_string_equal(output.data, expected.data);
+    render(&t, "{{ for i, x in xs }}{{ x.a[0] }}{{ endfor }}", &scores,
+                                                               &output);
+    assert_string_equal(output.data, expected.data);
+    value_free(&scores);
+    string_free(&expected);
+    string_free(&data);
+
+    /* Unordered tables iterate in hash order */
+    key.data = "t";
+    key.len = 1;
+    key.byte_len = 1;
+    assert_true(value_init_table(&scores, &status));
+    assert_true(value_table_insert(&scores, &key, &table, &status));
+    assert_true(value_init_table(table, &status));
+
+    for (const char *k = "abc"; *k; k++) {
+        key.data = k;
+        assert_true(value_table_insert(table, &key, &slot, &status));
+        value_init_boolean(slot, true);
+    }
+
+    render(&t, "{{ for k, v in t }}{{ if v }}x{{ endif }}{{ endfor }}",
+               &scores,
+               &output);
+    assert_string_equal(output.data, "xxx");
+    value_free(&scores);
+
+    /* Loops without breaks or impure calls can be split between threads */
+    assert_true(render_pool_init(&pool, 3, &status));
+    template_set_parallel(&t, &pool, 2);
+    render(
+        &t,
+        "{{ for i, fib in fibs }}"
+            "{{ if fib == 2 }}{{ continue }}{{ endif }}"
+            "{{ loop.index }}{{ upper('x') }}"
+            "{{ for c in [fib] }}{{ c }}{{ endfor }},"
+        "{{ endfor }}",
+        &fibs,
+        &output
+    );
+    assert_true(((TemplateNode *)array_index_fast(&t.nodes, 0))->parallel);
+    assert_string_equal(output.data, "0X1,1X1,3X3,4X5,5X8,6X13,");
+
+    render(&t, "{{ for fib in fibs }}{{ double(fib) }}{{ endfor }}",
+               &fibs,
+               &output);
+    assert_false(((TemplateNode *)array_index_fast(&t.nodes, 0))->parallel);
+    assert_string_equal(output.data, "2246101626");
+
+    render(&t, "{{ for fib in fibs }}{{ if fib == 3 }}{{ break }}{{ endif }}"
+               "{{ fib }}{{ endfor }}",
+               &fibs,
+               &output);
+    assert_false(((TemplateNode *)array_index_fast(&t.nodes, 0))->parallel);
+    assert_string_equal(output.data, "112");
+
+    assert_true(json_load_data(&scores, SCORES_CONTEXT,
+                                        strlen(SCORES_CONTEXT),
+                                        &ctx,
+                                        &status));
+    render(&t, "{{ for name, score in scores }}{{ name }}{{ score }}"
+               "{{ endfor }}",
+               &scores,
+               &output);
+    assert_string_equal(output.data, "zoe3al1mo7");
+    value_free(&scores);
+
+    render_fails(&t, "{{ for fib in fibs }}{{ if fib == 8 }}{{ x }}{{ endif }}"
+                     "{{ endfor }}",
+                     &fibs,
+                     "value",
+                     VALUE_KEY_NOT_FOUND);
+
+    /* Rendered by one of the pool's own workers, loops are serial */
+    render(&t, "{{ for fib in fibs }}{{ fib }}{{ endfor }}", &fibs,
+                                                              &output);
+    assert_string_equal(output.data, "11235813");
+    job.template = &t;
+    job.context = &fibs;
+    job.output = &output;
+    assert_true(render_pool_render(&pool, &job, 1, &status));
+    assert_true(job.ok);
+    assert_string_equal(output.data, "11235813");
+
+    template_set_parallel(&t, NULL, 0);
+    render_pool_free(&pool);
+
+    /* Included templates are compiled in place */
+    fd = mkstemp(path);
+    assert_int_not_equal(fd, -1);
+    include_file = fdopen(fd, "w");
+    assert_non_null(include_file);
+    fputs("[{{ double(fib) }}]", include_file);
+    fclose(include_file);
+
+    snprintf(include, sizeof(include), "{{ include '%s' }}", path);
+
+    assert_true(string_assign(&output, "{{ for fib in fibs }}", &status));
+    assert_true(string_append_cstr(&output, include, &status));
+    assert_true(string_append_cstr(&output, "{{ if fib > 2 }}{{ break }}"
+                                            "{{ endif }}{{ endfor }}",
+                                            &status));
+    assert_true(template_parse_data(&t, &output, &status));
+    unlink(path);
+
+    string_clear(&output);
+    assert_true(template_render(&t, &fibs, &output, &status));
+    assert_string_equal(output.data, "[2][2][4][6]");
+
+    /* Repeated pure calls are answered from the per-render memo */
+    assert_true(expression_evaluator_init(&evaluator, &status));
+    assert_true(string_assign(
+        &output,
+        "{{ for person in people }}"
+            "{{ upper(message) }}{{ upper('x') }}{{ double(2) }}"
+        "{{ endfor }}",
+        &status
+    ));
+    assert_true(template_parse_data(&t, &output, &status));
+
+    upper_calls = 0;
+
+    for (size_t i = 1; i <= 2; i++) {
+        string_clear(&output);
+        assert_true(template_render_with_evaluator(&t, &evaluator,
+                                                       &context,
+                                                       &output,
+                                                       &status));
+        assert_int_equal(upper_calls, 2 * i);
+        assert_int_equal(evaluator.memo_misses, 2);
+        assert_int_equal(evaluator.memo_hits, 4);
+    }
+
+    assert_string_equal(output.data, "ESCAPES: \"\t/\nX4"
+                                     "ESCAPES: \"\t/\nX4"
+                                     "ESCAPES: \"\t/\nX4");
+
+    /* Pure functions can opt out of the memo */
+    assert_true(function_registry_set_memoized(&functions, "upper", false,
+                                                                    &status));
+    upper_calls = 0;
+    string_clear(&output);
+    assert_true(template_render_with_evaluator(&t, &evaluator, &context,
+                                                               &output,
+                                                               &status));
+    assert_int_equal(upper_calls, 6);
+    assert_int_equal(evaluator.memo_misses, 0);
+    assert_int_equal(evaluator.memo_hits, 0);
+    assert_true(function_registry_set_memoized(&functions, "upper", true,
+                                                                   &status));
+    assert_false(function_registry_set_memoized(&functions, "missing",
+                                                            true,
+                                                            &status));
+
+    /* The memo holds a fixed number of calls, later ones replacing earlier */
+    key.data = "upper";
+    key.len = 5;
+    key.byte_len = 5;
+    assert_true(function_registry_lookup(&functions, &key, &function,
+                                                           &status));
+    expression_evaluator_reset_memo(&evaluator);
+
+    for (size_t i = 0; i < (EXPRESSION_EVALUATOR_MEMO_SIZE * 4); i++) {
+        for (size_t j = 0; j < 2; j++) {
+            snprintf(element, sizeof(element), "x%zu", i);
+            assert_true(value_init_string(&argument, element, &status));
+            assert_true(expression_evaluator_call(&evaluator, function,
+                                                              &argument,
+                                                              &status));
+            snprintf(element, sizeof(element), "X%zu", i);
+            assert_string_equal(value_string_data(&argument), element);
+            value_free(&argument);
+        }
+    }
+
+    assert_int_equal(evaluator.memo_misses,
+                     EXPRESSION_EVALUATOR_MEMO_SIZE * 4);
+    assert_int_equal(evaluator.memo_hits, EXPRESSION_EVALUATOR_MEMO_SIZE * 4);
+    expression_evaluator_free(&evaluator);
+
+    /* Trim markers eat whitespace on their side of the tag */
+    render(&t, "<ul>\n  {{- for fib in [1, 2] -}}\n  <li>{{ fib }}</li>\n"
+               "{{- endfor }}\n</ul>",
+               &context,
+               &output);
+    assert_string_equal(output.data, "<ul><li>1</li><li>2</li>\n</ul>");
+
+    /* Lines holding only block tags are left out */
+    template_set_trim_blocks(&t, true);
+    render(&t, "  {{ for fib in [1, 2, 3] }}\n"
+               "    {{ if fib == 2 }}{{ continue }}{{ endif }}\n"
+               "    <li>{{ fib }}</li>\n"
+               "  {{ endfor }}\n"
+               "{{ if 1 == 1 }}x{{ endif }}\n"
+               "  {{ for fib in [] }}\n"
+               "  {{ endfor }}",
+               &fibs,
+               &output);
+    assert_string_equal(output.data, "    <li>1</li>\n"
+                                     "    <li>3</li>\n"
+                                     "x\n");
+    template_set_trim_blocks(&t, false);
+
+    /* Adjacent text is merged, but not across jump targets */
+    render(&t, "a{{ raw }}b{{ endraw }}c", &context, &output);
+    assert_string_equal(output.data, "abc");
+    assert_int_equal(t.nodes.len, 1);
+    render(&t, "a{{ raw }}b{{ endraw }}{{ if 1 == 2 }}c{{ endif }}d",
+               &context,
+               &output);
+    assert_string_equal(output.data, "abd");
+    assert_int_equal(t.nodes.len, 4);
+
+    compile_fails(&t, "{{ missing(1) }}", "expression",
+                                          EXPRESSION_UNKNOWN_FUNCTION);
+    compile_fails(&t, "{{ double(1, 2) }}",
+                      "expression",
+                      EXPRESSION_WRONG_NUMBER_OF_ARGUMENTS);
+    compile_fails(
+        &t,
+        "{{ if 1 == 1 }}{{ for x in people }}{{ endif }}{{ endfor }}",
+        "template",
+        TEMPLATE_MISMATCHED_BLOCK_END
+    );
+    compile_fails(&t, "{{ if 1 == 1 }}open", "template",
+                                             TEMPLATE_UNTERMINATED_BLOCK);
+
+    render_fails(&t, "{{ double('two') }}", &context,
+                                            "function",
+                                            FUNCTION_WRONG_ARGUMENT_TYPE);
+    render_fails(&t, "{{ if tax_rate }}x{{ endif }}",
+                     &context,
+                     "template",
+                     TEMPLATE_NON_BOOLEAN_CONDITIONAL);
+    render_fails(&t, "{{ for c in tax_rate }}x{{ endfor }}",
+                     &context,
+                     "template",
+                     TEMPLATE_NON_ITERABLE_EXPRESSION);
+
+    string_free(&output);
+    template_free(&t);
+    value_free(&context);
+    value_free(&fibs);
+    function_registry_free(&functions);
+}
+
+/* vi: set et ts=4 sw=4: */
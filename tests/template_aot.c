@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <setjmp.h>
+
+#include <cbase.h>
+
+#include <cmocka.h>
+
+#include "lang.h"
+#include "value.h"
+#include "json.h"
+#include "function.h"
+#include "expression.h"
+#include "expression_evaluator.h"
+#include "template.h"
+#include "template_aot.h"
+#include "builtins.h"
+
+/* Generated from template_aot.txt at build time */
+TEMPLATE_AOT_DECLARE(test_page);
+
+#define ITEMS_CONTEXT                                                     \
+    "{\"title\": \"shop\", \"total\": 12345.678, \"nums\": [4, 5], "     \
+    "\"items\": [{\"name\": \"a\", \"price\": 1.5, \"quantity\": 2}, "   \
+                "{\"name\": \"b\", \"price\": 2, \"quantity\": 7}, "     \
+                "{\"name\": \"c\", \"price\": 3, \"quantity\": 10}, "    \
+                "{\"name\": \"d\", \"price\": 3, \"quantity\": 1}]}"
+
+#define ITEMS_OUTPUT                                                      \
+    "<h1>SHOP</h1>\n<ul>\n"                                               \
+    "<li class=\"even\">0 a: 3.0[2][2]!</li>\n"                           \
+    "<li class=\"odd\">1 b: 14[7]!</li>\n"                                \
+    "<li class=\"even\">2 c: 30[10]"                                      \
+    "<li class=\"last\">3 d: 3[1][2]!</li>\n"                             \
+    "</ul>\n123 12,345.68 4 5\n"
+
+static void load(Value *context, const char *data) {
+    DecimalContext ctx;
+    Status status;
+
+    status_init(&status);
+
+    decimal_context_set_max(&ctx);
+
+    assert_true(json_load_data(context, data, strlen(data), &ctx, &status));
+}
+
+void test_template_aot(void **state) {
+    FunctionRegistry functions;
+    ExpressionEvaluator evaluator;
+    FunctionEntry *entry = NULL;
+    Template t;
+    Value context;
+    String input;
+    String output;
+    Status status;
+
+    (void)state;
+
+    status_init(&status);
+
+    assert_true(function_registry_init(&functions, &status));
+    assert_true(builtins_register(&functions, &status));
+    assert_true(expression_evaluator_init(&evaluator, &status));
+    assert_true(string_init(&output, "", &status));
+    load(&context, ITEMS_CONTEXT);
+
+    /* Renders like the interpreter, and can render again */
+    assert_true(test_page_init(&functions, &status));
+    assert_true(test_page_render(&evaluator, &context, &output, &status));
+    assert_string_equal(output.data, ITEMS_OUTPUT);
+    string_clear(&output);
+    assert_true(test_page_render(&evaluator, &context, &output, &status));
+    assert_string_equal(output.data, ITEMS_OUTPUT);
+
+    /* Failures inside loops fail the render */
+    value_free(&context);
+    load(&context, "{\"title\": \"shop\", \"items\": [{\"name\": \"a\"}]}");
+    string_clear(&output);
+    assert_false(test_page_render(&evaluator, &context, &output, &status));
+    value_free(&context);
+    test_page_free();
+
+    /* Functions the template calls must be registered */
+    function_registry_free(&functions);
+    assert_true(function_registry_init(&functions, &status));
+    assert_false(test_page_init(&functions, &status));
+
+    /* ...with the arity they had when the template was compiled */
+    assert_true(builtins_register(&functions, &status));
+    assert_true(template_aot_function(&functions, "upper", 5, 1, &entry,
+                                                                 &status));
+    assert_false(template_aot_function(&functions, "upper", 5, 2, &entry,
+                                                                  &status));
+    assert_true(status_match(&status, "template_aot",
+                                      TEMPLATE_AOT_WRONG_ARITY));
+
+    /* Names must be C identifiers */
+    assert_true(template_init(&t, &functions, &status));
+    assert_true(string_init(&input, "{{ upper(name) }}", &status));
+    assert_true(template_parse_data(&t, &input, &status));
+    string_clear(&output);
+    assert_true(template_aot_generate(&t, "page_2", &output, &status));
+    assert_non_null(strstr(output.data, "bool page_2_render("));
+    assert_non_null(strstr(output.data, "template_aot_function(functions, "
+                                        "page_2_function_0, 5, 1, "));
+    assert_false(template_aot_generate(&t, "2page", &output, &status));
+    assert_true(status_match(&status, "template_aot",
+                                      TEMPLATE_AOT_INVALID_NAME));
+    assert_false(template_aot_generate(&t, "pa-ge", &output, &status));
+    assert_true(status_match(&status, "template_aot",
+                                      TEMPLATE_AOT_INVALID_NAME));
+
+    string_free(&input);
+    string_free(&output);
+    template_free(&t);
+    expression_evaluator_free(&evaluator);
+    function_registry_free(&functions);
+}
+
+/* vi: set et ts=4 sw=4: */
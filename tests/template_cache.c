@@ -0,0 +1,266 @@
+#include <stdio.h>
+#include <setjmp.h>
+#include <unistd.h>
+
+#include <cbase.h>
+
+#include <cmocka.h>
+
+#include "lang.h"
+#include "value.h"
+#include "json.h"
+#include "function.h"
+#include "expression.h"
+#include "expression_evaluator.h"
+#include "template.h"
+#include "template_cache.h"
+
+#define PAGE_TEMPLATE                                         \
+    "{{ include '%s' }}"                                      \
+    "{{ for i, p in people }}"                                \
+        "{{ i }}:{{ double(p.age) + 0.5 }} {{ p.name }}"      \
+        "{{ if loop.last }}.{{ else }}, {{ endif }}"          \
+    "{{ endfor }}"
+
+#define NAME_JSON "{\"name\": \"<b>\"}"
+
+#define PEOPLE_JSON \
+    "{\"people\": [{\"name\": \"Al\", \"age\": 20}, " \
+                  "{\"name\": \"Bo\", \"age\": 31}]}"
+
+static bool fn_double(Value *result, Value *arguments, DecimalContext *ctx,
+                                                       Status *status) {
+    return value_add(result, &arguments[0], &arguments[0], ctx, status);
+}
+
+static void write_file(const char *dir, const char *name, const char *data,
+                                                          char *path,
+                                                          size_t size) {
+    FILE *file = NULL;
+
+    snprintf(path, size, "%s/%s", dir, name);
+    file = fopen(path, "w");
+    assert_non_null(file);
+    fputs(data, file);
+    fclose(file);
+}
+
+/*
+ * Sets the local read by the cache file at `path`, whose first expression is
+ * a single LOOKUP and whose second starts with a LOCAL, to `local`.
+ */
+static void corrupt_local(const char *path, uint64_t local) {
+    TemplateCacheHeader header;
+    TemplateCacheInstruction record;
+    FILE *file = fopen(path, "r+b");
+    long offset = 0;
+
+    assert_non_null(file);
+    assert_int_equal(fread(&header, sizeof(header), 1, file), 1);
+
+    offset = (long)(
+        sizeof(TemplateCacheHeader) +
+        (header.dependency_count * sizeof(TemplateCacheDependency)) +
+        (header.node_count * sizeof(TemplateCacheNode)) +
+        sizeof(TemplateCacheExpression) +
+        sizeof(TemplateCacheInstruction) +
+        sizeof(TemplateCacheConstant) +
+        sizeof(TemplateCacheExpression)
+    );
+
+    assert_int_equal(fseek(file, offset, SEEK_SET), 0);
+    assert_int_equal(fread(&record, sizeof(record), 1, file), 1);
+    assert_int_equal(record.type, INSTRUCTION_LOCAL);
+    record.operand = local;
+    assert_int_equal(fseek(file, offset, SEEK_SET), 0);
+    assert_int_equal(fwrite(&record, sizeof(record), 1, file), 1);
+    fclose(file);
+}
+
+static void render(Template *t, Value *context, const char *expected) {
+    String output;
+    Status status;
+
+    status_init(&status);
+
+    assert_true(string_init(&output, "", &status));
+    assert_true(template_render(t, context, &output, &status));
+    assert_string_equal(output.data, expected);
+    string_free(&output);
+}
+
+void test_template_cache(void **state) {
+    char dir[] = "/tmp/sst_test_template_cache_XXXXXX";
+    char header[256];
+    char page[256];
+    char cache[256];
+    char data[512];
+    char escape[256];
+    char escape_cache[256];
+    char loop[256];
+    char loop_cache[256];
+    FunctionRegistry functions;
+    Template t;
+    Template loaded;
+    Value context;
+    Value name;
+    String input;
+    DecimalContext ctx;
+    FILE *file = NULL;
+    Status status;
+
+    (void)state;
+
+    status_init(&status);
+
+    decimal_context_set_max(&ctx);
+
+    assert_non_null(mkdtemp(dir));
+    write_file(dir, "header.txt", "<h1>People</h1>", header, sizeof(header));
+    snprintf(data, sizeof(data), PAGE_TEMPLATE, header);
+    write_file(dir, "page.txt", data, page, sizeof(page));
+    snprintf(cache, sizeof(cache), "%s/page.sstc", dir);
+    snprintf(escape_cache, sizeof(escape_cache), "%s/escape.sstc", dir);
+    snprintf(loop_cache, sizeof(loop_cache), "%s/loop.sstc", dir);
+
+    assert_true(json_load_data(&context, PEOPLE_JSON, strlen(PEOPLE_JSON),
+                                                      &ctx,
+                                                      &status));
+    assert_true(function_registry_init(&functions, &status));
+    assert_true(function_registry_add(&functions, "double", 1, "n",
+                                                     fn_double,
+                                                     &status));
+    assert_true(template_init(&t, &functions, &status));
+    assert_true(template_init(&loaded, &functions, &status));
+
+    /* A loaded template renders like the one that was saved */
+    assert_true(template_parse_path(&t, page, &status));
+    assert_true(template_cache_save(&t, cache, &status));
+    assert_true(template_cache_load(&loaded, cache, &status));
+    render(&t, &context, "<h1>People</h1>0:40.5 Al, 1:62.5 Bo.");
+    render(&loaded, &context, "<h1>People</h1>0:40.5 Al, 1:62.5 Bo.");
+    assert_int_equal(loaded.paths.len, 2);
+    assert_string_equal(parray_index_fast(&loaded.paths, 1), header);
+
+    /* ...and can be saved again */
+    assert_true(template_cache_save(&loaded, cache, &status));
+    assert_true(template_cache_load(&loaded, cache, &status));
+    render(&loaded, &context, "<h1>People</h1>0:40.5 Al, 1:62.5 Bo.");
+
+    /* Changing an include makes it stale */
+    write_file(dir, "header.txt", "<h1>Folks</h1>", header, sizeof(header));
+    assert_false(template_cache_load(&loaded, cache, &status));
+    assert_true(status_match(&status, "template_cache",
+                                      TEMPLATE_CACHE_STALE));
+    assert_int_equal(loaded.nodes.len, 0);
+
+    /* As does a function that's no longer registered */
+    write_file(dir, "header.txt", "<h1>People</h1>", header, sizeof(header));
+    assert_true(template_cache_load(&loaded, cache, &status));
+    template_free(&loaded);
+    function_registry_free(&functions);
+    assert_true(function_registry_init(&functions, &status));
+    assert_true(template_init(&loaded, &functions, &status));
+    assert_false(template_cache_load(&loaded, cache, &status));
+    assert_true(status_match(&status, "template_cache",
+                                      TEMPLATE_CACHE_STALE));
+
+    /* Or one whose arity changed, since the stack depths depend on it */
+    template_free(&loaded);
+    function_registry_free(&functions);
+    assert_true(function_registry_init(&functions, &status));
+    assert_true(function_registry_add(&functions, "double", 2, "nn",
+                                                     fn_double,
+                                                     &status));
+    assert_true(template_init(&loaded, &functions, &status));
+    assert_false(template_cache_load(&loaded, cache, &status));
+    assert_true(status_match(&status, "template_cache",
+                                      TEMPLATE_CACHE_STALE));
+
+    /* Only templates parsed from a path can be saved */
+    assert_true(string_init(&input, "{{ name }}", &status));
+    assert_true(template_parse_data(&loaded, &input, &status));
+    assert_false(template_cache_save(&loaded, cache, &status));
+    assert_true(status_match(&status, "template_cache",
+                                      TEMPLATE_CACHE_NOT_CACHEABLE));
+    string_free(&input);
+
+    file = fopen(cache, "r+b");
+    assert_non_null(file);
+    fputs("JUNK", file);
+    fclose(file);
+    assert_false(template_cache_load(&loaded, cache, &status));
+    assert_true(status_match(&status, "template_cache",
+                                      TEMPLATE_CACHE_INVALID_FORMAT));
+    unlink(cache);
+
+    /* Parsing through the cache writes it the first time, then reads it */
+    template_free(&t);
+    template_free(&loaded);
+    function_registry_free(&functions);
+    assert_true(function_registry_init(&functions, &status));
+    assert_true(function_registry_add(&functions, "double", 1, "n",
+                                                     fn_double,
+                                                     &status));
+    assert_true(template_init(&t, &functions, &status));
+    assert_true(template_parse_path_cached(&t, page, dir, &status));
+    render(&t, &context, "<h1>People</h1>0:40.5 Al, 1:62.5 Bo.");
+    snprintf(cache, sizeof(cache), "%s/%016llx.sstc",
+             dir,
+             (unsigned long long)hash64(page, strlen(page), 0));
+    assert_int_equal(access(cache, R_OK), 0);
+    assert_true(template_parse_path_cached(&t, page, dir, &status));
+    render(&t, &context, "<h1>People</h1>0:40.5 Al, 1:62.5 Bo.");
+    write_file(dir, "page.txt", "changed", page, sizeof(page));
+    assert_true(template_parse_path_cached(&t, page, dir, &status));
+    render(&t, &context, "changed");
+
+    /* Escaping is compiled in, so other settings don't use the cache */
+    write_file(dir, "escape.txt", "<p>{{ name }}</p>", escape,
+                                                       sizeof(escape));
+    assert_true(json_load_data(&name, NAME_JSON, strlen(NAME_JSON), &ctx,
+                                                                    &status));
+    assert_true(template_parse_path(&t, escape, &status));
+    assert_true(template_cache_save(&t, escape_cache, &status));
+    assert_true(template_init(&loaded, &functions, &status));
+    template_set_autoescape(&loaded, true);
+    assert_false(template_cache_load(&loaded, escape_cache, &status));
+    assert_true(status_match(&status, "template_cache",
+                                      TEMPLATE_CACHE_STALE));
+    assert_true(template_parse_path_cached(&loaded, escape, dir, &status));
+    render(&loaded, &name, "<p>&lt;b&gt;</p>");
+    snprintf(escape_cache, sizeof(escape_cache), "%s/%016llx.sstc",
+             dir,
+             (unsigned long long)hash64(escape, strlen(escape), 0));
+    unlink(escape_cache);
+    snprintf(escape_cache, sizeof(escape_cache), "%s/escape.sstc", dir);
+    template_free(&loaded);
+    value_free(&name);
+
+    /* Files reading locals that aren't in scope are rejected */
+    write_file(dir, "loop.txt", "{{ for p in people }}{{ p.name }}"
+                                "{{ endfor }}", loop, sizeof(loop));
+    assert_true(template_parse_path(&t, loop, &status));
+    assert_true(template_cache_save(&t, loop_cache, &status));
+    corrupt_local(loop_cache, 50);
+    assert_true(template_init(&loaded, &functions, &status));
+    assert_false(template_cache_load(&loaded, loop_cache, &status));
+    assert_true(status_match(&status, "template_cache",
+                                      TEMPLATE_CACHE_INVALID_FORMAT));
+    template_free(&loaded);
+
+    template_free(&t);
+    function_registry_free(&functions);
+    value_free(&context);
+
+    unlink(cache);
+    unlink(escape_cache);
+    unlink(loop_cache);
+    unlink(header);
+    unlink(page);
+    unlink(escape);
+    unlink(loop);
+    rmdir(dir);
+}
+
+/* vi: set et ts=4 sw=4: */
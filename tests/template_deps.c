@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <setjmp.h>
+#include <unistd.h>
+
+#include <cbase.h>
+
+#include <cmocka.h>
+
+#include "lang.h"
+#include "value.h"
+#include "function.h"
+#include "expression.h"
+#include "expression_evaluator.h"
+#include "builtins.h"
+#include "template.h"
+#include "template_deps.h"
+
+static void parse(Template *t, const char *input) {
+    String template_input;
+    Status status;
+
+    status_init(&status);
+
+    assert_true(string_init(&template_input, input, &status));
+    assert_true(template_parse_data(t, &template_input, &status));
+    string_free(&template_input);
+}
+
+static void collect(TemplateDeps *deps, Template *t, const char *input) {
+    Status status;
+
+    status_init(&status);
+
+    parse(t, input);
+    assert_true(template_deps_collect(deps, t, &status));
+}
+
+static void listed(PArray *list, size_t count, ...) {
+    va_list args;
+
+    assert_int_equal(list->len, count);
+
+    va_start(args, count);
+
+    for (size_t i = 0; i < count; i++) {
+        assert_string_equal(parray_index_fast(list, i),
+                            va_arg(args, const char *));
+    }
+
+    va_end(args);
+}
+
+void test_template_deps(void **state) {
+    char path[] = "/tmp/sst_test_template_deps_XXXXXX";
+    char input[256];
+    FunctionRegistry functions;
+    TemplateDeps deps;
+    Template t;
+    FILE *include_file = NULL;
+    int fd = -1;
+    Status status;
+
+    (void)state;
+
+    status_init(&status);
+
+    assert_true(function_registry_init(&functions, &status));
+    assert_true(builtins_register(&functions, &status));
+    assert_true(template_init(&t, &functions, &status));
+    assert_true(template_deps_init(&deps, &status));
+
+    /* Paths, functions and loop variables, each listed once */
+    collect(&deps, &t, "{{ upper(site.title) }}{{ site.title }}"
+                       "{{ if user.age >= 18 }}{{ lower(user.name) }}"
+                       "{{ endif }}{{ site }}");
+    listed(&deps.paths, 4, "site.title", "user.age", "user.name", "site");
+    listed(&deps.functions, 2, "upper", "lower");
+    listed(&deps.locals, 0);
+
+    /* Loop variables stand for their iterable's elements */
+    collect(&deps, &t, "{{ for p in people }}"
+                           "{{ p.name }}"
+                           "{{ for pet in p.pets }}{{ pet.kind }}{{ endfor }}"
+                           "{{ if loop.last }}.{{ endif }}"
+                       "{{ endfor }}");
+    listed(&deps.paths, 2, "people.*.name", "people.*.pets.*.kind");
+    listed(&deps.functions, 0);
+    listed(&deps.locals, 2, "p", "pet");
+
+    /* Loops whose variables aren't read use the whole iterable */
+    collect(&deps, &t, "{{ for k, v in scores }}{{ k }}{{ endfor }}"
+                       "{{ for i in range(0, count) }}{{ i }}{{ endfor }}"
+                       "{{ for x in items }}-{{ loop.index }}{{ endfor }}");
+    listed(&deps.paths, 3, "scores", "count", "items");
+    listed(&deps.functions, 1, "range");
+    listed(&deps.locals, 4, "k", "v", "i", "x");
+
+    /* Keys and indices are read from the iterable, not its elements */
+    collect(&deps, &t, "{{ for k, v in scores }}{{ k }}{{ v.total }}"
+                       "{{ endfor }}"
+                       "{{ for i, row in rows }}{{ i }}{{ row }}{{ endfor }}"
+                       "{{ for i, col in cols }}{{ i.name }}{{ endfor }}");
+    listed(&deps.paths, 3, "scores.*.total", "rows.*", "cols");
+    listed(&deps.functions, 0);
+    listed(&deps.locals, 5, "k", "v", "i", "row", "col");
+
+    /* Indexing uses the whole container, and cache keys are read too */
+    collect(&deps, &t, "{{ cache page.id }}"
+                           "{{ fibs[length(offset)] }}"
+                       "{{ endcache }}");
+    listed(&deps.paths, 3, "page.id", "offset", "fibs");
+    listed(&deps.functions, 1, "length");
+
+    /* What included templates use is listed as well */
+    fd = mkstemp(path);
+    assert_int_not_equal(fd, -1);
+    include_file = fdopen(fd, "w");
+    assert_non_null(include_file);
+    fputs("{{ escape(footer.text) }}{{ p.email }}", include_file);
+    fclose(include_file);
+
+    snprintf(input, sizeof(input), "{{ for p in people }}"
+                                       "{{ include '%s' }}"
+                                   "{{ endfor }}",
+                                   path);
+    collect(&deps, &t, input);
+    unlink(path);
+    listed(&deps.paths, 2, "footer.text", "people.*.email");
+    listed(&deps.functions, 1, "escape");
+    listed(&deps.locals, 1, "p");
+
+    template_deps_free(&deps);
+    template_free(&t);
+    function_registry_free(&functions);
+}
+
+/* vi: set et ts=4 sw=4: */
@@ -0,0 +1,200 @@
+#include <stdio.h>
+#include <setjmp.h>
+#include <pthread.h>
+
+#include <cbase.h>
+
+#include <cmocka.h>
+
+#include "lang.h"
+#include "value.h"
+#include "json.h"
+#include "function.h"
+#include "expression.h"
+#include "expression_evaluator.h"
+#include "template.h"
+#include "template_registry.h"
+
+#define RELOADS 200
+#define RENDER_THREADS 4
+
+#define V_TEMPLATE "v:{{ for p in people }}{{ p }};{{ endfor }}"
+#define W_TEMPLATE "w:{{ for p in people }}{{ p }},{{ endfor }}"
+
+typedef struct {
+    TemplateRegistry *registry;
+    TemplateRegistryEntry *entry;
+    Value *context;
+    bool done;
+    bool ok;
+} Renderer;
+
+static void set_data(TemplateRegistry *registry, const char *name,
+                                                 const char *input) {
+    String template_input;
+    Status status;
+
+    status_init(&status);
+
+    assert_true(string_init(&template_input, input, &status));
+    assert_true(template_registry_set_data(registry, name, &template_input,
+                                                            &status));
+    string_free(&template_input);
+}
+
+/*
+ * Renders until told to stop, checking every output is one of the versions
+ * the main thread sets.
+ */
+static void* render_loop(void *data) {
+    Renderer *renderer = data;
+    TemplateRegistryReader *reader = NULL;
+    ExpressionEvaluator evaluator;
+    String output;
+    Status status;
+
+    status_init(&status);
+
+    renderer->ok = (
+        template_registry_reader_init(renderer->registry, &reader, &status) &&
+        expression_evaluator_init(&evaluator, &status)
+    );
+
+    if (!renderer->ok) {
+        return NULL;
+    }
+
+    renderer->ok = string_init(&output, "", &status);
+
+    while (renderer->ok && !__atomic_load_n(&renderer->done,
+                                            __ATOMIC_ACQUIRE)) {
+        string_clear(&output);
+
+        renderer->ok = (
+            template_registry_render(renderer->registry, reader,
+                                                         renderer->entry,
+                                                         &evaluator,
+                                                         renderer->context,
+                                                         &output,
+                                                         &status) &&
+            ((strcmp(output.data, "v:Al;Bo;") == 0) ||
+             (strcmp(output.data, "w:Al,Bo,") == 0))
+        );
+    }
+
+    string_free(&output);
+    expression_evaluator_free(&evaluator);
+    template_registry_reader_release(renderer->registry, reader);
+
+    return NULL;
+}
+
+void test_template_registry(void **state) {
+    FunctionRegistry functions;
+    DecimalContext ctx;
+    TemplateRegistry registry;
+    TemplateRegistryEntry *entry = NULL;
+    TemplateRegistryReader *reader = NULL;
+    ExpressionEvaluator evaluator;
+    Renderer renderers[RENDER_THREADS];
+    pthread_t threads[RENDER_THREADS];
+    Template *old = NULL;
+    Value context;
+    String output;
+    String input;
+    Status status;
+    const char *json = "{\"people\": [\"Al\", \"Bo\"]}";
+
+    (void)state;
+
+    status_init(&status);
+    decimal_context_set_max(&ctx);
+
+    assert_true(function_registry_init(&functions, &status));
+    assert_true(json_load_data(&context, json, strlen(json), &ctx, &status));
+    assert_true(expression_evaluator_init(&evaluator, &status));
+    assert_true(string_init(&output, "", &status));
+    assert_true(template_registry_init(&registry, &functions, &status));
+
+    assert_false(template_registry_find(&registry, "people", &entry,
+                                                             &status));
+    assert_true(status_match(&status, "base", ERROR_NOT_FOUND));
+
+    set_data(&registry, "people", V_TEMPLATE);
+    assert_true(template_registry_find(&registry, "people", &entry, &status));
+    assert_true(template_registry_reader_init(&registry, &reader, &status));
+
+    /* A version in use survives being replaced until its reader exits */
+    old = template_registry_enter(&registry, reader, entry);
+    set_data(&registry, "people", W_TEMPLATE);
+    assert_int_equal(registry.retired.len, 1);
+    assert_true(template_render_with_evaluator(old, &evaluator, &context,
+                                                                &output,
+                                                                &status));
+    assert_string_equal(output.data, "v:Al;Bo;");
+    template_registry_exit(reader);
+
+    template_registry_collect(&registry);
+    assert_int_equal(registry.retired.len, 0);
+
+    string_clear(&output);
+    assert_true(template_registry_render(&registry, reader, entry,
+                                                            &evaluator,
+                                                            &context,
+                                                            &output,
+                                                            &status));
+    assert_string_equal(output.data, "w:Al,Bo,");
+
+    /* Versions nobody is reading are freed as soon as they're replaced */
+    set_data(&registry, "people", W_TEMPLATE);
+    assert_int_equal(registry.retired.len, 0);
+
+    /* A version that fails to compile leaves the current one in place */
+    assert_true(string_init(&input, "{{ if x }}", &status));
+    assert_false(template_registry_set_data(&registry, "people", &input,
+                                                                 &status));
+    assert_true(status_match(&status, "template",
+                                      TEMPLATE_UNTERMINATED_BLOCK));
+    string_free(&input);
+
+    string_clear(&output);
+    assert_true(template_registry_render(&registry, reader, entry,
+                                                            &evaluator,
+                                                            &context,
+                                                            &output,
+                                                            &status));
+    assert_string_equal(output.data, "w:Al,Bo,");
+    template_registry_reader_release(&registry, reader);
+
+    /* Reloads while other threads render */
+    for (size_t i = 0; i < RENDER_THREADS; i++) {
+        renderers[i].registry = &registry;
+        renderers[i].entry = entry;
+        renderers[i].context = &context;
+        renderers[i].done = false;
+        renderers[i].ok = false;
+        assert_int_equal(pthread_create(&threads[i], NULL, render_loop,
+                                                           &renderers[i]), 0);
+    }
+
+    for (size_t i = 0; i < RELOADS; i++) {
+        set_data(&registry, "people", (i % 2) ? V_TEMPLATE : W_TEMPLATE);
+    }
+
+    for (size_t i = 0; i < RENDER_THREADS; i++) {
+        __atomic_store_n(&renderers[i].done, true, __ATOMIC_RELEASE);
+        pthread_join(threads[i], NULL);
+        assert_true(renderers[i].ok);
+    }
+
+    template_registry_collect(&registry);
+    assert_int_equal(registry.retired.len, 0);
+
+    template_registry_free(&registry);
+    string_free(&output);
+    expression_evaluator_free(&evaluator);
+    value_free(&context);
+    function_registry_free(&functions);
+}
+
+/* vi: set et ts=4 sw=4: */
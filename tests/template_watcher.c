@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <cbase.h>
+
+#include <cmocka.h>
+
+#include "lang.h"
+#include "value.h"
+#include "function.h"
+#include "expression.h"
+#include "expression_evaluator.h"
+#include "template.h"
+#include "template_registry.h"
+#include "template_watcher.h"
+
+static void write_file(const char *dir, const char *name, const char *data,
+                                                          char *path,
+                                                          size_t size) {
+    FILE *file = NULL;
+
+    snprintf(path, size, "%s/%s", dir, name);
+    file = fopen(path, "w");
+    assert_non_null(file);
+    fputs(data, file);
+    fclose(file);
+}
+
+static void render(TemplateRegistry *registry, const char *name,
+                                               const char *expected) {
+    TemplateRegistryEntry *entry = NULL;
+    TemplateRegistryReader *reader = NULL;
+    ExpressionEvaluator evaluator;
+    Value context;
+    String output;
+    Status status;
+
+    status_init(&status);
+
+    context.type = VALUE_NONE;
+
+    assert_true(template_registry_find(registry, name, &entry, &status));
+    assert_true(template_registry_reader_init(registry, &reader, &status));
+    assert_true(expression_evaluator_init(&evaluator, &status));
+    assert_true(string_init(&output, "", &status));
+    assert_true(template_registry_render(registry, reader, entry,
+                                                           &evaluator,
+                                                           &context,
+                                                           &output,
+                                                           &status));
+    assert_string_equal(output.data, expected);
+    string_free(&output);
+    expression_evaluator_free(&evaluator);
+    template_registry_reader_release(registry, reader);
+}
+
+static Template* current(TemplateRegistry *registry, const char *name) {
+    TemplateRegistryEntry *entry = NULL;
+    Status status;
+
+    status_init(&status);
+
+    assert_true(template_registry_find(registry, name, &entry, &status));
+
+    return entry->template;
+}
+
+void test_template_watcher(void **state) {
+    char dir[] = "/tmp/sst_test_watcher_XXXXXX";
+    char header[256];
+    char page[256];
+    char other[256];
+    char include[320];
+    FunctionRegistry functions;
+    TemplateRegistry registry;
+    TemplateWatcher watcher;
+    Template *unchanged = NULL;
+    size_t reloaded = 0;
+    Status status;
+
+    (void)state;
+
+    status_init(&status);
+
+    assert_non_null(mkdtemp(dir));
+    write_file(dir, "header.txt", "H1 ", header, sizeof(header));
+    snprintf(include, sizeof(include), "{{ include '%s' }}page", header);
+    write_file(dir, "page.txt", include, page, sizeof(page));
+    write_file(dir, "other.txt", "other", other, sizeof(other));
+
+    assert_true(function_registry_init(&functions, &status));
+    assert_true(template_registry_init(&registry, &functions, &status));
+    assert_true(template_registry_set_path(&registry, "page", page,
+                                                              &status));
+    assert_true(template_registry_set_path(&registry, "other", other,
+                                                               &status));
+    assert_true(template_watcher_init(&watcher, &registry, &status));
+    assert_true(template_watcher_sync(&watcher, &status));
+
+    assert_true(template_watcher_process(&watcher, &reloaded, &status));
+    assert_int_equal(reloaded, 0);
+
+    /* Editing an include reloads exactly the templates that include it */
+    unchanged = current(&registry, "other");
+    write_file(dir, "header.txt", "H2 ", header, sizeof(header));
+    assert_true(template_watcher_process(&watcher, &reloaded, &status));
+    assert_int_equal(reloaded, 1);
+    assert_ptr_equal(current(&registry, "other"), unchanged);
+    render(&registry, "page", "H2 page");
+
+    /* Reloaded templates stop depending on includes they've dropped */
+    write_file(dir, "page.txt", "plain", page, sizeof(page));
+    write_file(dir, "other.txt", "changed", other, sizeof(other));
+    assert_true(template_watcher_process(&watcher, &reloaded, &status));
+    assert_int_equal(reloaded, 2);
+    render(&registry, "page", "plain");
+    render(&registry, "other", "changed");
+
+    unchanged = current(&registry, "page");
+    write_file(dir, "header.txt", "H3 ", header, sizeof(header));
+    assert_true(template_watcher_process(&watcher, &reloaded, &status));
+    assert_int_equal(reloaded, 0);
+    assert_ptr_equal(current(&registry, "page"), unchanged);
+
+    /* Broken edits keep the current version */
+    write_file(dir, "page.txt", "{{ if x }}", page, sizeof(page));
+    assert_false(template_watcher_process(&watcher, &reloaded, &status));
+    assert_true(status_match(&status, "template",
+                                      TEMPLATE_UNTERMINATED_BLOCK));
+    assert_int_equal(reloaded, 0);
+    render(&registry, "page", "plain");
+
+    template_watcher_free(&watcher);
+    template_registry_free(&registry);
+    function_registry_free(&functions);
+
+    unlink(header);
+    unlink(page);
+    unlink(other);
+    rmdir(dir);
+}
+
+/* vi: set et ts=4 sw=4: */
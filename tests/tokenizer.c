@@ -274,6 +274,22 @@ void test_tokenizer(void **state) {
     texpect_text("\n\nLast little bit down here\n");
 
     string_free(&s);
+
+    assert_true(string_init(&s, "a \n{{- b -}}\n\t{{- c }} d", &status));
+    assert_true(string_slice(&s, 0, s.len, &ss, &status));
+
+    tokenizer_init(&tokenizer, &ss);
+
+    texpect_text("a");
+    texpect_code_start();
+    texpect_identifier("b");
+    texpect_code_end();
+    texpect_code_start();
+    texpect_identifier("c");
+    texpect_code_end();
+    texpect_text(" d");
+
+    string_free(&s);
 }
 
 /* vi: set et ts=4 sw=4: */
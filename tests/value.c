@@ -39,7 +39,7 @@ void test_add(void **state) {
 
     assert_true(value_add(&v3, &v1, &v2, &ctx, &status));
 
-    assert_true(value_to_cstr(&result, &v3, &status));
+    assert_true(value_to_cstr(&v3, &result, &status));
 
     assert_string_equal(result, NUMBER3);
 
@@ -53,4 +53,121 @@ void test_add(void **state) {
     string_free(&s2);
 }
 
+void test_copy_on_write(void **state) {
+    Value array;
+    Value copy;
+    Value table;
+    Value table_copy;
+    Value element;
+    Value *new_element = NULL;
+    SSlice key;
+    size_t length = 0;
+    Status status;
+    DecimalContext ctx;
+
+    (void)state;
+
+    status_init(&status);
+
+    decimal_context_set_max(&ctx);
+
+    assert_true(value_init_array(&array, &status));
+
+    for (size_t i = 0; i < 3; i++) {
+        assert_true(value_array_append(&array, &new_element, &status));
+        assert_true(value_init_number(new_element, NUMBER1, &ctx, &status));
+    }
+
+    copy.type = VALUE_NONE;
+    assert_true(value_copy(&copy, &array, &status));
+    assert_ptr_equal(copy.as.array, array.as.array);
+
+    assert_true(value_array_append(&copy, &new_element, &status));
+    assert_true(value_init_number(new_element, NUMBER2, &ctx, &status));
+    assert_ptr_not_equal(copy.as.array, array.as.array);
+
+    assert_true(value_length(&array, &length, &status));
+    assert_int_equal(length, 3);
+    assert_true(value_length(&copy, &length, &status));
+    assert_int_equal(length, 4);
+
+    assert_true(value_init_table(&table, &status));
+
+    key.data = "numbers";
+    key.len = 7;
+    key.byte_len = 7;
+
+    assert_true(value_table_insert(&table, &key, &new_element, &status));
+    new_element->type = VALUE_NONE;
+    assert_true(value_copy(new_element, &array, &status));
+
+    table_copy.type = VALUE_NONE;
+    assert_true(value_copy(&table_copy, &table, &status));
+    assert_ptr_equal(table_copy.as.table, table.as.table);
+
+    element.type = VALUE_NONE;
+    assert_true(value_lookup(&table_copy, &key, &element, &status));
+    assert_ptr_equal(element.as.array, array.as.array);
+
+    assert_true(value_table_insert(&table_copy, &key, &new_element, &status));
+    assert_ptr_not_equal(table_copy.as.table, table.as.table);
+    assert_true(value_copy(new_element, &copy, &status));
+
+    assert_true(value_lookup(&table, &key, &element, &status));
+    assert_true(value_length(&element, &length, &status));
+    assert_int_equal(length, 3);
+
+    value_free(&element);
+    value_free(&table_copy);
+    value_free(&table);
+    value_free(&copy);
+    value_free(&array);
+}
+
+void test_small_strings(void **state) {
+    Value short_string;
+    Value long_string;
+    Value copy;
+    Value result;
+    char long_data[VALUE_INLINE_STRING_MAX + 2];
+    Status status;
+
+    (void)state;
+
+    status_init(&status);
+
+    memset(long_data, 'x', sizeof(long_data) - 1);
+    long_data[sizeof(long_data) - 1] = '\0';
+
+    assert_true(value_init_string(&short_string, "person.name", &status));
+    assert_null(short_string.as.string.shared);
+    assert_int_equal(short_string.as.string.byte_len, 11);
+    assert_string_equal(value_string_data(&short_string), "person.name");
+
+    assert_true(value_init_string(&long_string, long_data, &status));
+    assert_non_null(long_string.as.string.shared);
+    assert_string_equal(value_string_data(&long_string), long_data);
+
+    copy.type = VALUE_NONE;
+    assert_true(value_copy(&copy, &short_string, &status));
+    assert_null(copy.as.string.shared);
+    assert_ptr_not_equal(value_string_data(&copy),
+                         value_string_data(&short_string));
+
+    result.type = VALUE_NONE;
+    assert_true(value_equal(&result, &copy, &short_string, &status));
+    assert_true(result.as.boolean);
+
+    assert_true(value_copy(&copy, &long_string, &status));
+    assert_ptr_equal(copy.as.string.shared, long_string.as.string.shared);
+
+    assert_true(value_equal(&result, &copy, &short_string, &status));
+    assert_false(result.as.boolean);
+
+    value_free(&result);
+    value_free(&copy);
+    value_free(&long_string);
+    value_free(&short_string);
+}
+
 /* vi: set et ts=4 sw=4: */